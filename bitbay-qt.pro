@@ -117,7 +117,10 @@ contains(BITBAY_NEED_QT_PLUGINS, 1) {
 
 INCLUDEPATH += src/leveldb/include src/leveldb/helpers
 LIBS += $$PWD/src/leveldb/out-static/libleveldb.a $$PWD/src/leveldb/out-static/libmemenv.a
+HEADERS += src/dbbatch.h
+HEADERS += src/dboptions.h
 HEADERS += src/txdb-leveldb.h
+SOURCES += src/dboptions.cpp
 SOURCES += src/txdb-leveldb.cpp
 !win32 {
     # we use QMAKE_CXXFLAGS_RELEASE even without RELEASE=1 because we use RELEASE to indicate linking preferences not -O preferences
@@ -106,7 +106,10 @@ contains(USE_UPNP, -) {
 
 INCLUDEPATH += src/leveldb/include src/leveldb/helpers
 LIBS += $$PWD/src/leveldb/out-static/libleveldb.a $$PWD/src/leveldb/out-static/libmemenv.a
+HEADERS += src/dbbatch.h
+HEADERS += src/dboptions.h
 HEADERS += src/txdb-leveldb.h
+SOURCES += src/dboptions.cpp
 SOURCES += src/txdb-leveldb.cpp
 !win32 {
     # we use QMAKE_CXXFLAGS_RELEASE even without RELEASE=1 because we use RELEASE to indicate linking preferences not -O preferences
@@ -143,12 +146,24 @@ SOURCES += \
 	src/test/base32_tests.cpp \
 	src/test/base64_tests.cpp \
 	src/test/bignum_tests.cpp \
+	src/test/blockdownload_tests.cpp \
+	src/test/blockindexmap_tests.cpp \
+	src/test/blockindexsnapshot_tests.cpp \
+	src/test/checkqueue_tests.cpp \
+	src/test/dbbatch_tests.cpp \
+	src/test/dboptions_tests.cpp \
 	src/test/getarg_tests.cpp \
 	src/test/hmac_tests.cpp \
+	src/test/mempool_tests.cpp \
+	src/test/miner_tests.cpp \
 	src/test/mruset_tests.cpp \
 	src/test/netbase_tests.cpp \
+	src/test/rpcmisc_tests.cpp \
 	src/test/serialize_tests.cpp \
+	src/test/sigcache_tests.cpp \
+	src/test/sighash_tests.cpp \
 	src/test/sigopcount_tests.cpp \
+	src/test/stakecandidate_tests.cpp \
 	src/test/uint160_tests.cpp \
 	src/test/uint256_tests.cpp \
 
@@ -0,0 +1,40 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "util.h"
+#include "wallet.h"
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+bool fConfChange = false;
+unsigned int nNodeLifespan = 7;
+unsigned int nMinerSleep = 500;
+bool fUseFastIndex = true;
+
+extern void noui_connect();
+extern void InitParamsOnStart();
+
+void Shutdown(void* parg)
+{
+  exit(0);
+}
+
+void StartShutdown()
+{
+  exit(0);
+}
+
+// bench_bitcoin [-filter=<name part>] [-seconds=<n>]
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    noui_connect();
+    InitParamsOnStart();
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""), GetArg("-seconds", 1));
+}
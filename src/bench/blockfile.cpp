@@ -0,0 +1,129 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blockfile.h"
+#include "main.h"
+#include "util.h"
+
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+// Block and tx reads of the block files via the pooled handles and via
+// reopening the block file for every read as before: blocks read in the
+// order they were written, and txs of these blocks read at random.
+
+static const int nBenchBlocks = 1000;
+static const int nBenchBlockTxs = 20;
+
+// Block files of nBenchBlocks proof-of-stake blocks in a temporary data
+// directory, removed with it; tx positions are collected the same way as
+// in ConnectBlock
+struct BenchBlockFiles {
+    boost::filesystem::path pathData;
+    std::vector<std::pair<unsigned int, unsigned int> > vBlockPos;
+    std::vector<CDiskTxPos> vTxPos;
+
+    BenchBlockFiles() {
+        pathData = boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("blockfiles-%%%%%%");
+        boost::filesystem::create_directories(pathData);
+        mapArgs["-datadir"] = pathData.string();
+        ClearDatadirCache();
+
+        for (int i=0; i<nBenchBlocks; i++) {
+            CBlock block;
+            block.nTime = 1500000000 + i * 64;
+            for (int n=0; n<nBenchBlockTxs; n++) {
+                CTransaction tx;
+                tx.nTime = block.nTime;
+                tx.vin.push_back(CTxIn(COutPoint(n ? GetRandHash() : uint256(0), n ? 0 : -1)));
+                tx.vin[0].scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+                if (n == 1) {
+                    // coinstake, the block is not checked for proof-of-work when read
+                    tx.vout.push_back(CTxOut());
+                    tx.vout[0].SetEmpty();
+                }
+                for (int k=0; k<2; k++)
+                    tx.vout.push_back(CTxOut(COIN, CScript() << OP_DUP << OP_HASH160 << uint160(insecure_rand())
+                                                             << OP_EQUALVERIFY << OP_CHECKSIG));
+                block.vtx.push_back(tx);
+            }
+            block.hashMerkleRoot = block.BuildMerkleTree();
+            unsigned int nFile, nBlockPos;
+            if (!block.WriteToDisk(nFile, nBlockPos))
+                break;
+            vBlockPos.push_back(std::make_pair(nFile, nBlockPos));
+            unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION)
+                    - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(block.vtx.size());
+            for (const CTransaction& tx : block.vtx) {
+                vTxPos.push_back(CDiskTxPos(nFile, nBlockPos, nTxPos));
+                nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+            }
+        }
+        for (size_t i=vTxPos.size(); i>1; i--)
+            std::swap(vTxPos[i - 1], vTxPos[GetRand(i)]);
+    }
+    ~BenchBlockFiles() {
+        CloseBlockFiles();
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathData);
+    }
+};
+
+static void BlockFileReadBlocksPooled(benchmark::State& state)
+{
+    BenchBlockFiles files;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& pos = files.vBlockPos[i++ % files.vBlockPos.size()];
+        CBlock block;
+        block.ReadFromDisk(pos.first, pos.second);
+    }
+}
+
+static void BlockFileReadBlocksReopen(benchmark::State& state)
+{
+    BenchBlockFiles files;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& pos = files.vBlockPos[i++ % files.vBlockPos.size()];
+        CBlock block;
+        CAutoFile filein = CAutoFile(OpenBlockFile(pos.first, pos.second, "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein)
+            filein >> block;
+    }
+}
+
+static void BlockFileReadTxsPooled(benchmark::State& state)
+{
+    BenchBlockFiles files;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        CTransaction tx;
+        tx.ReadFromDisk(files.vTxPos[i++ % files.vTxPos.size()]);
+    }
+}
+
+static void BlockFileReadTxsReopen(benchmark::State& state)
+{
+    BenchBlockFiles files;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const CDiskTxPos& pos = files.vTxPos[i++ % files.vTxPos.size()];
+        CTransaction tx;
+        CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, pos.nTxPos, "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein)
+            filein >> tx;
+    }
+}
+
+BENCHMARK(BlockFileReadBlocksPooled);
+BENCHMARK(BlockFileReadBlocksReopen);
+BENCHMARK(BlockFileReadTxsPooled);
+BENCHMARK(BlockFileReadTxsReopen);
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <map>
+#include <vector>
+
+// Block index lookups and build in CBlockIndexMap and in the previous
+// layout, std::map with separately allocated block indexes.
+
+static const size_t nBenchBlocks = 500000;
+static const size_t nBenchBuildBlocks = 10000;
+
+static std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> vHashes(n);
+    for (size_t i=0; i<n; i++)
+        vHashes[i] = GetRandHash();
+    return vHashes;
+}
+
+static void BuildStdMap(std::map<uint256, CBlockIndex*>& mapIndex, const std::vector<uint256>& vHashes)
+{
+    for (const uint256& hash : vHashes) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->phashBlock = &mapIndex.insert(std::make_pair(hash, pindex)).first->first;
+    }
+}
+
+static void FreeStdMap(std::map<uint256, CBlockIndex*>& mapIndex)
+{
+    for (auto& item : mapIndex)
+        delete item.second;
+    mapIndex.clear();
+}
+
+static void BuildIndexMap(CBlockIndexMap& mapIndex, const std::vector<uint256>& vHashes)
+{
+    for (const uint256& hash : vHashes) {
+        CBlockIndex* pindex = mapIndex.NewIndex();
+        pindex->phashBlock = &mapIndex.insert(hash, pindex).first->first;
+    }
+}
+
+static void BlockIndexStdMapFind(benchmark::State& state)
+{
+    std::vector<uint256> vHashes = RandomHashes(nBenchBlocks);
+    std::map<uint256, CBlockIndex*> mapIndex;
+    BuildStdMap(mapIndex, vHashes);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        mapIndex.find(vHashes[i])->second->nHeight++;
+        i = (i + 7919) % nBenchBlocks;
+    }
+    FreeStdMap(mapIndex);
+}
+
+static void BlockIndexMapFind(benchmark::State& state)
+{
+    std::vector<uint256> vHashes = RandomHashes(nBenchBlocks);
+    CBlockIndexMap mapIndex;
+    BuildIndexMap(mapIndex, vHashes);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        mapIndex.find(vHashes[i])->second->nHeight++;
+        i = (i + 7919) % nBenchBlocks;
+    }
+}
+
+static void BlockIndexStdMapBuild(benchmark::State& state)
+{
+    std::vector<uint256> vHashes = RandomHashes(nBenchBuildBlocks);
+    while (state.KeepRunning()) {
+        std::map<uint256, CBlockIndex*> mapIndex;
+        BuildStdMap(mapIndex, vHashes);
+        FreeStdMap(mapIndex);
+    }
+}
+
+static void BlockIndexMapBuild(benchmark::State& state)
+{
+    std::vector<uint256> vHashes = RandomHashes(nBenchBuildBlocks);
+    while (state.KeepRunning()) {
+        CBlockIndexMap mapIndex;
+        BuildIndexMap(mapIndex, vHashes);
+    }
+}
+
+BENCHMARK(BlockIndexStdMapFind);
+BENCHMARK(BlockIndexMapFind);
+BENCHMARK(BlockIndexStdMapBuild);
+BENCHMARK(BlockIndexMapBuild);
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "dbbatch.h"
+#include "util.h"
+
+#include <algorithm>
+#include <string>
+
+// Reads made while connecting a block of nBenchTxs txs: every tx reads
+// the indexes of two earlier txs of the block and writes its own, with
+// scans of a plain leveldb batch as before and with the indexed batch.
+
+static const int nBenchTxs = 2000;
+
+// lookup of the previous implementation: scan of the whole batch
+class CBatchScanner : public leveldb::WriteBatch::Handler {
+public:
+    std::string needle;
+    bool foundEntry = false;
+
+    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& v) {
+        if (key.ToString() == needle)
+            foundEntry = true;
+    }
+    virtual void Delete(const leveldb::Slice& key) {
+        if (key.ToString() == needle)
+            foundEntry = true;
+    }
+};
+
+static std::string Key(int n)
+{
+    return strprintf("tx%08d", n);
+}
+
+static void DBBatchConnectScan(benchmark::State& state)
+{
+    std::string value(100, 'x');
+    while (state.KeepRunning()) {
+        leveldb::WriteBatch batch;
+        for (int i=0; i<nBenchTxs; i++) {
+            for (int j=i/2; j<i; j+=std::max(1,i/2)) {
+                CBatchScanner scanner;
+                scanner.needle = Key(j);
+                batch.Iterate(&scanner);
+            }
+            batch.Put(Key(i), value);
+        }
+    }
+}
+
+static void DBBatchConnectIndexed(benchmark::State& state)
+{
+    std::string value(100, 'x');
+    while (state.KeepRunning()) {
+        CDBBatch batch;
+        for (int i=0; i<nBenchTxs; i++) {
+            for (int j=i/2; j<i; j+=std::max(1,i/2)) {
+                std::string v;
+                bool deleted;
+                batch.Get(Key(j), &v, &deleted);
+            }
+            batch.Put(Key(i), value);
+        }
+    }
+}
+
+BENCHMARK(DBBatchConnectScan);
+BENCHMARK(DBBatchConnectIndexed);
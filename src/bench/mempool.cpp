@@ -0,0 +1,107 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+// Selection of the txs of a block from a mempool of chains of ten txs: by
+// a full pass over the mempool as the miner did, and by walking the fee
+// rate index with the packages of ancestors.
+
+static const size_t nBenchTxs = 50000;
+static const uint64_t nBenchBlockMaxSize = MAX_BLOCK_SIZE_GEN/2;
+
+static void FillMempool(CTxMemPool& pool)
+{
+    uint256 hashPrev;
+    for (size_t i=0; i<nBenchTxs; i++) {
+        COutPoint prevout(i % 10 ? hashPrev : GetRandHash(), 0);
+        CTransaction tx;
+        tx.vin.push_back(CTxIn(prevout));
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1000000000 - 10000 - GetRand(90000);
+        MapPrevOut mapInputs;
+        mapInputs[uint320(prevout.hash, prevout.n)] = CTxOut(1000000000, CScript());
+        MapFractions mapFractions;
+        hashPrev = tx.GetHash();
+        pool.addUnchecked(hashPrev, tx, mapInputs, mapFractions);
+    }
+}
+
+static void MempoolAssemblyScan(benchmark::State& state)
+{
+    CTxMemPool pool;
+    FillMempool(pool);
+    while (state.KeepRunning()) {
+        // fee and size of every tx, heap of the ready ones
+        std::vector<std::pair<double, uint256> > vecFeeRate;
+        std::map<uint256, std::vector<uint256> > mapDependers;
+        for (std::map<uint256, CTransaction>::iterator mi = pool.mapTx.begin(); mi != pool.mapTx.end(); ++mi) {
+            const CTransaction& tx = (*mi).second;
+            int64_t nValueIn = 0;
+            bool fDependent = false;
+            for (const CTxIn& txin : tx.vin) {
+                nValueIn += pool.mapPrevOuts[(*mi).first][uint320(txin.prevout.hash, txin.prevout.n)].nValue;
+                if (pool.mapTx.count(txin.prevout.hash)) {
+                    mapDependers[txin.prevout.hash].push_back((*mi).first);
+                    fDependent = true;
+                }
+            }
+            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            if (!fDependent)
+                vecFeeRate.push_back(std::make_pair((nValueIn - tx.GetValueOut()) / (nTxSize / 1000.0), (*mi).first));
+        }
+        std::make_heap(vecFeeRate.begin(), vecFeeRate.end());
+        uint64_t nBlockSize = 1000;
+        while (!vecFeeRate.empty()) {
+            uint256 hash = vecFeeRate.front().second;
+            std::pop_heap(vecFeeRate.begin(), vecFeeRate.end());
+            vecFeeRate.pop_back();
+            unsigned int nTxSize = ::GetSerializeSize(pool.mapTx[hash], SER_NETWORK, PROTOCOL_VERSION);
+            if (nBlockSize + nTxSize >= nBenchBlockMaxSize)
+                break;
+            nBlockSize += nTxSize;
+            for (const uint256& hashDepender : mapDependers[hash]) {
+                const CTxMemPoolRank& rank = pool.mapRanks[hashDepender];
+                vecFeeRate.push_back(std::make_pair(rank.GetFeePerKb(), hashDepender));
+                std::push_heap(vecFeeRate.begin(), vecFeeRate.end());
+            }
+        }
+    }
+}
+
+static void MempoolAssemblyIndex(benchmark::State& state)
+{
+    CTxMemPool pool;
+    FillMempool(pool);
+    while (state.KeepRunning()) {
+        // packages by fee rate until the block is full
+        std::set<uint256> setIncluded;
+        uint64_t nBlockSize = 1000;
+        for (CTxMemPoolIndex::reverse_iterator mi = pool.setByFeeRate.rbegin(); mi != pool.setByFeeRate.rend(); ++mi) {
+            if (setIncluded.count((*mi).second))
+                continue;
+            const CTxMemPoolRank& rank = pool.mapRanks[(*mi).second];
+            if (nBlockSize + rank.nAncestorsSize >= nBenchBlockMaxSize)
+                break;
+            std::vector<uint256> vPackage;
+            pool.queryPackage((*mi).second, setIncluded, vPackage);
+            for (const uint256& hash : vPackage) {
+                nBlockSize += pool.mapRanks[hash].nTxSize;
+                setIncluded.insert(hash);
+            }
+        }
+    }
+}
+
+BENCHMARK(MempoolAssemblyScan);
+BENCHMARK(MempoolAssemblyIndex);
@@ -0,0 +1,62 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+// Signature hashes of all inputs of a consolidation transaction,
+// hashed one by one and from one CSignatureHashContext.
+
+static const int nBenchInputs = 1000;
+
+static CTransaction ConsolidationTransaction()
+{
+    CTransaction tx;
+    tx.nTime = 1500000000;
+    for (int i=0; i<nBenchInputs; i++) {
+        CTxIn txin(COutPoint(GetRandHash(), i % 4));
+        txin.scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        tx.vin.push_back(txin);
+    }
+    for (int i=0; i<2; i++) {
+        CScript scriptPubKey;
+        scriptPubKey << OP_DUP << OP_HASH160 << uint160(insecure_rand()) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout.push_back(CTxOut(COIN, scriptPubKey));
+    }
+    return tx;
+}
+
+static CScript ScriptCode()
+{
+    CScript scriptCode;
+    scriptCode << OP_DUP << OP_HASH160 << uint160(insecure_rand()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return scriptCode;
+}
+
+static void SighashPerInput(benchmark::State& state)
+{
+    CTransaction tx = ConsolidationTransaction();
+    CScript scriptCode = ScriptCode();
+    while (state.KeepRunning()) {
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+            SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL);
+    }
+}
+
+static void SighashContext(benchmark::State& state)
+{
+    CTransaction tx = ConsolidationTransaction();
+    CScript scriptCode = ScriptCode();
+    while (state.KeepRunning()) {
+        CSignatureHashContext sighash(tx);
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+            sighash.SignatureHash(scriptCode, nIn, SIGHASH_ALL);
+    }
+}
+
+BENCHMARK(SighashPerInput);
+BENCHMARK(SighashContext);
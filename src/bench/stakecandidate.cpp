@@ -0,0 +1,73 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "bignum.h"
+#include "kernel.h"
+#include "util.h"
+
+// Kernel checks of a wallet with nBenchCandidates staking outputs over a
+// 60 seconds search window, hashed in full for every timestamp as
+// CheckStakeKernelHashV2() does and from the prepared candidates.
+
+static const size_t nBenchCandidates = 1000;
+static const unsigned int nBenchSlots = 60;
+static const unsigned int nBenchBits = 0x1b00ffff;
+
+static std::vector<CStakeCandidate> Candidates(const uint256& bnStakeModifierV2)
+{
+    std::vector<CStakeCandidate> vCandidates;
+    for (size_t i=0; i<nBenchCandidates; i++) {
+        CStakeCandidate candidate;
+        candidate.prevout = COutPoint(GetRandHash(), i % 4);
+        candidate.nValue = 1 + GetRand(100000 * COIN);
+        candidate.nTimeBlockFrom = 1500000000 + GetRand(10000000);
+        candidate.nTimeTxPrev = candidate.nTimeBlockFrom - GetRand(600);
+        candidate.fFound = true;
+        candidate.Prepare(bnStakeModifierV2, nBenchBits);
+        vCandidates.push_back(candidate);
+    }
+    return vCandidates;
+}
+
+// as CheckStakeKernelHashV2() hashes and checks a protocol v3 kernel
+static bool CheckFullKernelHash(const CStakeCandidate& candidate, const uint256& bnStakeModifierV2,
+                                unsigned int nTimeTx)
+{
+    CBigNum bnTarget;
+    bnTarget.SetCompact(nBenchBits);
+    bnTarget *= CBigNum(candidate.nValue);
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnStakeModifierV2;
+    ss << candidate.nTimeTxPrev << candidate.prevout.hash << candidate.prevout.n << nTimeTx;
+    return !(CBigNum(Hash(ss.begin(), ss.end())) > bnTarget);
+}
+
+static void StakeKernelFull(benchmark::State& state)
+{
+    uint256 bnStakeModifierV2 = GetRandHash();
+    std::vector<CStakeCandidate> vCandidates = Candidates(bnStakeModifierV2);
+    while (state.KeepRunning()) {
+        for (const CStakeCandidate& candidate : vCandidates) {
+            for (unsigned int n=0; n<nBenchSlots; n++)
+                CheckFullKernelHash(candidate, bnStakeModifierV2, candidate.nTimeBlockFrom + 100000 - n);
+        }
+    }
+}
+
+static void StakeKernelCandidate(benchmark::State& state)
+{
+    uint256 bnStakeModifierV2 = GetRandHash();
+    std::vector<CStakeCandidate> vCandidates = Candidates(bnStakeModifierV2);
+    while (state.KeepRunning()) {
+        for (const CStakeCandidate& candidate : vCandidates) {
+            for (unsigned int n=0; n<nBenchSlots; n++)
+                candidate.CheckKernelHash(candidate.nTimeBlockFrom + 100000 - n);
+        }
+    }
+}
+
+BENCHMARK(StakeKernelFull);
+BENCHMARK(StakeKernelCandidate);
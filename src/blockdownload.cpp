@@ -0,0 +1,354 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+
+#include <algorithm>
+
+using namespace std;
+
+CBlockDownload::CBlockDownload(int nWindowIn, int nMaxInFlightIn, int64_t nTimeoutIn, int nMaxHeadersIn,
+                               int64_t nStallTimeoutIn)
+    :nWindow(nWindowIn)
+    ,nMaxInFlight(nMaxInFlightIn)
+    ,nTimeout(nTimeoutIn)
+    ,nMaxHeaders(nMaxHeadersIn)
+    ,nStallTimeout(nStallTimeoutIn)
+    ,nChainBase(0)
+    ,nodeHeaders(-1)
+    ,nHeadersTime(0)
+    ,nConnected(0)
+    ,nProgressConnected(0)
+    ,nProgressTime(0)
+    ,nStallCheckTime(0)
+    ,nStallTime(0)
+    ,nRequested(0)
+    ,nReceived(0)
+    ,nTimeouts(0)
+    ,nStalls(0)
+{
+}
+
+int CBlockDownload::HeaderHeight(const uint256& hash) const
+{
+    const CHeader* pheader = GetHeader(hash);
+    return pheader ? pheader->nHeight : -1;
+}
+
+uint256 CBlockDownload::HeaderTrust(const uint256& hash) const
+{
+    const CHeader* pheader = GetHeader(hash);
+    return pheader ? pheader->nChainTrust : uint256(0);
+}
+
+const CBlockDownload::CHeader* CBlockDownload::GetHeader(const uint256& hash) const
+{
+    map<uint256, CHeader>::const_iterator mi = mapHeaders.find(hash);
+    return mi != mapHeaders.end() ? &mi->second : NULL;
+}
+
+int CBlockDownload::BestHeaderHeight() const
+{
+    return vChain.empty() ? -1 : nChainBase + int(vChain.size()) - 1;
+}
+
+uint256 CBlockDownload::BestHeaderTrust() const
+{
+    return vChain.empty() ? uint256(0) : HeaderTrust(vChain.back());
+}
+
+bool CBlockDownload::IsWanted(const uint256& hash) const
+{
+    // blocks of the header chain are the ones not connected yet
+    int nHeight = HeaderHeight(hash);
+    int nIndex = nHeight - nChainBase;
+    return nHeight >= 0 && nIndex >= 0 && nIndex < int(vChain.size()) && vChain[nIndex] == hash;
+}
+
+bool CBlockDownload::AddHeader(const uint256& hash, const uint256& hashPrev, int nHeight,
+                               const uint256& nChainTrust, NodeId node)
+{
+    CHeader header;
+    header.hashPrev = hashPrev;
+    header.nHeight = nHeight;
+    header.nChainTrust = nChainTrust;
+    header.node = node;
+    return AddHeader(hash, header);
+}
+
+bool CBlockDownload::AddHeader(const uint256& hash, const CHeader& header)
+{
+    const uint256& hashPrev = header.hashPrev;
+    const int nHeight = header.nHeight;
+    if (setInvalid.count(hash) || setInvalid.count(hashPrev)) {
+        setInvalid.insert(hash);
+        return false;
+    }
+    if (mapHeaders.count(hash))
+        return true;
+
+    mapHeaders[hash] = header;
+    if (header.nChainTrust <= BestHeaderTrust())
+        return true;
+
+    if (!vChain.empty() && hashPrev == vChain.back()) {
+        vChain.push_back(hash);
+        return true;
+    }
+
+    // switch to the new chain: walk back to a connected block, requests
+    // and kept blocks of the old chain are dropped
+    deque<uint256> vNew;
+    map<uint256, CHeader>::iterator mi = mapHeaders.find(hash);
+    while (mi != mapHeaders.end()) {
+        vNew.push_front(mi->first);
+        mi = mapHeaders.find(mi->second.hashPrev);
+    }
+    vChain.swap(vNew);
+    nChainBase = nHeight - int(vChain.size()) + 1;
+
+    for (map<uint256, CRequest>::iterator it = mapInFlight.begin(); it != mapInFlight.end();) {
+        if (IsWanted(it->first))
+            ++it;
+        else RemoveRequest(it++);
+    }
+    for (map<uint256, CBuffered>::iterator it = mapBuffered.begin(); it != mapBuffered.end();) {
+        if (IsWanted(it->first))
+            ++it;
+        else mapBuffered.erase(it++);
+    }
+
+    // headers of abandoned chains are forgotten
+    if (mapHeaders.size() > 2 * vChain.size() + 1000) {
+        for (map<uint256, CHeader>::iterator it = mapHeaders.begin(); it != mapHeaders.end();) {
+            if (IsWanted(it->first))
+                ++it;
+            else mapHeaders.erase(it++);
+        }
+    }
+    return true;
+}
+
+vector<uint256> CBlockDownload::GetLocatorHashes() const
+{
+    vector<uint256> vHave;
+    if (vChain.empty())
+        return vHave;
+
+    // exponentially larger steps back from the tip, as CBlockLocator,
+    // down to the connected parent of the header chain
+    int nStep = 1;
+    for (int i = vChain.size() - 1; i >= 0; i -= nStep) {
+        vHave.push_back(vChain[i]);
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+    vHave.push_back(mapHeaders.find(vChain.front())->second.hashPrev);
+    return vHave;
+}
+
+bool CBlockDownload::StartHeaders(NodeId node, int nNodeHeight, int nBestHeight, int64_t nNow)
+{
+    if (int(vChain.size()) >= nMaxHeaders)
+        return false;
+    if (nodeHeaders != -1) {
+        if (nNow - nHeadersTime < nTimeout)
+            return false;
+        // ask another peer
+        mapHeadersIdle[nodeHeaders] = nNow;
+        nodeHeaders = -1;
+        nTimeouts++;
+    }
+    map<NodeId, int64_t>::const_iterator mi = mapHeadersIdle.find(node);
+    if (mi != mapHeadersIdle.end() && nNow - mi->second < nTimeout)
+        return false;
+    if (nNodeHeight <= max(BestHeaderHeight(), nBestHeight))
+        return false;
+
+    nodeHeaders = node;
+    nHeadersTime = nNow;
+    return true;
+}
+
+void CBlockDownload::HeadersReceived(NodeId node, bool fMore, int64_t nNow)
+{
+    if (node == nodeHeaders)
+        nodeHeaders = -1;
+    if (fMore)
+        mapHeadersIdle.erase(node);
+    else mapHeadersIdle[node] = nNow;
+}
+
+void CBlockDownload::RequestBlocks(NodeId node, int nNodeHeight, int64_t nNow, vector<uint256>& vHashes)
+{
+    int& nNodeInFlight = mapNodeInFlight[node];
+    int nEnd = min(int(vChain.size()), nWindow);
+    for (int i = 0; i < nEnd && nNodeInFlight < nMaxInFlight; i++) {
+        // the peer is not asked for blocks above its height
+        if (nChainBase + i > nNodeHeight)
+            break;
+        const uint256& hash = vChain[i];
+        if (mapInFlight.count(hash) || mapBuffered.count(hash))
+            continue;
+        CRequest& request = mapInFlight[hash];
+        request.node = node;
+        request.nTime = nNow;
+        nNodeInFlight++;
+        nRequested++;
+        vHashes.push_back(hash);
+    }
+    if (nNodeInFlight == 0)
+        mapNodeInFlight.erase(node);
+}
+
+void CBlockDownload::ExpireRequests(int64_t nNow)
+{
+    for (map<uint256, CRequest>::iterator it = mapInFlight.begin(); it != mapInFlight.end();) {
+        if (nNow - it->second.nTime >= nTimeout) {
+            nTimeouts++;
+            RemoveRequest(it++);
+        }
+        else ++it;
+    }
+}
+
+NodeId CBlockDownload::ExpireStalledChain(int64_t nNow)
+{
+    // the wait starts with the header chain, after a connected block
+    // and after a pause of the checks (the sync was not driven)
+    bool fProgress = !IsActive() || nConnected != nProgressConnected ||
+                     nNow - nStallCheckTime > nTimeout;
+    nStallCheckTime = nNow;
+    if (fProgress) {
+        nProgressConnected = nConnected;
+        nProgressTime = nNow;
+        return -1;
+    }
+    if (nNow - nProgressTime < nStallTimeout)
+        return -1;
+
+    // no peer delivers the next block: the chain can be made up by the
+    // sender of its header, it is dropped and requested again
+    NodeId node = mapHeaders[vChain.front()].node;
+    Reset();
+    nStalls++;
+    nStallTime = nNow;
+    nProgressTime = nNow;
+    return node;
+}
+
+bool CBlockDownload::BlockReceived(const uint256& hash, NodeId node)
+{
+    // a copy from another peer is not taken for the request, the
+    // requested one is still expected
+    map<uint256, CRequest>::iterator it = mapInFlight.find(hash);
+    if (it == mapInFlight.end() || it->second.node != node)
+        return false;
+    nReceived++;
+    RemoveRequest(it);
+    return true;
+}
+
+void CBlockDownload::BufferBlock(const uint256& hash, const shared_ptr<CBlock>& pblock, NodeId node)
+{
+    if (IsWanted(hash)) {
+        CBuffered& buffered = mapBuffered[hash];
+        buffered.pblock = pblock;
+        buffered.node = node;
+    }
+}
+
+shared_ptr<CBlock> CBlockDownload::TakeNext(NodeId& node)
+{
+    if (vChain.empty())
+        return shared_ptr<CBlock>();
+    map<uint256, CBuffered>::iterator it = mapBuffered.find(vChain.front());
+    if (it == mapBuffered.end())
+        return shared_ptr<CBlock>();
+    shared_ptr<CBlock> pblock = it->second.pblock;
+    node = it->second.node;
+    mapBuffered.erase(it);
+    return pblock;
+}
+
+void CBlockDownload::BlockAccepted(const uint256& hash)
+{
+    map<uint256, CHeader>::iterator mi = mapHeaders.find(hash);
+    if (mi == mapHeaders.end())
+        return;
+    // connected blocks of the header chain and their ancestors are done
+    if (IsWanted(hash))
+        PopChain(mi->second.nHeight - nChainBase + 1);
+    else mapHeaders.erase(mi);
+}
+
+void CBlockDownload::BlockInvalid(const uint256& hash)
+{
+    // the headers are requested again, the invalid block
+    // and its descendants are refused
+    setInvalid.insert(hash);
+    Reset();
+}
+
+void CBlockDownload::NodeFinalized(NodeId node)
+{
+    for (map<uint256, CRequest>::iterator it = mapInFlight.begin(); it != mapInFlight.end();) {
+        if (it->second.node == node)
+            RemoveRequest(it++);
+        else ++it;
+    }
+    mapNodeInFlight.erase(node);
+    mapHeadersIdle.erase(node);
+    if (nodeHeaders == node)
+        nodeHeaders = -1;
+}
+
+CBlockDownload::Stats CBlockDownload::GetStats() const
+{
+    Stats stats;
+    stats.nHeaders      = mapHeaders.size();
+    stats.nChainHeight  = BestHeaderHeight();
+    stats.nInFlight     = mapInFlight.size();
+    stats.nBuffered     = mapBuffered.size();
+    stats.nRequested    = nRequested;
+    stats.nReceived     = nReceived;
+    stats.nTimeouts     = nTimeouts;
+    stats.nStalls       = nStalls;
+    return stats;
+}
+
+void CBlockDownload::Reset()
+{
+    mapHeaders.clear();
+    vChain.clear();
+    nChainBase = 0;
+    mapInFlight.clear();
+    mapNodeInFlight.clear();
+    mapBuffered.clear();
+    nodeHeaders = -1;
+    mapHeadersIdle.clear();
+}
+
+void CBlockDownload::PopChain(size_t nCount)
+{
+    for (size_t i = 0; i < nCount && !vChain.empty(); i++) {
+        const uint256& hash = vChain.front();
+        mapHeaders.erase(hash);
+        mapBuffered.erase(hash);
+        map<uint256, CRequest>::iterator it = mapInFlight.find(hash);
+        if (it != mapInFlight.end())
+            RemoveRequest(it);
+        vChain.pop_front();
+        nChainBase++;
+        nConnected++;
+    }
+}
+
+void CBlockDownload::RemoveRequest(map<uint256, CRequest>::iterator it)
+{
+    map<NodeId, int>::iterator ni = mapNodeInFlight.find(it->second.node);
+    if (ni != mapNodeInFlight.end() && --ni->second <= 0)
+        mapNodeInFlight.erase(ni);
+    mapInFlight.erase(it);
+}
@@ -0,0 +1,159 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITBAY_BLOCKDOWNLOAD_H
+#define BITBAY_BLOCKDOWNLOAD_H
+
+#include "net.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+class CBlock;
+
+/** Number of headers sent in one headers message */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Blocks past the last connected one that can be requested or kept aside */
+static const int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Blocks requested from one peer at a time */
+static const int MAX_BLOCKS_IN_FLIGHT = 16;
+/** Seconds to wait for a requested block or headers before asking another peer */
+static const int64_t BLOCK_DOWNLOAD_TIMEOUT = 60;
+/** Headers kept ahead of the connected blocks, header sync pauses above it */
+static const int MAX_HEADERS_AHEAD = 50000;
+/** Seconds without a connected block of the header chain before it is dropped */
+static const int64_t HEADERS_STALL_TIMEOUT = 300;
+
+/** Headers-first download of the initial sync.
+ *  Headers are requested from one peer at a time, only its answer is
+ *  taken, and form the header chain: the chain of headers starting at a
+ *  block of mapBlockIndex with the most chain trust told by the targets
+ *  of the headers. Blocks of the header chain are requested from all the
+ *  peers that have them, at most nMaxInFlight per peer and at most
+ *  nWindow ahead of the last connected block. A block is taken only
+ *  from the peer it was requested from. Blocks received before their
+ *  parent are kept aside with their sender, not in the orphan pool, and
+ *  are taken in the chain order once the parent is connected. A header
+ *  chain which gets no block connected for nStallTimeout is dropped, the
+ *  peer which sent the header of the missing block is reported, and the
+ *  sync by getblocks takes over for nStallTimeout.
+ *  Not thread safe, all calls are made under cs_main.
+ */
+class CBlockDownload
+{
+public:
+    struct Stats {
+        int nHeaders        = 0;
+        int nChainHeight    = -1;
+        int nInFlight       = 0;
+        int nBuffered       = 0;
+        uint64_t nRequested = 0;
+        uint64_t nReceived  = 0;
+        uint64_t nTimeouts  = 0;
+        uint64_t nStalls    = 0;
+    };
+    struct CHeader {
+        uint256 hashPrev;
+        int     nHeight         = 0;
+        uint256 nChainTrust;
+        NodeId  node            = -1;   // sender
+        // what the target of the next header is computed from
+        unsigned int nTime      = 0;
+        unsigned int nBits      = 0;
+        bool    fProofOfStake   = false;
+    };
+
+    CBlockDownload(int nWindowIn = BLOCK_DOWNLOAD_WINDOW,
+                   int nMaxInFlightIn = MAX_BLOCKS_IN_FLIGHT,
+                   int64_t nTimeoutIn = BLOCK_DOWNLOAD_TIMEOUT,
+                   int nMaxHeadersIn = MAX_HEADERS_AHEAD,
+                   int64_t nStallTimeoutIn = HEADERS_STALL_TIMEOUT);
+
+    // Header chain
+    int         HeaderHeight(const uint256& hash) const; // -1 if unknown
+    uint256     HeaderTrust(const uint256& hash) const;  // 0 if unknown
+    bool        AddHeader(const uint256& hash, const uint256& hashPrev, int nHeight,
+                          const uint256& nChainTrust, NodeId node);
+    bool        AddHeader(const uint256& hash, const CHeader& header);
+    const CHeader* GetHeader(const uint256& hash) const; // NULL if unknown
+    int         BestHeaderHeight() const; // -1 if no blocks to download
+    uint256     BestHeaderTrust() const;
+    bool        IsActive() const { return !vChain.empty(); }
+    bool        IsInvalid(const uint256& hash) const { return setInvalid.count(hash) > 0; }
+    std::vector<uint256> GetLocatorHashes() const;
+
+    // Header requests: StartHeaders tells if the node is to be asked for
+    // headers now, HeadersReceived ends the request
+    bool        StartHeaders(NodeId node, int nNodeHeight, int nBestHeight, int64_t nNow);
+    bool        IsHeadersPeer(NodeId node) const { return node == nodeHeaders; }
+    void        HeadersReceived(NodeId node, bool fMore, int64_t nNow);
+
+    // Block requests
+    void        RequestBlocks(NodeId node, int nNodeHeight, int64_t nNow, std::vector<uint256>& vHashes);
+    void        ExpireRequests(int64_t nNow);
+    // drops a stalled header chain, returns the peer to blame or -1
+    NodeId      ExpireStalledChain(int64_t nNow);
+    // the sync by getblocks is taken for nStallTimeout after a stall
+    bool        IsStalled(int64_t nNow) const { return nStalls > 0 && nNow - nStallTime < nStallTimeout; }
+    bool        IsWanted(const uint256& hash) const;
+    // ends the request, false if the block was not requested from the node
+    bool        BlockReceived(const uint256& hash, NodeId node);
+    void        BufferBlock(const uint256& hash, const std::shared_ptr<CBlock>& pblock, NodeId node);
+    std::shared_ptr<CBlock> TakeNext(NodeId& node);
+    void        BlockAccepted(const uint256& hash);
+    // for a block failing in what its hash commits to, not for a bad copy
+    void        BlockInvalid(const uint256& hash);
+    void        NodeFinalized(NodeId node);
+
+    Stats       GetStats() const;
+
+private:
+    struct CRequest {
+        NodeId  node;
+        int64_t nTime;
+    };
+    struct CBuffered {
+        std::shared_ptr<CBlock> pblock;
+        NodeId  node;   // sender
+    };
+
+    void        Reset();
+    void        PopChain(size_t nCount);
+    void        RemoveRequest(std::map<uint256, CRequest>::iterator it);
+
+    int         nWindow;
+    int         nMaxInFlight;
+    int64_t     nTimeout;
+    int         nMaxHeaders;
+    int64_t     nStallTimeout;
+
+    std::map<uint256, CHeader>  mapHeaders;
+    std::deque<uint256>         vChain;     // header chain, blocks not connected yet
+    int                         nChainBase; // height of vChain[0]
+    std::map<uint256, CRequest> mapInFlight;
+    std::map<NodeId, int>       mapNodeInFlight;
+    std::map<uint256, CBuffered> mapBuffered;
+    std::set<uint256>           setInvalid;
+
+    NodeId                      nodeHeaders; // -1 if no headers request
+    int64_t                     nHeadersTime;
+    std::map<NodeId, int64_t>   mapHeadersIdle; // peers at the end of their chain
+
+    uint64_t                    nConnected;     // blocks of header chains
+    uint64_t                    nProgressConnected;
+    int64_t                     nProgressTime;
+    int64_t                     nStallCheckTime;
+    int64_t                     nStallTime;
+
+    uint64_t                    nRequested;
+    uint64_t                    nReceived;
+    uint64_t                    nTimeouts;
+    uint64_t                    nStalls;
+};
+
+#endif
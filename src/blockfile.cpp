@@ -0,0 +1,234 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfile.h"
+#include "util.h"
+
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <list>
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const int DEFAULT_BLOCKFILE_HANDLES = 8;
+
+static std::atomic<uint64_t> nOpens(0);
+static std::atomic<uint64_t> nCloses(0);
+static std::atomic<uint64_t> nReads(0);
+static std::atomic<uint64_t> nBytesRead(0);
+
+namespace {
+
+struct BlockFileHandle {
+    unsigned int nFile = 0;
+    int nUsers = 0;     // reads in progress, handle is not closed while used
+#ifdef WIN32
+    FILE* file = NULL;
+    boost::mutex mutex; // positioned read is fseek+fread here
+#else
+    int fd = -1;
+#endif
+};
+
+typedef std::list<BlockFileHandle> BlockFileHandles;
+
+boost::mutex cs_handles;
+BlockFileHandles lruHandles; // most recently used first
+std::map<unsigned int, BlockFileHandles::iterator> mapHandles;
+
+void CloseHandle(BlockFileHandle& handle)
+{
+#ifdef WIN32
+    if (handle.file)
+        fclose(handle.file);
+#else
+    if (handle.fd >= 0)
+        close(handle.fd);
+#endif
+    nCloses++;
+}
+
+// closes least recently used idle handles above the limit
+void TrimHandles()
+{
+    size_t nMax = std::max(1, (int)GetArg("-blockfilehandles", DEFAULT_BLOCKFILE_HANDLES));
+    auto it = lruHandles.end();
+    while (mapHandles.size() > nMax && it != lruHandles.begin()) {
+        --it;
+        if (it->nUsers > 0)
+            continue;
+        CloseHandle(*it);
+        mapHandles.erase(it->nFile);
+        it = lruHandles.erase(it);
+    }
+}
+
+BlockFileHandle* AcquireHandle(unsigned int nFile)
+{
+    if ((nFile < 1) || (nFile == (unsigned int) -1))
+        return NULL;
+
+    boost::mutex::scoped_lock lock(cs_handles);
+    auto mi = mapHandles.find(nFile);
+    if (mi != mapHandles.end()) {
+        lruHandles.splice(lruHandles.begin(), lruHandles, mi->second);
+        mi->second->nUsers++;
+        return &*mi->second;
+    }
+
+#ifdef WIN32
+    FILE* file = fopen(BlockFilePath(nFile).string().c_str(), "rb");
+    if (!file)
+        return NULL;
+#else
+    int fd = open(BlockFilePath(nFile).string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return NULL;
+#endif
+    nOpens++;
+    lruHandles.emplace_front();
+    BlockFileHandle& added = lruHandles.front();
+    added.nFile = nFile;
+    added.nUsers = 1;
+#ifdef WIN32
+    added.file = file;
+#else
+    added.fd = fd;
+#endif
+    mapHandles[nFile] = lruHandles.begin();
+    TrimHandles();
+    return &added;
+}
+
+void ReleaseHandle(BlockFileHandle* handle)
+{
+    boost::mutex::scoped_lock lock(cs_handles);
+    handle->nUsers--;
+    TrimHandles();
+}
+
+}
+
+boost::filesystem::path BlockFilePath(unsigned int nFile)
+{
+    string strBlockFn = strprintf("blk%04u.dat", nFile);
+    return GetDataDir() / strBlockFn;
+}
+
+int64_t ReadBlockFile(unsigned int nFile, uint64_t nPos, char* pch, size_t nSize)
+{
+    BlockFileHandle* handle = AcquireHandle(nFile);
+    if (!handle)
+        return -1;
+
+    int64_t nRead = 0;
+#ifdef WIN32
+    {
+        boost::mutex::scoped_lock lock(handle->mutex);
+        if (fseek(handle->file, nPos, SEEK_SET) == 0)
+            nRead = fread(pch, 1, nSize, handle->file);
+        else nRead = -1;
+    }
+#else
+    while (nRead < (int64_t)nSize) {
+        ssize_t n = pread(handle->fd, pch + nRead, nSize - nRead, nPos + nRead);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            nRead = -1;
+            break;
+        }
+        if (n == 0)
+            break; // end of file
+        nRead += n;
+    }
+#endif
+    ReleaseHandle(handle);
+
+    nReads++;
+    if (nRead > 0)
+        nBytesRead += nRead;
+    return nRead;
+}
+
+void CloseBlockFiles()
+{
+    boost::mutex::scoped_lock lock(cs_handles);
+    for (auto it = lruHandles.begin(); it != lruHandles.end();) {
+        if (it->nUsers > 0) {
+            ++it;
+            continue;
+        }
+        CloseHandle(*it);
+        mapHandles.erase(it->nFile);
+        it = lruHandles.erase(it);
+    }
+}
+
+CBlockFileStats GetBlockFileStats()
+{
+    CBlockFileStats stats;
+    stats.nOpens = nOpens;
+    stats.nCloses = nCloses;
+    stats.nReads = nReads;
+    stats.nBytesRead = nBytesRead;
+    {
+        boost::mutex::scoped_lock lock(cs_handles);
+        stats.nHandles = mapHandles.size();
+    }
+    return stats;
+}
+
+CBlockFileReader::CBlockFileReader(unsigned int nFileIn, uint64_t nPosIn, int nTypeIn, int nVersionIn,
+                                   size_t nReadAheadIn)
+    :nType(nTypeIn)
+    ,nVersion(nVersionIn)
+    ,nFile(nFileIn)
+    ,nPos(nPosIn)
+    ,nReadAhead(std::max(nReadAheadIn, size_t(64)))
+    ,fFailed(false)
+    ,nBufferPos(0)
+{
+    fFailed = !Fill(0);
+}
+
+// reads more of the file into the buffer to have at least nMin bytes
+// available, read ahead is doubled with every fill
+bool CBlockFileReader::Fill(size_t nMin)
+{
+    size_t nAvail = vBuffer.size() - nBufferPos;
+    size_t nWant = std::max(nMin - std::min(nMin, nAvail), nReadAhead);
+    vBuffer.erase(vBuffer.begin(), vBuffer.begin() + nBufferPos);
+    nBufferPos = 0;
+    vBuffer.resize(nAvail + nWant);
+    int64_t nRead = ReadBlockFile(nFile, nPos, vBuffer.data() + nAvail, nWant);
+    if (nRead < 0) {
+        vBuffer.resize(nAvail);
+        return false;
+    }
+    vBuffer.resize(nAvail + nRead);
+    nPos += nRead;
+    nReadAhead = std::min(nReadAhead * 2, size_t(MAX_SIZE));
+    return true;
+}
+
+CBlockFileReader& CBlockFileReader::read(char* pch, size_t nSize)
+{
+    if (vBuffer.size() - nBufferPos < nSize) {
+        if (!Fill(nSize) || vBuffer.size() - nBufferPos < nSize)
+            throw std::ios_base::failure("CBlockFileReader::read : end of file");
+    }
+    memcpy(pch, &vBuffer[nBufferPos], nSize);
+    nBufferPos += nSize;
+    return (*this);
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILE_H
+#define BITCOIN_BLOCKFILE_H
+
+#include "serialize.h"
+
+#include <stdint.h>
+#include <ios>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+// Read access to the blk*.dat block files. Instead of fopen and fseek for
+// every block or transaction read, a bounded pool of read-only handles is
+// kept per block file (-blockfilehandles, least recently used handle is
+// closed first) and reads are positioned reads on these handles, so many
+// threads can read the same file without reopening it.
+
+struct CBlockFileStats {
+    uint64_t nOpens     = 0; // block files opened by the pool
+    uint64_t nCloses    = 0; // pool handles closed (evicted)
+    uint64_t nReads     = 0; // positioned reads
+    uint64_t nBytesRead = 0;
+    uint64_t nHandles   = 0; // handles open now
+};
+
+boost::filesystem::path BlockFilePath(unsigned int nFile);
+
+// Reads nSize bytes at nPos of block file, returns number of bytes read
+// (less than nSize at end of file) or -1 if the file can not be read
+int64_t ReadBlockFile(unsigned int nFile, uint64_t nPos, char* pch, size_t nSize);
+void CloseBlockFiles();
+CBlockFileStats GetBlockFileStats();
+
+/** Stream for unserializing from a block file position, buffered
+ *  reads are made via the block file handles pool.
+ */
+class CBlockFileReader
+{
+public:
+    int nType;
+    int nVersion;
+
+    CBlockFileReader(unsigned int nFileIn, uint64_t nPosIn, int nTypeIn, int nVersionIn,
+                     size_t nReadAheadIn = 4096);
+
+    bool operator!() const      { return fFailed; }
+
+    int GetType()               { return nType; }
+    int GetVersion()            { return nVersion; }
+    uint64_t GetPos() const     { return nPos - (vBuffer.size() - nBufferPos); }
+
+    CBlockFileReader& read(char* pch, size_t nSize);
+
+    template<typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+private:
+    bool Fill(size_t nMin);
+
+    unsigned int nFile;
+    uint64_t nPos;      // file position after the buffer
+    size_t nReadAhead;
+    bool fFailed;
+    std::vector<char> vBuffer;
+    size_t nBufferPos;
+};
+
+#endif // BITCOIN_BLOCKFILE_H
@@ -3,43 +3,161 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blockindexmap.h"
+#include "main.h"
+
+#include <new>
+
+static const size_t nEntriesPerChunk = 4096;
+static const size_t nIndexesPerChunk = 4096;
+static const size_t nMinSlots = 1024;
+
+CBlockIndexMap::CBlockIndexMap()
+    :vSlots(nMinSlots, nullptr)
+    ,nEntries(0)
+    ,nEntryChunkUsed(nEntriesPerChunk)
+    ,nIndexChunkUsed(nIndexesPerChunk)
+{
+}
+
+CBlockIndexMap::~CBlockIndexMap()
+{
+    Clear();
+}
+
+void CBlockIndexMap::Clear()
+{
+    for (size_t i=0; i<vIndexChunks.size(); i++) {
+        CBlockIndex* chunk = reinterpret_cast<CBlockIndex*>(vIndexChunks[i]);
+        size_t nUsed = i+1 == vIndexChunks.size() ? nIndexChunkUsed : nIndexesPerChunk;
+        for (size_t n=0; n<nUsed; n++)
+            chunk[n].~CBlockIndex();
+        ::operator delete(vIndexChunks[i]);
+    }
+    vIndexChunks.clear();
+    nIndexChunkUsed = nIndexesPerChunk;
+
+    // entries are trivially destructible
+    for (value_type* chunk : vEntryChunks)
+        ::operator delete(chunk);
+    vEntryChunks.clear();
+    nEntryChunkUsed = nEntriesPerChunk;
+
+    std::vector<value_type*>(nMinSlots, nullptr).swap(vSlots);
+    nEntries = 0;
+}
 
 bool CBlockIndexMap::empty() const {
-    return mapBlockIndex.empty();
+    return nEntries == 0;
 }
 
 size_t CBlockIndexMap::size() const {
-    return mapBlockIndex.size();
+    return nEntries;
+}
+
+size_t CBlockIndexMap::Slot(const uint256& hashBlock) const {
+    // block hashes are uniform in low bits, no need to rehash
+    size_t nMask = vSlots.size() - 1;
+    size_t i = hashBlock.GetLow64() & nMask;
+    while (vSlots[i] && vSlots[i]->first != hashBlock)
+        i = (i + 1) & nMask;
+    return i;
 }
 
 size_t CBlockIndexMap::count(const uint256& hashBlock) const {
-    return mapBlockIndex.count(hashBlock);
+    return vSlots[Slot(hashBlock)] ? 1 : 0;
+}
+
+CBlockIndexMap::iterator CBlockIndexMap::find(const uint256& hashBlock) {
+    size_t i = Slot(hashBlock);
+    if (!vSlots[i])
+        return end();
+    return iterator(&vSlots[i], vSlots.data() + vSlots.size());
 }
 
-std::map<uint256, CBlockIndex*>::iterator CBlockIndexMap::find(const uint256& hashBlock) {
-    return mapBlockIndex.find(hashBlock);
+CBlockIndexMap::const_iterator CBlockIndexMap::find(const uint256& hashBlock) const {
+    size_t i = Slot(hashBlock);
+    if (!vSlots[i])
+        return end();
+    return const_iterator(&vSlots[i], vSlots.data() + vSlots.size());
 }
 
 CBlockIndex* CBlockIndexMap::ref(const uint256& hashBlock) {
-    return mapBlockIndex[hashBlock];
+    return insert(hashBlock, nullptr).first->second;
 }
 
-std::map<uint256, CBlockIndex*>::const_iterator CBlockIndexMap::begin() const {
-    return mapBlockIndex.begin();
+CBlockIndexMap::const_iterator CBlockIndexMap::begin() const {
+    return const_iterator(vSlots.data(), vSlots.data() + vSlots.size());
+}
+
+CBlockIndexMap::const_iterator CBlockIndexMap::end() const {
+    return const_iterator(vSlots.data() + vSlots.size(), vSlots.data() + vSlots.size());
+}
+
+CBlockIndexMap::iterator CBlockIndexMap::begin() {
+    return iterator(vSlots.data(), vSlots.data() + vSlots.size());
+}
+
+CBlockIndexMap::iterator CBlockIndexMap::end() {
+    return iterator(vSlots.data() + vSlots.size(), vSlots.data() + vSlots.size());
+}
+
+void CBlockIndexMap::reserve(size_t n) {
+    size_t nSlots = vSlots.size();
+    while (n * 2 > nSlots)
+        nSlots *= 2;
+    if (nSlots != vSlots.size())
+        Grow(nSlots);
+}
+
+void CBlockIndexMap::Grow(size_t nSlots) {
+    std::vector<value_type*> vOld(nSlots, nullptr);
+    vOld.swap(vSlots);
+    for (value_type* entry : vOld) {
+        if (entry)
+            vSlots[Slot(entry->first)] = entry;
+    }
+}
+
+std::pair<CBlockIndexMap::iterator, bool> CBlockIndexMap::insert(const uint256& hashBlock, CBlockIndex* pindex) {
+    size_t i = Slot(hashBlock);
+    if (vSlots[i])
+        return std::make_pair(iterator(&vSlots[i], vSlots.data() + vSlots.size()), false);
+
+    // load factor is kept under 1/2
+    if ((nEntries + 1) * 2 > vSlots.size()) {
+        Grow(vSlots.size() * 2);
+        i = Slot(hashBlock);
+    }
+    if (nEntryChunkUsed == nEntriesPerChunk) {
+        void* chunk = ::operator new(nEntriesPerChunk * sizeof(value_type));
+        vEntryChunks.push_back(static_cast<value_type*>(chunk));
+        nEntryChunkUsed = 0;
+    }
+    value_type* entry = new (vEntryChunks.back() + nEntryChunkUsed) value_type(hashBlock, pindex);
+    nEntryChunkUsed++;
+    vSlots[i] = entry;
+    nEntries++;
+    return std::make_pair(iterator(&vSlots[i], vSlots.data() + vSlots.size()), true);
 }
 
-std::map<uint256, CBlockIndex*>::const_iterator CBlockIndexMap::end() const {
-    return mapBlockIndex.end();
+void* CBlockIndexMap::AllocIndex() {
+    if (nIndexChunkUsed == nIndexesPerChunk) {
+        vIndexChunks.push_back(static_cast<char*>(::operator new(nIndexesPerChunk * sizeof(CBlockIndex))));
+        nIndexChunkUsed = 0;
+    }
+    return vIndexChunks.back() + sizeof(CBlockIndex) * nIndexChunkUsed++;
 }
 
-std::map<uint256, CBlockIndex*>::iterator CBlockIndexMap::begin() {
-    return mapBlockIndex.begin();
+CBlockIndex* CBlockIndexMap::NewIndex() {
+    return new (AllocIndex()) CBlockIndex();
 }
 
-std::map<uint256, CBlockIndex*>::iterator CBlockIndexMap::end() {
-    return mapBlockIndex.end();
+CBlockIndex* CBlockIndexMap::NewIndex(unsigned int nFile, unsigned int nBlockPos, CBlock& block) {
+    return new (AllocIndex()) CBlockIndex(nFile, nBlockPos, block);
 }
 
-std::pair<std::map<uint256, CBlockIndex*>::iterator, bool> CBlockIndexMap::insert(const uint256& hashBlock, CBlockIndex* pindex) {
-    return mapBlockIndex.insert(std::make_pair(hashBlock, pindex));
+size_t CBlockIndexMap::MemoryUsage() const {
+    return vSlots.capacity() * sizeof(value_type*)
+        + vEntryChunks.size() * nEntriesPerChunk * sizeof(value_type)
+        + vIndexChunks.size() * nIndexesPerChunk * sizeof(CBlockIndex);
 }
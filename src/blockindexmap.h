@@ -9,25 +9,91 @@
 #include "uint256.h"
 #include "util.h"
 
-#include <map>
+#include <iterator>
+#include <utility>
 #include <vector>
 
+class CBlock;
 class CBlockIndex;
 
+/** Index of blocks by hash.
+ *  Open addressing hash table (linear probing) of pointers to entries,
+ *  the entries and the CBlockIndex objects are allocated in chunks and
+ *  never move, so the hash referenced by CBlockIndex::phashBlock and
+ *  the pointers to block indexes stay valid when the table grows.
+ *  Entries are not removed one by one, Clear() drops all entries and
+ *  destroys the block indexes allocated by the map. Iteration order is
+ *  the table order.
+ */
 class CBlockIndexMap {
 public:
-    std::map<uint256, CBlockIndex*> mapBlockIndex;
-    
+    typedef std::pair<const uint256, CBlockIndex*> value_type;
+
+    template<typename V>
+    class iterator_base : public std::iterator<std::forward_iterator_tag, V> {
+    public:
+        iterator_base() :p(nullptr), end(nullptr) {}
+        iterator_base(value_type* const* pIn, value_type* const* endIn) :p(pIn), end(endIn) { skip(); }
+        template<typename O>
+        iterator_base(const iterator_base<O>& o) :p(o.p), end(o.end) {}
+
+        V& operator*() const { return **p; }
+        V* operator->() const { return *p; }
+        iterator_base& operator++() { ++p; skip(); return *this; }
+        iterator_base operator++(int) { iterator_base r = *this; ++*this; return r; }
+        bool operator==(const iterator_base& o) const { return p == o.p; }
+        bool operator!=(const iterator_base& o) const { return p != o.p; }
+
+    private:
+        template<typename O> friend class iterator_base;
+        void skip() { while (p != end && !*p) ++p; }
+        value_type* const* p;
+        value_type* const* end;
+    };
+    typedef iterator_base<value_type> iterator;
+    typedef iterator_base<const value_type> const_iterator;
+
+    CBlockIndexMap();
+    ~CBlockIndexMap();
+
     bool empty() const;
     size_t size() const;
     size_t count(const uint256& hashBlock) const;
-    std::map<uint256, CBlockIndex*>::const_iterator begin() const;
-    std::map<uint256, CBlockIndex*>::const_iterator end() const;
-    std::map<uint256, CBlockIndex*>::iterator begin();
-    std::map<uint256, CBlockIndex*>::iterator end();
-    std::map<uint256, CBlockIndex*>::iterator find(const uint256& hashBlock);
+    const_iterator begin() const;
+    const_iterator end() const;
+    iterator begin();
+    iterator end();
+    iterator find(const uint256& hashBlock);
+    const_iterator find(const uint256& hashBlock) const;
+    // as std::map operator[], adds NULL entry for unknown hash
     CBlockIndex* ref(const uint256& hashBlock);
-    std::pair<std::map<uint256, CBlockIndex*>::iterator, bool> insert(const uint256& hashBlock, CBlockIndex* pindex);
+    std::pair<iterator, bool> insert(const uint256& hashBlock, CBlockIndex* pindex);
+    // prepares the table for n entries without growing in between
+    void reserve(size_t n);
+    // drops all entries and destroys the block indexes from NewIndex()
+    void Clear();
+
+    // block indexes from the arena of the map, live until Clear()
+    CBlockIndex* NewIndex();
+    CBlockIndex* NewIndex(unsigned int nFile, unsigned int nBlockPos, CBlock& block);
+
+    // bytes held by the table, entries and block indexes
+    size_t MemoryUsage() const;
+
+private:
+    CBlockIndexMap(const CBlockIndexMap&) = delete;
+    CBlockIndexMap& operator=(const CBlockIndexMap&) = delete;
+
+    size_t Slot(const uint256& hashBlock) const;
+    void Grow(size_t nSlots);
+    void* AllocIndex();
+
+    std::vector<value_type*> vSlots;    // size is power of two, NULL if empty
+    size_t nEntries;
+    std::vector<value_type*> vEntryChunks;
+    size_t nEntryChunkUsed;
+    std::vector<char*> vIndexChunks;
+    size_t nIndexChunkUsed;
 };
 
 #endif
@@ -0,0 +1,266 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexsnapshot.h"
+#include "blockindexmap.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "main.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+static const uint32_t BLOCKINDEX_SNAPSHOT_VERSION = 1;
+static const char pchSnapshotMagic[4] = { 'b', 'b', 'i', 'x' };
+
+namespace {
+
+// Layout of the file, integers are in host (little endian) order as the
+// uint256 values are, fields are ordered to have no padding
+struct SnapshotHeader {
+    char pchMagic[4];
+    uint32_t nVersion;
+    uint32_t nRecordSize;
+    uint32_t nRecords;
+    unsigned char pchMessageStart[4];
+    uint32_t nReserved;
+    uint256 hashBest;
+    uint256 hashRecords;    // Hash() of the records array
+};
+
+struct SnapshotRecord {
+    uint256 hashBlock;
+    uint256 hashMerkleRoot;
+    uint256 hashProof;
+    uint256 bnStakeModifierV2;
+    uint256 nChainTrust;
+    uint256 hashPrevoutStake;
+    uint64_t nStakeModifier;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    int32_t nPrev;          // index of parent record, -1 if none
+    int32_t nNext;          // index of next record in best chain, -1 if none
+    uint32_t nFile;
+    uint32_t nBlockPos;
+    int32_t nHeight;
+    uint32_t nFlags;
+    int32_t nPegSupplyIndex;
+    int32_t nPegVotesInflate;
+    int32_t nPegVotesDeflate;
+    int32_t nPegVotesNochange;
+    uint32_t nPrevoutStake;
+    uint32_t nStakeTime;
+    int32_t nVersion;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+};
+
+static_assert(sizeof(SnapshotHeader) == 88, "snapshot header has no padding");
+static_assert(sizeof(SnapshotRecord) == 280, "snapshot record has no padding");
+
+}
+
+boost::filesystem::path BlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blkindex.snapshot";
+}
+
+bool WriteBlockIndexSnapshot(const boost::filesystem::path& path,
+                             const CBlockIndexMap& mapIndex,
+                             const uint256& hashBest)
+{
+    int64_t nStart = GetTimeMicros();
+
+    // records are numbered in the map order, entries without
+    // block index (referenced only) are skipped
+    unordered_map<const CBlockIndex*, int32_t> mapRecordOf;
+    mapRecordOf.reserve(mapIndex.size());
+    for(const CBlockIndexMap::value_type & item : mapIndex) {
+        if (item.second) {
+            int32_t nRecord = mapRecordOf.size();
+            mapRecordOf[item.second] = nRecord;
+        }
+    }
+    auto recordOf = [&](const CBlockIndex* pindex) -> int32_t {
+        if (!pindex)
+            return -1;
+        auto mi = mapRecordOf.find(pindex);
+        return mi != mapRecordOf.end() ? mi->second : -1;
+    };
+
+    vector<SnapshotRecord> vRecords(mapRecordOf.size());
+    for(const CBlockIndexMap::value_type & item : mapIndex) {
+        const CBlockIndex* pindex = item.second;
+        if (!pindex)
+            continue;
+        SnapshotRecord& rec = vRecords[mapRecordOf[pindex]];
+        rec.hashBlock           = item.first;
+        rec.hashMerkleRoot      = pindex->hashMerkleRoot;
+        rec.hashProof           = pindex->hashProof;
+        rec.bnStakeModifierV2   = pindex->bnStakeModifierV2;
+        rec.nChainTrust         = pindex->nChainTrust;
+        rec.hashPrevoutStake    = pindex->prevoutStake.hash;
+        rec.nStakeModifier      = pindex->nStakeModifier;
+        rec.nMint               = pindex->nMint;
+        rec.nMoneySupply        = pindex->nMoneySupply;
+        rec.nPrev               = recordOf(pindex->pprev);
+        rec.nNext               = recordOf(pindex->pnext);
+        rec.nFile               = pindex->nFile;
+        rec.nBlockPos           = pindex->nBlockPos;
+        rec.nHeight             = pindex->nHeight;
+        rec.nFlags              = pindex->nFlags;
+        rec.nPegSupplyIndex     = pindex->nPegSupplyIndex;
+        rec.nPegVotesInflate    = pindex->nPegVotesInflate;
+        rec.nPegVotesDeflate    = pindex->nPegVotesDeflate;
+        rec.nPegVotesNochange   = pindex->nPegVotesNochange;
+        rec.nPrevoutStake       = pindex->prevoutStake.n;
+        rec.nStakeTime          = pindex->nStakeTime;
+        rec.nVersion            = pindex->nVersion;
+        rec.nTime               = pindex->nTime;
+        rec.nBits               = pindex->nBits;
+        rec.nNonce              = pindex->nNonce;
+    }
+
+    SnapshotHeader header = {};
+    memcpy(header.pchMagic, pchSnapshotMagic, sizeof(header.pchMagic));
+    header.nVersion = BLOCKINDEX_SNAPSHOT_VERSION;
+    header.nRecordSize = sizeof(SnapshotRecord);
+    header.nRecords = vRecords.size();
+    memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+    header.hashBest = hashBest;
+    const char* pbegin = (const char*)vRecords.data();
+    header.hashRecords = Hash(pbegin, pbegin + vRecords.size() * sizeof(SnapshotRecord));
+
+    // written aside and renamed, not to leave a truncated snapshot
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("WriteBlockIndexSnapshot() : open %s failed", pathTmp.string());
+    bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (fOk && !vRecords.empty())
+        fOk = fwrite(vRecords.data(), sizeof(SnapshotRecord), vRecords.size(), file) == vRecords.size();
+    if (fOk) {
+        fflush(file);
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        return error("WriteBlockIndexSnapshot() : write %s failed", path.string());
+    }
+
+    LogPrintf("WriteBlockIndexSnapshot() : %u blocks in %dms\n",
+              header.nRecords, (GetTimeMicros() - nStart) / 1000);
+    return true;
+}
+
+bool ReadBlockIndexSnapshot(const boost::filesystem::path& path,
+                            CBlockIndexMap& mapIndex,
+                            const uint256& hashBest,
+                            set<pair<COutPoint, unsigned int> >& setStakeSeen)
+{
+    if (!mapIndex.empty())
+        return false;
+
+    // one read of the whole file, the snapshot is removed right after
+    // as the index starts to change from this point
+    vector<char> vData;
+    {
+        FILE* file = fopen(path.string().c_str(), "rb");
+        if (!file)
+            return false;
+        bool fOk = fseek(file, 0, SEEK_END) == 0;
+        long nSize = fOk ? ftell(file) : -1;
+        if (nSize >= (long)sizeof(SnapshotHeader)) {
+            vData.resize(nSize);
+            fOk = fseek(file, 0, SEEK_SET) == 0 && fread(vData.data(), 1, nSize, file) == (size_t)nSize;
+        }
+        fclose(file);
+        boost::filesystem::remove(path);
+        if (!fOk || vData.empty())
+            return error("ReadBlockIndexSnapshot() : read %s failed", path.string());
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, vData.data(), sizeof(header));
+    if (memcmp(header.pchMagic, pchSnapshotMagic, sizeof(header.pchMagic)) != 0 ||
+        header.nVersion != BLOCKINDEX_SNAPSHOT_VERSION ||
+        header.nRecordSize != sizeof(SnapshotRecord) ||
+        memcmp(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart)) != 0)
+        return error("ReadBlockIndexSnapshot() : unknown snapshot format");
+    if (header.hashBest != hashBest) {
+        LogPrintf("ReadBlockIndexSnapshot() : snapshot is stale, best chain %s, expected %s\n",
+                  header.hashBest.ToString(), hashBest.ToString());
+        return false;
+    }
+    if (vData.size() != sizeof(SnapshotHeader) + uint64_t(header.nRecords) * sizeof(SnapshotRecord))
+        return error("ReadBlockIndexSnapshot() : snapshot size mismatch");
+    const char* pbegin = vData.data() + sizeof(SnapshotHeader);
+    const char* pend = vData.data() + vData.size();
+    if (Hash(pbegin, pend) != header.hashRecords)
+        return error("ReadBlockIndexSnapshot() : snapshot checksum mismatch");
+
+    const SnapshotRecord* vRecords = (const SnapshotRecord*)pbegin;
+    const int32_t nRecords = header.nRecords;
+    for (int32_t i=0; i<nRecords; i++) {
+        const SnapshotRecord& rec = vRecords[i];
+        if (rec.nPrev < -1 || rec.nPrev >= nRecords || rec.nNext < -1 || rec.nNext >= nRecords)
+            return error("ReadBlockIndexSnapshot() : bad link at %d", rec.nHeight);
+    }
+
+    vector<CBlockIndex*> vIndexes(nRecords);
+    mapIndex.reserve(nRecords);
+    for (int32_t i=0; i<nRecords; i++) {
+        CBlockIndex* pindex = mapIndex.NewIndex();
+        auto ins = mapIndex.insert(vRecords[i].hashBlock, pindex);
+        if (!ins.second) {
+            // the caller falls back to the scan into the same map
+            mapIndex.Clear();
+            return error("ReadBlockIndexSnapshot() : duplicate block %s", vRecords[i].hashBlock.ToString());
+        }
+        pindex->phashBlock = &ins.first->first;
+        vIndexes[i] = pindex;
+    }
+    for (int32_t i=0; i<nRecords; i++) {
+        const SnapshotRecord& rec = vRecords[i];
+        CBlockIndex* pindex = vIndexes[i];
+        pindex->pprev               = rec.nPrev >= 0 ? vIndexes[rec.nPrev] : NULL;
+        pindex->pnext               = rec.nNext >= 0 ? vIndexes[rec.nNext] : NULL;
+        pindex->nFile               = rec.nFile;
+        pindex->nBlockPos           = rec.nBlockPos;
+        pindex->nHeight             = rec.nHeight;
+        pindex->nFlags              = rec.nFlags;
+        pindex->nChainTrust         = rec.nChainTrust;
+        pindex->nMint               = rec.nMint;
+        pindex->nMoneySupply        = rec.nMoneySupply;
+        pindex->nPegSupplyIndex     = rec.nPegSupplyIndex;
+        pindex->nPegVotesInflate    = rec.nPegVotesInflate;
+        pindex->nPegVotesDeflate    = rec.nPegVotesDeflate;
+        pindex->nPegVotesNochange   = rec.nPegVotesNochange;
+        pindex->nStakeModifier      = rec.nStakeModifier;
+        pindex->bnStakeModifierV2   = rec.bnStakeModifierV2;
+        pindex->prevoutStake        = COutPoint(rec.hashPrevoutStake, rec.nPrevoutStake);
+        pindex->nStakeTime          = rec.nStakeTime;
+        pindex->hashProof           = rec.hashProof;
+        pindex->nVersion            = rec.nVersion;
+        pindex->hashMerkleRoot      = rec.hashMerkleRoot;
+        pindex->nTime               = rec.nTime;
+        pindex->nBits               = rec.nBits;
+        pindex->nNonce              = rec.nNonce;
+
+        // NovaCoin: build setStakeSeen
+        if (pindex->IsProofOfStake())
+            setStakeSeen.insert(make_pair(pindex->prevoutStake, pindex->nStakeTime));
+    }
+    return true;
+}
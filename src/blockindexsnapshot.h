@@ -0,0 +1,42 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITBAY_BLOCKINDEXSNAPSHOT_H
+#define BITBAY_BLOCKINDEXSNAPSHOT_H
+
+#include "uint256.h"
+
+#include <set>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+class CBlockIndexMap;
+class COutPoint;
+
+// Snapshot of the block index written on clean shutdown, so the next start
+// does not scan the blockindex records of txleveldb and recompute the chain
+// trust. The file is a header followed by a flat array of fixed size
+// records (block header, height, peg supply and votes, stake modifiers,
+// chain trust and indexes of parent and next blocks in the array instead
+// of pointers), checksummed with Hash() of the records.
+// The snapshot is valid only for the best chain it was written for and is
+// removed once read, so blocks connected after the start (or a crash) fall
+// back to the leveldb scan.
+
+boost::filesystem::path BlockIndexSnapshotPath();
+
+bool WriteBlockIndexSnapshot(const boost::filesystem::path& path,
+                             const CBlockIndexMap& mapIndex,
+                             const uint256& hashBest);
+
+// Fills the empty mapIndex and setStakeSeen from the snapshot if it was
+// written for hashBest, returns false if missing, stale or corrupted.
+// mapIndex is left empty when false is returned.
+bool ReadBlockIndexSnapshot(const boost::filesystem::path& path,
+                            CBlockIndexMap& mapIndex,
+                            const uint256& hashBest,
+                            std::set<std::pair<COutPoint, unsigned int> >& setStakeSeen);
+
+#endif
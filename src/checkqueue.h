@@ -0,0 +1,232 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef CHECKQUEUE_H
+#define CHECKQUEUE_H
+
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+template<typename T> class CCheckQueueControl;
+
+/** Queue for verifications that have to be performed.
+  * The verifications are represented by a type T, which must provide an
+  * operator(), returning a bool, and a swap.
+  *
+  * One thread (the master) is assumed to push batches of verifications
+  * onto the queue, where they are processed by N-1 worker threads. When
+  * the master is done adding work, it temporarily joins the worker pool
+  * as an N'th worker, until all jobs are done.
+  *
+  * Checks are numbered in the order they are added. Of the failed checks
+  * the first added one is handed to the master, so the failure can be
+  * reported as the serial verification would report it. Checks added
+  * after a known failure are skipped.
+  */
+template<typename T> class CCheckQueue
+{
+private:
+    typedef std::pair<uint64_t, T> Item;
+    static const uint64_t NONE = std::numeric_limits<uint64_t>::max();
+
+    // Mutex to protect the inner state
+    boost::mutex mutex;
+
+    // Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    // Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
+
+    // The queue of elements to be processed.
+    // As the order of booleans doesn't matter, it is used as a LIFO (stack)
+    std::vector<Item> queue;
+
+    // The number of workers (including the master) that are idle.
+    int nIdle;
+
+    // The total number of workers (including the master).
+    int nTotal;
+
+    // Number of verifications that haven't completed yet.
+    // This includes elements that are no longer queued, but still in the
+    // worker's own batches.
+    uint64_t nTodo;
+
+    // Number given to the next added verification
+    uint64_t nAdded;
+
+    // The first added of the failed verifications
+    uint64_t nFailed;
+    T failed;
+
+    // The maximum number of elements to be processed in one batch
+    unsigned int nBatchSize;
+
+    // Internal function that does bulk of the verification work.
+    bool Loop(bool fMaster = false, T* pfailed = NULL)
+    {
+        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        std::vector<Item> vChecks;
+        vChecks.reserve(nBatchSize);
+        unsigned int nNow = 0;
+        uint64_t nSkipFrom = NONE;
+        uint64_t nFailedNow = NONE;
+        T failedNow;
+        do {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
+                if (nNow) {
+                    if (nFailedNow < nFailed) {
+                        nFailed = nFailedNow;
+                        failed.swap(failedNow);
+                    }
+                    nTodo -= nNow;
+                    if (nTodo == 0 && !fMaster)
+                        // We processed the last element; inform the master it can exit and return the result
+                        condMaster.notify_one();
+                } else {
+                    // first iteration
+                    nTotal++;
+                }
+                // logically, the do loop starts here
+                while (queue.empty()) {
+                    if (fMaster && nTodo == 0) {
+                        nTotal--;
+                        bool fRet = nFailed == NONE;
+                        // hand over the failure and reset the status for new work later
+                        if (!fRet && pfailed)
+                            pfailed->swap(failed);
+                        failed = T();
+                        nFailed = NONE;
+                        nAdded = 0;
+                        return fRet;
+                    }
+                    nIdle++;
+                    cond.wait(lock); // wait
+                    nIdle--;
+                }
+                // Decide how many work units to process now.
+                // * Do not try to do everything at once, but aim for increasingly smaller batches so
+                //   all workers finish approximately simultaneously.
+                // * Try to account for idle jobs which will instantly start helping.
+                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
+                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                vChecks.resize(nNow);
+                for (unsigned int i = 0; i < nNow; i++) {
+                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
+                    // queue to the local batch vector instead of copying.
+                    vChecks[i].first = queue.back().first;
+                    vChecks[i].second.swap(queue.back().second);
+                    queue.pop_back();
+                }
+                nSkipFrom = nFailed;
+            }
+            // execute work, checks after a failed one do not change the result
+            nFailedNow = NONE;
+            for (Item& item : vChecks) {
+                if (item.first >= nSkipFrom || item.first >= nFailedNow)
+                    continue;
+                if (!item.second()) {
+                    nFailedNow = item.first;
+                    failedNow.swap(item.second);
+                }
+            }
+            vChecks.clear();
+        } while (true);
+    }
+
+public:
+    // Create a new check queue
+    CCheckQueue(unsigned int nBatchSizeIn)
+        : nIdle(0), nTotal(0), nTodo(0), nAdded(0), nFailed(NONE), nBatchSize(nBatchSizeIn) {}
+
+    // Worker thread
+    void Thread()
+    {
+        Loop();
+    }
+
+    // Wait until execution finishes, and return whether all evaluations
+    // were successful; the first added failed check is swapped to pfailed
+    bool Wait(T* pfailed = NULL)
+    {
+        return Loop(true, pfailed);
+    }
+
+    // Add a batch of checks to the queue
+    void Add(std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (T& check : vChecks) {
+            queue.push_back(Item(nAdded++, T()));
+            check.swap(queue.back().second);
+        }
+        nTodo += vChecks.size();
+        if (vChecks.size() == 1)
+            condWorker.notify_one();
+        else if (vChecks.size() > 1)
+            condWorker.notify_all();
+    }
+
+    bool IsIdle()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return (nTotal == nIdle && nTodo == 0 && nFailed == NONE);
+    }
+};
+
+/** RAII-style controller object for a CCheckQueue that guarantees the passed
+ *  queue is finished before continuing.
+ */
+template<typename T> class CCheckQueueControl
+{
+private:
+    CCheckQueue<T>* pqueue;
+    bool fDone;
+
+public:
+    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
+    {
+        // passed queue is supposed to be unused, or NULL
+        if (pqueue != NULL) {
+            bool isIdle = pqueue->IsIdle();
+            assert(isIdle);
+        }
+    }
+
+    bool Wait(T* pfailed = NULL)
+    {
+        if (pqueue == NULL)
+            return true;
+        bool fRet = pqueue->Wait(pfailed);
+        fDone = true;
+        return fRet;
+    }
+
+    void Add(std::vector<T>& vChecks)
+    {
+        if (pqueue != NULL) {
+            pqueue->Add(vChecks);
+            fDone = false;
+        }
+    }
+
+    ~CCheckQueueControl()
+    {
+        if (!fDone)
+            Wait();
+    }
+};
+
+#endif // CHECKQUEUE_H
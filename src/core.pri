@@ -9,6 +9,7 @@ HEADERS += \
     $$PWD/chainparams.h \
     $$PWD/chainparamsseeds.h \
     $$PWD/checkpoints.h \
+    $$PWD/checkqueue.h \
     $$PWD/compat.h \
     $$PWD/coincontrol.h \
     $$PWD/sync.h \
@@ -25,6 +26,7 @@ HEADERS += \
     $$PWD/txdb.h \
     $$PWD/txmempool.h \
     $$PWD/script.h \
+    $$PWD/sigcache.h \
     $$PWD/init.h \
     $$PWD/mruset.h \
     $$PWD/keystore.h \
@@ -38,7 +40,10 @@ HEADERS += \
     $$PWD/clientversion.h \
     $$PWD/threadsafety.h \
     $$PWD/tinyformat.h \
+    $$PWD/blockdownload.h \
     $$PWD/blockindexmap.h \
+    $$PWD/blockindexsnapshot.h \
+    $$PWD/blockfile.h \
 
 SOURCES += \
     $$PWD/alert.cpp \
@@ -52,6 +57,7 @@ SOURCES += \
     $$PWD/netbase.cpp \
     $$PWD/key.cpp \
     $$PWD/script.cpp \
+    $$PWD/sigcache.cpp \
     $$PWD/core.cpp \
     $$PWD/main.cpp \
     $$PWD/net.cpp \
@@ -63,7 +69,10 @@ SOURCES += \
     $$PWD/protocol.cpp \
     $$PWD/noui.cpp \
     $$PWD/kernel.cpp \
+    $$PWD/blockdownload.cpp \
     $$PWD/blockindexmap.cpp \
+    $$PWD/blockindexsnapshot.cpp \
+    $$PWD/blockfile.cpp \
 
 HEADERS += \
     $$PWD/crypto/pbkdf2.h \
@@ -0,0 +1,331 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_DBBATCH_H
+#define BITCOIN_DBBATCH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+
+class CDBWriteBuffer;
+
+// Pending writes and deletes of a database transaction. Unlike a plain
+// leveldb::WriteBatch the pending changes are kept in ordered indexes, so
+// reads made while a transaction is open (point lookups and range seeks
+// which have to skip pending deletes) do not scan the whole batch.
+// Only the last change of a key is kept, the leveldb batch is built
+// from the indexes when the transaction is committed.
+// A batch can be layered on the write buffer of its database: reads
+// not answered by the batch are answered by the buffer, then by disk.
+class CDBBatch
+{
+public:
+    struct cmpBySlice {
+        bool operator()(const std::string& a, const std::string& b) const {
+            leveldb::Slice sa(a);
+            leveldb::Slice sb(b);
+            int cmp = sa.compare(sb);
+            return cmp < 0;
+        }
+    };
+    typedef std::map<std::string, std::string, cmpBySlice> Puts;
+    typedef std::set<std::string, cmpBySlice> Deletes;
+
+    explicit CDBBatch(const CDBWriteBuffer* pbaseIn = NULL) : pbase(pbaseIn), nBytes(0) {}
+
+    void Put(const std::string& key, const std::string& value)
+    {
+        if (deletes.erase(key))
+            nBytes -= key.size();
+        Puts::iterator it = puts.find(key);
+        if (it != puts.end()) {
+            nBytes += value.size();
+            nBytes -= it->second.size();
+            it->second = value;
+            return;
+        }
+        puts.insert(it, std::make_pair(key, value));
+        nBytes += key.size() + value.size();
+    }
+
+    void Delete(const std::string& key)
+    {
+        Puts::iterator it = puts.find(key);
+        if (it != puts.end()) {
+            nBytes -= key.size() + it->second.size();
+            puts.erase(it);
+        }
+        if (deletes.insert(key).second)
+            nBytes += key.size();
+    }
+
+    // Returns true and sets (value,false) if the batch contains the given key
+    // or leaves value alone and sets deleted = true if the batch contains a
+    // delete for it.
+    bool Get(const std::string& key, std::string* value, bool* deleted) const;
+
+    bool IsDeleted(const std::string& key) const;
+
+    // First written key not less than fromkey
+    bool Seek(const std::string& fromkey, std::string* key, std::string* value) const;
+
+    // Written keys in [fromkey, tokey]
+    bool Range(const std::string& fromkey, const std::string& tokey, Puts* seekmap) const;
+
+    // Changes of another batch applied on top of this one
+    void Merge(const CDBBatch& other)
+    {
+        for(const std::string& key : other.deletes)
+            Delete(key);
+        for(const Puts::value_type& item : other.puts)
+            Put(item.first, item.second);
+    }
+
+    void Clear()
+    {
+        puts.clear();
+        deletes.clear();
+        nBytes = 0;
+    }
+
+    size_t Size() const { return puts.size() + deletes.size(); }
+    size_t Bytes() const { return nBytes; }
+
+    leveldb::Status Write(leveldb::DB* pdb, bool fSync = false) const
+    {
+        leveldb::WriteBatch batch;
+        for(const std::string& key : deletes)
+            batch.Delete(key);
+        for(const Puts::value_type& item : puts)
+            batch.Put(item.first, item.second);
+        leveldb::WriteOptions options;
+        options.sync = fSync;
+        return pdb->Write(options, &batch);
+    }
+
+private:
+    const CDBWriteBuffer* pbase;
+    Puts puts;
+    Deletes deletes;
+    size_t nBytes; // keys and values
+};
+
+// Committed transactions of a database kept in memory and written to disk
+// together, to coalesce the writes of many connected blocks in one leveldb
+// write. Shared by all the handles of the database: transaction batches
+// are layered on it and handles read through it, so the pending changes
+// are seen as if written. Disabled, the commits go straight to disk.
+class CDBWriteBuffer
+{
+public:
+    struct Stats {
+        bool     fEnabled       = false;
+        size_t   nKeys          = 0;
+        size_t   nBytes         = 0;
+        uint64_t nCommits       = 0;
+        uint64_t nFlushes       = 0;
+        uint64_t nFlushedKeys   = 0;
+        uint64_t nFlushedBytes  = 0;
+        int64_t  nFlushMicros   = 0; // total time of the flushes
+        int64_t  nLastFlushMicros = 0;
+    };
+
+    CDBWriteBuffer() : fEnabled(false), fEmpty(true) {}
+
+    bool IsEnabled() const { return fEnabled; }
+    void Enable()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        fEnabled = true;
+    }
+
+    // Applies the batch of a committed transaction, false if disabled
+    bool Commit(const CDBBatch& committed)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!fEnabled)
+            return false;
+        batch.Merge(committed);
+        fEmpty = batch.Size() == 0;
+        stats.nCommits++;
+        return true;
+    }
+
+    // Single writes made outside of transactions, false if disabled
+    bool Put(const std::string& key, const std::string& value)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!fEnabled)
+            return false;
+        batch.Put(key, value);
+        fEmpty = false;
+        return true;
+    }
+    bool Delete(const std::string& key)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!fEnabled)
+            return false;
+        batch.Delete(key);
+        fEmpty = false;
+        return true;
+    }
+
+    bool Get(const std::string& key, std::string* value, bool* deleted) const
+    {
+        *deleted = false;
+        if (fEmpty)
+            return false;
+        boost::mutex::scoped_lock lock(mutex);
+        return batch.Get(key, value, deleted);
+    }
+    bool IsDeleted(const std::string& key) const
+    {
+        if (fEmpty)
+            return false;
+        boost::mutex::scoped_lock lock(mutex);
+        return batch.IsDeleted(key);
+    }
+    bool Seek(const std::string& fromkey, std::string* key, std::string* value) const
+    {
+        if (fEmpty)
+            return false;
+        boost::mutex::scoped_lock lock(mutex);
+        return batch.Seek(fromkey, key, value);
+    }
+    bool Range(const std::string& fromkey, const std::string& tokey, CDBBatch::Puts* seekmap) const
+    {
+        if (fEmpty)
+            return false;
+        boost::mutex::scoped_lock lock(mutex);
+        return batch.Range(fromkey, tokey, seekmap);
+    }
+
+    size_t Bytes() const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return batch.Bytes();
+    }
+
+    // Writes the pending changes in one synced leveldb write, the buffer
+    // is disabled after if fDisable. On failure the changes are kept.
+    leveldb::Status Flush(leveldb::DB* pdb, bool fDisable)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        leveldb::Status status;
+        if (batch.Size() > 0) {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            status = batch.Write(pdb, true);
+            if (!status.ok())
+                return status;
+            int64_t nMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+            stats.nFlushes++;
+            stats.nFlushedKeys += batch.Size();
+            stats.nFlushedBytes += batch.Bytes();
+            stats.nFlushMicros += nMicros;
+            stats.nLastFlushMicros = nMicros;
+            batch.Clear();
+            fEmpty = true;
+        }
+        if (fDisable)
+            fEnabled = false;
+        return status;
+    }
+
+    Stats GetStats() const
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        Stats s = stats;
+        s.fEnabled = fEnabled;
+        s.nKeys = batch.Size();
+        s.nBytes = batch.Bytes();
+        return s;
+    }
+
+private:
+    mutable boost::mutex mutex;
+    CDBBatch batch;
+    std::atomic<bool> fEnabled;
+    std::atomic<bool> fEmpty; // read without the lock on the hot path
+    Stats stats;
+};
+
+inline bool CDBBatch::Get(const std::string& key, std::string* value, bool* deleted) const
+{
+    *deleted = false;
+    Puts::const_iterator it = puts.find(key);
+    if (it != puts.end()) {
+        *value = it->second;
+        return true;
+    }
+    if (deletes.count(key)) {
+        *deleted = true;
+        return true;
+    }
+    return pbase && pbase->Get(key, value, deleted);
+}
+
+inline bool CDBBatch::IsDeleted(const std::string& key) const
+{
+    if (!deletes.empty() && deletes.count(key))
+        return true;
+    return pbase && !puts.count(key) && pbase->IsDeleted(key);
+}
+
+inline bool CDBBatch::Seek(const std::string& fromkey, std::string* key, std::string* value) const
+{
+    Puts::const_iterator it = puts.lower_bound(fromkey);
+    bool fFound = it != puts.end();
+
+    // first key of the buffer not deleted in this batch, the next
+    // key after k in the bytewise order is k followed by a zero byte
+    std::string strBKey, strBValue;
+    bool fFoundBase = false;
+    std::string strFrom = fromkey;
+    while (pbase && pbase->Seek(strFrom, &strBKey, &strBValue)) {
+        if (!deletes.count(strBKey)) {
+            fFoundBase = true;
+            break;
+        }
+        strFrom = strBKey + '\0';
+    }
+
+    if (fFoundBase && (!fFound || cmpBySlice()(strBKey, it->first))) {
+        *key = strBKey;
+        *value = strBValue;
+        return true;
+    }
+    if (!fFound)
+        return false;
+    *key = it->first;
+    *value = it->second;
+    return true;
+}
+
+inline bool CDBBatch::Range(const std::string& fromkey, const std::string& tokey, Puts* seekmap) const
+{
+    if (pbase && pbase->Range(fromkey, tokey, seekmap)) {
+        Deletes::const_iterator di = deletes.lower_bound(fromkey);
+        Deletes::const_iterator dend = deletes.upper_bound(tokey);
+        for(; di != dend; ++di)
+            seekmap->erase(*di);
+    }
+    Puts::const_iterator it = puts.lower_bound(fromkey);
+    Puts::const_iterator end = puts.upper_bound(tokey);
+    for(; it != end; ++it)
+        (*seekmap)[it->first] = it->second;
+    return !seekmap->empty();
+}
+
+#endif // BITCOIN_DBBATCH_H
@@ -0,0 +1,98 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "dboptions.h"
+
+#include "util.h"
+
+#include <algorithm>
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+
+using namespace std;
+
+static size_t GetSizeArg(const string& strArg, int64_t nDefault, int64_t nMin, int64_t nMax, int64_t nUnit)
+{
+    int64_t n = GetArg(strArg, nDefault);
+    return size_t(max(nMin, min(nMax, n)) * nUnit);
+}
+
+CDBOptions GetDBOptions(const string& strName)
+{
+    CDBOptions dbopts;
+    dbopts.strName = strName;
+
+    int64_t nCacheMB = max(int64_t(1), GetArg("-dbcache", DEFAULT_DB_CACHE));
+    int64_t nPegPercent = max(int64_t(0), min(int64_t(100), GetArg("-dbcachepeg", DEFAULT_DB_CACHE_PEG)));
+    int64_t nPercent = strName == "pegdb" ? nPegPercent : 100 - nPegPercent;
+    dbopts.nCacheBytes = max(int64_t(1048576), nCacheMB * 1048576 * nPercent / 100);
+
+    string strArg = "-" + strName;
+    dbopts.nWriteBufferBytes = GetSizeArg(strArg + "writebuffer", dbopts.nWriteBufferBytes >> 20, 1, 1024, 1048576);
+    dbopts.nMaxFileBytes = GetSizeArg(strArg + "filesize", dbopts.nMaxFileBytes >> 20, 1, 1024, 1048576);
+    dbopts.nBlockBytes = GetSizeArg(strArg + "blocksize", dbopts.nBlockBytes >> 10, 1, 1024, 1024);
+    dbopts.fCompression = GetBoolArg(strArg + "compression", dbopts.fCompression);
+    dbopts.nBloomBits = GetSizeArg(strArg + "bloombits", dbopts.nBloomBits, 0, 32, 1);
+    return dbopts;
+}
+
+leveldb::Options MakeLevelDBOptions(const CDBOptions& dbopts)
+{
+    leveldb::Options options;
+    options.block_cache = leveldb::NewLRUCache(dbopts.nCacheBytes);
+    if (dbopts.nBloomBits > 0)
+        options.filter_policy = leveldb::NewBloomFilterPolicy(dbopts.nBloomBits);
+    options.write_buffer_size = dbopts.nWriteBufferBytes;
+    options.max_file_size = dbopts.nMaxFileBytes;
+    options.block_size = dbopts.nBlockBytes;
+    options.compression = dbopts.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    LogPrintf("LevelDB %s: cache %u MB, write buffer %u MB, file size %u MB, block size %u KB, compression %d, bloom filter %d bits\n",
+              dbopts.strName, dbopts.nCacheBytes >> 20, dbopts.nWriteBufferBytes >> 20,
+              dbopts.nMaxFileBytes >> 20, dbopts.nBlockBytes >> 10, dbopts.fCompression, dbopts.nBloomBits);
+    return options;
+}
+
+void GetLevelDBStats(leveldb::DB* pdb, const vector<string>& vPrefixes, CDBStats& stats)
+{
+    pdb->GetProperty("leveldb.stats", &stats.strStats);
+    stats.vFilesAtLevel.clear();
+    for (int nLevel = 0; ; nLevel++) {
+        string strFiles;
+        if (!pdb->GetProperty("leveldb.num-files-at-level" + std::to_string(nLevel), &strFiles))
+            break;
+        stats.vFilesAtLevel.push_back(atoi(strFiles));
+    }
+
+    // the whole key space, then the keys of each prefix: a serialized
+    // string is its length (one byte below 253) followed by the chars,
+    // so the prefix has a range for each length
+    vector<string> vStart, vLimit;
+    vStart.push_back(string());
+    vLimit.push_back(string(64, '\xff'));
+    for (const string& strPrefix : vPrefixes) {
+        string strSuccessor = strPrefix;
+        strSuccessor[strSuccessor.size()-1]++;
+        for (size_t nLen = strPrefix.size(); nLen < 253; nLen++) {
+            vStart.push_back(string(1, char(nLen)) + strPrefix);
+            vLimit.push_back(string(1, char(nLen)) + strSuccessor);
+        }
+    }
+    vector<leveldb::Range> vRanges;
+    for (size_t i = 0; i < vStart.size(); i++)
+        vRanges.push_back(leveldb::Range(vStart[i], vLimit[i]));
+    vector<uint64_t> vSizes(vRanges.size());
+    pdb->GetApproximateSizes(vRanges.data(), vRanges.size(), vSizes.data());
+
+    stats.nApproxBytes = vSizes[0];
+    stats.vPrefixBytes.clear();
+    size_t nRange = 1;
+    for (const string& strPrefix : vPrefixes) {
+        uint64_t nBytes = 0;
+        for (size_t nLen = strPrefix.size(); nLen < 253; nLen++)
+            nBytes += vSizes[nRange++];
+        stats.vPrefixBytes.push_back(make_pair(strPrefix, nBytes));
+    }
+}
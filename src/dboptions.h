@@ -0,0 +1,59 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITBAY_DBOPTIONS_H
+#define BITBAY_DBOPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <leveldb/options.h>
+
+namespace leveldb {
+class DB;
+}
+
+/** Default for -dbcache, megabytes of block cache of txleveldb and pegleveldb together */
+static const int DEFAULT_DB_CACHE = 100;
+/** Default for -dbcachepeg, percent of -dbcache given to pegleveldb */
+static const int DEFAULT_DB_CACHE_PEG = 50;
+
+// LevelDB tuning of one database. The -dbcache megabytes of block cache
+// are split between txleveldb and pegleveldb by -dbcachepeg percent, the
+// other options are per database: -<name>writebuffer, -<name>filesize
+// (megabytes), -<name>blocksize (kilobytes), -<name>compression and
+// -<name>bloombits, where <name> is txdb or pegdb. The defaults are the
+// ones of leveldb with a 10 bits bloom filter.
+struct CDBOptions {
+    std::string strName;
+    size_t  nCacheBytes         = 0;
+    size_t  nWriteBufferBytes   = 4 << 20;
+    size_t  nMaxFileBytes       = 2 << 20;
+    size_t  nBlockBytes         = 4 << 10;
+    bool    fCompression        = true;
+    int     nBloomBits          = 10;
+};
+
+CDBOptions GetDBOptions(const std::string& strName);
+
+// The block cache and filter policy are allocated for the database and
+// are to be deleted after it is closed.
+leveldb::Options MakeLevelDBOptions(const CDBOptions& dbopts);
+
+/** LevelDB statistics of a database, see getdbstats */
+struct CDBStats {
+    CDBOptions options;
+    std::string strStats;               // leveldb.stats property
+    std::vector<int> vFilesAtLevel;
+    uint64_t nApproxBytes = 0;          // of the whole key space
+    std::vector<std::pair<std::string, uint64_t> > vPrefixBytes;
+};
+
+// Approximate sizes are given for the keys that are serialized strings
+// starting with one of vPrefixes, as ("tx", hash) or "utxo"+address.
+void GetLevelDBStats(leveldb::DB* pdb, const std::vector<std::string>& vPrefixes, CDBStats& stats);
+
+#endif
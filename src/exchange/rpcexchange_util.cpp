@@ -28,19 +28,16 @@ void printpegshift(const CFractions & frPegShift,
                    const CPegLevel & peglevel,
                    Object & result)
 {
-    int64_t nValue = frPegShift.Positive(nullptr).Total();
-    CFractions frLiquid = frPegShift.HighPart(peglevel, nullptr);
-    CFractions frReserve = frPegShift.LowPart(peglevel, nullptr);
+    int64_t nValue = 0;
+    frPegShift.Range(0, PEG_SIZE).Signed(&nValue, nullptr);
     
     int64_t nLiquidNegative = 0;
     int64_t nLiquidPositive = 0;
-    frLiquid.Negative(&nLiquidNegative);
-    frLiquid.Positive(&nLiquidPositive);
+    frPegShift.HighRange(peglevel).Signed(&nLiquidPositive, &nLiquidNegative);
     
     int64_t nReserveNegative = 0;
     int64_t nReservePositive = 0;
-    frReserve.Negative(&nReserveNegative);
-    frReserve.Positive(&nReservePositive);
+    frPegShift.LowRange(peglevel).Signed(&nReservePositive, &nReserveNegative);
     
     int64_t nLiquidPart = std::min(nLiquidPositive, -nLiquidNegative);
     int64_t nReservePart = std::min(nReservePositive, -nReserveNegative);
@@ -52,8 +49,7 @@ void printpegshift(const CFractions & frPegShift,
     CPegData pegdata;
     pegdata.fractions = frPegShift;
     pegdata.peglevel = peglevel;
-    pegdata.nLiquid = frPegShift.High(peglevel);
-    pegdata.nReserve = frPegShift.Low(peglevel);
+    frPegShift.LowHigh(peglevel, &pegdata.nReserve, &pegdata.nLiquid);
     
     result.push_back(Pair("pegshift_pegdata", pegdata.ToString()));
 }
@@ -82,8 +78,8 @@ void printpegbalance(const CPegData & pegdata,
     int64_t nNChange    = pegdata.fractions.NChange(pegdata.peglevel);
 
     int16_t nValueHli   = pegdata.fractions.HLI();
-    int16_t nLiquidHli  = pegdata.fractions.HighPart(pegdata.peglevel, nullptr).HLI();
-    int16_t nReserveHli = pegdata.fractions.LowPart(pegdata.peglevel, nullptr).HLI();
+    int16_t nLiquidHli  = pegdata.fractions.HighRange(pegdata.peglevel).HLI();
+    int16_t nReserveHli = pegdata.fractions.LowRange(pegdata.peglevel).HLI();
 
     result.push_back(Pair(prefix+"value", nValue));
     result.push_back(Pair(prefix+"value_hli", nValueHli));
@@ -109,8 +105,8 @@ void printpegtxout(const CPegData & pegdata,
     int64_t nReserve = pegdata.fractions.Low(pegn_reserve);
     
     int16_t nValueHli   = pegdata.fractions.HLI();
-    int16_t nLiquidHli  = pegdata.fractions.HighPart(pegn_liquid, nullptr).HLI();
-    int16_t nReserveHli = pegdata.fractions.LowPart(pegn_reserve, nullptr).HLI();
+    int16_t nLiquidHli  = pegdata.fractions.HighRange(pegn_liquid).HLI();
+    int16_t nReserveHli = pegdata.fractions.LowRange(pegn_reserve).HLI();
 
     result.push_back(Pair(prefix+"value", nValue));
     result.push_back(Pair(prefix+"value_hli", nValueHli));
@@ -69,11 +69,14 @@ static void consumereservepegshift(CFractions & frBalance,
     CFractions frPegShiftReserve = frPegShift.LowPart(nSupplyEffective, nullptr);
     consumepegshift(frBalance, frExchange, frPegShift, frPegShiftReserve);
 
-    if (frPegShift.Positive(nullptr).Total() != -frPegShift.Negative(nullptr).Total()) {
+    int64_t nPegShiftPositive = 0;
+    int64_t nPegShiftNegative = 0;
+    frPegShift.Range(0, PEG_SIZE).Signed(&nPegShiftPositive, &nPegShiftNegative);
+    if (nPegShiftPositive != -nPegShiftNegative) {
         throw JSONRPCError(RPC_MISC_ERROR,
                            strprintf("Mismatch pegshift parts (%d - %d)",
-                                     frPegShift.Positive(nullptr).Total(),
-                                     frPegShift.Negative(nullptr).Total()));
+                                     nPegShiftPositive,
+                                     nPegShiftNegative));
     }
 }
 
@@ -91,11 +94,14 @@ static void consumeliquidpegshift(CFractions & frBalance,
     CFractions frPegShiftLiquid = frPegShift.HighPart(nSupplyEffective, nullptr);
     consumepegshift(frBalance, frExchange, frPegShift, frPegShiftLiquid);
 
-    if (frPegShift.Positive(nullptr).Total() != -frPegShift.Negative(nullptr).Total()) {
+    int64_t nPegShiftPositive = 0;
+    int64_t nPegShiftNegative = 0;
+    frPegShift.Range(0, PEG_SIZE).Signed(&nPegShiftPositive, &nPegShiftNegative);
+    if (nPegShiftPositive != -nPegShiftNegative) {
         throw JSONRPCError(RPC_MISC_ERROR,
                            strprintf("Mismatch pegshift parts (%d - %d)",
-                                     frPegShift.Positive(nullptr).Total(),
-                                     frPegShift.Negative(nullptr).Total()));
+                                     nPegShiftPositive,
+                                     nPegShiftNegative));
     }
 }
 
@@ -482,10 +488,11 @@ Value prepareliquidwithdraw(const Array& params, bool fHelp)
         nSupplyEffective++;
     }
     
-    CFractions frBalanceLiquid = pdBalance.fractions.HighPart(nSupplyEffective, nullptr);
+    int64_t nBalanceLiquid = 0;
+    CFractions frBalanceLiquid = pdBalance.fractions.HighPart(nSupplyEffective, &nBalanceLiquid);
     
     if (fPartial) {
-        int64_t nPartialLiquid = pdBalance.nLiquid - frBalanceLiquid.Total();
+        int64_t nPartialLiquid = pdBalance.nLiquid - nBalanceLiquid;
         if (nPartialLiquid < 0) {
             throw JSONRPCError(RPC_MISC_ERROR, 
                                strprintf("Mismatch on nPartialLiquid %d",
@@ -493,12 +500,13 @@ Value prepareliquidwithdraw(const Array& params, bool fHelp)
         }
         
         frBalanceLiquid.f[nSupplyEffective-1] = nPartialLiquid;
+        nBalanceLiquid += nPartialLiquid;
     }
     
-    if (frBalanceLiquid.Total() < nAmountWithFee) {
+    if (nBalanceLiquid < nAmountWithFee) {
         throw JSONRPCError(RPC_MISC_ERROR, 
                            strprintf("Not enough liquid(1) %d  on 'src' to move %d",
-                                     frBalanceLiquid.Total(),
+                                     nBalanceLiquid,
                                      nAmountWithFee));
     }
     
@@ -797,9 +805,10 @@ Value prepareliquidwithdraw(const Array& params, bool fHelp)
     }
     
     // signing the transaction to get it ready for broadcast
+    CSignatureHashContext sighash(rawTx);
     int nIn = 0;
     for(const CCoinToUse& coin : vCoins) {
-        if (!SignSignature(*pwalletMain, coin.scriptPubKey, rawTx, nIn++)) {
+        if (!SignSignature(*pwalletMain, coin.scriptPubKey, rawTx, nIn++, SIGHASH_ALL, &sighash)) {
             throw JSONRPCError(RPC_MISC_ERROR, 
                                strprintf("Fail on signing input (%d)", nIn-1));
         }
@@ -986,9 +995,10 @@ Value preparereservewithdraw(const Array& params, bool fHelp)
     int nSupplyEffective = peglevel_exchange.nSupply + peglevel_exchange.nShift;
     bool fPartial = peglevel_exchange.nShiftLastPart >0 && peglevel_exchange.nShiftLastTotal >0;
     
-    CFractions frBalanceReserve = pdBalance.fractions.LowPart(nSupplyEffective, nullptr);
+    int64_t nBalanceReserve = 0;
+    CFractions frBalanceReserve = pdBalance.fractions.LowPart(nSupplyEffective, &nBalanceReserve);
     if (fPartial) {
-        int64_t nPartialReserve = pdBalance.nReserve - frBalanceReserve.Total();
+        int64_t nPartialReserve = pdBalance.nReserve - nBalanceReserve;
         if (nPartialReserve < 0) {
             throw JSONRPCError(RPC_MISC_ERROR, 
                                strprintf("Mismatch on nPartialReserve %d",
@@ -1371,9 +1381,10 @@ Value preparereservewithdraw(const Array& params, bool fHelp)
     }
     
     // signing the transaction to get it ready for broadcast
+    CSignatureHashContext sighash(rawTx);
     int nIn = 0;
     for(const CCoinToUse& coin : vCoins) {
-        if (!SignSignature(*pwalletMain, coin.scriptPubKey, rawTx, nIn++)) {
+        if (!SignSignature(*pwalletMain, coin.scriptPubKey, rawTx, nIn++, SIGHASH_ALL, &sighash)) {
             throw JSONRPCError(RPC_MISC_ERROR, 
                                strprintf("Fail on signing input (%d)", nIn-1));
         }
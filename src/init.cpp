@@ -5,9 +5,12 @@
 
 #include "init.h"
 #include "main.h"
+#include "blockindexsnapshot.h"
 #include "chainparams.h"
 #include "txdb.h"
 #include "rpcserver.h"
+#include "dboptions.h"
+#include "sigcache.h"
 #include "net.h"
 #include "util.h"
 #include "ui_interface.h"
@@ -100,15 +103,19 @@ void Shutdown()
     StopNode();
     {
         LOCK(cs_main);
+        bool fFlushed = FlushBlockWrites(true);
 #ifdef ENABLE_WALLET
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
 #endif
+        if (fFlushed && pindexBest && GetBoolArg("-blockindexsnapshot", true))
+            WriteBlockIndexSnapshot(BlockIndexSnapshotPath(), mapBlockIndex, hashBestChain);
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         bitdb.Flush(true);
 #endif
+    CloseBlockFiles();
     boost::filesystem::remove(GetPidFile());
     UnregisterAllWallets();
 #ifdef ENABLE_WALLET
@@ -164,7 +171,20 @@ std::string HelpMessage()
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: bitbayd.pid)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
-    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 50)") + "\n";
+    strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes, split between txleveldb and pegleveldb (default: %d)"), DEFAULT_DB_CACHE) + "\n";
+    strUsage += "  -dbcachepeg=<n>        " + strprintf(_("Percent of the database cache given to pegleveldb (default: %d)"), DEFAULT_DB_CACHE_PEG) + "\n";
+    strUsage += "  -txdbwritebuffer=<n>   " + _("Size of the txleveldb write buffer in megabytes (default: 4, -pegdbwritebuffer for pegleveldb)") + "\n";
+    strUsage += "  -txdbfilesize=<n>      " + _("Size of the txleveldb table files in megabytes (default: 2, -pegdbfilesize for pegleveldb)") + "\n";
+    strUsage += "  -txdbblocksize=<n>     " + _("Size of the txleveldb table blocks in kilobytes (default: 4, -pegdbblocksize for pegleveldb)") + "\n";
+    strUsage += "  -txdbcompression       " + _("Compress the txleveldb table blocks (default: 1, -pegdbcompression for pegleveldb)") + "\n";
+    strUsage += "  -txdbbloombits=<n>     " + _("Bits per key of the txleveldb bloom filter, 0 for none (default: 10, -pegdbbloombits for pegleveldb)") + "\n";
+    strUsage += "  -dbbatchsize=<n>       " + strprintf(_("Keep up to <n> megabytes of block writes in memory during the initial sync, 0 to write each block (default: %d)"), DEFAULT_DB_BATCH_SIZE) + "\n";
+    strUsage += "  -dbbatchtime=<n>       " + strprintf(_("Write the kept block changes at least every <n> seconds (default: %d)"), DEFAULT_DB_BATCH_TIME) + "\n";
+    strUsage += "  -blockfilehandles=<n>  " + _("Keep at most <n> block files open for reading (default: 8)") + "\n";
+    strUsage += "  -pegcache=<n>          " + _("Set cache size of decoded peg fractions in megabytes (default: 64)") + "\n";
+    strUsage += "  -mempoolfractions=<n>  " + strprintf(_("Keep up to <n> megabytes of fractions of the memory pool decoded (default: %d)"), DEFAULT_MEMPOOL_FRACTIONS) + "\n";
+    strUsage += "  -limitancestorcount=<n>  " + strprintf(_("Do not accept transactions with more than <n> unconfirmed ancestors in the memory pool, with itself (default: %u)"), DEFAULT_ANCESTOR_LIMIT) + "\n";
+    strUsage += "  -limitdescendantcount=<n>  " + strprintf(_("Do not accept transactions if an ancestor in the memory pool would have more than <n> descendants, with itself (default: %u)"), DEFAULT_DESCENDANT_LIMIT) + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
@@ -242,6 +262,12 @@ std::string HelpMessage()
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
+    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (up to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_SCRIPTCHECK_THREADS, 0) + "\n";
+    strUsage += "  -sigcachemb=<n>        " + strprintf(_("Limit the signature cache to <n> megabytes (up to %d, default: %d)"), MAX_SIG_CACHE_MB, DEFAULT_SIG_CACHE_MB) + "\n";
+    strUsage += "  -loadthreads=<n>       " + _("Number of threads to decode the block index at startup (default: cores, up to 8)") + "\n";
+    strUsage += "  -blockindexsnapshot    " + _("Write the block index snapshot on shutdown and load it at start (default: 1)") + "\n";
+    strUsage += "  -benchstartup          " + _("Log the time taken by each phase of the node startup") + "\n";
+    strUsage += "  -headersfirst          " + _("Download the blocks of the initial sync from several peers after their headers (default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
     strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
@@ -396,6 +422,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     // Check for -debugnet (deprecated)
     if (GetBoolArg("-debugnet", false))
         InitWarning(_("Warning: Deprecated argument -debugnet ignored, use -debug=net"));
+    // Check for -maxsigcachesize (deprecated)
+    if (mapArgs.count("-maxsigcachesize") && !mapArgs.count("-sigcachemb"))
+        InitWarning(_("Warning: Deprecated argument -maxsigcachesize is taken as a number of entries, use -sigcachemb"));
     // Check for -socks - as this is a privacy risk to continue, exit here
     if (mapArgs.count("-socks"))
         return InitError(_("Error: Unsupported argument -socks found. Setting SOCKS version isn't possible anymore, only SOCKS5 proxies are supported."));
@@ -409,6 +438,16 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (!fHaveGUI)
         fServer = true;
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
+
+    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
+    nScriptCheckThreads = GetArg("-par", 0);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    mempool.SetFractionsMaxBytes(size_t(std::max(int64_t(0), GetArg("-mempoolfractions", DEFAULT_MEMPOOL_FRACTIONS))) << 20);
     fLogTimestamps = GetBoolArg("-logtimestamps", false);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
@@ -477,7 +516,15 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fDaemon)
         fprintf(stdout, "BitBay server starting\n");
 
+    if (nScriptCheckThreads) {
+        LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadScriptCheck);
+    }
+    LogPrintf("Using up to %u KB signature cache\n", GetSignatureCache().GetStats().nMaxBytes >> 10);
+
     int64_t nStart;
+    int64_t nStartupStart = GetTimeMicros();
 
     // ********************************************************* Step 5: verify database integrity
 #ifdef ENABLE_WALLET
@@ -669,7 +716,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -754,6 +801,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 
         LogPrintf("%s", strErrors.str());
         LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
+        AddStartupTime("wallet", (GetTimeMillis() - nStart) * 1000);
 
         RegisterWallet(pwalletMain);
 
@@ -776,6 +824,7 @@ bool AppInit2(boost::thread_group& threadGroup)
             nStart = GetTimeMillis();
             pwalletMain->ScanForWalletTransactions(pindexRescan, true);
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
+            AddStartupTime("wallet: rescan", (GetTimeMillis() - nStart) * 1000);
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
             nWalletDBUpdated++;
         }
@@ -861,6 +910,11 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     uiInterface.InitMessage(_("Done loading"));
 
+    if (GetBoolArg("-benchstartup", false)) {
+        AddStartupTime("total", GetTimeMicros() - nStartupStart);
+        LogStartupTimes();
+    }
+
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         // Add wallet transactions that aren't already in a block to mapTransactions
@@ -493,3 +493,101 @@ bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, con
 
     return CheckStakeKernelHash(pindexPrev, nBits, block, txindex.pos.nTxPos - txindex.pos.nBlockPos, txPrev, prevout, nTime, hashProofOfStake, targetProofOfStake);
 }
+
+void CStakeCandidate::Prepare(const uint256& bnStakeModifierV2, unsigned int nBits)
+{
+    // Weighted target
+    CBigNum bnTarget;
+    bnTarget.SetCompact(nBits);
+    bnTarget *= CBigNum(nValue);
+    fTargetOverflow = bnTarget.bitSize() > 256;
+    targetProofOfStake = bnTarget.getuint256();
+
+    // modifier, txPrev.nTime, prevout.hash, prevout.n, nTimeTx as in
+    // CheckStakeKernelHashV2(), the first 64 bytes go into the midstate
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnStakeModifierV2 << nTimeTxPrev << prevout.hash << prevout.n;
+    assert(ss.size() == 72);
+    SHA256_Init(&midstate);
+    SHA256_Update(&midstate, &ss[0], 64);
+    memcpy(vchTail, &ss[64], 8);
+}
+
+uint256 CStakeCandidate::KernelHash(unsigned int nTimeTx) const
+{
+    unsigned char tail[12];
+    memcpy(tail, vchTail, 8);
+    memcpy(tail + 8, &nTimeTx, 4);     // as serialized
+    SHA256_CTX ctx = midstate;
+    SHA256_Update(&ctx, tail, sizeof(tail));
+    uint256 hash1;
+    SHA256_Final((unsigned char*)&hash1, &ctx);
+    uint256 hash2;
+    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    return hash2;
+}
+
+bool CStakeCandidate::CheckKernelHash(unsigned int nTimeTx) const
+{
+    return fTargetOverflow || !(KernelHash(nTimeTx) > targetProofOfStake);
+}
+
+void CStakeCandidateTable::Clear()
+{
+    hashTip = 0;
+    nBits = 0;
+    vCandidates.clear();
+    mapCandidates.clear();
+}
+
+const CStakeCandidate* CStakeCandidateTable::Get(CBlockIndex* pindexPrev, unsigned int nBitsIn, const COutPoint& prevout)
+{
+    if (hashTip != pindexPrev->GetBlockHash() || nBits != nBitsIn)
+    {
+        Clear();
+        hashTip = pindexPrev->GetBlockHash();
+        nBits = nBitsIn;
+    }
+    map<COutPoint, size_t>::const_iterator it = mapCandidates.find(prevout);
+    if (it != mapCandidates.end())
+        return &vCandidates[it->second];
+
+    CStakeCandidate candidate;
+    candidate.prevout = prevout;
+    CTxDB txdb("r");
+    CTransaction txPrev;
+    CTxIndex txindex;
+    CBlock block;
+    if (txPrev.ReadFromDisk(txdb, prevout, txindex) &&
+        block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+    {
+        int nDepth;
+        candidate.fFound = true;
+        candidate.fRecent = IsConfirmedInNPrevBlocks(txindex, pindexPrev, nStakeMinConfirmations - 1, nDepth);
+        candidate.nValue = txPrev.vout[prevout.n].nValue;
+        candidate.nTimeBlockFrom = block.GetBlockTime();
+        candidate.nTxPrevOffset = txindex.pos.nTxPos - txindex.pos.nBlockPos;
+        candidate.nTimeTxPrev = txPrev.nTime;
+        candidate.Prepare(pindexPrev->bnStakeModifierV2, nBits);
+    }
+    mapCandidates[prevout] = vCandidates.size();
+    vCandidates.push_back(candidate);
+    return &vCandidates.back();
+}
+
+bool CStakeCandidateTable::CheckKernel(const CStakeCandidate& candidate, CBlockIndex* pindexPrev, unsigned int nBitsIn, int64_t nTime) const
+{
+    if (!candidate.fFound)
+        return false;
+
+    // the earlier protocols take the generic path
+    if (!IsProtocolV2(pindexPrev->nHeight+1) || !IsProtocolV3(nTime) ||
+        hashTip != pindexPrev->GetBlockHash() || nBits != nBitsIn)
+        return ::CheckKernel(pindexPrev, nBitsIn, nTime, candidate.prevout);
+
+    if (candidate.fRecent)
+        return false;
+    if (nTime < candidate.nTimeTxPrev)  // Transaction timestamp violation
+        return error("CheckStakeKernelHash() : nTime violation");
+    return candidate.CheckKernelHash(nTime);
+}
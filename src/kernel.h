@@ -6,6 +6,8 @@
 
 #include "main.h"
 
+#include <openssl/sha.h>
+
 // To decrease granularity of timestamp
 // Supposed to be 2^n-1
 static const int STAKE_TIMESTAMP_MASK = 15;
@@ -40,4 +42,45 @@ int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd);
 // Convenient for searching a kernel
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime = NULL);
 
+// What the kernel hash needs of a staking candidate, read from the disk
+// once for the tip. The protocol v3 kernel up to its last 12 bytes is
+// hashed ahead, a time slot only adds its timestamp.
+struct CStakeCandidate
+{
+    COutPoint prevout;
+    int64_t nValue = 0;
+    unsigned int nTimeBlockFrom = 0;
+    unsigned int nTxPrevOffset = 0;
+    unsigned int nTimeTxPrev = 0;
+    bool fFound = false;                // in the main chain
+    bool fRecent = false;               // within nStakeMinConfirmations of the tip
+    bool fTargetOverflow = false;       // any hash meets the target
+    uint256 targetProofOfStake;
+    SHA256_CTX midstate;
+    unsigned char vchTail[12];
+
+    void Prepare(const uint256& bnStakeModifierV2, unsigned int nBits);
+    uint256 KernelHash(unsigned int nTimeTx) const;
+    bool CheckKernelHash(unsigned int nTimeTx) const;
+};
+
+// Staking candidates of the wallet for the current tip and target,
+// cleared when either changes
+class CStakeCandidateTable
+{
+public:
+    // Candidate of the prevout, read on first use; valid until the next Get
+    const CStakeCandidate* Get(CBlockIndex* pindexPrev, unsigned int nBits, const COutPoint& prevout);
+    // Same result as CheckKernel() for the prevout of the candidate
+    bool CheckKernel(const CStakeCandidate& candidate, CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime) const;
+    void Clear();
+    size_t size() const { return vCandidates.size(); }
+
+private:
+    uint256 hashTip;
+    unsigned int nBits = 0;
+    std::vector<CStakeCandidate> vCandidates;
+    std::map<COutPoint, size_t> mapCandidates;
+};
+
 #endif // PPCOIN_KERNEL_H
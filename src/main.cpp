@@ -11,6 +11,7 @@
 #include "alert.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "db.h"
 #include "init.h"
 #include "kernel.h"
@@ -20,6 +21,7 @@
 #include "ui_interface.h"
 #include "peg.h"
 #include "base58.h"
+#include "blockdownload.h"
 #include "blockindexmap.h"
 
 #include <zconf.h>
@@ -63,6 +65,7 @@ unsigned int nStakeMinAge = 2 * 60 * 60; // 2 hours
 unsigned int nModifierInterval = 10 * 60; // time to elapse before new modifier is computed
 
 int nCoinbaseMaturity = 50;
+int nScriptCheckThreads = 0;
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
 
@@ -90,6 +93,9 @@ set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 map<uint256, CTransaction> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
 
+// Headers-first download of the initial sync, guarded by cs_main
+static CBlockDownload blockdownload;
+
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
 
@@ -163,16 +169,24 @@ void ResendWalletTransactions(bool fForce) {
 // Registration of network node signals.
 //
 
+void static FinalizeNode(NodeId nodeid)
+{
+    LOCK(cs_main);
+    blockdownload.NodeFinalized(nodeid);
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
     nodeSignals.SendMessages.connect(&SendMessages);
+    nodeSignals.FinalizeNode.connect(&FinalizeNode);
 }
 
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
     nodeSignals.SendMessages.disconnect(&SendMessages);
+    nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
 }
 
 
@@ -530,7 +544,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     vMerkleBranch = pblock->GetMerkleBranch(nIndex);
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -671,12 +685,24 @@ bool AcceptToMemoryPool(CTxMemPool& pool,
         }
     }
 
+    // Long chains of unconfirmed txs are costly to rank and to mine
+    {
+        string reasonLimit;
+        if (!pool.CheckChainLimits(tx,
+                                   GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT),
+                                   GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT),
+                                   reasonLimit))
+            return error("AcceptToMemoryPool : too long mempool chain %s, %s",
+                         hash.ToString(), reasonLimit);
+    }
+
     MapPrevTx mapInputs;
     MapFractions mapInputsFractions;
     map<uint256, CTxIndex> mapUnused;
     MapPrevOut mapPrevOuts;
     MapFractions mapOutputsFractions;
     CFractions feesFractions;
+    double dPriority = 0;
     
     {
         CTxDB txdb("r");
@@ -732,6 +758,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool,
                          hash.ToString(),
                          nFees, txMinFee);
 
+        // Priority is sum(valuein * age) / txsize, inputs from the
+        // mempool have no age yet
+        for (const CTxIn& txin : tx.vin)
+        {
+            if (pool.exists(txin.prevout.hash))
+                continue;
+            const CTxIndex& txindex = mapInputs[txin.prevout.hash].first;
+            int64_t nValueIn = mapInputs[txin.prevout.hash].second.vout[txin.prevout.n].nValue;
+            dPriority += (double)nValueIn * std::max(0, 1 + nHeight - int(txindex.nHeight));
+        }
+        dPriority /= nSize;
+
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
@@ -787,7 +825,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool,
     }
 
     // Store transaction in memory
-    pool.addUnchecked(hash, tx, mapPrevOuts, mapOutputsFractions);
+    pool.addUnchecked(hash, tx, mapPrevOuts, mapOutputsFractions, dPriority);
 
     SyncWithWallets(tx, NULL, true, mapOutputsFractions);
 
@@ -813,7 +851,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
     AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -889,7 +927,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -913,7 +951,7 @@ int CTxIndex::GetHeightInMainChain(unsigned int* vtxidx, uint256 txhash, uint256
     // Find the block in the index
     uint256 bhash = block.GetHash();
     if (blockhash) *blockhash = bhash;
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(bhash);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(bhash);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1544,7 +1582,8 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
                                  const CBlockIndex* pindexBlock,
                                  bool fBlock, 
                                  bool fMiner, 
-                                 unsigned int flags)
+                                 unsigned int flags,
+                                 std::vector<CScriptCheck>* pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1614,6 +1653,10 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
     // The first loop above does all the inexpensive checks.
     // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
     // Helps prevent CPU exhaustion attacks.
+    // Signature hashes of the inputs share one prepared serialization.
+    std::shared_ptr<const CSignatureHashContext> psighash;
+    if (vin.size() > 1 && !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
+        psighash = std::make_shared<CSignatureHashContext>(*this);
     for (unsigned int i = 0; i < vin.size(); i++)
     {
         COutPoint prevout = vin[i].prevout;
@@ -1633,27 +1676,13 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
         if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
         {
             // Verify signature
-            if (!VerifySignature(txPrev, *this, i, flags, 0))
-            {
-                if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                    // Check whether the failure was caused by a
-                    // non-mandatory script verification check, such as
-                    // non-null dummy arguments;
-                    // if so, don't trigger DoS protection to
-                    // avoid splitting the network between upgraded and
-                    // non-upgraded nodes.
-                    if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
-                        return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
-                }
-                // Failures of other flags indicate a transaction that is
-                // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                // such nodes as they are not following the protocol. That
-                // said during an upgrade careful thought should be taken
-                // as to the correct behavior - we may want to continue
-                // peering with non-upgraded nodes even after a soft-fork
-                // super-majority vote has passed.
-                return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString()));
+            CScriptCheck check(txPrev, *this, i, flags, psighash);
+            if (pvChecks) {
+                pvChecks->push_back(CScriptCheck());
+                check.swap(pvChecks->back());
             }
+            else if (!check())
+                return check.ReportFailure();
         }
 
         // Mark outpoints as spent
@@ -1685,6 +1714,59 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
     return true;
 }
 
+CScriptCheck::CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn,
+                           std::shared_ptr<const CSignatureHashContext> psighashIn)
+    :ptxTo(&txToIn)
+    ,psighash(psighashIn)
+    ,nIn(nInIn)
+    ,nFlags(nFlagsIn)
+    ,fPrevoutOk(false)
+    ,fNonMandatory(false)
+{
+    const COutPoint& prevout = txToIn.vin[nInIn].prevout;
+    if (prevout.n < txFromIn.vout.size() && prevout.hash == txFromIn.GetHash()) {
+        txoutFrom = txFromIn.vout[prevout.n];
+        fPrevoutOk = true;
+    }
+}
+
+bool CScriptCheck::operator()()
+{
+    if (fPrevoutOk && VerifySignature(txoutFrom, *ptxTo, nIn, nFlags, 0, psighash.get()))
+        return true;
+    // Check whether the failure was caused by a
+    // non-mandatory script verification check, such as
+    // non-null dummy arguments;
+    // if so, don't trigger DoS protection to
+    // avoid splitting the network between upgraded and
+    // non-upgraded nodes.
+    if (fPrevoutOk && (nFlags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS))
+        fNonMandatory = VerifySignature(txoutFrom, *ptxTo, nIn, nFlags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0, psighash.get());
+    return false;
+}
+
+bool CScriptCheck::ReportFailure() const
+{
+    if (fNonMandatory)
+        return error("ConnectInputs() : %s non-mandatory VerifySignature failed", ptxTo->GetHash().ToString());
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after a soft-fork
+    // super-majority vote has passed.
+    return ptxTo->DoS(100,error("ConnectInputs() : %s VerifySignature failed", ptxTo->GetHash().ToString()));
+}
+
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck()
+{
+    RenameThread("bitbay-scriptch");
+    scriptcheckqueue.Thread();
+}
+
 static void CreateUtxoHistoryRecord(CTxDB& txdb, 
                                     string sAddress,
                                     uint64_t nTime,
@@ -2103,12 +2185,9 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex)
         if (!vtx[i].DisconnectInputs(txdb, pegdb)) {
             return false;
         }
-        uint256 txhash = vtx[i].GetHash();
-        for (unsigned int j = vtx[i].vout.size(); j-- > 0;) {
-            auto fkey = uint320(txhash, j);
-            pegdb.Erase(fkey);
-        }
     }
+    // the fractions of the outputs are erased by WriteReorganize(), after
+    // the best chain moves off this block
 
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
@@ -2174,6 +2253,21 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
     // bitbay: prepare peg supply index information
     CalculateBlockPegIndex(pindex);
 
+    // bitbay: fractions of the block are allocated in one arena
+    CFractionsArena fractionsArena;
+
+    // Script checks of the block are run by the queue workers while the
+    // transactions are connected. The block level failures found before
+    // the checks are done report the failed script first, as the serial
+    // verification would.
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    auto scriptChecksOk = [&control]() -> bool {
+        CScriptCheck failed;
+        if (control.Wait(&failed))
+            return true;
+        return failed.ReportFailure();
+    };
+
     map<size_t,MapPrevTx> mapInputs;
     map<size_t,MapFractions> mapInputsFractions;
     map<uint256, CTxIndex> mapQueuedChanges;
@@ -2204,14 +2298,20 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
         CTxIndex txindexOld;
         if (txdb.ReadTxIndex(hashTx, txindexOld)) {
             for(CDiskTxPos &pos : txindexOld.vSpent) {
-                if (pos.IsNull())
+                if (pos.IsNull()) {
+                    if (!scriptChecksOk())
+                        return false;
                     return DoS(100, error("ConnectBlock() : tried to overwrite transaction"));
+                }
             }
         }
 
         nSigOps += GetLegacySigOpCount(tx);
-        if (nSigOps > MAX_BLOCK_SIGOPS)
+        if (nSigOps > MAX_BLOCK_SIGOPS) {
+            if (!scriptChecksOk())
+                return false;
             return DoS(100, error("ConnectBlock() : too many sigops"));
+        }
 
         CDiskTxPos posThisTx(pindex->nFile, pindex->nBlockPos, nTxPos);
         if (!fJustCheck)
@@ -2226,15 +2326,20 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
                                 mapQueuedChanges, mapQueuedFractionsChanges,
                                 true, false,
                                 mapInputs[i], mapInputsFractions[i],
-                                fInvalid))
+                                fInvalid)) {
+                scriptChecksOk();
                 return false;
+            }
 
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
             // an incredibly-expensive-to-validate block.
             nSigOps += GetP2SHSigOpCount(tx, mapInputs[i]);
-            if (nSigOps > MAX_BLOCK_SIGOPS)
+            if (nSigOps > MAX_BLOCK_SIGOPS) {
+                if (!scriptChecksOk())
+                    return false;
                 return DoS(100, error("ConnectBlock() : too many sigops"));
+            }
 
             int64_t nTxValueIn = tx.GetValueIn(mapInputs[i]);
             int64_t nTxValueOut = tx.GetValueOut();
@@ -2246,11 +2351,19 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
             if (tx.IsCoinStake())
                 nStakeReward = nTxValueOut - nTxValueIn;
 
+            vector<CScriptCheck> vChecks;
             if (!tx.ConnectInputs(mapInputs[i], mapInputsFractions[i],
                                   mapQueuedChanges, mapQueuedFractionsChanges,
                                   feesFractions,
-                                  posThisTx, pindex, true, false, flags))
+                                  posThisTx, pindex, true, false, flags,
+                                  nScriptCheckThreads ? &vChecks : NULL)) {
+                // the checks of its inputs before the failure are run,
+                // the serial verification fails on them first
+                control.Add(vChecks);
+                scriptChecksOk();
                 return false;
+            }
+            control.Add(vChecks);
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size(), pindex->nHeight, i);
@@ -2261,6 +2374,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
         }
     }
 
+    if (!scriptChecksOk())
+        return false;
+
     if (IsProofOfWork())
     {
         int64_t nReward = GetProofOfWorkReward(nFees);
@@ -2394,8 +2510,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindex, bool
     }
 
     // Watch for transactions paying to me
-    for(const CTransaction& tx : vtx) {
-        SyncWithWallets(tx, this, true, mapQueuedFractionsChanges);
+    {
+        // wallet keeps fractions, these are not from block arena
+        CFractionsArena::Pause pauseArena;
+        for(const CTransaction& tx : vtx) {
+            SyncWithWallets(tx, this, true, mapQueuedFractionsChanges);
+        }
     }
 
     // Watch for peg activation transaction
@@ -2476,6 +2596,7 @@ bool static Reorganize(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
 
     // Disconnect shorter branch
     list<CTransaction> vResurrect;
+    vector<CTransaction> vDisconnected;
     for(CBlockIndex* pindex : vDisconnect)
     {
         CBlock block;
@@ -2483,6 +2604,7 @@ bool static Reorganize(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
             return error("Reorganize() : ReadFromDisk for disconnect failed");
         if (!block.DisconnectBlock(txdb, pegdb, pindex))
             return error("Reorganize() : DisconnectBlock %s failed", pindex->GetBlockHash().ToString());
+        vDisconnected.insert(vDisconnected.end(), block.vtx.begin(), block.vtx.end());
 
         // Queue memory transactions to resurrect.
         // We only do this for blocks after the last checkpoint (reorganisation before that
@@ -2514,12 +2636,22 @@ bool static Reorganize(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
             vDelete.push_back(tx);
         }
     }
-    if (!txdb.WriteHashBestChain(pindexNew->GetBlockHash()))
-        return error("Reorganize() : WriteHashBestChain failed");
+    // fractions of the disconnected txs which are not connected again
+    set<uint256> setConnected;
+    for(const CTransaction& tx : vDelete)
+        setConnected.insert(tx.GetHash());
+    vector<uint320> vErase;
+    for(const CTransaction& tx : vDisconnected) {
+        uint256 txhash = tx.GetHash();
+        if (setConnected.count(txhash))
+            continue;
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+            vErase.push_back(uint320(txhash, j));
+    }
 
     // Make sure it's successfully written to disk before changing memory structure
-    if (!txdb.TxnCommit())
-        return error("Reorganize() : TxnCommit failed");
+    if (!WriteReorganize(txdb, pegdb, pindexNew->GetBlockHash(), vErase))
+        return error("Reorganize() : WriteReorganize failed");
 
     // Disconnect shorter branch
     for(const CBlockIndex* pindex : vDisconnect) {
@@ -2561,9 +2693,15 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CPegDB& pegdb, CBlockIndex *pindexNe
     if (!ConnectBlock(txdb, pegdb, pindexNew) || !txdb.WriteHashBestChain(hash))
     {
         txdb.TxnAbort();
+        pegdb.TxnAbort();
         InvalidChainFound(pindexNew);
         return false;
     }
+    if (!pegdb.TxnCommit())
+    {
+        txdb.TxnAbort();
+        return error("SetBestChain() : peg TxnCommit failed");
+    }
     if (!txdb.TxnCommit())
         return error("SetBestChain() : TxnCommit failed");
 
@@ -2584,11 +2722,16 @@ bool CBlock::SetBestChain(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
 
     if (!txdb.TxnBegin())
         return error("SetBestChain() : TxnBegin failed");
+    if (!pegdb.TxnBegin())
+    {
+        txdb.TxnAbort();
+        return error("SetBestChain() : peg TxnBegin failed");
+    }
 
     if (pindexGenesisBlock == NULL && hash == Params().HashGenesisBlock())
     {
         txdb.WriteHashBestChain(hash);
-        if (!txdb.TxnCommit())
+        if (!pegdb.TxnCommit() || !txdb.TxnCommit())
             return error("SetBestChain() : TxnCommit failed");
         pindexGenesisBlock = pindexNew;
     }
@@ -2620,6 +2763,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
         if (!Reorganize(txdb, pegdb, pindexIntermediate))
         {
             txdb.TxnAbort();
+            pegdb.TxnAbort();
             InvalidChainFound(pindexNew);
             return error("SetBestChain() : Reorganize failed");
         }
@@ -2639,6 +2783,11 @@ bool CBlock::SetBestChain(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
                 LogPrintf("SetBestChain() : TxnBegin 2 failed\n");
                 break;
             }
+            if (!pegdb.TxnBegin()) {
+                txdb.TxnAbort();
+                LogPrintf("SetBestChain() : peg TxnBegin 2 failed\n");
+                break;
+            }
             // errors now are not fatal, we still did a reorganisation to a new chain in a valid way
             if (!block.SetBestChainInner(txdb, pegdb, pindex))
                 break;
@@ -2673,6 +2822,9 @@ bool CBlock::SetBestChain(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
       nBestBlockTrust.GetLow64(),
       DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()));
 
+    // Errors are not fatal, the kept changes are written at the next block
+    FlushBlockWrites(false);
+
     // Check the version of the last 100 blocks to see if we need to upgrade:
     if (!fIsInitialDownload)
     {
@@ -2708,6 +2860,74 @@ bool CBlock::SetBestChain(CTxDB& txdb, CPegDB& pegdb, CBlockIndex* pindexNew)
     return true;
 }
 
+// The changes of a reorganization are not kept in the write buffers: the
+// kept block changes are written before, then the fractions and the best
+// chain as one write of each database, the pegdb first, and last the
+// fractions of the disconnected txs are erased. A crash between any of the
+// writes leaves the fractions of the best chain stored in the txdb, the
+// erased ones are only of txs out of it.
+bool WriteReorganize(CTxDB& txdb, CPegDB& pegdb, const uint256& hashBestChain,
+                     const std::vector<uint320>& vErase)
+{
+    if (!FlushBlockWrites(true))
+        return error("WriteReorganize() : write of kept block changes failed");
+    if (!txdb.WriteHashBestChain(hashBestChain))
+        return error("WriteReorganize() : WriteHashBestChain failed");
+    if (!pegdb.TxnCommit())
+        return error("WriteReorganize() : peg TxnCommit failed");
+    if (!txdb.TxnCommit())
+        return error("WriteReorganize() : TxnCommit failed");
+
+    // the best chain is written, a failure is not fatal: the fractions
+    // left are of txs out of the chain, rewritten if they are connected again
+    if (!vErase.empty() && pegdb.TxnBegin()) {
+        for(const uint320& fkey : vErase)
+            pegdb.EraseFractions(fkey);
+        if (!pegdb.TxnCommit())
+            error("WriteReorganize() : peg TxnCommit of erased fractions failed");
+    }
+    return true;
+}
+
+// During the initial sync the changes of connected blocks are kept in the
+// write buffers of the txdb and pegdb and written together once -dbbatchsize
+// megabytes or -dbbatchtime seconds are reached. The pegdb is written first,
+// so the best chain stored in the txdb is never past the stored fractions;
+// after a crash the blocks past it are connected again and write the same
+// fractions. Out of the initial sync the buffers are written and disabled.
+bool FlushBlockWrites(bool fForce)
+{
+    static int64_t nMaxBytes = GetArg("-dbbatchsize", DEFAULT_DB_BATCH_SIZE) * 1048576;
+    static int64_t nMaxMicros = GetArg("-dbbatchtime", DEFAULT_DB_BATCH_TIME) * 1000000;
+    static int64_t nLastFlush = 0;
+
+    CDBWriteBuffer& txbuffer = CTxDB::WriteBuffer();
+    CDBWriteBuffer& pegbuffer = CPegDB::WriteBuffer();
+    int64_t nNow = GetTimeMicros();
+    bool fBatch = !fForce && nMaxBytes > 0 && (fImporting || fReindex || IsInitialBlockDownload());
+    if (!txbuffer.IsEnabled() && !pegbuffer.IsEnabled()) {
+        if (fBatch) {
+            pegbuffer.Enable();
+            txbuffer.Enable();
+            nLastFlush = nNow;
+            LogPrint("db", "FlushBlockWrites() : block writes kept up to %d MB or %d s\n",
+                     nMaxBytes / 1048576, nMaxMicros / 1000000);
+        }
+        return true;
+    }
+
+    size_t nBytes = txbuffer.Bytes() + pegbuffer.Bytes();
+    if (fBatch && int64_t(nBytes) < nMaxBytes && nNow - nLastFlush < nMaxMicros)
+        return true;
+
+    if (!CPegDB::FlushWriteBuffer(!fBatch) || !CTxDB::FlushWriteBuffer(!fBatch))
+        return error("FlushBlockWrites() : write of kept block changes failed");
+    nLastFlush = nNow;
+    LogPrint("db", "FlushBlockWrites() : %u bytes written in %dms at height %d%s\n",
+             nBytes, (GetTimeMicros() - nNow) / 1000, nBestHeight, fBatch ? "" : ", batching ended");
+    return true;
+}
+
 // ppcoin: total coin age spent in transaction, in the unit of coin-days.
 // Only those coins meeting minimum age requirement counts. As those
 // transactions not in main chain are not currently indexed so we
@@ -2774,11 +2994,11 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
         return error("AddToBlockIndex() : %s already exists", hash.ToString());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
+    CBlockIndex* pindexNew = mapBlockIndex.NewIndex(nFile, nBlockPos, *this);
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
     pindexNew->phashBlock = &hash;
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -2805,7 +3025,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     pindexNew->bnStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, IsProofOfWork() ? hash : vtx[1].vin[0].prevout.hash);
 
     // Add to mapBlockIndex
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(hash, pindexNew).first;
+    CBlockIndexMap::iterator mi = mapBlockIndex.insert(hash, pindexNew).first;
     if (pindexNew->IsProofOfStake())
         setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     pindexNew->phashBlock = &((*mi).first);
@@ -2993,7 +3213,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return DoS(10, error("AcceptBlock() : prev block not found"));
     CBlockIndex* pindexPrev = (*mi).second;
@@ -3089,7 +3309,8 @@ bool CBlock::AcceptBlock()
     return true;
 }
 
-uint256 CBlockIndex::GetBlockTrust() const
+// trust of a block by its target, as its header tells it
+static uint256 GetBlockTrust(unsigned int nBits)
 {
     CBigNum bnTarget;
     bnTarget.SetCompact(nBits);
@@ -3100,6 +3321,11 @@ uint256 CBlockIndex::GetBlockTrust() const
     return ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
 }
 
+uint256 CBlockIndex::GetBlockTrust() const
+{
+    return ::GetBlockTrust(nBits);
+}
+
 bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
 {
     unsigned int nFound = 0;
@@ -3123,6 +3349,123 @@ void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
     pnode->PushMessage("getblocks", CBlockLocator(pindexBegin), hashEnd);
 }
 
+// Blocks of the initial sync are downloaded after their headers,
+// -headersfirst=0 syncs by getblocks. Out of the initial sync blocks
+// come by inv, a header chain left is kept for a later initial sync.
+// After a stall of the header chain the getblocks sync is taken for a
+// while, a peer sending made up headers does not hold the sync.
+bool static IsHeadersFirstSync()
+{
+    static bool fHeadersFirst = GetBoolArg("-headersfirst", true);
+    if (!fHeadersFirst || fImporting || fReindex)
+        return false;
+    if (blockdownload.IsStalled(GetTime()))
+        return false;
+    return IsInitialBlockDownload();
+}
+
+// GetNextTargetRequired() of the header after hashPrev, a block of the
+// index or a header of the header chain. Headers are taken into index
+// entries as far as the retarget walks back: to the parent of the second
+// last one of the kind, or to a block of the index.
+static unsigned int GetNextHeaderTargetRequired(const uint256& hashPrev, bool fProofOfStake)
+{
+    deque<CBlockIndex> vIndex; // entries are linked by their addresses
+    CBlockIndex* pindexLast = NULL;
+    CBlockIndex* pindexTail = NULL;
+    int nFound = 0;
+    uint256 hash = hashPrev;
+    while (true)
+    {
+        CBlockIndex* pindex = NULL;
+        const CBlockDownload::CHeader* pheader = NULL;
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end())
+            pindex = mi->second;
+        else if ((pheader = blockdownload.GetHeader(hash)))
+        {
+            vIndex.emplace_back();
+            pindex = &vIndex.back();
+            pindex->nHeight = pheader->nHeight;
+            pindex->nTime = pheader->nTime;
+            pindex->nBits = pheader->nBits;
+            if (pheader->fProofOfStake)
+                pindex->SetProofOfStake();
+        }
+
+        if (pindexTail)
+            pindexTail->pprev = pindex;
+        else pindexLast = pindex;
+        if (!pheader || nFound == 2)
+            break;
+        if (pindex->IsProofOfStake() == fProofOfStake)
+            nFound++;
+        pindexTail = pindex;
+        hash = pheader->hashPrev;
+    }
+    return GetNextTargetRequired(pindexLast, fProofOfStake);
+}
+
+// Misbehaving() of a peer known by its id, if it is still connected
+void static MisbehavingNode(NodeId nodeid, int howmuch)
+{
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        if (pnode->GetId() == nodeid) {
+            pnode->Misbehaving(howmuch);
+            break;
+        }
+    }
+}
+
+// The hash of a block commits to its header and by the merkle root to its
+// transactions, not to the block signature. A copy with transactions not
+// matching the merkle root, repeated ones which keep the root, or a bad
+// signature can be a mutated copy of a valid block.
+bool static IsBlockIntact(const CBlock& block)
+{
+    if (block.vtx.empty() || block.hashMerkleRoot != block.BuildMerkleTree())
+        return false;
+    set<uint256> setTx;
+    for (const CTransaction& tx : block.vtx) {
+        if (!setTx.insert(tx.GetHash()).second)
+            return false;
+    }
+    return block.CheckBlockSignature();
+}
+
+// A block of the header chain which is not accepted drops the header chain
+// only when the failure is in what its hash commits to. Bad copies are put
+// on the sender by its DoS score, failures without score are local (disk,
+// time) or may pass later, such blocks are requested again.
+void static DownloadedBlockFailed(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    if (block.nDoS > 0 && IsBlockIntact(block)) {
+        LogPrintf("DownloadedBlockFailed() : block %s is invalid, header chain is dropped\n", hash.ToString());
+        blockdownload.BlockInvalid(hash);
+    }
+    else LogPrint("net", "block %s of the header chain is not accepted, requested again\n", hash.ToString());
+}
+
+// Connects the kept blocks of the header chain which parents are connected
+void static ProcessDownloadedBlocks()
+{
+    std::shared_ptr<CBlock> pblock;
+    NodeId node;
+    while ((pblock = blockdownload.TakeNext(node))) {
+        uint256 hash = pblock->GetHash();
+        ProcessBlock(NULL, pblock.get());
+        if (mapBlockIndex.count(hash))
+            blockdownload.BlockAccepted(hash);
+        else {
+            if (pblock->nDoS)
+                MisbehavingNode(node, pblock->nDoS);
+            DownloadedBlockFailed(*pblock);
+        }
+    }
+}
+
 bool static ReserealizeBlockSignature(CBlock* pblock)
 {
     if (pblock->IsProofOfWork()) {
@@ -3385,12 +3728,6 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes)
     return true;
 }
 
-static filesystem::path BlockFilePath(unsigned int nFile)
-{
-    string strBlockFn = strprintf("blk%04u.dat", nFile);
-    return GetDataDir() / strBlockFn;
-}
-
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
     if ((nFile < 1) || (nFile == (unsigned int) -1))
@@ -3432,6 +3769,24 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
     }
 }
 
+static CCriticalSection cs_startupTimes;
+static vector<pair<string, int64_t> > vStartupTimes;
+
+void AddStartupTime(const string& strPhase, int64_t nMicros)
+{
+    LOCK(cs_startupTimes);
+    vStartupTimes.push_back(make_pair(strPhase, nMicros));
+}
+
+void LogStartupTimes()
+{
+    LOCK(cs_startupTimes);
+    LogPrintf("Startup phases:\n");
+    for(const pair<string, int64_t> & phase : vStartupTimes) {
+        LogPrintf("  %-28s %10.2fms\n", phase.first, phase.second * 0.001);
+    }
+}
+
 bool LoadBlockIndex(LoadMsg load_msg, bool fAllowNew)
 {
     LOCK(cs_main);
@@ -3475,16 +3830,22 @@ bool LoadBlockIndex(LoadMsg load_msg, bool fAllowNew)
                 return error("LoadBlockIndex() : peg TxnCommit failed");
         }
     }
+    int64_t nStart = GetTimeMicros();
     if (!txdb.LoadBlockIndex(load_msg))
         return false;
-    
+    AddStartupTime("block index", GetTimeMicros() - nStart);
+
+    nStart = GetTimeMicros();
     CPegDB pegdb("cr+");
     if (!pegdb.LoadPegData(txdb, load_msg))
         return false;
+    AddStartupTime("peg data", GetTimeMicros() - nStart);
 
     // pegdb to be ready for utxo db build
+    nStart = GetTimeMicros();
     if (!txdb.LoadUtxoData(load_msg))
         return false;
+    AddStartupTime("utxo data", GetTimeMicros() - nStart);
     
     //
     // Init with genesis block
@@ -3514,7 +3875,7 @@ void PrintBlockTree()
     AssertLockHeld(cs_main);
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3800,7 +4161,7 @@ void static ProcessGetData(CNode* pfrom)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -4091,6 +4452,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
         CTxDB txdb("r");
+        bool fHeadersSync = IsHeadersFirstSync();
 
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++)
         {
@@ -4103,8 +4465,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LogPrint("net", "  got inventory: %s  %s\n", inv.ToString(), fAlreadyHave ? "have" : "new");
 
             if (!fAlreadyHave) {
-                if (!fImporting)
+                // blocks of the headers-first sync are requested by SendMessages
+                if (!fImporting && !(inv.type == MSG_BLOCK && fHeadersSync))
                     pfrom->AskFor(inv);
+            } else if (fHeadersSync) {
+                // the header chain brings the next blocks
             } else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
                 PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(inv.hash));
             } else if (nInv == nLastBlock) {
@@ -4190,7 +4555,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -4204,7 +4569,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         vector<CBlock> vHeaders;
-        int nLimit = 2000;
+        int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString());
         for (; pindex; pindex = pindex->pnext)
         {
@@ -4216,6 +4581,106 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    else if (strCommand == "headers" && !fImporting && !fReindex)
+    {
+        vector<CBlock> vHeaders;
+        vRecv >> vHeaders;
+        if (vHeaders.size() > MAX_HEADERS_RESULTS)
+        {
+            pfrom->Misbehaving(20);
+            return error("message headers size() = %u", vHeaders.size());
+        }
+
+        LOCK(cs_main);
+
+        // only the answer of the peer asked for headers is taken, other
+        // headers could keep a made up chain in the download
+        if (!blockdownload.IsHeadersPeer(pfrom->GetId()))
+        {
+            LogPrint("net", "unsolicited headers from %s ignored\n", pfrom->addrName);
+            return true;
+        }
+
+        int nAdded = 0;
+        for (const CBlock& header : vHeaders)
+        {
+            uint256 hash = header.GetHash();
+            if (mapBlockIndex.count(hash))
+                continue;
+
+            // the header chain starts at a block of the index
+            int nHeight = blockdownload.HeaderHeight(header.hashPrevBlock);
+            uint256 nChainTrust = blockdownload.HeaderTrust(header.hashPrevBlock);
+            if (nHeight < 0)
+            {
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+                if (mi != mapBlockIndex.end() && mi->second) {
+                    nHeight = mi->second->nHeight;
+                    nChainTrust = mi->second->nChainTrust;
+                }
+            }
+            if (nHeight < 0)
+            {
+                blockdownload.HeadersReceived(pfrom->GetId(), false, GetTime());
+                pfrom->Misbehaving(20);
+                return error("headers : header %s does not connect", hash.ToString());
+            }
+            nHeight++;
+
+            if (!Checkpoints::CheckHardened(nHeight, hash))
+            {
+                blockdownload.HeadersReceived(pfrom->GetId(), false, GetTime());
+                pfrom->Misbehaving(100);
+                return error("headers : rejected by hardened checkpoint at height %d", nHeight);
+            }
+            if (header.GetBlockTime() > FutureDrift(GetAdjustedTime(), nHeight))
+            {
+                blockdownload.HeadersReceived(pfrom->GetId(), false, GetTime());
+                return error("headers : header %s timestamp too far in the future", hash.ToString());
+            }
+            // the kind of block is not in the header: a proof-of-work one
+            // meets its target, others are proof-of-stake. The target tells
+            // the trust of the chain, it is the one required after the
+            // parent as AcceptBlock() checks it.
+            CBigNum bnTarget;
+            bnTarget.SetCompact(header.nBits);
+            bool fProofOfWork = bnTarget > 0 && bnTarget <= Params().ProofOfWorkLimit() &&
+                                hash <= bnTarget.getuint256() &&
+                                header.nBits == GetNextHeaderTargetRequired(header.hashPrevBlock, false);
+            if (!fProofOfWork && header.nBits != GetNextHeaderTargetRequired(header.hashPrevBlock, true))
+            {
+                blockdownload.HeadersReceived(pfrom->GetId(), false, GetTime());
+                pfrom->Misbehaving(100);
+                return error("headers : header %s incorrect target", hash.ToString());
+            }
+            nChainTrust += GetBlockTrust(header.nBits);
+
+            CBlockDownload::CHeader headerChain;
+            headerChain.hashPrev = header.hashPrevBlock;
+            headerChain.nHeight = nHeight;
+            headerChain.nChainTrust = nChainTrust;
+            headerChain.node = pfrom->GetId();
+            headerChain.nTime = header.nTime;
+            headerChain.nBits = header.nBits;
+            headerChain.fProofOfStake = !fProofOfWork;
+            // the block was found invalid from the copy of another peer,
+            // which was scored for it, this peer may not have validated it
+            if (!blockdownload.AddHeader(hash, headerChain))
+            {
+                blockdownload.HeadersReceived(pfrom->GetId(), false, GetTime());
+                return error("headers : header %s of invalid chain", hash.ToString());
+            }
+            nAdded++;
+        }
+
+        // full message asks for more, unless nothing new was sent
+        bool fMore = vHeaders.size() == MAX_HEADERS_RESULTS && nAdded > 0;
+        blockdownload.HeadersReceived(pfrom->GetId(), fMore, GetTime());
+        LogPrint("net", "received %u headers (%d new), header chain to %d\n",
+                 vHeaders.size(), nAdded, blockdownload.BestHeaderHeight());
+    }
+
+
     else if (strCommand == "tx")
     {
         vector<uint256> vWorkQueue;
@@ -4298,9 +4763,31 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
+        // Blocks of the header chain are kept aside until their parent
+        // is connected, other blocks are not taken as orphans during
+        // the headers-first sync, the header chain brings them. A block
+        // of the header chain is taken only from the peer asked for it.
+        bool fWanted = blockdownload.IsWanted(hashBlock) &&
+                       blockdownload.BlockReceived(hashBlock, pfrom->GetId());
+        if ((fWanted || IsHeadersFirstSync()) && !mapBlockIndex.count(block.hashPrevBlock))
+        {
+            if (fWanted)
+                blockdownload.BufferBlock(hashBlock, std::make_shared<CBlock>(block), pfrom->GetId());
+            else LogPrint("net", "block %s is not requested from %s, ignored\n", hashBlock.ToString(), pfrom->addrName);
+            return true;
+        }
+
         if (ProcessBlock(pfrom, &block))
             mapAlreadyAskedFor.erase(inv);
         if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+
+        if (fWanted)
+        {
+            if (mapBlockIndex.count(hashBlock))
+                blockdownload.BlockAccepted(hashBlock);
+            else DownloadedBlockFailed(block);
+            ProcessDownloadedBlocks();
+        }
     }
 
 
@@ -4625,9 +5112,51 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         }
 
         // Start block sync
+        bool fHeadersSync = IsHeadersFirstSync();
         if (pto->fStartSync && !fImporting && !fReindex) {
             pto->fStartSync = false;
-            PushGetBlocks(pto, pindexBest, uint256(0));
+            if (!fHeadersSync)
+                PushGetBlocks(pto, pindexBest, uint256(0));
+        }
+
+        // Headers-first sync: headers from one peer, blocks of the
+        // header chain from all peers having them
+        if (fHeadersSync && !pto->fClient && !pto->fDisconnect &&
+            (pto->nVersion < NOBLKS_VERSION_START || pto->nVersion >= NOBLKS_VERSION_END)) {
+            int64_t nNow = GetTime();
+            blockdownload.BlockAccepted(hashBestChain);
+            ProcessDownloadedBlocks();
+            blockdownload.ExpireRequests(nNow);
+            NodeId nodeStalled = blockdownload.ExpireStalledChain(nNow);
+            if (nodeStalled != -1) {
+                LogPrintf("header chain stalled, dropped, headers from peer %d\n", nodeStalled);
+                MisbehavingNode(nodeStalled, 100);
+                // the getblocks sync is taken, from this peer and by inv
+                // of the others
+                if (pto->GetId() != nodeStalled)
+                    PushGetBlocks(pto, pindexBest, uint256(0));
+            }
+
+            if (!blockdownload.IsStalled(nNow) && blockdownload.StartHeaders(pto->GetId(), pto->nStartingHeight, nBestHeight, nNow)) {
+                vector<uint256> vHave = blockdownload.GetLocatorHashes();
+                CBlockLocator locator(pindexBest);
+                if (!vHave.empty()) {
+                    vHave.push_back(Params().HashGenesisBlock());
+                    locator = CBlockLocator(vHave);
+                }
+                LogPrint("net", "getheaders from %d to %s\n", blockdownload.BestHeaderHeight(), pto->addrName);
+                pto->PushMessage("getheaders", locator, uint256(0));
+            }
+
+            vector<uint256> vHashes;
+            blockdownload.RequestBlocks(pto->GetId(), pto->nStartingHeight, nNow, vHashes);
+            if (!vHashes.empty()) {
+                vector<CInv> vGetData;
+                for (const uint256& hash : vHashes)
+                    vGetData.push_back(CInv(MSG_BLOCK, hash));
+                LogPrint("net", "getdata %u blocks from %s\n", vGetData.size(), pto->addrName);
+                pto->PushMessage("getdata", vGetData);
+            }
         }
 
         // Resend wallet transactions that haven't gotten in a block yet
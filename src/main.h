@@ -14,9 +14,11 @@
 #include "script.h"
 #include "peg.h"
 #include "blockindexmap.h"
+#include "blockfile.h"
 
 #include <list>
 #include <functional>
+#include <memory>
 
 class CBlock;
 class CBlockIndex;
@@ -44,6 +46,12 @@ static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
 /** Default for -maxorphanblocks, maximum number of orphan blocks kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS = 750;
+/** Maximum number of script-checking threads allowed */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Default for -dbbatchsize, megabytes of block writes kept in memory during the initial sync */
+static const int DEFAULT_DB_BATCH_SIZE = 64;
+/** Default for -dbbatchtime, seconds between the writes of the kept block changes */
+static const int DEFAULT_DB_BATCH_TIME = 60;
 /** The maximum number of entries in an 'inv' protocol message */
 static const unsigned int MAX_INV_SZ = 50000;
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
@@ -85,6 +93,7 @@ extern int nRecommendedConfirmations;
 extern unsigned int nStakeMinAge;
 extern unsigned int nNodeLifespan;
 extern int nCoinbaseMaturity;
+extern int nScriptCheckThreads;
 extern int nBestHeight;
 extern uint256 nBestChainTrust;
 extern uint256 nBestInvalidTrust;
@@ -92,6 +101,9 @@ extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
+extern uint64_t nBlockTemplateBuilds;
+extern uint64_t nBlockTemplateExtends;
+extern uint64_t nBlockTemplateReuses;
 extern int64_t nLastCoinStakeSearchInterval;
 extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
@@ -109,6 +121,7 @@ extern bool fUseFastIndex;
 static const uint64_t nMinDiskSpace = 52428800;
 
 class CReserveKey;
+class CScriptCheck;
 class CTxDB;
 class CTxIndex;
 class CWalletInterface;
@@ -143,11 +156,21 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
 bool LoadBlockIndex(LoadMsg fLoadMsg, bool fAllowNew=true);
+/** Write the block changes kept in memory, fForce ends the batching */
+bool FlushBlockWrites(bool fForce);
+/** Write the open transactions of a reorganization, erase the fractions of vErase after */
+bool WriteReorganize(CTxDB& txdb, CPegDB& pegdb, const uint256& hashBestChain,
+                     const std::vector<uint320>& vErase);
+/** Record duration of a node startup phase, reported with -benchstartup */
+void AddStartupTime(const std::string& strPhase, int64_t nMicros);
+void LogStartupTimes();
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
+/** Run an instance of the script checking thread */
+void ThreadScriptCheck();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
@@ -333,6 +356,20 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        if (!pfileRet) {
+            // Read transaction via pooled block file handles
+            CBlockFileReader filein(pos.nFile, pos.nTxPos, SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
+            try {
+                filein >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
+            return true;
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -425,6 +462,7 @@ public:
         @param[in] pindexBlock
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
+        @param[out] pvChecks	If not NULL, script checks are appended here instead of being run
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(MapPrevTx inputs,
@@ -436,7 +474,8 @@ public:
                        const CBlockIndex* pindexBlock,
                        bool fBlock, 
                        bool fMiner, 
-                       unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS);
+                       unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS,
+                       std::vector<CScriptCheck>* pvChecks = NULL);
     bool CheckTransaction() const;
     bool GetCoinAge(CTxDB& txdb, const CBlockIndex* pindexPrev, uint64_t& nCoinAge) const;
 
@@ -455,6 +494,42 @@ public:
                         MapFractions& mapOutputsFractions) const;
 };
 
+/** Closure representing one script verification of ConnectInputs.
+ *  The output spent is copied, as the previous transactions are not
+ *  kept by ConnectBlock until the queued checks are done.
+ */
+class CScriptCheck
+{
+private:
+    CTxOut txoutFrom;
+    const CTransaction* ptxTo;
+    std::shared_ptr<const CSignatureHashContext> psighash; // shared by inputs of ptxTo
+    unsigned int nIn;
+    unsigned int nFlags;
+    bool fPrevoutOk;        // prevout refers to the spent transaction
+    bool fNonMandatory;     // failed only for non-mandatory flags
+
+public:
+    CScriptCheck(): ptxTo(NULL), nIn(0), nFlags(0), fPrevoutOk(false), fNonMandatory(false) {}
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn,
+                 std::shared_ptr<const CSignatureHashContext> psighashIn = nullptr);
+
+    bool operator()();
+
+    // logs the failure and marks the transaction as ConnectInputs does
+    bool ReportFailure() const;
+
+    void swap(CScriptCheck& check) {
+        std::swap(txoutFrom, check.txoutFrom);
+        std::swap(ptxTo, check.ptxTo);
+        psighash.swap(check.psighash);
+        std::swap(nIn, check.nIn);
+        std::swap(nFlags, check.nFlags);
+        std::swap(fPrevoutOk, check.fPrevoutOk);
+        std::swap(fNonMandatory, check.fNonMandatory);
+    }
+};
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -983,8 +1058,9 @@ public:
     {
         SetNull();
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
+        // Read history file via pooled block file handles
+        CBlockFileReader filein(nFile, nBlockPos, SER_DISK, CLIENT_VERSION,
+                                fReadTransactions ? 65536 : 4096);
         if (!filein)
             return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
         if (!fReadTransactions)
@@ -1064,13 +1140,16 @@ private:
 class CBlockIndex
 {
 public:
+    // fields are ordered to avoid padding, block indexes are allocated
+    // from the arena of CBlockIndexMap (mapBlockIndex.NewIndex)
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
     unsigned int nFile;
     unsigned int nBlockPos;
-    uint256 nChainTrust; // ppcoin: trust score of block chain
     int nHeight;
+    unsigned int nFlags;  // ppcoin: block index flags
+    uint256 nChainTrust; // ppcoin: trust score of block chain
 
     int64_t nMint;
     int64_t nMoneySupply;
@@ -1079,7 +1158,6 @@ public:
     int nPegVotesDeflate;
     int nPegVotesNochange;
 
-    unsigned int nFlags;  // ppcoin: block index flags
     enum
     {
         BLOCK_PROOF_OF_STAKE = (1 << 0), // is proof-of-stake block
@@ -1457,7 +1535,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1508,7 +1586,7 @@ public:
         int nStep = 1;
         for(const uint256& hash : vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1527,7 +1605,7 @@ public:
         // Find the first block the caller has in the main chain
         for(const uint256& hash : vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1543,7 +1621,7 @@ public:
         // Find the first block the caller has in the main chain
         for(const uint256& hash : vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -221,8 +221,7 @@ int CalculatePegVotes(const CFractions & fractions, int nPegSupplyIndex)
     int64_t nReserveWeight=0;
     int64_t nLiquidWeight=0;
 
-    fractions.LowPart(nPegSupplyIndex, &nReserveWeight);
-    fractions.HighPart(nPegSupplyIndex, &nLiquidWeight);
+    fractions.LowHigh(nPegSupplyIndex, &nReserveWeight, &nLiquidWeight);
 
     if (nLiquidWeight > INT_LEAST64_MAX/(nPegSupplyIndex+2)) {
         // check for rare extreme case when user stake more than about 100M coins
@@ -689,7 +688,7 @@ void PrunePegForBlock(const CBlock& blockprune, CPegDB& pegdb)
         for (size_t j=0; j< tx.vin.size(); j++) {
             COutPoint prevout = tx.vin[j].prevout;
             auto fkey = uint320(prevout.hash, prevout.n);
-            pegdb.Erase(fkey);
+            pegdb.EraseFractions(fkey);
         }
         if (!tx.IsCoinStake())
             continue;
@@ -701,7 +700,7 @@ void PrunePegForBlock(const CBlock& blockprune, CPegDB& pegdb)
             CTxOut out = tx.vout[j];
 
             if (out.nValue == 0) {
-                pegdb.Erase(fkey);
+                pegdb.EraseFractions(fkey);
                 continue;
             }
 
@@ -716,7 +715,7 @@ void PrunePegForBlock(const CBlock& blockprune, CPegDB& pegdb)
                 CScript::const_iterator pc1 = scriptPubKey.begin();
                 if (scriptPubKey.GetOp(pc1, opcode1, vch1)) {
                     if (opcode1 == OP_RETURN && scriptPubKey.size()>1) {
-                        pegdb.Erase(fkey);
+                        pegdb.EraseFractions(fkey);
                         continue;
                     }
                 }
@@ -733,7 +732,7 @@ void PrunePegForBlock(const CBlock& blockprune, CPegDB& pegdb)
             if (!voted)
                 continue;
 
-            pegdb.Erase(fkey);
+            pegdb.EraseFractions(fkey);
         }
     }
 }
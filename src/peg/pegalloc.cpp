@@ -0,0 +1,424 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#include "pegalloc.h"
+#include "pegdata.h"
+
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+using namespace std;
+
+namespace pegalloc {
+
+static_assert(sizeof(Header) == 16, "fractions alignment");
+
+static const size_t nBufferBytes    = sizeof(Header) + PEG_SIZE*sizeof(int64_t);
+static const size_t nThreadCached   = 32;
+static const size_t nMaxPooled      = 1024;
+static const size_t nSlabBuffers    = 64;
+
+static std::atomic<uint64_t> nAllocs(0);
+static std::atomic<uint64_t> nFrees(0);
+static std::atomic<uint64_t> nShares(0);
+static std::atomic<uint64_t> nUnshares(0);
+static std::atomic<uint64_t> nMallocs(0);
+static std::atomic<uint64_t> nArenaAllocs(0);
+static std::atomic<uint64_t> nArenas(0);
+static std::atomic<uint64_t> nArenasAlive(0);
+static std::atomic<uint64_t> nWindows(0);
+static std::atomic<uint64_t> nWindowBytes(0);
+
+static inline int64_t* BufferOf(Header* h)
+{
+    return reinterpret_cast<int64_t*>(reinterpret_cast<char*>(h) + sizeof(Header));
+}
+
+// shared pool, never destroyed as thread caches return into it on exit
+struct Pool {
+    boost::mutex        mtx;
+    vector<Header*>     vFree;
+};
+
+static Pool& SharedPool()
+{
+    static Pool* pool = new Pool;
+    return *pool;
+}
+
+struct ThreadCache {
+    vector<Header*> vFree;
+    ~ThreadCache() {
+        Pool& pool = SharedPool();
+        boost::mutex::scoped_lock lock(pool.mtx);
+        for(Header* h : vFree) {
+            if (pool.vFree.size() < nMaxPooled)
+                pool.vFree.push_back(h);
+            else ::operator delete(h);
+        }
+    }
+};
+
+static boost::thread_specific_ptr<ThreadCache>& ThreadCacheTss()
+{
+    static boost::thread_specific_ptr<ThreadCache>* tss = new boost::thread_specific_ptr<ThreadCache>;
+    return *tss;
+}
+
+struct Arena {
+    boost::mutex        mtx;
+    vector<char*>       vSlabs;
+    vector<Header*>     vFree;
+    size_t              nSlabUsed       = nSlabBuffers;
+    size_t              nOutstanding    = 0;
+    bool                fClosed         = false;
+
+    ~Arena() {
+        for(char* slab : vSlabs) ::operator delete(slab);
+        nArenasAlive--;
+    }
+    Header* Take() {
+        boost::mutex::scoped_lock lock(mtx);
+        nOutstanding++;
+        if (!vFree.empty()) {
+            Header* h = vFree.back();
+            vFree.pop_back();
+            return h;
+        }
+        if (nSlabUsed == nSlabBuffers) {
+            vSlabs.push_back(static_cast<char*>(::operator new(nSlabBuffers*nBufferBytes)));
+            nMallocs++;
+            nSlabUsed = 0;
+        }
+        Header* h = reinterpret_cast<Header*>(vSlabs.back() + nSlabUsed*nBufferBytes);
+        h->pArena = this;
+        nSlabUsed++;
+        return h;
+    }
+    // returns true if arena is to be released
+    bool Return(Header* h) {
+        boost::mutex::scoped_lock lock(mtx);
+        nOutstanding--;
+        if (!fClosed) {
+            vFree.push_back(h);
+            return false;
+        }
+        return nOutstanding == 0;
+    }
+    bool Close() {
+        boost::mutex::scoped_lock lock(mtx);
+        fClosed = true;
+        vFree.clear();
+        return nOutstanding == 0;
+    }
+};
+
+static void NoCleanup(Arena*) {}
+
+static boost::thread_specific_ptr<Arena>& ThreadArenaTss()
+{
+    static boost::thread_specific_ptr<Arena>* tss = new boost::thread_specific_ptr<Arena>(NoCleanup);
+    return *tss;
+}
+
+static Header* Take()
+{
+    Arena* pArena = ThreadArenaTss().get();
+    if (pArena) {
+        nArenaAllocs++;
+        return pArena->Take();
+    }
+
+    ThreadCache* pCache = ThreadCacheTss().get();
+    if (pCache && !pCache->vFree.empty()) {
+        Header* h = pCache->vFree.back();
+        pCache->vFree.pop_back();
+        return h;
+    }
+
+    Pool& pool = SharedPool();
+    {
+        boost::mutex::scoped_lock lock(pool.mtx);
+        if (!pool.vFree.empty()) {
+            Header* h = pool.vFree.back();
+            pool.vFree.pop_back();
+            return h;
+        }
+    }
+
+    nMallocs++;
+    Header* h = static_cast<Header*>(::operator new(nBufferBytes));
+    h->pArena = nullptr;
+    return h;
+}
+
+int64_t* Alloc()
+{
+    nAllocs++;
+    Header* h = Take();
+    h->nRefs.store(1, std::memory_order_relaxed);
+    return BufferOf(h);
+}
+
+int64_t* Share(int64_t* p)
+{
+    Header* h = HeaderOf(p);
+    if (h->pArena && h->pArena != ThreadArenaTss().get()) {
+        int64_t* pCopy = Alloc();
+        std::copy(p, p+PEG_SIZE, pCopy);
+        return pCopy;
+    }
+    nShares++;
+    h->nRefs.fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+int64_t* Unshare(int64_t* p)
+{
+    nUnshares++;
+    int64_t* pCopy = Alloc();
+    std::copy(p, p+PEG_SIZE, pCopy);
+    Release(p);
+    return pCopy;
+}
+
+static void Free(Header* h);
+
+void Release(int64_t* p)
+{
+    if (!p) return;
+    Header* h = HeaderOf(p);
+    if (h->nRefs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    Free(h);
+}
+
+static void Free(Header* h)
+{
+    nFrees++;
+
+    if (h->pArena) {
+        Arena* pArena = h->pArena;
+        if (pArena->Return(h))
+            delete pArena;
+        return;
+    }
+
+    ThreadCache* pCache = ThreadCacheTss().get();
+    if (!pCache) {
+        pCache = new ThreadCache;
+        ThreadCacheTss().reset(pCache);
+    }
+    if (pCache->vFree.size() < nThreadCached) {
+        pCache->vFree.push_back(h);
+        return;
+    }
+
+    Pool& pool = SharedPool();
+    {
+        boost::mutex::scoped_lock lock(pool.mtx);
+        if (pool.vFree.size() < nMaxPooled) {
+            pool.vFree.push_back(h);
+            return;
+        }
+    }
+    ::operator delete(h);
+}
+
+const int64_t Window::nZero = 0;
+
+size_t WindowBytes(const Window* w)
+{
+    return sizeof(Window) + (w->nTo - w->nFrom)*sizeof(int64_t);
+}
+
+Window* WindowAlloc(int from, int to)
+{
+    if (to < from) to = from;
+    size_t nBytes = sizeof(Window) + (to - from)*sizeof(int64_t);
+    Window* w = static_cast<Window*>(::operator new(nBytes));
+    new (&w->nRefs) std::atomic<uint32_t>(1);
+    w->nFrom = from;
+    w->nTo = to;
+    nWindows++;
+    nWindowBytes += nBytes;
+    return w;
+}
+
+Window* WindowShare(Window* w)
+{
+    nShares++;
+    w->nRefs.fetch_add(1, std::memory_order_relaxed);
+    return w;
+}
+
+void WindowRelease(Window* w)
+{
+    if (!w) return;
+    if (w->nRefs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    nWindows--;
+    nWindowBytes -= WindowBytes(w);
+    ::operator delete(w);
+}
+
+int64_t* Expand(const Window* w)
+{
+    CFractionsArena::Pause pauseArena;
+    int64_t* p = Alloc();
+    std::fill(p, p+w->nFrom, 0);
+    std::copy(w->Values(), w->Values()+(w->nTo-w->nFrom), p+w->nFrom);
+    std::fill(p+w->nTo, p+PEG_SIZE, 0);
+    return p;
+}
+
+Stats GetStats()
+{
+    Stats stats;
+    stats.nAllocs       = nAllocs;
+    stats.nFrees        = nFrees;
+    stats.nShares       = nShares;
+    stats.nUnshares     = nUnshares;
+    stats.nMallocs      = nMallocs;
+    stats.nArenaAllocs  = nArenaAllocs;
+    stats.nArenas       = nArenas;
+    stats.nArenasAlive  = nArenasAlive;
+    stats.nWindows      = nWindows;
+    stats.nWindowBytes  = nWindowBytes;
+    Pool& pool = SharedPool();
+    boost::mutex::scoped_lock lock(pool.mtx);
+    stats.nPooled       = pool.vFree.size();
+    return stats;
+}
+
+}
+
+using namespace pegalloc;
+
+CFractionsArena::CFractionsArena()
+    :pArena(new Arena)
+    ,pPrev(ThreadArenaTss().get())
+{
+    nArenas++;
+    nArenasAlive++;
+    ThreadArenaTss().reset(static_cast<Arena*>(pArena));
+}
+
+CFractionsArena::~CFractionsArena()
+{
+    ThreadArenaTss().reset(static_cast<Arena*>(pPrev));
+    Arena* pA = static_cast<Arena*>(pArena);
+    if (pA->Close())
+        delete pA;
+}
+
+CFractionsArena::Pause::Pause()
+    :pPaused(ThreadArenaTss().get())
+{
+    ThreadArenaTss().reset(nullptr);
+}
+
+CFractionsArena::Pause::~Pause()
+{
+    ThreadArenaTss().reset(static_cast<Arena*>(pPaused));
+}
+
+CFractionsBuffer::CFractionsBuffer(const CFractionsBuffer & o)
+    :p(o.p ? Share(o.p) : nullptr)
+    ,w(o.w ? WindowShare(o.w) : nullptr)
+{
+}
+
+CFractionsBuffer::CFractionsBuffer(CFractionsBuffer && o) noexcept
+    :p(o.p)
+    ,w(o.w)
+{
+    o.p = nullptr;
+    o.w = nullptr;
+}
+
+CFractionsBuffer::~CFractionsBuffer()
+{
+    Release(p);
+    WindowRelease(w);
+}
+
+CFractionsBuffer& CFractionsBuffer::operator=(const CFractionsBuffer & o)
+{
+    if (this == &o) return *this;
+    int64_t* pShared = o.p ? Share(o.p) : nullptr;
+    Window* wShared = o.w ? WindowShare(o.w) : nullptr;
+    Release(p);
+    WindowRelease(w);
+    p = pShared;
+    w = wShared;
+    return *this;
+}
+
+CFractionsBuffer& CFractionsBuffer::operator=(CFractionsBuffer && o) noexcept
+{
+    std::swap(p, o.p);
+    std::swap(w, o.w);
+    return *this;
+}
+
+bool CFractionsBuffer::IsShared() const
+{
+    if (p && pegalloc::IsShared(p)) return true;
+    return w && w->nRefs.load(std::memory_order_acquire) > 1;
+}
+
+void CFractionsBuffer::Detach()
+{
+    if (!p) p = Alloc();
+    else if (pegalloc::IsShared(p)) p = Unshare(p);
+}
+
+void CFractionsBuffer::Compact(int from, int to)
+{
+    if (w) return;
+    if (!p) from = to = 0;
+    w = WindowAlloc(from, to);
+    if (p) std::copy(p+w->nFrom, p+w->nTo, w->Values());
+    Release(p);
+    p = nullptr;
+}
+
+void CFractionsBuffer::Decompact()
+{
+    if (!w) return;
+    Release(p);
+    p = pegalloc::Expand(w);
+    WindowRelease(w);
+    w = nullptr;
+}
+
+size_t CFractionsBuffer::MemoryUsage() const
+{
+    size_t nBytes = 0;
+    if (p) nBytes += PEG_SIZE*sizeof(int64_t);
+    if (w) nBytes += WindowBytes(w);
+    return nBytes;
+}
+
+CFractionsDense::CFractionsDense(const CFractionsBuffer & b)
+{
+    const Window* w = b.GetWindow();
+    if (w) d = pExpanded = pegalloc::Expand(w);
+    else d = b.get();
+}
+
+CFractionsDense::~CFractionsDense()
+{
+    Release(pExpanded);
+}
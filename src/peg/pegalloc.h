@@ -0,0 +1,190 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#ifndef BITBAY_PEGALLOC_H
+#define BITBAY_PEGALLOC_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+/** Allocator of PEG_SIZE fractions buffers used by CFractions.
+ *  Freed buffers are kept in a small per-thread cache and in a shared
+ *  free list, so the fractions churn of block connect, mempool and rpc
+ *  does not go to malloc for every temporary.
+ *  While a CFractionsArena is open on a thread all buffers allocated by
+ *  this thread are carved from the arena slabs.
+ */
+namespace pegalloc {
+
+struct Stats {
+    uint64_t nAllocs        = 0; // buffers handed out
+    uint64_t nFrees         = 0; // buffers returned
+    uint64_t nShares        = 0; // copies sharing a buffer
+    uint64_t nUnshares      = 0; // shared buffers copied on write
+    uint64_t nMallocs       = 0; // system allocations (buffers and slabs)
+    uint64_t nArenaAllocs   = 0; // buffers handed out from arenas
+    uint64_t nArenas        = 0; // arenas opened
+    uint64_t nArenasAlive   = 0; // arenas with slabs not yet released
+    uint64_t nPooled        = 0; // free buffers in the shared pool
+    uint64_t nWindows       = 0; // compact windows alive
+    uint64_t nWindowBytes   = 0; // bytes held by compact windows
+};
+
+struct Arena;
+
+// every buffer is prefixed by header keeping its arena (if any) and
+// references count, header is 16 bytes to keep fractions aligned for
+// vector kernels
+struct Header {
+    Arena*                  pArena;
+    std::atomic<uint32_t>   nRefs;
+    uint32_t                nReserved;
+};
+
+inline Header* HeaderOf(const int64_t* p)
+{
+    return reinterpret_cast<Header*>(reinterpret_cast<char*>(const_cast<int64_t*>(p)) - sizeof(Header));
+}
+
+// buffers are reference counted, Alloc returns buffer with one reference
+int64_t*    Alloc();
+// returns p with one more reference, arena buffer is shared only while
+// its arena is the open one, otherwise a copy is returned
+int64_t*    Share(int64_t* p);
+void        Release(int64_t*);
+// private copy of shared buffer, reference to p is released
+int64_t*    Unshare(int64_t* p);
+Stats       GetStats();
+
+inline bool IsShared(const int64_t* p)
+{
+    return HeaderOf(p)->nRefs.load(std::memory_order_acquire) > 1;
+}
+
+// compact form of fractions: only slots [nFrom,nTo) are kept,
+// all other slots are zero
+struct Window {
+    std::atomic<uint32_t>   nRefs;
+    int16_t                 nFrom;
+    int16_t                 nTo;
+
+    static const int64_t nZero;
+    int64_t* Values() { return reinterpret_cast<int64_t*>(this+1); }
+    const int64_t* Values() const { return reinterpret_cast<const int64_t*>(this+1); }
+    const int64_t& At(int i) const {
+        return (i >= nFrom && i < nTo) ? Values()[i-nFrom] : nZero;
+    }
+};
+
+Window*     WindowAlloc(int from, int to);
+Window*     WindowShare(Window*);
+void        WindowRelease(Window*);
+size_t      WindowBytes(const Window*);
+// dense buffer with the window values, never from arena
+int64_t*    Expand(const Window*);
+
+}
+
+/** Fractions storage shared between copies until one of them is
+ *  modified (copy on write). Any non-const access is treated as a
+ *  modification, reads via const CFractions do not copy.
+ *  References taken from non-const access are not to be kept over
+ *  copying of the owner.
+ *  The storage can be compacted to a window of non-zero slots. Compact
+ *  storage is read only: const element access reads the window,
+ *  CFractionsDense gives a temporary dense copy for kernels, and it has
+ *  to be expanded with Decompact() before any non-const access.
+ */
+class CFractionsBuffer {
+public:
+    CFractionsBuffer() :p(pegalloc::Alloc()) {}
+    CFractionsBuffer(const CFractionsBuffer & o);
+    CFractionsBuffer(CFractionsBuffer && o) noexcept;
+    ~CFractionsBuffer();
+
+    CFractionsBuffer& operator=(const CFractionsBuffer & o);
+    CFractionsBuffer& operator=(CFractionsBuffer && o) noexcept;
+
+    int64_t* get() {
+        assert(!w); // compact storage, see Decompact()
+        if (!p || pegalloc::IsShared(p)) Detach();
+        return p;
+    }
+    const int64_t* get() const {
+        assert(!w); // compact storage, see CFractionsDense
+        return p;
+    }
+    int64_t& operator[](int i) { return get()[i]; }
+    const int64_t& operator[](int i) const {
+        return w ? w->At(i) : p[i];
+    }
+    bool IsShared() const;
+
+    // keeps only slots [from,to), the others have to be zero
+    void Compact(int from, int to);
+    // expands compact storage back to the dense buffer
+    void Decompact();
+    const pegalloc::Window* GetWindow() const { return w; }
+    size_t MemoryUsage() const;
+
+private:
+    void Detach();
+    int64_t* p;                     // dense buffer, null when compact
+    pegalloc::Window* w = nullptr;  // window, null when dense
+};
+
+/** Dense read only view of fractions storage for the kernels. Compact
+ *  storage is expanded into a buffer owned by the view and released
+ *  with it, the storage itself stays compact.
+ */
+class CFractionsDense {
+public:
+    explicit CFractionsDense(const CFractionsBuffer & b);
+    ~CFractionsDense();
+
+    const int64_t* get() const { return d; }
+
+private:
+    CFractionsDense(const CFractionsDense&) = delete;
+    CFractionsDense& operator=(const CFractionsDense&) = delete;
+    const int64_t* d;
+    int64_t* pExpanded = nullptr;
+};
+
+/** Scoped arena for fractions buffers, released all at once.
+ *  Buffers that outlive the arena scope are still valid: the slabs are
+ *  released when the scope is closed and the last buffer is returned.
+ *  Use CFractionsArena::Pause around code which stores fractions for
+ *  longer (wallet, caches) to keep such buffers out of the arena, copies
+ *  of arena fractions made there do not share the arena buffer.
+ */
+class CFractionsArena {
+public:
+    CFractionsArena();
+    ~CFractionsArena();
+
+    class Pause {
+    public:
+        Pause();
+        ~Pause();
+    private:
+        Pause(const Pause&) = delete;
+        Pause& operator=(const Pause&) = delete;
+        void* pPaused;
+    };
+
+private:
+    CFractionsArena(const CFractionsArena&) = delete;
+    CFractionsArena& operator=(const CFractionsArena&) = delete;
+    void* pArena;
+    void* pPrev;
+};
+
+#endif
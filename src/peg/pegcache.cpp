@@ -0,0 +1,161 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#include "pegcache.h"
+#include "pegalloc.h"
+
+using namespace std;
+
+// approximate bookkeeping per entry: list node, map node, key copy
+static const size_t nEntryOverhead = sizeof(pair<uint320, CFractions>) + 2*sizeof(uint320) + 96;
+
+CFractionsCache::CFractionsCache(size_t nMaxBytes)
+    :nMaxShardBytes(nMaxBytes / nShards)
+    ,nHits(0)
+    ,nMisses(0)
+    ,nInserts(0)
+    ,nEvictions(0)
+    ,nInvalidations(0)
+{
+}
+
+CFractionsCache::Shard& CFractionsCache::ShardOf(const uint320 & key)
+{
+    return shards[(key.GetLow64() ^ key.b2()) % nShards];
+}
+
+const CFractionsCache::Shard& CFractionsCache::ShardOf(const uint320 & key) const
+{
+    return shards[(key.GetLow64() ^ key.b2()) % nShards];
+}
+
+bool CFractionsCache::Lookup(const uint320 & key, CFractions & f)
+{
+    Shard & shard = ShardOf(key);
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            f = it->second->second;
+            f.nVersion = it->second->second.nVersion;
+            nHits++;
+            return true;
+        }
+    }
+    nMisses++;
+    return false;
+}
+
+uint64_t CFractionsCache::Generation(const uint320 & key) const
+{
+    const Shard & shard = ShardOf(key);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    return shard.nGeneration;
+}
+
+bool CFractionsCache::Insert(const uint320 & key, const CFractions & f, uint64_t nGeneration)
+{
+    size_t nMax = nMaxShardBytes.load(std::memory_order_relaxed);
+    if (nMax == 0)
+        return false;
+
+    // the cached copy must not share an arena buffer, it is
+    // compacted before taking the lock
+    CFractionsArena::Pause pause;
+    CFractions cached(f);
+    cached.nVersion = f.nVersion;
+    cached.Compact();
+    size_t nBytes = cached.MemoryUsage() + nEntryOverhead;
+    if (nBytes > nMax)
+        return false;
+
+    Shard & shard = ShardOf(key);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    if (shard.nGeneration != nGeneration)
+        return false;
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return true;
+    }
+    while (shard.nBytes + nBytes > nMax && !shard.lru.empty()) {
+        Erase(shard, shard.index.find(shard.lru.back().first));
+        nEvictions++;
+    }
+    shard.lru.emplace_front(key, std::move(cached));
+    shard.index[key] = shard.lru.begin();
+    shard.nBytes += nBytes;
+    nInserts++;
+    return true;
+}
+
+void CFractionsCache::Erase(Shard & shard, std::map<uint320, Entries::iterator>::iterator it)
+{
+    size_t nBytes = it->second->second.MemoryUsage() + nEntryOverhead;
+    shard.nBytes -= std::min(nBytes, shard.nBytes);
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+}
+
+void CFractionsCache::Invalidate(const uint320 & key)
+{
+    Shard & shard = ShardOf(key);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    shard.nGeneration++;
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+        return;
+    Erase(shard, it);
+    nInvalidations++;
+}
+
+void CFractionsCache::Clear()
+{
+    for (int i=0; i<nShards; i++) {
+        Shard & shard = shards[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.nGeneration++;
+        shard.index.clear();
+        shard.lru.clear();
+        shard.nBytes = 0;
+    }
+}
+
+void CFractionsCache::SetMaxBytes(size_t nMaxBytes)
+{
+    size_t nMax = nMaxBytes / nShards;
+    nMaxShardBytes.store(nMax, std::memory_order_relaxed);
+    for (int i=0; i<nShards; i++) {
+        Shard & shard = shards[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        while (shard.nBytes > nMax && !shard.lru.empty()) {
+            Erase(shard, shard.index.find(shard.lru.back().first));
+            nEvictions++;
+        }
+    }
+}
+
+CFractionsCache::Stats CFractionsCache::GetStats() const
+{
+    Stats stats;
+    stats.nHits             = nHits.load(std::memory_order_relaxed);
+    stats.nMisses           = nMisses.load(std::memory_order_relaxed);
+    stats.nInserts          = nInserts.load(std::memory_order_relaxed);
+    stats.nEvictions        = nEvictions.load(std::memory_order_relaxed);
+    stats.nInvalidations    = nInvalidations.load(std::memory_order_relaxed);
+    stats.nMaxBytes         = nMaxShardBytes.load(std::memory_order_relaxed) * nShards;
+    for (int i=0; i<nShards; i++) {
+        const Shard & shard = shards[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        stats.nEntries += shard.index.size();
+        stats.nBytes += shard.nBytes;
+    }
+    return stats;
+}
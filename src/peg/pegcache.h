@@ -0,0 +1,82 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#ifndef BITBAY_PEGCACHE_H
+#define BITBAY_PEGCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <utility>
+
+#include <boost/thread/mutex.hpp>
+
+#include "uint256.h"
+#include "pegdata.h"
+
+/** Cache of decoded fractions of pegdb, keyed by txout (uint320).
+ *  Split into shards with own lock and LRU list, bounded by memory usage
+ *  of the kept fractions. Cached fractions are stored compacted and out
+ *  of arenas, lookups return copies sharing the cached buffer.
+ *  To not insert a value read before a concurrent write the reader takes
+ *  a generation of the key shard before reading the db and passes it to
+ *  Insert, any Invalidate of the shard in between rejects the insert.
+ */
+class CFractionsCache {
+public:
+    struct Stats {
+        uint64_t nHits          = 0;
+        uint64_t nMisses        = 0;
+        uint64_t nInserts       = 0;
+        uint64_t nEvictions     = 0;
+        uint64_t nInvalidations = 0;
+        uint64_t nEntries       = 0;
+        uint64_t nBytes         = 0;
+        uint64_t nMaxBytes      = 0;
+    };
+
+    explicit CFractionsCache(size_t nMaxBytes);
+
+    bool        Lookup(const uint320 & key, CFractions & f);
+    uint64_t    Generation(const uint320 & key) const;
+    bool        Insert(const uint320 & key, const CFractions & f, uint64_t nGeneration);
+    void        Invalidate(const uint320 & key);
+    void        Clear();
+
+    void        SetMaxBytes(size_t nMaxBytes);
+    Stats       GetStats() const;
+
+    static const int nShards = 16;
+
+private:
+    typedef std::pair<uint320, CFractions> Entry;
+    typedef std::list<Entry> Entries;
+
+    struct Shard {
+        mutable boost::mutex    mutex;
+        Entries                 lru; // most recently used first
+        std::map<uint320, Entries::iterator> index;
+        size_t                  nBytes = 0;
+        uint64_t                nGeneration = 0;
+    };
+
+    Shard&          ShardOf(const uint320 & key);
+    const Shard&    ShardOf(const uint320 & key) const;
+    void            Erase(Shard & shard, std::map<uint320, Entries::iterator>::iterator it);
+
+    Shard                   shards[nShards];
+    std::atomic<size_t>     nMaxShardBytes;
+    std::atomic<uint64_t>   nHits;
+    std::atomic<uint64_t>   nMisses;
+    std::atomic<uint64_t>   nInserts;
+    std::atomic<uint64_t>   nEvictions;
+    std::atomic<uint64_t>   nInvalidations;
+};
+
+#endif
@@ -10,8 +10,10 @@
 #define BITBAY_PEGDATA_H
 
 #include "bignum.h"
+#include "pegalloc.h"
 #include <cstdint>
 #include <string>
+#include <memory>
 
 enum
 {
@@ -80,6 +82,31 @@ private:
     bool Unpack1(CDataStream &);
 };
 
+/** Read-only window over std fractions, slots [nFrom,nTo), where
+ *  the slot nEdge (if any) is replaced by nEdgeValue. Gives the same
+ *  results as LowPart/HighPart followed by reductions but without
+ *  building the part fractions.
+ */
+class CFractionsRange {
+public:
+    CFractionsRange(const int64_t* f, int from, int to);
+
+    int64_t Total() const;
+    int16_t HLI() const;
+    void Signed(int64_t* positive, int64_t* negative) const;
+
+private:
+    friend class CFractions;
+    int64_t At(int i) const { return i == nEdge ? nEdgeValue : f[i]; }
+
+    const int64_t* f;
+    int nFrom;
+    int nTo;
+    int nEdge           = -1;
+    int64_t nEdgeValue  = 0;
+    std::shared_ptr<const CFractions> pStd; // holds dense std of value or compact fractions
+};
+
 class CFractions {
 public:
     uint8_t     nVersion   = 1;
@@ -104,16 +131,25 @@ public:
         SER_MASK    = 0xffff,
         SER_VALUE   = (1 << 16),
         SER_ZDELTA  = (1 << 17),
-        SER_RAW     = (1 << 18)
+        SER_RAW     = (1 << 18),
+        SER_VDELTA  = (1 << 19)  // zigzag varint deltas of non-zero window
     };
-    std::unique_ptr<int64_t[]> f;
+    CFractionsBuffer f;
 
     CFractions();
     CFractions(int64_t, uint32_t flags);
     CFractions(const CFractions &);
+    CFractions(CFractions &&) noexcept;
     CFractions& operator=(const CFractions&);
+    CFractions& operator=(CFractions&&) noexcept;
+
+    bool IsShared() const { return f.IsShared(); }
+    bool IsCompact() const { return f.GetWindow() != nullptr; }
+    bool Compact();
+    void Decompact() { f.Decompact(); }
+    size_t MemoryUsage() const { return f.MemoryUsage(); }
 
-    bool Pack(CDataStream &, unsigned long* len =nullptr, bool compress=true) const;
+    bool Pack(CDataStream &, unsigned long* len =nullptr, uint32_t codec =SER_ZDELTA) const;
     bool Unpack(CDataStream &);
 
     CFractions Std() const;
@@ -138,11 +174,22 @@ public:
 
     void ToDeltas(int64_t* deltas) const;
     void FromDeltas(const int64_t* deltas);
+    size_t ToVDeltas(unsigned char* out) const;
+    bool FromVDeltas(const unsigned char* inp, size_t len);
 
     int64_t Low(int supply) const;
     int64_t High(int supply) const;
     int64_t Low(const CPegLevel &) const;
     int64_t High(const CPegLevel &) const;
+    void    LowHigh(int supply, int64_t* low, int64_t* high) const;
+    void    LowHigh(const CPegLevel &, int64_t* low, int64_t* high) const;
+    CFractionsRange Range(int from, int to) const;
+    CFractionsRange LowRange(int supply) const { return Range(0, supply); }
+    CFractionsRange HighRange(int supply) const { return Range(supply, PEG_SIZE); }
+    CFractionsRange LowRange(const CPegLevel &) const;
+    CFractionsRange HighRange(const CPegLevel &) const;
+    static int64_t StdLow(int64_t value, int supply);
+    static int64_t StdHigh(int64_t value, int supply);
     int64_t NChange(const CPegLevel &) const;
     int64_t NChange(int src_supply, int dst_supply) const;
     int16_t HLI() const;
@@ -155,6 +202,7 @@ public:
 
 private:
     void ToStd();
+    int64_t Sum(int from, int to) const;
     friend class CPegData;
     bool Unpack1(CDataStream &);
     bool Unpack2(CDataStream &);
@@ -35,6 +35,7 @@ bool CPegLevel::Unpack1(CDataStream & finp) {
 
 bool CFractions::Unpack2(CDataStream& inp)
 {
+    f.Decompact();
     uint32_t nSerFlags = 0;
     inp >> nSerFlags;
     inp >> nLockTime;
@@ -81,6 +82,7 @@ bool CFractions::Unpack2(CDataStream& inp)
 
 bool CFractions::Unpack1(CDataStream& inp)
 {
+    f.Decompact();
     uint32_t nSerFlags = 0;
     inp >> nSerFlags;
     inp >> nLockTime;
@@ -22,6 +22,7 @@
 #include "chainparams.h"
 #include "base58.h"
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 
@@ -30,12 +31,19 @@ using namespace boost;
 
 leveldb::DB *pegdb; // global pointer for LevelDB object instance
 
+static CFractionsCache& FractionsCache() {
+    static CFractionsCache cache(GetArg("-pegcache", 64) * 1048576);
+    return cache;
+}
+
+static CDBOptions& DBOptions() {
+    static CDBOptions dbopts;
+    return dbopts;
+}
+
 static leveldb::Options GetOptions() {
-    leveldb::Options options;
-    int nCacheSizeMB = GetArg("-dbcache", 50);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    return options;
+    DBOptions() = GetDBOptions("pegdb");
+    return MakeLevelDBOptions(DBOptions());
 }
 
 static void init_blockindex(leveldb::Options& options, bool fRemoveOld = false, bool fCreateBootstrap = false) {
@@ -52,6 +60,7 @@ static void init_blockindex(leveldb::Options& options, bool fRemoveOld = false,
 // CDB subclasses are created and destroyed VERY OFTEN. That's why
 // we shouldn't treat this as a free operations.
 CPegDB::CPegDB(const char* pszMode)
+    :bufferView(&WriteBuffer())
 {
     assert(pszMode);
     activeBatch = NULL;
@@ -66,7 +75,6 @@ CPegDB::CPegDB(const char* pszMode)
 
     options = GetOptions();
     options.create_if_missing = fCreate;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
     init_blockindex(options); // Init directory
     pdb = pegdb;
@@ -108,6 +116,7 @@ CPegDB::CPegDB(const char* pszMode)
 
 void CPegDB::Close()
 {
+    FlushWriteBuffer(true);
     delete pegdb;
     pegdb = pdb = NULL;
     delete options.filter_policy;
@@ -116,21 +125,29 @@ void CPegDB::Close()
     options.block_cache = NULL;
     delete activeBatch;
     activeBatch = NULL;
+    vBatchFractions.clear();
+    FractionsCache().Clear();
 }
 
 bool CPegDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CDBBatch(&WriteBuffer());
     return true;
 }
 
 bool CPegDB::TxnCommit()
 {
     assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
+    leveldb::Status status;
+    if (!WriteBuffer().Commit(*activeBatch))
+        status = activeBatch->Write(pdb);
     delete activeBatch;
     activeBatch = NULL;
+    // drop values cached by readers in the meantime
+    for (const uint320 & txout : vBatchFractions)
+        FractionsCache().Invalidate(txout);
+    vBatchFractions.clear();
     if (!status.ok()) {
         LogPrintf("LevelDB batch commit failure: %s\n", status.ToString());
         return false;
@@ -138,53 +155,67 @@ bool CPegDB::TxnCommit()
     return true;
 }
 
-class CPegBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
-
-    CPegBatchScanner() : foundEntry(false) {}
+CDBWriteBuffer& CPegDB::WriteBuffer()
+{
+    static CDBWriteBuffer buffer;
+    return buffer;
+}
 
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        }
-    }
+bool CPegDB::GetDBStats(CDBStats& stats)
+{
+    if (!pegdb)
+        return false;
+    // fractions and peg txids are keyed by hashes, not by prefixes
+    stats.options = DBOptions();
+    GetLevelDBStats(pegdb, vector<string>(), stats);
+    return true;
+}
 
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
-        }
-    }
-};
+bool CPegDB::FlushWriteBuffer(bool fDisable)
+{
+    if (!pegdb)
+        return true;
+    leveldb::Status status = WriteBuffer().Flush(pegdb, fDisable);
+    if (!status.ok())
+        return error("CPegDB::FlushWriteBuffer() : LevelDB write failure: %s", status.ToString());
+    return true;
+}
 
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. The batch keeps
+// its changes indexed, so the lookup does not depend on the batch size.
+// Commits kept by the write buffer are looked up the same way.
 bool CPegDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
-    assert(activeBatch);
-    *deleted = false;
-    CPegBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
-    }
-    return scanner.foundEntry;
+    return ReadBatch()->Get(key.str(), value, deleted);
 }
 
 bool CPegDB::ReadFractions(uint320 txout, CFractions & f, bool must_have) {
+    CFractionsCache & cache = FractionsCache();
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << txout;
     std::string strValue;
-    if (!ReadStr(txout, strValue)) {
+    bool fCacheable = true;
+    bool fFound = false;
+    if (HasBatch()) {
+        // values pending in the batch or the write buffer are not cached
+        bool deleted = false;
+        fFound = ScanBatch(ssKey, &strValue, &deleted);
+        fCacheable = !fFound && !deleted;
+        if (deleted)
+            fFound = false;
+    }
+    uint64_t nGeneration = 0;
+    if (fCacheable) {
+        if (cache.Lookup(txout, f))
+            return true;
+        nGeneration = cache.Generation(txout);
+        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue);
+        fFound = status.ok();
+        if (!fFound && !status.IsNotFound())
+            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+    }
+    if (!fFound) {
         if (must_have) {
             // Have a flag indicating that pegdb should have these
             // fractions, otherwise it indicates the pegdb fail
@@ -196,13 +227,125 @@ bool CPegDB::ReadFractions(uint320 txout, CFractions & f, bool must_have) {
     }
     CDataStream finp(strValue.data(), strValue.data() + strValue.size(),
                      SER_DISK, CLIENT_VERSION);
-    return f.Unpack(finp);
+    if (!f.Unpack(finp))
+        return false;
+    if (fCacheable)
+        cache.Insert(txout, f, nGeneration);
+    return true;
 }
 bool CPegDB::WriteFractions(uint320 txout, const CFractions & f) {
     CDataStream fout(SER_DISK, CLIENT_VERSION);
-    f.Pack(fout);
+    f.Pack(fout, nullptr, CFractions::SER_VDELTA);
+    FractionsCache().Invalidate(txout);
+    if (activeBatch)
+        vBatchFractions.push_back(txout);
     return Write(txout, fout);
 }
+bool CPegDB::EraseFractions(uint320 txout) {
+    FractionsCache().Invalidate(txout);
+    if (activeBatch)
+        vBatchFractions.push_back(txout);
+    return Erase(txout);
+}
+
+CFractionsCache::Stats CPegDB::GetFractionsCacheStats() {
+    return FractionsCache().GetStats();
+}
+
+bool CPegDB::BenchFractions(int64_t nMaxRecords, bool fMigrate, CPegDBCodecStats & stats)
+{
+    if (fMigrate && fReadOnly)
+        assert(!"BenchFractions migrate called on database in read-only mode");
+
+    typedef std::chrono::steady_clock Clock;
+    auto ns = [](Clock::duration d) {
+        return int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    };
+
+    leveldb::WriteBatch batch;
+    int64_t nBatched = 0;
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    for(iterator->SeekToFirst(); iterator->Valid(); iterator->Next()) {
+        if (nMaxRecords >= 0 && stats.nRecords >= nMaxRecords)
+            break;
+        // fractions are keyed by txout
+        leveldb::Slice slKey = iterator->key();
+        leveldb::Slice slValue = iterator->value();
+        if (slKey.size() != sizeof(uint320) || slValue.size() < 5)
+            continue;
+
+        // version byte then serialization flags
+        uint32_t nSerFlags = 0;
+        memcpy(&nSerFlags, slValue.data()+1, sizeof(nSerFlags));
+        CFractions fractions;
+        try {
+            CDataStream finp(slValue.data(), slValue.data() + slValue.size(),
+                             SER_DISK, CLIENT_VERSION);
+            if (!fractions.Unpack(finp))
+                continue;
+        }
+        catch (std::exception &) {
+            continue;
+        }
+
+        stats.nRecords++;
+        stats.nStoredBytes += slValue.size();
+        if (nSerFlags & CFractions::SER_VALUE) {
+            stats.nValueRecords++;
+            continue;
+        }
+        if (nSerFlags & CFractions::SER_ZDELTA) stats.nZDeltaRecords++;
+        if (nSerFlags & CFractions::SER_VDELTA) stats.nVDeltaRecords++;
+        if (nSerFlags & CFractions::SER_RAW) stats.nRawRecords++;
+        stats.nCodecRecords++;
+
+        std::string strVDelta;
+        for(uint32_t nCodec : {uint32_t(CFractions::SER_ZDELTA), uint32_t(CFractions::SER_VDELTA)}) {
+            CDataStream fout(SER_DISK, CLIENT_VERSION);
+            auto t0 = Clock::now();
+            fractions.Pack(fout, nullptr, nCodec);
+            auto t1 = Clock::now();
+            int64_t nBytes = fout.size();
+            if (nCodec == CFractions::SER_VDELTA)
+                strVDelta = fout.str();
+            CFractions decoded;
+            auto t2 = Clock::now();
+            decoded.Unpack(fout);
+            auto t3 = Clock::now();
+            if (nCodec == CFractions::SER_ZDELTA) {
+                stats.nZDeltaBytes += nBytes;
+                stats.nZDeltaEncodeNs += ns(t1-t0);
+                stats.nZDeltaDecodeNs += ns(t3-t2);
+            } else {
+                stats.nVDeltaBytes += nBytes;
+                stats.nVDeltaEncodeNs += ns(t1-t0);
+                stats.nVDeltaDecodeNs += ns(t3-t2);
+            }
+        }
+
+        if (fMigrate && (nSerFlags & CFractions::SER_VDELTA) == 0) {
+            batch.Put(slKey, strVDelta);
+            stats.nMigrated++;
+            if (++nBatched >= 1000) {
+                leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+                if (!status.ok()) {
+                    delete iterator;
+                    return error("BenchFractions() : batch write failure: %s", status.ToString());
+                }
+                batch.Clear();
+                nBatched = 0;
+            }
+        }
+    }
+    delete iterator;
+
+    if (nBatched >0) {
+        leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+        if (!status.ok())
+            return error("BenchFractions() : batch write failure: %s", status.ToString());
+    }
+    return true;
+}
 
 bool CPegDB::ReadPegStartHeight(int& nHeight)
 {
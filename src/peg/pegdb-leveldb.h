@@ -8,6 +8,9 @@
 
 #include "main.h"
 #include "peg.h"
+#include "pegcache.h"
+#include "dbbatch.h"
+#include "dboptions.h"
 
 #include <map>
 #include <string>
@@ -16,6 +19,24 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+/** Codec statistics of stored fractions, see CPegDB::BenchFractions */
+struct CPegDBCodecStats {
+    int64_t nRecords        = 0;
+    int64_t nStoredBytes    = 0;
+    int64_t nValueRecords   = 0;
+    int64_t nZDeltaRecords  = 0;
+    int64_t nVDeltaRecords  = 0;
+    int64_t nRawRecords     = 0;
+    int64_t nCodecRecords   = 0; // not value records, used for codecs
+    int64_t nZDeltaBytes    = 0;
+    int64_t nZDeltaEncodeNs = 0;
+    int64_t nZDeltaDecodeNs = 0;
+    int64_t nVDeltaBytes    = 0;
+    int64_t nVDeltaEncodeNs = 0;
+    int64_t nVDeltaDecodeNs = 0;
+    int64_t nMigrated       = 0;
+};
+
 class CPegDB
 {
 public:
@@ -31,18 +52,36 @@ public:
 
     bool ReadFractions(uint320 txout, CFractions &, bool must_have =false);
     bool WriteFractions(uint320 txout, const CFractions &);
+    bool EraseFractions(uint320 txout);
+    // measures zdelta and vdelta codecs on stored fractions, optionally
+    // rewrites records of older codecs with vdelta
+    bool BenchFractions(int64_t nMaxRecords, bool fMigrate, CPegDBCodecStats &);
+
+    // decoded fractions cache shared by all CPegDB objects
+    static CFractionsCache::Stats GetFractionsCacheStats();
 
 private:
     leveldb::DB *pdb;  // Points to the global instance.
 
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    CDBBatch *activeBatch;
+    // Empty batch on the write buffer, for the reads made outside of
+    // a transaction while the write buffer is enabled
+    CDBBatch bufferView;
+    // fractions written or erased in activeBatch, invalidated in the
+    // cache once more after commit
+    std::vector<uint320> vBatchFractions;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
 
 protected:
+    // Pending changes to look at before disk: an open transaction, or
+    // commits kept by the write buffer
+    bool HasBatch() const { return activeBatch || WriteBuffer().IsEnabled(); }
+    const CDBBatch* ReadBatch() const { return activeBatch ? activeBatch : &bufferView; }
+
     // Returns true and sets (value,false) if activeBatch contains the given key
     // or leaves value alone and sets deleted = true if activeBatch contains a
     // delete for it.
@@ -57,7 +96,7 @@ protected:
         std::string strValue;
 
         bool readFromDb = true;
-        if (activeBatch) {
+        if (HasBatch()) {
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
@@ -96,7 +135,7 @@ protected:
         ssKey << key;
 
         bool readFromDb = true;
-        if (activeBatch) {
+        if (HasBatch()) {
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
@@ -137,6 +176,8 @@ public:
             activeBatch->Put(ssKey.str(), ssValue.str());
             return true;
         }
+        if (WriteBuffer().Put(ssKey.str(), ssValue.str()))
+            return true;
         leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
         if (!status.ok()) {
             LogPrintf("LevelDB write failure: %s\n", status.ToString());
@@ -160,6 +201,8 @@ public:
             activeBatch->Delete(ssKey.str());
             return true;
         }
+        if (WriteBuffer().Delete(ssKey.str()))
+            return true;
         leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
         return (status.ok() || status.IsNotFound());
     }
@@ -172,11 +215,10 @@ public:
         ssKey << key;
         std::string unused;
 
-        if (activeBatch) {
+        if (HasBatch()) {
             bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
-            }
+            if (ScanBatch(ssKey, &unused, &deleted))
+                return !deleted;
         }
 
 
@@ -192,9 +234,18 @@ public:
     {
         delete activeBatch;
         activeBatch = NULL;
+        vBatchFractions.clear();
         return true;
     }
 
+    // Commits kept in memory while the write buffer is enabled, written
+    // in one leveldb write by FlushWriteBuffer, see CDBWriteBuffer
+    static CDBWriteBuffer& WriteBuffer();
+    static bool FlushWriteBuffer(bool fDisable);
+
+    // LevelDB statistics and options of the database, false if not open
+    static bool GetDBStats(CDBStats& stats);
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
@@ -7,10 +7,12 @@
 // Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
 
 #include "pegdata.h"
+#include "pegkernels.h"
 
 #include <map>
 #include <set>
 #include <cstdint>
+#include <cstring>
 #include <utility>
 #include <algorithm>
 #include <type_traits>
@@ -27,13 +29,11 @@ using namespace boost;
 
 CFractions::CFractions()
     :nFlags(VALUE)
-    ,f(new int64_t[PEG_SIZE])
 {
     f[0] = 0; // fast init first item
 }
 CFractions::CFractions(int64_t value, uint32_t flags)
     :nFlags(flags)
-    ,f(new int64_t[PEG_SIZE])
 {
     if (flags & VALUE)
         f[0] = value; // fast init first item
@@ -47,15 +47,20 @@ CFractions::CFractions(int64_t value, uint32_t flags)
         assert(0);
     }
 }
+// copies share the buffer until modified, see CFractionsBuffer
 CFractions::CFractions(const CFractions & o)
     :nFlags(o.nFlags)
     ,nLockTime(o.nLockTime)
     ,sReturnAddr(o.sReturnAddr)
-    ,f(new int64_t[PEG_SIZE])
+    ,f(o.f)
+{
+}
+CFractions::CFractions(CFractions && o) noexcept
+    :nFlags(o.nFlags)
+    ,nLockTime(o.nLockTime)
+    ,sReturnAddr(std::move(o.sReturnAddr))
+    ,f(std::move(o.f))
 {
-    for(int i=0; i< PEG_SIZE; i++) {
-        f[i] = o.f[i];
-    }
 }
 
 CFractions& CFractions::operator=(const CFractions& o)
@@ -63,9 +68,15 @@ CFractions& CFractions::operator=(const CFractions& o)
     nFlags = o.nFlags;
     nLockTime = o.nLockTime;
     sReturnAddr = o.sReturnAddr;
-    for(int i=0; i< PEG_SIZE; i++) {
-        f[i] = o.f[i];
-    }
+    f = o.f;
+    return *this;
+}
+CFractions& CFractions::operator=(CFractions&& o) noexcept
+{
+    nFlags = o.nFlags;
+    nLockTime = o.nLockTime;
+    sReturnAddr = std::move(o.sReturnAddr);
+    f = std::move(o.f);
     return *this;
 }
 
@@ -95,7 +106,241 @@ void CFractions::FromDeltas(const int64_t* deltas)
     }
 }
 
-bool CFractions::Pack(CDataStream& out, unsigned long* report_len, bool compress) const
+// SER_VDELTA: window [from,to) of non-zero slots, predictor mode, then
+// zigzag varints of differences to the predicted slots, zero differences
+// are run-length coded as 0 followed by the run length. Predictors:
+// VDELTA_REMAIN follows std decay of value remaining at window start,
+// VDELTA_PREV decays the previous slot (std parts scaled by ratio).
+// The first byte tells if the varints are deflated (fast level).
+static const size_t nVDeltaMaxLen = 1 + 4*10 + PEG_SIZE*10;
+static const int nVDeltaProbe = 32;
+static const int nVDeltaDeflateFrom = 96; // deflate longer varints
+
+enum {
+    VDELTA_PLAIN    = 0,
+    VDELTA_DEFLATE  = 1
+};
+
+enum {
+    VDELTA_REMAIN   = 0,
+    VDELTA_PREV     = 1
+};
+
+static inline void PutVarInt(unsigned char*& p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = uint8_t(v) | 0x80;
+        v >>= 7;
+    }
+    *p++ = uint8_t(v);
+}
+
+static inline bool GetVarInt(const unsigned char*& p, const unsigned char* end, uint64_t& v)
+{
+    v = 0;
+    for(int shift=0; shift<64; shift+=7) {
+        if (p == end) return false;
+        uint8_t b = *p++;
+        v |= uint64_t(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static inline uint64_t ZigZag(uint64_t v) { return (v << 1) ^ (0 - (v >> 63)); }
+static inline uint64_t UnZigZag(uint64_t z) { return (z >> 1) ^ (0 - (z & 1)); }
+
+// values are handled in unsigned arithmetic to wrap on any input,
+// state is remaining value or previous slot depending on mode
+static inline uint64_t VDeltaPredict(int mode, uint64_t state, int i)
+{
+    if (mode == VDELTA_PREV)
+        return state - uint64_t(int64_t(state) / PEG_RATE);
+    if (i == PEG_SIZE-1)
+        return state;
+    return uint64_t(int64_t(state) / PEG_RATE);
+}
+
+static inline uint64_t VDeltaNext(int mode, uint64_t state, uint64_t v)
+{
+    return mode == VDELTA_PREV ? v : state - v;
+}
+
+static unsigned char* PutVDeltas(unsigned char* p, const int64_t* f, int from, int to,
+                                 int mode, uint64_t state)
+{
+    PutVarInt(p, from);
+    PutVarInt(p, to-from);
+    PutVarInt(p, mode);
+    if (mode == VDELTA_REMAIN)
+        PutVarInt(p, ZigZag(state));
+    uint64_t nZeros = 0;
+    for(int i=from; i<to; i++) {
+        uint64_t v = uint64_t(f[i]);
+        uint64_t delta = v - VDeltaPredict(mode, state, i);
+        state = VDeltaNext(mode, state, v);
+        if (delta == 0) {
+            nZeros++;
+            continue;
+        }
+        if (nZeros) {
+            PutVarInt(p, 0);
+            PutVarInt(p, nZeros);
+            nZeros = 0;
+        }
+        PutVarInt(p, ZigZag(delta));
+    }
+    if (nZeros) {
+        PutVarInt(p, 0);
+        PutVarInt(p, nZeros);
+    }
+    return p;
+}
+
+size_t CFractions::ToVDeltas(unsigned char* out) const
+{
+    int from = 0;
+    int to = PEG_SIZE;
+    const int64_t* d = nullptr;
+    int64_t dense[PEG_SIZE];
+    auto w = f.GetWindow();
+    if (w) {
+        // keep compact fractions compact
+        from = w->nFrom;
+        to = w->nTo;
+        std::copy(w->Values(), w->Values()+(to-from), dense+from);
+        d = dense;
+    } else {
+        d = f.get();
+    }
+    while (from < to && d[from] == 0) from++;
+    while (to > from && d[to-1] == 0) to--;
+
+    // remaining value at window start: sum of the window is exact for
+    // std fractions up to the end, a low part misses the value above
+    // the window which is probed from the first slot
+    auto mismatches = [&](uint64_t remain) {
+        int n = 0;
+        for(int i=from; i<to && i<from+nVDeltaProbe; i++) {
+            uint64_t v = uint64_t(d[i]);
+            if (v != VDeltaPredict(VDELTA_REMAIN, remain, i)) n++;
+            remain -= v;
+        }
+        return n;
+    };
+    uint64_t nRemain = 0;
+    for(int i=from; i<to; i++) {
+        nRemain += uint64_t(d[i]);
+    }
+    if (from < to) {
+        int nBest = mismatches(nRemain);
+        uint64_t nBase = uint64_t(d[from]) * PEG_RATE;
+        for(int r=0; r<PEG_RATE && nBest >0; r++) {
+            int n = mismatches(nBase + r);
+            if (n < nBest) {
+                nBest = n;
+                nRemain = nBase + r;
+            }
+        }
+    }
+
+    unsigned char vout[nVDeltaMaxLen];
+    unsigned char* pEnd = PutVDeltas(vout, d, from, to, VDELTA_REMAIN, nRemain);
+    if (pEnd - vout > nVDeltaDeflateFrom) {
+        unsigned char prev[nVDeltaMaxLen];
+        unsigned char* pPrevEnd = PutVDeltas(prev, d, from, to, VDELTA_PREV, 0);
+        if (pPrevEnd - prev < pEnd - vout) {
+            pEnd = std::copy(prev, pPrevEnd, vout);
+        }
+    }
+    unsigned long vlen = pEnd - vout;
+
+    if (vlen > nVDeltaDeflateFrom) {
+        // small window and memory level as varints are few kilobytes
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 10, 1, Z_DEFAULT_STRATEGY) == Z_OK) {
+            zs.next_in = vout;
+            zs.avail_in = vlen;
+            zs.next_out = out+1;
+            zs.avail_out = nVDeltaMaxLen-1;
+            int res = deflate(&zs, Z_FINISH);
+            unsigned long zlen = zs.total_out;
+            deflateEnd(&zs);
+            if (res == Z_STREAM_END && zlen < vlen) {
+                out[0] = VDELTA_DEFLATE;
+                return zlen+1;
+            }
+        }
+    }
+    out[0] = VDELTA_PLAIN;
+    std::copy(vout, pEnd, out+1);
+    return vlen+1;
+}
+
+bool CFractions::FromVDeltas(const unsigned char* inp, size_t len)
+{
+    if (len < 1)
+        return false;
+    unsigned char vinp[nVDeltaMaxLen];
+    const unsigned char* p = inp+1;
+    const unsigned char* end = inp+len;
+    if (inp[0] == VDELTA_DEFLATE) {
+        unsigned long vlen = nVDeltaMaxLen;
+        int res = ::uncompress(vinp, &vlen, inp+1, len-1);
+        if (res != Z_OK)
+            return false;
+        p = vinp;
+        end = vinp+vlen;
+    }
+    else if (inp[0] != VDELTA_PLAIN)
+        return false;
+
+    uint64_t from = 0;
+    uint64_t n = 0;
+    uint64_t mode = 0;
+    uint64_t state = 0;
+    if (!GetVarInt(p, end, from) || !GetVarInt(p, end, n) || !GetVarInt(p, end, mode))
+        return false;
+    if (from > PEG_SIZE || n > PEG_SIZE - from)
+        return false;
+    if (mode == VDELTA_REMAIN) {
+        if (!GetVarInt(p, end, state))
+            return false;
+        state = UnZigZag(state);
+    }
+    else if (mode != VDELTA_PREV)
+        return false;
+
+    int64_t* d = f.get();
+    std::fill(d, d+from, 0);
+    int to = from + n;
+    uint64_t nZeros = 0;
+    for(int i=from; i<to; i++) {
+        uint64_t delta = 0;
+        if (nZeros) {
+            nZeros--;
+        } else {
+            uint64_t z = 0;
+            if (!GetVarInt(p, end, z))
+                return false;
+            if (z == 0) {
+                if (!GetVarInt(p, end, nZeros) || nZeros == 0 || nZeros > uint64_t(to-i))
+                    return false;
+                nZeros--;
+            } else {
+                delta = UnZigZag(z);
+            }
+        }
+        uint64_t v = VDeltaPredict(mode, state, i) + delta;
+        state = VDeltaNext(mode, state, v);
+        d[i] = int64_t(v);
+    }
+    std::fill(d+to, d+PEG_SIZE, 0);
+    return p == end;
+}
+
+bool CFractions::Pack(CDataStream& out, unsigned long* report_len, uint32_t codec) const
 {
     if (nFlags & VALUE) {
         if (report_len) *report_len = sizeof(int64_t);
@@ -104,7 +349,17 @@ bool CFractions::Pack(CDataStream& out, unsigned long* report_len, bool compress
         out << nLockTime;
         out << sReturnAddr;
         out << f[0];
-    } else if (compress) {
+    } else if (codec == SER_VDELTA) {
+        unsigned char vout[nVDeltaMaxLen];
+        uint32_t vlen = ToVDeltas(vout);
+        if (report_len) *report_len = vlen;
+        out << nVersion;
+        out << uint32_t(nFlags | SER_VDELTA);
+        out << nLockTime;
+        out << sReturnAddr;
+        out << vlen;
+        out.write(reinterpret_cast<const char *>(vout), vlen);
+    } else if (codec == SER_ZDELTA) {
         int64_t deltas[PEG_SIZE];
         ToDeltas(deltas);
 
@@ -130,7 +385,8 @@ bool CFractions::Pack(CDataStream& out, unsigned long* report_len, bool compress
             out << uint32_t(nFlags | SER_RAW);
             out << nLockTime;
             out << sReturnAddr;
-            auto ser = reinterpret_cast<const char *>(f.get());
+            CFractionsDense dense(f);
+            auto ser = reinterpret_cast<const char *>(dense.get());
             out.write(ser, PEG_SIZE*sizeof(int64_t));
         }
     } else {
@@ -139,7 +395,8 @@ bool CFractions::Pack(CDataStream& out, unsigned long* report_len, bool compress
         out << uint32_t(nFlags | SER_RAW);
         out << nLockTime;
         out << sReturnAddr;
-        auto ser = reinterpret_cast<const char *>(f.get());
+        CFractionsDense dense(f);
+        auto ser = reinterpret_cast<const char *>(dense.get());
         out.write(ser, PEG_SIZE*sizeof(int64_t));
     }
     return true;
@@ -147,6 +404,7 @@ bool CFractions::Pack(CDataStream& out, unsigned long* report_len, bool compress
 
 bool CFractions::Unpack(CDataStream& inp)
 {
+    f.Decompact();
     uint32_t nSerFlags = 0;
     inp >> nVersion;
     inp >> nSerFlags;
@@ -157,6 +415,23 @@ bool CFractions::Unpack(CDataStream& inp)
         nFlags = nSerFlags | VALUE;
         inp >> f[0];
     }
+    else if (nSerFlags & SER_VDELTA) {
+        uint32_t vlen = 0;
+        inp >> vlen;
+
+        if (vlen > nVDeltaMaxLen) {
+            // data are broken, no read
+            return false;
+        }
+
+        unsigned char vinp[nVDeltaMaxLen];
+        inp.read(reinterpret_cast<char *>(vinp), vlen);
+        if (!FromVDeltas(vinp, vlen)) {
+            // data are broken, can not decode
+            return false;
+        }
+        nFlags = nSerFlags | STD;
+    }
     else if (nSerFlags & SER_ZDELTA) {
         unsigned long zlen = 0;
         inp >> zlen;
@@ -188,10 +463,31 @@ bool CFractions::Unpack(CDataStream& inp)
         nFlags = nSerFlags | STD;
     }
     nFlags &= SER_MASK;
+    Compact();
 
     return true;
 }
 
+/** Keeps only the window of non-zero slots when it is small enough,
+ *  value fractions are always compact. Returns true if compacted.
+ */
+bool CFractions::Compact()
+{
+    if (f.GetWindow() || (nFlags & VALUE)) {
+        f.Compact(0, 1);
+        return true;
+    }
+    const int64_t* d = static_cast<const CFractions&>(*this).f.get();
+    int from = 0;
+    while (from < PEG_SIZE && d[from] == 0) from++;
+    int to = PEG_SIZE;
+    while (to > from && d[to-1] == 0) to--;
+    if (to - from > PEG_SIZE/2)
+        return false;
+    f.Compact(from, to);
+    return true;
+}
+
 CFractions CFractions::Std() const
 {
     if ((nFlags & VALUE) ==0)
@@ -243,38 +539,41 @@ bool CFractions::IsNegative() const
 
 int64_t CFractions::Total() const
 {
-    int64_t nValue =0;
     if (nFlags & VALUE)
         return f[0];
 
-    for(int i=0;i<PEG_SIZE;i++) {
-        nValue += f[i];
+    return Sum(0, PEG_SIZE);
+}
+
+/** Sum of slots [from,to), for compact fractions only the window
+ *  part is summed without expanding.
+ */
+int64_t CFractions::Sum(int from, int to) const
+{
+    auto w = f.GetWindow();
+    if (w) {
+        from = std::max(from, int(w->nFrom));
+        to = std::min(to, int(w->nTo));
+        if (to <= from) return 0;
+        return pegkernels::Sum(w->Values()+from-w->nFrom, to-from);
     }
-    return nValue;
+    return pegkernels::Sum(f.get()+from, to-from);
 }
 
 int64_t CFractions::Low(int supply) const
 {
-    int64_t nValue =0;
     if (nFlags & VALUE)
-        return Std().Low(supply);
+        return StdLow(f[0], supply);
 
-    for(int i=0;i<supply;i++) {
-        nValue += f[i];
-    }
-    return nValue;
+    return Sum(0, supply);
 }
 
 int64_t CFractions::High(int supply) const
 {
-    int64_t nValue =0;
     if (nFlags & VALUE)
-        return Std().High(supply);
+        return StdHigh(f[0], supply);
 
-    for(int i=supply;i<PEG_SIZE;i++) {
-        nValue += f[i];
-    }
-    return nValue;
+    return Sum(supply, PEG_SIZE);
 }
 
 int64_t CFractions::Low(const CPegLevel & peglevel) const
@@ -298,9 +597,7 @@ int64_t CFractions::Low(const CPegLevel & peglevel) const
         nValue += vpart;
     }
 
-    for(int i=0;i<to;i++) {
-        nValue += f[i];
-    }
+    nValue += Sum(0, to);
 
     return nValue;
 }
@@ -327,13 +624,181 @@ int64_t CFractions::High(const CPegLevel & peglevel) const
         from++;
     }
 
-    for(int i=from;i<PEG_SIZE;i++) {
-        nValue += f[i];
+    nValue += Sum(from, PEG_SIZE);
+
+    return nValue;
+}
+
+/** Low and high values of value fractions without expanding them,
+ *  the value left after n slots of Std() is the high part.
+ */
+int64_t CFractions::StdHigh(int64_t value, int supply)
+{
+    if (supply >= PEG_SIZE) return 0;
+    int64_t v = value;
+    for(int i=0; i<supply; i++) {
+        v -= v/PEG_RATE;
+    }
+    return v;
+}
+
+int64_t CFractions::StdLow(int64_t value, int supply)
+{
+    return value - StdHigh(value, supply);
+}
+
+void CFractions::LowHigh(int supply, int64_t* low, int64_t* high) const
+{
+    int64_t nLow = 0;
+    int64_t nHigh = 0;
+    if (nFlags & VALUE) {
+        nHigh = StdHigh(f[0], supply);
+        nLow = f[0] - nHigh;
+    } else {
+        nLow = Sum(0, supply);
+        nHigh = Sum(supply, PEG_SIZE);
     }
+    if (low) *low += nLow;
+    if (high) *high += nHigh;
+}
+
+void CFractions::LowHigh(const CPegLevel & peglevel, int64_t* low, int64_t* high) const
+{
+    if ((nFlags & STD) == 0) {
+        Std().LowHigh(peglevel, low, high);
+        return;
+    }
+    if (low) *low += Low(peglevel);
+    if (high) *high += High(peglevel);
+}
+
+// std fractions in a dense buffer kept by ranges over value or compact
+// fractions
+static std::shared_ptr<const CFractions> DenseStd(const CFractions& fractions)
+{
+    auto pStd = std::make_shared<CFractions>(fractions.Std());
+    pStd->Decompact();
+    return pStd;
+}
 
+CFractionsRange CFractions::Range(int from, int to) const
+{
+    if ((nFlags & STD) == 0 || IsCompact()) {
+        auto pStd = DenseStd(*this);
+        CFractionsRange range = pStd->Range(from, to);
+        range.pStd = pStd;
+        return range;
+    }
+    return CFractionsRange(f.get(), from, to);
+}
+
+CFractionsRange CFractions::LowRange(const CPegLevel & peglevel) const
+{
+    if ((nFlags & STD) == 0 || IsCompact()) {
+        auto pStd = DenseStd(*this);
+        CFractionsRange range = pStd->LowRange(peglevel);
+        range.pStd = pStd;
+        return range;
+    }
+
+    int to = peglevel.nSupply + peglevel.nShift;
+    CFractionsRange range(f.get(), 0, to);
+
+    if (to >=0 &&
+            to <PEG_SIZE &&
+            peglevel.nShiftLastPart >0 &&
+            peglevel.nShiftLastTotal >0) {
+        // partial value to use, same as in LowPart
+        int64_t v = f[to];
+        int64_t vpart = ::RatioPart(v,
+                                    peglevel.nShiftLastPart,
+                                    peglevel.nShiftLastTotal);
+        if (vpart < v) vpart++;
+        range.nTo = to+1;
+        range.nEdge = to;
+        range.nEdgeValue = vpart;
+    }
+    return range;
+}
+
+CFractionsRange CFractions::HighRange(const CPegLevel & peglevel) const
+{
+    if ((nFlags & STD) == 0 || IsCompact()) {
+        auto pStd = DenseStd(*this);
+        CFractionsRange range = pStd->HighRange(peglevel);
+        range.pStd = pStd;
+        return range;
+    }
+
+    int from = peglevel.nSupply + peglevel.nShift;
+    CFractionsRange range(f.get(), from, PEG_SIZE);
+
+    if (from >=0 &&
+            from <PEG_SIZE &&
+            peglevel.nShiftLastPart >0 &&
+            peglevel.nShiftLastTotal >0) {
+        // partial value to use, same as in HighPart
+        int64_t v = f[from];
+        int64_t vpart = ::RatioPart(v,
+                                    peglevel.nShiftLastPart,
+                                    peglevel.nShiftLastTotal);
+        if (vpart < v) vpart++;
+        range.nEdge = from;
+        range.nEdgeValue = v - vpart;
+    }
+    return range;
+}
+
+CFractionsRange::CFractionsRange(const int64_t* f, int from, int to)
+    :f(f)
+    ,nFrom(std::max(from, 0))
+    ,nTo(std::min(to, int(PEG_SIZE)))
+{
+}
+
+int64_t CFractionsRange::Total() const
+{
+    if (nTo <= nFrom)
+        return 0;
+    int64_t nValue = pegkernels::Sum(f+nFrom, nTo-nFrom);
+    if (nEdge >= nFrom && nEdge < nTo) {
+        nValue += nEdgeValue - f[nEdge];
+    }
     return nValue;
 }
 
+int16_t CFractionsRange::HLI() const
+{
+    int64_t half = 0;
+    int64_t total = Total();
+    if (total ==0) {
+        return 0;
+    }
+    if (nFrom >0 && 0 > total/2) {
+        return 0; // zero slots before the range
+    }
+    for(int i=nFrom;i<nTo;i++) {
+        half += At(i);
+        if (half > total/2) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void CFractionsRange::Signed(int64_t* positive, int64_t* negative) const
+{
+    int64_t nPositive = 0;
+    int64_t nNegative = 0;
+    for(int i=nFrom;i<nTo;i++) {
+        int64_t v = At(i);
+        if (v > 0) nPositive += v;
+        else nNegative += v;
+    }
+    if (positive) *positive += nPositive;
+    if (negative) *negative += nNegative;
+}
+
 int64_t CFractions::NChange(const CPegLevel & peglevel) const
 {
     CPegLevel peglevel_next = peglevel;
@@ -379,6 +844,7 @@ void CFractions::ToStd()
     nFlags &= ~uint32_t(VALUE);
     nFlags |= STD;
 
+    f.Decompact();
     int64_t v = f[0];
     for(int i=0;i<PEG_SIZE;i++) {
         if (i == PEG_SIZE-1) {
@@ -396,12 +862,10 @@ CFractions CFractions::Positive(int64_t* total) const
     if ((nFlags & STD) == 0) {
         return Std().Positive(total);
     }
-    CFractions frPositive(0, CFractions::STD);
-    for(int i=0; i<PEG_SIZE; i++) {
-        if (f[i] <=0) continue;
-        frPositive.f[i] = f[i];
-        if (total) *total += f[i];
-    }
+    CFractions frPositive;
+    frPositive.nFlags = CFractions::STD;
+    int64_t nPositive = pegkernels::KeepPositive(frPositive.f.get(), CFractionsDense(f).get(), PEG_SIZE);
+    if (total) *total += nPositive;
     return frPositive;
 }
 CFractions CFractions::Negative(int64_t* total) const
@@ -409,12 +873,10 @@ CFractions CFractions::Negative(int64_t* total) const
     if ((nFlags & STD) == 0) {
         return Std().Negative(total);
     }
-    CFractions frNegative(0, CFractions::STD);
-    for(int i=0; i<PEG_SIZE; i++) {
-        if (f[i] >=0) continue;
-        frNegative.f[i] = f[i];
-        if (total) *total += f[i];
-    }
+    CFractions frNegative;
+    frNegative.nFlags = CFractions::STD;
+    int64_t nNegative = pegkernels::KeepNegative(frNegative.f.get(), CFractionsDense(f).get(), PEG_SIZE);
+    if (total) *total += nNegative;
     return frNegative;
 }
 
@@ -425,9 +887,10 @@ CFractions CFractions::LowPart(int supply, int64_t* total) const
         return Std().LowPart(supply, total);
     }
     CFractions frLowPart(0, CFractions::STD);
-    for(int i=0; i<supply; i++) {
-        if (total) *total += f[i];
-        frLowPart.f[i] += f[i];
+    if (supply >0) {
+        CFractionsDense d(f);
+        std::copy(d.get(), d.get()+supply, frLowPart.f.get());
+        if (total) *total += pegkernels::Sum(d.get(), supply);
     }
     return frLowPart;
 }
@@ -437,9 +900,10 @@ CFractions CFractions::HighPart(int supply, int64_t* total) const
         return Std().HighPart(supply, total);
     }
     CFractions frHighPart(0, CFractions::STD);
-    for(int i=supply; i<PEG_SIZE; i++) {
-        if (total) *total += f[i];
-        frHighPart.f[i] += f[i];
+    if (supply < PEG_SIZE) {
+        CFractionsDense d(f);
+        std::copy(d.get()+supply, d.get()+PEG_SIZE, frHighPart.f.get()+supply);
+        if (total) *total += pegkernels::Sum(d.get()+supply, PEG_SIZE-supply);
     }
     return frHighPart;
 }
@@ -467,9 +931,10 @@ CFractions CFractions::LowPart(const CPegLevel & peglevel, int64_t* total) const
         if (total) *total += vpart;
     }
 
-    for(int i=0; i<to; i++) {
-        if (total) *total += f[i];
-        frLowPart.f[i] = f[i];
+    if (to >0) {
+        CFractionsDense d(f);
+        std::copy(d.get(), d.get()+to, frLowPart.f.get());
+        if (total) *total += pegkernels::Sum(d.get(), to);
     }
     return frLowPart;
 }
@@ -497,9 +962,10 @@ CFractions CFractions::HighPart(const CPegLevel & peglevel, int64_t* total) cons
         from++;
     }
 
-    for(int i=from; i<PEG_SIZE; i++) {
-        if (total) *total += f[i];
-        frHighPart.f[i] = f[i];
+    if (from < PEG_SIZE) {
+        CFractionsDense d(f);
+        std::copy(d.get()+from, d.get()+PEG_SIZE, frHighPart.f.get()+from);
+        if (total) *total += pegkernels::Sum(d.get()+from, PEG_SIZE-from);
     }
     return frHighPart;
 }
@@ -634,6 +1100,8 @@ int64_t CFractions::MoveRatioPartTo(int64_t nValueToMove,
         ToStd();
     if ((b.nFlags & STD) == 0)
         b.ToStd();
+    f.Decompact();
+    b.f.Decompact();
 
     if (nPartValue >= nTotalValue) {
         nPartValue = nTotalValue;
@@ -709,9 +1177,14 @@ CFractions& CFractions::operator+=(const CFractions& b)
     if ((nFlags & STD) == 0) {
         ToStd();
     }
-    for(int i=0; i<PEG_SIZE; i++) {
-        f[i] += b.f[i];
+    f.Decompact();
+    int64_t* d = f.get();
+    auto w = b.f.GetWindow();
+    if (w) {
+        pegkernels::Add(d+w->nFrom, w->Values(), w->nTo-w->nFrom);
+        return *this;
     }
+    pegkernels::Add(d, b.f.get(), PEG_SIZE);
     return *this;
 }
 
@@ -723,15 +1196,21 @@ CFractions& CFractions::operator-=(const CFractions& b)
     if ((nFlags & STD) == 0) {
         ToStd();
     }
-    for(int i=0; i<PEG_SIZE; i++) {
-        f[i] -= b.f[i];
+    f.Decompact();
+    int64_t* d = f.get();
+    auto w = b.f.GetWindow();
+    if (w) {
+        pegkernels::Sub(d+w->nFrom, w->Values(), w->nTo-w->nFrom);
+        return *this;
     }
+    pegkernels::Sub(d, b.f.get(), PEG_SIZE);
     return *this;
 }
 
 CFractions CFractions::operator&(const CFractions& b) const
 {
     CFractions a = *this;
+    a.f.Decompact();
     for(int i=0; i<PEG_SIZE; i++) {
         int64_t va = a.f[i];
         int64_t vb = b.f[i];
@@ -746,6 +1225,7 @@ CFractions CFractions::operator&(const CFractions& b) const
 CFractions CFractions::operator-() const
 {
     CFractions a = *this;
+    a.f.Decompact();
     for(int i=0; i<PEG_SIZE; i++) {
         int64_t va = a.f[i];
         a.f[i] = -va;
@@ -764,16 +1244,7 @@ double CFractions::Distortion(const CFractions& b) const
             return 0;
         }
 
-        int64_t nDiff = 0;
-
-        for(int i=0; i<PEG_SIZE; i++) {
-            int64_t va = f[i];
-            int64_t vb = b.f[i];
-            if (va > vb) {
-                nDiff += (va - vb);
-            }
-        }
-
+        int64_t nDiff = pegkernels::PositiveDiff(CFractionsDense(f).get(), CFractionsDense(b.f).get(), PEG_SIZE);
         return double(nDiff) / double(nTotalA);
     }
 
@@ -0,0 +1,397 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#include "pegkernels.h"
+
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PEG_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace pegkernels {
+
+struct Impl {
+    Level   level;
+    void    (*add)(int64_t*, const int64_t*, int);
+    void    (*sub)(int64_t*, const int64_t*, int);
+    int64_t (*sum)(const int64_t*, int);
+    int64_t (*keep_positive)(int64_t*, const int64_t*, int);
+    int64_t (*keep_negative)(int64_t*, const int64_t*, int);
+    int64_t (*positive_diff)(const int64_t*, const int64_t*, int);
+};
+
+// scalar
+
+static void add_scalar(int64_t* a, const int64_t* b, int n)
+{
+    for(int i=0; i<n; i++) a[i] += b[i];
+}
+
+static void sub_scalar(int64_t* a, const int64_t* b, int n)
+{
+    for(int i=0; i<n; i++) a[i] -= b[i];
+}
+
+static int64_t sum_scalar(const int64_t* a, int n)
+{
+    int64_t nValue = 0;
+    for(int i=0; i<n; i++) nValue += a[i];
+    return nValue;
+}
+
+static int64_t keep_positive_scalar(int64_t* dst, const int64_t* src, int n)
+{
+    int64_t nValue = 0;
+    for(int i=0; i<n; i++) {
+        int64_t v = src[i] >0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+static int64_t keep_negative_scalar(int64_t* dst, const int64_t* src, int n)
+{
+    int64_t nValue = 0;
+    for(int i=0; i<n; i++) {
+        int64_t v = src[i] <0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+static int64_t positive_diff_scalar(const int64_t* a, const int64_t* b, int n)
+{
+    int64_t nDiff = 0;
+    for(int i=0; i<n; i++) {
+        if (a[i] > b[i]) nDiff += (a[i] - b[i]);
+    }
+    return nDiff;
+}
+
+static const Impl impl_scalar = {
+    LEVEL_SCALAR,
+    add_scalar,
+    sub_scalar,
+    sum_scalar,
+    keep_positive_scalar,
+    keep_negative_scalar,
+    positive_diff_scalar
+};
+
+#ifdef PEG_KERNELS_X86
+
+// SSE2: there is no 64-bit compare, signs are taken from high dwords
+
+#define PEG_SSE2 __attribute__((target("sse2")))
+
+PEG_SSE2 static inline int64_t hsum_sse2(__m128i acc)
+{
+    int64_t v[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v), acc);
+    return v[0] + v[1];
+}
+
+PEG_SSE2 static inline __m128i negmask_sse2(__m128i v)
+{
+    return _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(3,3,1,1));
+}
+
+PEG_SSE2 static inline __m128i zeromask_sse2(__m128i v)
+{
+    __m128i eq = _mm_cmpeq_epi32(v, _mm_setzero_si128());
+    return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2,3,0,1)));
+}
+
+PEG_SSE2 static void add_sse2(int64_t* a, const int64_t* b, int n)
+{
+    int i = 0;
+    for(; i+2<=n; i+=2) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a+i), _mm_add_epi64(va, vb));
+    }
+    for(; i<n; i++) a[i] += b[i];
+}
+
+PEG_SSE2 static void sub_sse2(int64_t* a, const int64_t* b, int n)
+{
+    int i = 0;
+    for(; i+2<=n; i+=2) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a+i), _mm_sub_epi64(va, vb));
+    }
+    for(; i<n; i++) a[i] -= b[i];
+}
+
+PEG_SSE2 static int64_t sum_sse2(const int64_t* a, int n)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i+2)));
+    }
+    int64_t nValue = hsum_sse2(_mm_add_epi64(acc0, acc1));
+    for(; i<n; i++) nValue += a[i];
+    return nValue;
+}
+
+PEG_SSE2 static int64_t keep_positive_sse2(int64_t* dst, const int64_t* src, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for(; i+2<=n; i+=2) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m128i notpos = _mm_or_si128(negmask_sse2(v), zeromask_sse2(v));
+        __m128i kept = _mm_andnot_si128(notpos, v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), kept);
+        acc = _mm_add_epi64(acc, kept);
+    }
+    int64_t nValue = hsum_sse2(acc);
+    for(; i<n; i++) {
+        int64_t v = src[i] >0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+PEG_SSE2 static int64_t keep_negative_sse2(int64_t* dst, const int64_t* src, int n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for(; i+2<=n; i+=2) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m128i kept = _mm_and_si128(negmask_sse2(v), v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), kept);
+        acc = _mm_add_epi64(acc, kept);
+    }
+    int64_t nValue = hsum_sse2(acc);
+    for(; i<n; i++) {
+        int64_t v = src[i] <0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+static const Impl impl_sse2 = {
+    LEVEL_SSE2,
+    add_sse2,
+    sub_sse2,
+    sum_sse2,
+    keep_positive_sse2,
+    keep_negative_sse2,
+    positive_diff_scalar // needs exact 64-bit compare
+};
+
+// AVX2
+
+#define PEG_AVX2 __attribute__((target("avx2")))
+
+PEG_AVX2 static inline int64_t hsum_avx2(__m256i acc)
+{
+    int64_t v[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), acc);
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+PEG_AVX2 static void add_avx2(int64_t* a, const int64_t* b, int n)
+{
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a+i), _mm256_add_epi64(va, vb));
+    }
+    for(; i<n; i++) a[i] += b[i];
+}
+
+PEG_AVX2 static void sub_avx2(int64_t* a, const int64_t* b, int n)
+{
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a+i), _mm256_sub_epi64(va, vb));
+    }
+    for(; i<n; i++) a[i] -= b[i];
+}
+
+PEG_AVX2 static int64_t sum_avx2(const int64_t* a, int n)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    int i = 0;
+    for(; i+8<=n; i+=8) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i+4)));
+    }
+    int64_t nValue = hsum_avx2(_mm256_add_epi64(acc0, acc1));
+    for(; i<n; i++) nValue += a[i];
+    return nValue;
+}
+
+PEG_AVX2 static int64_t keep_positive_avx2(int64_t* dst, const int64_t* src, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src+i));
+        __m256i kept = _mm256_and_si256(_mm256_cmpgt_epi64(v, zero), v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), kept);
+        acc = _mm256_add_epi64(acc, kept);
+    }
+    int64_t nValue = hsum_avx2(acc);
+    for(; i<n; i++) {
+        int64_t v = src[i] >0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+PEG_AVX2 static int64_t keep_negative_avx2(int64_t* dst, const int64_t* src, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src+i));
+        __m256i kept = _mm256_and_si256(_mm256_cmpgt_epi64(zero, v), v);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), kept);
+        acc = _mm256_add_epi64(acc, kept);
+    }
+    int64_t nValue = hsum_avx2(acc);
+    for(; i<n; i++) {
+        int64_t v = src[i] <0 ? src[i] : 0;
+        dst[i] = v;
+        nValue += v;
+    }
+    return nValue;
+}
+
+PEG_AVX2 static int64_t positive_diff_avx2(const int64_t* a, const int64_t* b, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for(; i+4<=n; i+=4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i));
+        __m256i diff = _mm256_sub_epi64(va, vb);
+        acc = _mm256_add_epi64(acc, _mm256_and_si256(_mm256_cmpgt_epi64(va, vb), diff));
+    }
+    int64_t nDiff = hsum_avx2(acc);
+    for(; i<n; i++) {
+        if (a[i] > b[i]) nDiff += (a[i] - b[i]);
+    }
+    return nDiff;
+}
+
+static const Impl impl_avx2 = {
+    LEVEL_AVX2,
+    add_avx2,
+    sub_avx2,
+    sum_avx2,
+    keep_positive_avx2,
+    keep_negative_avx2,
+    positive_diff_avx2
+};
+
+#endif // PEG_KERNELS_X86
+
+static const Impl* ImplOf(Level level)
+{
+#ifdef PEG_KERNELS_X86
+    if (level == LEVEL_AVX2) return &impl_avx2;
+    if (level == LEVEL_SSE2) return &impl_sse2;
+#endif
+    return &impl_scalar;
+}
+
+Level DetectedLevel()
+{
+    static const Level detected = []() {
+#ifdef PEG_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return LEVEL_AVX2;
+        if (__builtin_cpu_supports("sse2")) return LEVEL_SSE2;
+#endif
+        return LEVEL_SCALAR;
+    }();
+    return detected;
+}
+
+static std::atomic<const Impl*>& Active()
+{
+    static std::atomic<const Impl*> active(ImplOf(DetectedLevel()));
+    return active;
+}
+
+Level ActiveLevel()
+{
+    return Active().load(std::memory_order_relaxed)->level;
+}
+
+Level SetLevel(Level level)
+{
+    if (level > DetectedLevel())
+        level = DetectedLevel();
+    Active().store(ImplOf(level), std::memory_order_relaxed);
+    return level;
+}
+
+const char* LevelName(Level level)
+{
+    switch(level) {
+    case LEVEL_AVX2: return "avx2";
+    case LEVEL_SSE2: return "sse2";
+    default: break;
+    }
+    return "scalar";
+}
+
+void Add(int64_t* a, const int64_t* b, int n)
+{
+    Active().load(std::memory_order_relaxed)->add(a, b, n);
+}
+
+void Sub(int64_t* a, const int64_t* b, int n)
+{
+    Active().load(std::memory_order_relaxed)->sub(a, b, n);
+}
+
+int64_t Sum(const int64_t* a, int n)
+{
+    if (n <= 0) return 0;
+    return Active().load(std::memory_order_relaxed)->sum(a, n);
+}
+
+int64_t KeepPositive(int64_t* dst, const int64_t* src, int n)
+{
+    return Active().load(std::memory_order_relaxed)->keep_positive(dst, src, n);
+}
+
+int64_t KeepNegative(int64_t* dst, const int64_t* src, int n)
+{
+    return Active().load(std::memory_order_relaxed)->keep_negative(dst, src, n);
+}
+
+int64_t PositiveDiff(const int64_t* a, const int64_t* b, int n)
+{
+    return Active().load(std::memory_order_relaxed)->positive_diff(a, b, n);
+}
+
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2018 yshurik
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The use in another cyptocurrency project the code is licensed under
+// Jelurida Public License (JPL). See https://www.jelurida.com/resources/jpl
+
+#ifndef BITBAY_PEGKERNELS_H
+#define BITBAY_PEGKERNELS_H
+
+#include <cstdint>
+
+/** Vectorized loops over fractions arrays used by CFractions.
+ *  Implementations are selected once at first use by cpu features
+ *  (scalar, SSE2, AVX2) and all of them produce identical results.
+ */
+namespace pegkernels {
+
+enum Level {
+    LEVEL_SCALAR    = 0,
+    LEVEL_SSE2      = 1,
+    LEVEL_AVX2      = 2
+};
+
+// a[i] += b[i]
+void    Add(int64_t* a, const int64_t* b, int n);
+// a[i] -= b[i]
+void    Sub(int64_t* a, const int64_t* b, int n);
+// sum of a[0..n)
+int64_t Sum(const int64_t* a, int n);
+// dst[i] = src[i] if src[i] >0 else 0, returns sum of dst
+int64_t KeepPositive(int64_t* dst, const int64_t* src, int n);
+// dst[i] = src[i] if src[i] <0 else 0, returns sum of dst
+int64_t KeepNegative(int64_t* dst, const int64_t* src, int n);
+// sum of (a[i]-b[i]) for a[i] > b[i]
+int64_t PositiveDiff(const int64_t* a, const int64_t* b, int n);
+
+Level       DetectedLevel();
+Level       ActiveLevel();
+// force implementation (limited by detected), used by tests and benchmarks
+Level       SetLevel(Level);
+const char* LevelName(Level);
+
+}
+
+#endif
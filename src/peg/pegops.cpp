@@ -161,8 +161,8 @@ bool getpegdatainfo(
     out_liquid      = pd.nLiquid;
     out_reserve     = pd.nReserve;
     out_value_hli   = pd.fractions.HLI();
-    out_liquid_hli  = pd.fractions.HighPart(pd.peglevel, nullptr).HLI();
-    out_reserve_hli = pd.fractions.LowPart(pd.peglevel, nullptr).HLI();
+    out_liquid_hli  = pd.fractions.HighRange(pd.peglevel).HLI();
+    out_reserve_hli = pd.fractions.LowRange(pd.peglevel).HLI();
     out_id          = pd.nId;
 
     out_level_version   = pd.peglevel.nVersion;
@@ -505,8 +505,8 @@ bool updatetxout(
     out_txout_next_cycle_available_reserve = pdTxout.fractions.Low(pegn_reserve);
 
     out_txout_value_hli = pdTxout.fractions.HLI();
-    out_txout_next_cycle_available_liquid_hli = pdTxout.fractions.HighPart(pegn_liquid, nullptr).HLI();
-    out_txout_next_cycle_available_reserve_hli = pdTxout.fractions.LowPart(pegn_reserve, nullptr).HLI();
+    out_txout_next_cycle_available_liquid_hli = pdTxout.fractions.HighRange(pegn_liquid).HLI();
+    out_txout_next_cycle_available_reserve_hli = pdTxout.fractions.LowRange(pegn_reserve).HLI();
 
     return true;
 }
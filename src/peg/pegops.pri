@@ -4,6 +4,9 @@ HEADERS += \
     $$PWD/pegops.h \
     $$PWD/pegopsp.h \
     $$PWD/pegdata.h \
+    $$PWD/pegkernels.h \
+    $$PWD/pegalloc.h \
+    $$PWD/pegcache.h \
 
 SOURCES += \
     $$PWD/pegstd.cpp \
@@ -13,4 +16,7 @@ SOURCES += \
     $$PWD/pegdata_compat.cpp \
     $$PWD/peglevel.cpp \
     $$PWD/pegfractions.cpp \
+    $$PWD/pegkernels.cpp \
+    $$PWD/pegalloc.cpp \
+    $$PWD/pegcache.cpp \
 
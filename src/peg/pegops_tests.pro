@@ -23,6 +23,11 @@ SOURCES += \
     $$PWD/tests/pegops_test8.cpp \
     $$PWD/tests/pegops_test1k.cpp \
     $$PWD/tests/pegops_withdraws.cpp \
+    $$PWD/tests/pegops_kernels.cpp \
+    $$PWD/tests/pegops_ranges.cpp \
+    $$PWD/tests/pegops_alloc.cpp \
+    $$PWD/tests/pegops_codec.cpp \
+    $$PWD/tests/pegops_cache.cpp \
 
 LIBS += -lz
 LIBS += -lboost_system
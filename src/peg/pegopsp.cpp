@@ -66,9 +66,9 @@ bool getpeglevel(
 
     int nPegEffective = pdPegPool.peglevel.nSupply + pdPegPool.peglevel.nShift;
     // pool to include both, liquidity and (may) last partial reserve fractions
-    pdPegPool.fractions = pdExchange.fractions.HighPart(nPegEffective, nullptr);
+    int64_t nPegPoolValue = 0;
+    pdPegPool.fractions = pdExchange.fractions.HighPart(nPegEffective, &nPegPoolValue);
 
-    int64_t nPegPoolValue = pdPegPool.fractions.Total();
     pdPegPool.nReserve = pdPegPool.peglevel.nShiftLastPart;
     pdPegPool.nLiquid = nPegPoolValue - pdPegPool.nReserve;
     peglevel = pdPegPool.peglevel;
@@ -142,6 +142,7 @@ bool updatepegbalances(
     bool fPartial = peglevelNew.nShiftLastPart >0 && peglevelNew.nShiftLastTotal >0;
 
     int nLastIdx = nSupplyEffective;
+    pdPegPool.fractions.Decompact(); // pool slots are updated in place
     if (fPartial) {
 
         int64_t nLastTotal = pdPegPool.fractions.f[nLastIdx];
@@ -905,10 +906,11 @@ bool prepareliquidwithdraw(
         nSupplyEffective++;
     }
 
-    CFractions frBalanceLiquid = pdBalance.fractions.HighPart(nSupplyEffective, nullptr);
+    int64_t nBalanceLiquid = 0;
+    CFractions frBalanceLiquid = pdBalance.fractions.HighPart(nSupplyEffective, &nBalanceLiquid);
 
     if (fPartial) {
-        int64_t nPartialLiquid = pdBalance.nLiquid - frBalanceLiquid.Total();
+        int64_t nPartialLiquid = pdBalance.nLiquid - nBalanceLiquid;
         if (nPartialLiquid < 0) {
             std::stringstream ss;
             ss << "Mismatch on nPartialLiquid " << nPartialLiquid;
@@ -917,11 +919,12 @@ bool prepareliquidwithdraw(
         }
 
         frBalanceLiquid.f[nSupplyEffective-1] = nPartialLiquid;
+        nBalanceLiquid += nPartialLiquid;
     }
 
-    if (frBalanceLiquid.Total() < nAmountWithFee) {
+    if (nBalanceLiquid < nAmountWithFee) {
         std::stringstream ss;
-        ss << "Not enough liquid(1) " << frBalanceLiquid.Total()
+        ss << "Not enough liquid(1) " << nBalanceLiquid
            << "  on 'balance' to withdraw " << nAmountWithFee;
         sErr = ss.str();
         return false;
@@ -1237,9 +1240,10 @@ bool prepareliquidwithdraw(
     }
 
     // signing the transaction to get it ready for broadcast
+    CSignatureHashContext sighash(rawTx);
     int nIn = 0;
     for(const CCoinToUse& coin : vCoins) {
-        if (!SignSignature(keyStore, coin.scriptPubKey, rawTx, nIn++)) {
+        if (!SignSignature(keyStore, coin.scriptPubKey, rawTx, nIn++, SIGHASH_ALL, &sighash)) {
             std::stringstream ss;
             ss << "Fail on signing input " << nIn-1;
             sErr = ss.str();
@@ -1428,10 +1432,11 @@ bool preparereservewithdraw(
     int nSupplyEffective = peglevel_exchange.nSupply + peglevel_exchange.nShift;
     bool fPartial = peglevel_exchange.nShiftLastPart >0 && peglevel_exchange.nShiftLastTotal >0;
 
-    CFractions frBalanceReserve = pdBalance.fractions.LowPart(nSupplyEffective, nullptr);
+    int64_t nBalanceReserve = 0;
+    CFractions frBalanceReserve = pdBalance.fractions.LowPart(nSupplyEffective, &nBalanceReserve);
 
     if (fPartial) {
-        int64_t nPartialReserve = pdBalance.nReserve - frBalanceReserve.Total();
+        int64_t nPartialReserve = pdBalance.nReserve - nBalanceReserve;
         if (nPartialReserve < 0) {
             std::stringstream ss;
             ss << "Mismatch on nPartialReserve " << nPartialReserve;
@@ -1440,11 +1445,12 @@ bool preparereservewithdraw(
         }
 
         frBalanceReserve.f[nSupplyEffective] = nPartialReserve;
+        nBalanceReserve += nPartialReserve;
     }
 
-    if (frBalanceReserve.Total() < nAmountWithFee) {
+    if (nBalanceReserve < nAmountWithFee) {
         std::stringstream ss;
-        ss << "Not enough reserve(1) " << frBalanceReserve.Total()
+        ss << "Not enough reserve(1) " << nBalanceReserve
            << "  on 'balance' to withdraw " << nAmountWithFee;
         sErr = ss.str();
         return false;
@@ -1840,9 +1846,10 @@ bool preparereservewithdraw(
     }
 
     // signing the transaction to get it ready for broadcast
+    CSignatureHashContext sighash(rawTx);
     int nIn = 0;
     for(const CCoinToUse& coin : vCoins) {
-        if (!SignSignature(keyStore, coin.scriptPubKey, rawTx, nIn++)) {
+        if (!SignSignature(keyStore, coin.scriptPubKey, rawTx, nIn++, SIGHASH_ALL, &sighash)) {
             std::stringstream ss;
             ss << "Fail on signing input " << nIn-1;
             sErr = ss.str();
@@ -0,0 +1,211 @@
+// Copyright (c) 2018 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <QtTest/QtTest>
+
+#include "pegdata.h"
+#include "pegalloc.h"
+#include "pegops_tests.h"
+
+#include <map>
+#include <vector>
+
+using namespace std;
+
+void TestPegOps::testAlloc()
+{
+    // buffers are reused instead of new system allocations
+    {
+        vector<CFractions> v(100, CFractions(0, CFractions::STD));
+    }
+    pegalloc::Stats stats1 = pegalloc::GetStats();
+    {
+        vector<CFractions> v(100, CFractions(0, CFractions::STD));
+    }
+    pegalloc::Stats stats2 = pegalloc::GetStats();
+    QCOMPARE(stats2.nMallocs, stats1.nMallocs);
+    QCOMPARE(stats2.nAllocs - stats1.nAllocs, stats2.nFrees - stats1.nFrees);
+
+    // arena buffers, one escapes the arena scope
+    CFractions frEscaped;
+    {
+        CFractionsArena arena;
+        vector<CFractions> v;
+        for(int i=0; i<200; i++) {
+            v.push_back(CFractions(i, CFractions::STD));
+        }
+        frEscaped = v[10];
+        CFractions frKept = v[20];
+        {
+            CFractionsArena::Pause pause;
+            frEscaped = CFractions(frKept);
+        }
+        pegalloc::Stats stats = pegalloc::GetStats();
+        QVERIFY(stats.nArenaAllocs > stats2.nArenaAllocs);
+        QCOMPARE(stats.nArenasAlive, stats2.nArenasAlive+1);
+    }
+    pegalloc::Stats stats3 = pegalloc::GetStats();
+    QCOMPARE(stats3.nArenasAlive, stats2.nArenasAlive);
+    QCOMPARE(frEscaped.Total(), int64_t(20));
+
+    // a buffer from arena keeps the arena slabs until returned
+    CFractions* pEscaped = nullptr;
+    {
+        CFractionsArena arena;
+        pEscaped = new CFractions(7, CFractions::STD);
+    }
+    pegalloc::Stats stats4 = pegalloc::GetStats();
+    QCOMPARE(stats4.nArenasAlive, stats3.nArenasAlive+1);
+    QCOMPARE(pEscaped->Total(), int64_t(7));
+    delete pEscaped;
+    pegalloc::Stats stats5 = pegalloc::GetStats();
+    QCOMPARE(stats5.nArenasAlive, stats3.nArenasAlive);
+}
+
+static const int64_t* buffer(const CFractions& fr)
+{
+    return fr.f.get();
+}
+
+void TestPegOps::testCopyOnWrite()
+{
+    CFractions a(1000000, CFractions::STD);
+    int64_t nTotal = a.Total();
+
+    // copies share the buffer
+    pegalloc::Stats stats1 = pegalloc::GetStats();
+    CFractions b = a;
+    MapFractions mapFractions;
+    mapFractions.insert(std::make_pair(uint320(), a));
+    pegalloc::Stats stats2 = pegalloc::GetStats();
+    QCOMPARE(stats2.nAllocs, stats1.nAllocs);
+    QVERIFY(a.IsShared());
+    QVERIFY(b.IsShared());
+    QCOMPARE(buffer(b), buffer(a));
+
+    // reads via const do not copy
+    const CFractions& cb = b;
+    QCOMPARE(cb.Total(), nTotal);
+    QCOMPARE(cb.f[10], buffer(a)[10]);
+    QVERIFY(b.IsShared());
+
+    // write copies, others are not affected
+    b.f[10] += 5;
+    QVERIFY(!b.IsShared());
+    QCOMPARE(b.Total(), nTotal+5);
+    QCOMPARE(a.Total(), nTotal);
+    QCOMPARE(mapFractions[uint320()].Total(), nTotal);
+    pegalloc::Stats stats3 = pegalloc::GetStats();
+    QCOMPARE(stats3.nUnshares, stats2.nUnshares+1);
+
+    b += a;
+    QCOMPARE(b.Total(), 2*nTotal+5);
+    QCOMPARE(a.Total(), nTotal);
+
+    // move takes the buffer
+    const int64_t* pBuffer = buffer(b);
+    CFractions c = std::move(b);
+    QCOMPARE(buffer(c), pBuffer);
+    CFractions d;
+    d = std::move(c);
+    QCOMPARE(buffer(d), pBuffer);
+    QCOMPARE(d.Total(), 2*nTotal+5);
+
+    // moved-from is assignable
+    b = a;
+    QCOMPARE(b.Total(), nTotal);
+    b.f[0] = 0;
+    QCOMPARE(a.Total(), nTotal);
+}
+
+void TestPegOps::testCompact()
+{
+    CFractions dense(0, CFractions::STD);
+    for(int i=600; i<700; i++) {
+        dense.f[i] = 1000+i;
+    }
+    dense.f[650] = -5;
+    CFractions other(1000000, CFractions::STD);
+
+    CFractions a = dense;
+    QVERIFY(a.Compact());
+    QVERIFY(a.IsCompact());
+    QVERIFY(a.MemoryUsage() < dense.MemoryUsage()/10);
+
+    // reductions and arithmetic do not expand
+    const CFractions& ca = a;
+    QCOMPARE(ca.Total(), dense.Total());
+    for(int supply=0; supply<=PEG_SIZE; supply+=50) {
+        QCOMPARE(ca.Low(supply), dense.Low(supply));
+        QCOMPARE(ca.High(supply), dense.High(supply));
+    }
+    QCOMPARE(ca.f[0], int64_t(0));
+    QCOMPARE(ca.f[650], int64_t(-5));
+    CFractions sum1 = other;
+    sum1 += a;
+    CFractions sum2 = other;
+    sum2 += dense;
+    CFractions dif1 = other;
+    dif1 -= a;
+    CFractions dif2 = other;
+    dif2 -= dense;
+    QVERIFY(a.MemoryUsage() < dense.MemoryUsage()/10);
+
+    for(int i=0; i<PEG_SIZE; i++) {
+        QCOMPARE(sum1.f[i], sum2.f[i]);
+        QCOMPARE(dif1.f[i], dif2.f[i]);
+    }
+
+    // dense views, parts and ranges do not keep an expanded buffer
+    {
+        CFractionsDense view(a.f);
+        QCOMPARE(view.get()[650], int64_t(-5));
+        QCOMPARE(view.get()[0], int64_t(0));
+    }
+    int64_t nLow = 0;
+    int64_t nHigh = 0;
+    QCOMPARE(ca.LowPart(650, &nLow).Total(), dense.Low(650));
+    QCOMPARE(ca.HighPart(650, &nHigh).Total(), dense.High(650));
+    QCOMPARE(nLow+nHigh, dense.Total());
+    QCOMPARE(ca.Range(600, 650).Total(), dense.Low(650));
+    QCOMPARE(ca.Positive(nullptr).Total()+ca.Negative(nullptr).Total(), dense.Total());
+    QCOMPARE(ca.Distortion(dense), 0.0);
+    QVERIFY(a.IsCompact());
+    QVERIFY(a.MemoryUsage() < dense.MemoryUsage()/10);
+
+    // writes expand explicitly, copies stay compact
+    CFractions b = a;
+    b.Decompact();
+    QVERIFY(!b.IsCompact());
+    b.f[0] = 7;
+    QCOMPARE(b.Total(), dense.Total()+7);
+    QVERIFY(a.IsCompact());
+    QCOMPARE(a.Total(), dense.Total());
+
+    // arithmetic on compact fractions expands only the result
+    CFractions c2 = a;
+    c2 += other;
+    QVERIFY(!c2.IsCompact());
+    QCOMPARE(c2.Total(), dense.Total()+other.Total());
+    QVERIFY(a.IsCompact());
+
+    // unpacked fractions are compact
+    CDataStream fout(SER_DISK, CLIENT_VERSION);
+    dense.Pack(fout);
+    CFractions c;
+    QVERIFY(c.Unpack(fout));
+    QVERIFY(c.IsCompact());
+    QCOMPARE(c.Total(), dense.Total());
+    QCOMPARE(c.HLI(), dense.HLI());
+
+    CFractions v(12345, CFractions::VALUE);
+    QVERIFY(v.Compact());
+    QCOMPARE(v.Total(), int64_t(12345));
+    QCOMPARE(v.Std().Total(), int64_t(12345));
+
+    // fractions without small window stay dense
+    CFractions d = other;
+    QVERIFY(!d.Compact());
+    QVERIFY(!d.IsCompact());
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2018 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <QtTest/QtTest>
+
+#include "pegdata.h"
+#include "pegalloc.h"
+#include "pegcache.h"
+#include "pegops_tests.h"
+
+using namespace std;
+
+void TestPegOps::testCache()
+{
+    CFractionsCache cache(1024*1024);
+    uint320 key1(uint256(1), 0);
+    uint320 key2(uint256(1), 1);
+
+    CFractions fr(1000000, CFractions::STD);
+    fr = fr.Std();
+    CFractions out;
+    QVERIFY(!cache.Lookup(key1, out));
+    QVERIFY(cache.Insert(key1, fr, cache.Generation(key1)));
+    QVERIFY(cache.Lookup(key1, out));
+    QCOMPARE(out.Total(), fr.Total());
+    const CFractions& frOut = out; // cached fractions are compact
+    for(int i=0; i<PEG_SIZE; i++) {
+        QCOMPARE(frOut.f[i], fr.f[i]);
+    }
+
+    // value read before invalidation is not inserted
+    uint64_t nGeneration = cache.Generation(key2);
+    cache.Invalidate(key2);
+    QVERIFY(!cache.Insert(key2, fr, nGeneration));
+    QVERIFY(!cache.Lookup(key2, out));
+
+    cache.Invalidate(key1);
+    QVERIFY(!cache.Lookup(key1, out));
+
+    CFractionsCache::Stats stats = cache.GetStats();
+    QCOMPARE(stats.nHits, uint64_t(1));
+    QCOMPARE(stats.nMisses, uint64_t(3));
+    QCOMPARE(stats.nInserts, uint64_t(1));
+    QCOMPARE(stats.nInvalidations, uint64_t(1));
+    QCOMPARE(stats.nEntries, uint64_t(0));
+
+    // bounded by memory, least recently used are evicted
+    {
+        CFractionsArena arena;
+        for(int i=0; i<2000; i++) {
+            uint320 key(uint256(i), 0);
+            CFractions fri(1000000+i, CFractions::STD);
+            fri = fri.Std();
+            cache.Insert(key, fri, cache.Generation(key));
+        }
+    }
+    stats = cache.GetStats();
+    QVERIFY(stats.nEvictions > 0);
+    QVERIFY(stats.nBytes <= stats.nMaxBytes);
+    QVERIFY(cache.Lookup(uint320(uint256(1999), 0), out));
+    QCOMPARE(out.Total(), int64_t(1000000+1999));
+    QVERIFY(!cache.Lookup(uint320(uint256(0), 0), out));
+
+    // arena is gone, cached fractions are not arena buffers
+    pegalloc::Stats alloc = pegalloc::GetStats();
+    QCOMPARE(alloc.nArenasAlive, uint64_t(0));
+
+    cache.SetMaxBytes(0);
+    QCOMPARE(cache.GetStats().nEntries, uint64_t(0));
+}
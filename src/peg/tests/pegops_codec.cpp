@@ -0,0 +1,107 @@
+// Copyright (c) 2018 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <QtTest/QtTest>
+
+#include "pegdata.h"
+#include "pegops_tests.h"
+
+#include <random>
+#include <vector>
+
+using namespace std;
+
+static vector<CFractions> codecSamples()
+{
+    std::default_random_engine generator;
+    std::uniform_int_distribution<int64_t> distribution(-1000000, 1000000);
+    vector<CFractions> samples;
+
+    samples.push_back(CFractions(0, CFractions::STD));
+    samples.push_back(CFractions(1, CFractions::STD));
+    samples.push_back(CFractions(123456789012, CFractions::STD));
+    samples.push_back(CFractions(int64_t(1) << 56, CFractions::STD));
+
+    CFractions frRandom(0, CFractions::STD);
+    for(int i=0;i<PEG_SIZE;i++) {
+        frRandom.f[i] = distribution(generator);
+    }
+    samples.push_back(frRandom);
+
+    CFractions frExtremes(0, CFractions::STD);
+    frExtremes.f[0] = 1000000000000000000;
+    frExtremes.f[1] = -1000000000000000000;
+    frExtremes.f[PEG_SIZE-1] = -1;
+    samples.push_back(frExtremes);
+
+    int64_t nLiquid = 0;
+    CFractions frStd(5000000000, CFractions::STD);
+    samples.push_back(frStd.HighPart(400, &nLiquid));
+    samples.push_back(frStd.LowPart(400, nullptr).RatioPart(1234567));
+    samples.back().nLockTime = 12345;
+    samples.back().sReturnAddr = "return";
+    return samples;
+}
+
+void TestPegOps::testCodec()
+{
+    for(const CFractions & fractions : codecSamples()) {
+        for(uint32_t codec : {uint32_t(CFractions::SER_ZDELTA),
+                              uint32_t(CFractions::SER_VDELTA),
+                              uint32_t(CFractions::SER_RAW)}) {
+            CDataStream fout(SER_DISK, CLIENT_VERSION);
+            unsigned long len = 0;
+            fractions.Pack(fout, &len, codec);
+            CFractions decoded;
+            QVERIFY(decoded.Unpack(fout));
+            QCOMPARE(decoded.nFlags, fractions.nFlags);
+            QCOMPARE(decoded.nLockTime, fractions.nLockTime);
+            QCOMPARE(decoded.sReturnAddr, fractions.sReturnAddr);
+            const CFractions& frDecoded = decoded; // may be compact
+            for(int i=0;i<PEG_SIZE;i++) {
+                QCOMPARE(frDecoded.f[i], fractions.f[i]);
+            }
+        }
+    }
+
+    // vdelta is smaller than zdelta for std fractions
+    CFractions frStd(5000000000, CFractions::STD);
+    unsigned long nZLen = 0;
+    unsigned long nVLen = 0;
+    CDataStream fout1(SER_DISK, CLIENT_VERSION);
+    frStd.Pack(fout1, &nZLen, CFractions::SER_ZDELTA);
+    CDataStream fout2(SER_DISK, CLIENT_VERSION);
+    frStd.Pack(fout2, &nVLen, CFractions::SER_VDELTA);
+    QVERIFY(nVLen < nZLen);
+
+    // broken data are not accepted
+    CDataStream fout3(SER_DISK, CLIENT_VERSION);
+    frStd.Pack(fout3, nullptr, CFractions::SER_VDELTA);
+    string data = fout3.str();
+    data[data.size()-1] = char(0x80);
+    CDataStream finp(data.data(), data.data()+data.size(), SER_DISK, CLIENT_VERSION);
+    CFractions broken;
+    QVERIFY(!broken.Unpack(finp));
+}
+
+void TestPegOps::benchCodec_data()
+{
+    QTest::addColumn<int>("codec");
+    QTest::newRow("zdelta") << int(CFractions::SER_ZDELTA);
+    QTest::newRow("vdelta") << int(CFractions::SER_VDELTA);
+}
+
+void TestPegOps::benchCodec()
+{
+    QFETCH(int, codec);
+    vector<CFractions> samples = codecSamples();
+    QBENCHMARK {
+        for(const CFractions & fractions : samples) {
+            CDataStream fout(SER_DISK, CLIENT_VERSION);
+            fractions.Pack(fout, nullptr, codec);
+            CFractions decoded;
+            decoded.Unpack(fout);
+        }
+    }
+}
@@ -0,0 +1,181 @@
+// Copyright (c) 2018 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <QtTest/QtTest>
+
+#include "pegdata.h"
+#include "pegkernels.h"
+#include "pegops_tests.h"
+
+#include <random>
+#include <vector>
+
+using namespace std;
+
+static CFractions randomFractions(std::default_random_engine & generator)
+{
+    std::uniform_int_distribution<int64_t> distribution(-1000000, 1000000);
+    CFractions fractions(0, CFractions::STD);
+    for(int i=0;i<PEG_SIZE;i++) {
+        fractions.f[i] = distribution(generator);
+    }
+    return fractions;
+}
+
+static void addLevelRows()
+{
+    QTest::addColumn<int>("level");
+    for(int level = pegkernels::LEVEL_SCALAR;
+        level <= pegkernels::DetectedLevel(); level++) {
+        auto name = pegkernels::LevelName(pegkernels::Level(level));
+        QTest::newRow(name) << level;
+    }
+}
+
+void TestPegOps::testKernels()
+{
+    std::default_random_engine generator;
+    auto nLevelWas = pegkernels::ActiveLevel();
+
+    for(int n=0; n<100; n++) {
+        CFractions a = randomFractions(generator);
+        CFractions b = randomFractions(generator);
+        int supply = n*PEG_SIZE/100;
+
+        pegkernels::SetLevel(pegkernels::LEVEL_SCALAR);
+        int64_t nPositive0 = 0;
+        int64_t nNegative0 = 0;
+        CFractions sum0 = a + b;
+        CFractions dif0 = a - b;
+        CFractions pos0 = a.Positive(&nPositive0);
+        CFractions neg0 = a.Negative(&nNegative0);
+        int64_t nTotal0 = a.Total();
+        int64_t nLow0 = a.Low(supply);
+        int64_t nHigh0 = a.High(supply);
+        double dDistortion0 = pos0.Distortion(b.Positive(nullptr));
+
+        for(int level = pegkernels::LEVEL_SSE2;
+            level <= pegkernels::DetectedLevel(); level++) {
+            pegkernels::SetLevel(pegkernels::Level(level));
+            int64_t nPositive = 0;
+            int64_t nNegative = 0;
+            CFractions sum = a + b;
+            CFractions dif = a - b;
+            CFractions pos = a.Positive(&nPositive);
+            CFractions neg = a.Negative(&nNegative);
+            for(int i=0;i<PEG_SIZE;i++) {
+                QCOMPARE(sum.f[i], sum0.f[i]);
+                QCOMPARE(dif.f[i], dif0.f[i]);
+                QCOMPARE(pos.f[i], pos0.f[i]);
+                QCOMPARE(neg.f[i], neg0.f[i]);
+            }
+            QCOMPARE(nPositive, nPositive0);
+            QCOMPARE(nNegative, nNegative0);
+            QCOMPARE(a.Total(), nTotal0);
+            QCOMPARE(a.Low(supply), nLow0);
+            QCOMPARE(a.High(supply), nHigh0);
+            QCOMPARE(pos.Distortion(b.Positive(nullptr)), dDistortion0);
+        }
+    }
+
+    pegkernels::SetLevel(nLevelWas);
+}
+
+void TestPegOps::benchAdd_data() { addLevelRows(); }
+void TestPegOps::benchAdd()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator);
+    CFractions b = randomFractions(generator);
+    QBENCHMARK {
+        a += b;
+    }
+}
+
+void TestPegOps::benchSub_data() { addLevelRows(); }
+void TestPegOps::benchSub()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator);
+    CFractions b = randomFractions(generator);
+    QBENCHMARK {
+        a -= b;
+    }
+}
+
+void TestPegOps::benchTotal_data() { addLevelRows(); }
+void TestPegOps::benchTotal()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator);
+    int64_t nTotal = 0;
+    QBENCHMARK {
+        nTotal += a.Total();
+    }
+    Q_UNUSED(nTotal);
+}
+
+void TestPegOps::benchLowHigh_data() { addLevelRows(); }
+void TestPegOps::benchLowHigh()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator);
+    int64_t nValue = 0;
+    QBENCHMARK {
+        nValue += a.Low(PEG_SIZE/2);
+        nValue += a.High(PEG_SIZE/2);
+    }
+    Q_UNUSED(nValue);
+}
+
+void TestPegOps::benchPositive_data() { addLevelRows(); }
+void TestPegOps::benchPositive()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator);
+    int64_t nPositive = 0;
+    int64_t nNegative = 0;
+    QBENCHMARK {
+        a.Positive(&nPositive);
+        a.Negative(&nNegative);
+    }
+}
+
+void TestPegOps::benchDistortion_data() { addLevelRows(); }
+void TestPegOps::benchDistortion()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator).Positive(nullptr);
+    CFractions b = randomFractions(generator).Positive(nullptr);
+    double dDistortion = 0;
+    QBENCHMARK {
+        dDistortion += a.Distortion(b);
+    }
+    Q_UNUSED(dDistortion);
+}
+
+void TestPegOps::benchRatioPart_data() { addLevelRows(); }
+void TestPegOps::benchRatioPart()
+{
+    QFETCH(int, level);
+    pegkernels::SetLevel(pegkernels::Level(level));
+    std::default_random_engine generator;
+    CFractions a = randomFractions(generator).Positive(nullptr);
+    int64_t nPart = a.Total() / 3;
+    QBENCHMARK {
+        a.RatioPart(nPart);
+    }
+}
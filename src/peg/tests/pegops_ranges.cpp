@@ -0,0 +1,77 @@
+// Copyright (c) 2018 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <QtTest/QtTest>
+
+#include "pegdata.h"
+#include "pegops_tests.h"
+
+#include <random>
+
+using namespace std;
+
+void TestPegOps::testRanges()
+{
+    std::default_random_engine generator;
+    std::uniform_int_distribution<int64_t> distribution(-1000, 1000000);
+
+    for(int n=0; n<300; n++) {
+        CFractions fr(0, CFractions::STD);
+        for(int i=n%PEG_SIZE;i<PEG_SIZE;i++) {
+            fr.f[i] = distribution(generator);
+        }
+        int supply = (n*7) % (PEG_SIZE+1);
+        CPegLevel level(1,0,0,2+supply%(PEG_SIZE-5),supply,supply);
+        level.nShift = (n%5)-2;
+        if (n%3) {
+            level.nShiftLastPart = 5+n;
+            level.nShiftLastTotal = 170+n;
+        }
+
+        int64_t nLow = 0;
+        int64_t nHigh = 0;
+        int64_t nLowPart = 0;
+        int64_t nHighPart = 0;
+        fr.LowHigh(supply, &nLow, &nHigh);
+        fr.LowPart(supply, &nLowPart);
+        fr.HighPart(supply, &nHighPart);
+        QCOMPARE(nLow, nLowPart);
+        QCOMPARE(nHigh, nHighPart);
+
+        nLow = nHigh = nLowPart = nHighPart = 0;
+        fr.LowHigh(level, &nLow, &nHigh);
+        fr.LowPart(level, &nLowPart);
+        fr.HighPart(level, &nHighPart);
+        QCOMPARE(nLow, nLowPart);
+        QCOMPARE(nHigh, nHighPart);
+        QCOMPARE(fr.LowRange(level).Total(), nLowPart);
+        QCOMPARE(fr.HighRange(level).Total(), nHighPart);
+
+        QCOMPARE(fr.LowRange(level).HLI(), fr.LowPart(level, nullptr).HLI());
+        QCOMPARE(fr.HighRange(level).HLI(), fr.HighPart(level, nullptr).HLI());
+        QCOMPARE(fr.LowRange(supply).HLI(), fr.LowPart(supply, nullptr).HLI());
+        QCOMPARE(fr.HighRange(supply).HLI(), fr.HighPart(supply, nullptr).HLI());
+
+        CFractions frSigned = fr - fr.RatioPart(fr.Total()/2);
+        for(int i=0;i<PEG_SIZE;i+=3) {
+            frSigned.f[i] = -frSigned.f[i];
+        }
+        int64_t nPositive = 0;
+        int64_t nNegative = 0;
+        int64_t nPositivePart = 0;
+        int64_t nNegativePart = 0;
+        frSigned.HighRange(level).Signed(&nPositive, &nNegative);
+        frSigned.HighPart(level, nullptr).Positive(&nPositivePart);
+        frSigned.HighPart(level, nullptr).Negative(&nNegativePart);
+        QCOMPARE(nPositive, nPositivePart);
+        QCOMPARE(nNegative, nNegativePart);
+
+        int64_t nValue = distribution(generator)*1000+n;
+        CFractions frValue(nValue, CFractions::VALUE);
+        QCOMPARE(frValue.Low(supply), frValue.Std().Low(supply));
+        QCOMPARE(frValue.High(supply), frValue.Std().High(supply));
+        QCOMPARE(CFractions::StdLow(nValue, supply), frValue.Std().Low(supply));
+        QCOMPARE(frValue.HighRange(level).HLI(), frValue.HighPart(level, nullptr).HLI());
+    }
+}
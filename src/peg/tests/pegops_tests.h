@@ -23,6 +23,29 @@ private slots:
     void test8();
     void test1k();
     void test1w();
+    void testKernels();
+    void testRanges();
+    void testAlloc();
+    void testCopyOnWrite();
+    void testCompact();
+    void testCodec();
+    void testCache();
+    void benchAdd_data();
+    void benchAdd();
+    void benchSub_data();
+    void benchSub();
+    void benchTotal_data();
+    void benchTotal();
+    void benchLowHigh_data();
+    void benchLowHigh();
+    void benchPositive_data();
+    void benchPositive();
+    void benchDistortion_data();
+    void benchDistortion();
+    void benchRatioPart_data();
+    void benchRatioPart();
+    void benchCodec_data();
+    void benchCodec();
 };
 
 #endif // BITBAY_PEGOPS_TESTS_H
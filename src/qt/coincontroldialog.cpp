@@ -586,9 +586,9 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog, PegTxT
         int64_t nValue = 0;
         if (txType == PEG_MAKETX_SEND_RESERVE ||
             txType == PEG_MAKETX_FREEZE_RESERVE) {
-            nValue = out.tx->vOutFractions[out.i].Ref().Low(model->getPegSupplyIndex());
+            nValue = out.tx->vOutFractions[out.i].Low(model->getPegSupplyIndex());
         } else {
-            nValue = out.tx->vOutFractions[out.i].Ref().High(model->getPegSupplyIndex());
+            nValue = out.tx->vOutFractions[out.i].High(model->getPegSupplyIndex());
         }
         nAmount += nValue;
 
@@ -795,8 +795,8 @@ void CoinControlDialog::updateView()
 
             // amount
             sumFractions += out.tx->vOutFractions[out.i].Ref();
-            int64_t nReserve = out.tx->vOutFractions[out.i].Ref().Low(model->getPegSupplyIndex());
-            int64_t nLiquidity = out.tx->vOutFractions[out.i].Ref().High(model->getPegSupplyIndex());
+            int64_t nReserve = out.tx->vOutFractions[out.i].Low(model->getPegSupplyIndex());
+            int64_t nLiquidity = out.tx->vOutFractions[out.i].High(model->getPegSupplyIndex());
             uint32_t nFlags = out.tx->vOutFractions[out.i].nFlags();
             nSumReserve += nReserve;
             nSumLiquidity += nLiquidity;
@@ -982,7 +982,7 @@ void CoinControlDialog::openFractions(QTreeWidgetItem * item, int column)
     auto supply = item->data(4, BlockchainModel::PegSupplyRole).toInt();
     auto vfractions = item->data(4, BlockchainModel::FractionsRole);
     auto fractions = vfractions.value<CFractions>();
-    auto fractions_std = fractions.Std();
+    const auto fractions_std = fractions.Std();
 
     unsigned long len_test = 0;
     CDataStream fout_test(SER_DISK, CLIENT_VERSION);
@@ -70,7 +70,7 @@ void FractionsItemDelegate::paint(QPainter* p,
 
     auto vfractions = index.data(BlockchainModel::FractionsRole);
     auto fractions = vfractions.value<CFractions>();
-    auto fractions_std = fractions.Std();
+    const auto fractions_std = fractions.Std();
 
     int64_t f_max = 0;
     for (int i=0; i<PEG_SIZE; i++) {
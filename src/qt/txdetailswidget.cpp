@@ -438,8 +438,7 @@ void TxDetailsWidget::openTx(CTransaction & tx,
     int64_t nReserveIn = 0;
     int64_t nLiquidityIn = 0;
     for(auto const & inputFractionItem : mapInputsFractions) {
-        inputFractionItem.second.LowPart(nSupply, &nReserveIn);
-        inputFractionItem.second.HighPart(nSupply, &nLiquidityIn);
+        inputFractionItem.second.LowHigh(nSupply, &nReserveIn, &nLiquidityIn);
     }
 
     bool peg_ok = false;
@@ -940,7 +939,7 @@ void TxDetailsWidget::openTxMenu(const QPoint & pos)
                 }
             }
 
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
             if (mi != mapBlockIndex.end() && (*mi).second) {
                 CBlockIndex* pindex = (*mi).second;
                 nSupply = pindex->nPegSupplyIndex;
@@ -1043,7 +1042,7 @@ void TxDetailsWidget::openInpMenu(const QPoint & pos)
         QModelIndex mi2 = model->index(mi.row(), COL_INP_FRACTIONS);
         QVariant vfractions = mi2.data(BlockchainModel::FractionsRole);
         if (!vfractions.isValid()) return;
-        CFractions fractions = vfractions.value<CFractions>().Std();
+        const CFractions fractions = vfractions.value<CFractions>().Std();
         QString text;
         for (int i=0; i<PEG_SIZE; i++) {
             if (i!=0) text += "\n";
@@ -1141,7 +1140,7 @@ void TxDetailsWidget::openOutMenu(const QPoint & pos)
         QModelIndex mi2 = model->index(mi.row(), COL_OUT_FRACTIONS);
         QVariant vfractions = mi2.data(BlockchainModel::FractionsRole);
         if (!vfractions.isValid()) return;
-        CFractions fractions = vfractions.value<CFractions>().Std();
+        const CFractions fractions = vfractions.value<CFractions>().Std();
         QString text;
         for (int i=0; i<PEG_SIZE; i++) {
             if (i!=0) text += "\n";
@@ -1564,7 +1563,7 @@ void TxDetailsWidget::plotFractions(QTreeWidget * table,
     if (reserveLabel) reserveLabel->setText(tr("Reserve: %1").arg(displayValue(fractions.Low(level))));
     if (liquidityLabel) liquidityLabel->setText(tr("Liquidity: %1").arg(displayValue(fractions.High(level))));
     
-    auto fractions_std = fractions.Std();
+    const auto fractions_std = fractions.Std();
 
     qreal y_min = 0;
     qreal y_max = 0;
@@ -1728,19 +1727,19 @@ void TxDetailsWidget::plotFractions(QTreeWidget * table,
     table->addTopLevelItem(row_item_vhli);
     
     QStringList row_lhli;
-    row_lhli << tr("LHLI") << QString::number(fractions.HighPart(level, nullptr).HLI());
+    row_lhli << tr("LHLI") << QString::number(fractions.HighRange(level).HLI());
     auto row_item_lhli = new QTreeWidgetItem(row_lhli);
     row_item_lhli->setData(0, Qt::TextAlignmentRole, int(Qt::AlignVCenter | Qt::AlignLeft));
     row_item_lhli->setData(1, Qt::TextAlignmentRole, int(Qt::AlignVCenter | Qt::AlignRight));
-    row_item_lhli->setData(1, BlockchainModel::ValueForCopy, qlonglong(fractions.HighPart(level, nullptr).HLI()));
+    row_item_lhli->setData(1, BlockchainModel::ValueForCopy, qlonglong(fractions.HighRange(level).HLI()));
     table->addTopLevelItem(row_item_lhli);
     
     QStringList row_rhli;
-    row_rhli << tr("RHLI") << QString::number(fractions.LowPart(level, nullptr).HLI());
+    row_rhli << tr("RHLI") << QString::number(fractions.LowRange(level).HLI());
     auto row_item_rhli = new QTreeWidgetItem(row_rhli);
     row_item_rhli->setData(0, Qt::TextAlignmentRole, int(Qt::AlignVCenter | Qt::AlignLeft));
     row_item_rhli->setData(1, Qt::TextAlignmentRole, int(Qt::AlignVCenter | Qt::AlignRight));
-    row_item_rhli->setData(1, BlockchainModel::ValueForCopy, qlonglong(fractions.LowPart(level, nullptr).HLI()));
+    row_item_rhli->setData(1, BlockchainModel::ValueForCopy, qlonglong(fractions.LowRange(level).HLI()));
     table->addTopLevelItem(row_item_rhli);
     
     QStringList row_space;
@@ -1884,6 +1883,7 @@ void TxDetailsWidget::copyPegData(QTreeWidget * table)
         bool isIndex = false;
         int index = name.toInt(&isIndex);
         if (isIndex && index >=0 && index < PEG_SIZE) {
+            pegdata.fractions.Decompact();
             pegdata.fractions.f[index] = value.toLongLong();
         }
         qDebug() << pegdata.fractions.Total();
@@ -82,7 +82,7 @@ qint64 WalletModel::getReserve(const CCoinControl *coinControl) const
         wallet->AvailableCoins(vCoins, true, true, coinControl);
         for(const COutput& out : vCoins) {
             if(out.fSpendable && !out.IsFrozen(wallet->nLastBlockTime)) {
-                nReserve += out.tx->vOutFractions[out.i].Ref().Low(getPegSupplyIndex());
+                nReserve += out.tx->vOutFractions[out.i].Low(getPegSupplyIndex());
             }
         }
 
@@ -101,7 +101,7 @@ qint64 WalletModel::getLiquidity(const CCoinControl *coinControl) const
         wallet->AvailableCoins(vCoins, true, true, coinControl);
         for(const COutput& out : vCoins) {
             if(out.fSpendable && !out.IsFrozen(wallet->nLastBlockTime)) {
-                nLiquidity += out.tx->vOutFractions[out.i].Ref().High(getPegSupplyIndex());
+                nLiquidity += out.tx->vOutFractions[out.i].High(getPegSupplyIndex());
             }
         }
 
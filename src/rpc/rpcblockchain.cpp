@@ -229,6 +229,42 @@ Value getrawmempool(const Array& params, bool fHelp)
     return a;
 }
 
+Value getmempoolinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmempoolinfo\n"
+            "Returns an object containing memory pool size, fractions store statistics\n"
+            "and the counts and time of the last review of the pool on peg change.");
+
+    CTxMemPoolFractions::Stats stats = mempool.GetFractionsStats();
+
+    Object result;
+    result.push_back(Pair("size", int64_t(mempool.size())));
+    Object fractions;
+    fractions.push_back(Pair("entries", int64_t(stats.nEntries)));
+    fractions.push_back(Pair("decoded", int64_t(stats.nDecoded)));
+    fractions.push_back(Pair("decodedbytes", int64_t(stats.nDecodedBytes)));
+    fractions.push_back(Pair("packedbytes", int64_t(stats.nPackedBytes)));
+    fractions.push_back(Pair("maxbytes", int64_t(stats.nMaxBytes)));
+    fractions.push_back(Pair("hits", int64_t(stats.nHits)));
+    fractions.push_back(Pair("unpacks", int64_t(stats.nUnpacks)));
+    fractions.push_back(Pair("spills", int64_t(stats.nSpills)));
+    result.push_back(Pair("fractions", fractions));
+
+    CTxMemPoolReviewStats review = mempool.GetReviewStats();
+    Object pegreview;
+    pegreview.push_back(Pair("height", review.nHeight));
+    pegreview.push_back(Pair("peg", review.nPegSupplyIndex));
+    pegreview.push_back(Pair("txs", int64_t(review.nTxs)));
+    pegreview.push_back(Pair("groups", int64_t(review.nGroups)));
+    pegreview.push_back(Pair("rechecked", int64_t(review.nRechecked)));
+    pegreview.push_back(Pair("removed", int64_t(review.nRemoved)));
+    pegreview.push_back(Pair("micros", int64_t(review.nMicros)));
+    result.push_back(Pair("pegreview", pegreview));
+    return result;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -474,7 +510,7 @@ Value gettxout(const Array& params, bool fHelp)
     bool is_in_main_chain = false;
     if (hashBlock != 0)
     {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second)
         {
             CBlockIndex* pindex = (*mi).second;
@@ -514,7 +550,7 @@ Value createbootstrap(const Array& params, bool fHelp)
     }
     
     uint256 blockHash = Params().HashGenesisBlock();
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(blockHash);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(blockHash);
     if (mi == mapBlockIndex.end()) {
         throw JSONRPCError(RPC_MISC_ERROR, "Genesis block not found");
     }
@@ -536,6 +572,27 @@ Value createbootstrap(const Array& params, bool fHelp)
     return ret;
 }
 
+static Object BlockFileStatsToJSON(const CBlockFileStats& stats)
+{
+    Object ret;
+    ret.push_back(Pair("opens", int64_t(stats.nOpens)));
+    ret.push_back(Pair("closes", int64_t(stats.nCloses)));
+    ret.push_back(Pair("reads", int64_t(stats.nReads)));
+    ret.push_back(Pair("bytesread", int64_t(stats.nBytesRead)));
+    ret.push_back(Pair("handles", int64_t(stats.nHandles)));
+    return ret;
+}
+
+Value getblockfilestats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockfilestats\n"
+            "Returns an object containing block files access statistics.");
+
+    return BlockFileStatsToJSON(GetBlockFileStats());
+}
+
 Value listunspent(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 4)
@@ -169,6 +169,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getliquidityrate", 1 },
     { "getpeglevel", 2 },
     { "getfractions", 1 },
+    { "benchpegdb", 0 },
+    { "benchpegdb", 1 },
     { "makepeglevel", 0 },
     { "makepeglevel", 1 },
     { "makepeglevel", 2 },
@@ -9,6 +9,7 @@
 #include "net.h"
 #include "netbase.h"
 #include "rpcserver.h"
+#include "sigcache.h"
 #include "timedata.h"
 #include "util.h"
 #include "txdb-leveldb.h"
@@ -104,6 +105,218 @@ Value getpeginfo(const Array& params, bool fHelp)
     return peg;
 }
 
+Value getpegstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getpegstats\n"
+            "Returns an object containing peg fractions memory and cache statistics.");
+
+    Object result;
+
+    pegalloc::Stats alloc = pegalloc::GetStats();
+    Object fractionsalloc;
+    fractionsalloc.push_back(Pair("allocs", int64_t(alloc.nAllocs)));
+    fractionsalloc.push_back(Pair("frees", int64_t(alloc.nFrees)));
+    fractionsalloc.push_back(Pair("inuse", int64_t(alloc.nAllocs - alloc.nFrees)));
+    fractionsalloc.push_back(Pair("shares", int64_t(alloc.nShares)));
+    fractionsalloc.push_back(Pair("unshares", int64_t(alloc.nUnshares)));
+    fractionsalloc.push_back(Pair("mallocs", int64_t(alloc.nMallocs)));
+    fractionsalloc.push_back(Pair("arenaallocs", int64_t(alloc.nArenaAllocs)));
+    fractionsalloc.push_back(Pair("arenas", int64_t(alloc.nArenas)));
+    fractionsalloc.push_back(Pair("arenasalive", int64_t(alloc.nArenasAlive)));
+    fractionsalloc.push_back(Pair("pooled", int64_t(alloc.nPooled)));
+    fractionsalloc.push_back(Pair("compact", int64_t(alloc.nWindows)));
+    fractionsalloc.push_back(Pair("compactbytes", int64_t(alloc.nWindowBytes)));
+    result.push_back(Pair("fractionsalloc", fractionsalloc));
+
+    CFractionsCache::Stats cache = CPegDB::GetFractionsCacheStats();
+    Object fractionscache;
+    fractionscache.push_back(Pair("hits", int64_t(cache.nHits)));
+    fractionscache.push_back(Pair("misses", int64_t(cache.nMisses)));
+    fractionscache.push_back(Pair("inserts", int64_t(cache.nInserts)));
+    fractionscache.push_back(Pair("evictions", int64_t(cache.nEvictions)));
+    fractionscache.push_back(Pair("invalidations", int64_t(cache.nInvalidations)));
+    fractionscache.push_back(Pair("entries", int64_t(cache.nEntries)));
+    fractionscache.push_back(Pair("bytes", int64_t(cache.nBytes)));
+    fractionscache.push_back(Pair("maxbytes", int64_t(cache.nMaxBytes)));
+    result.push_back(Pair("fractionscache", fractionscache));
+
+    return result;
+}
+
+Value getsigcachestats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcachestats\n"
+            "Returns an object containing signature cache statistics.");
+
+    CSignatureCache::Stats stats = GetSignatureCache().GetStats();
+    uint64_t nLookups = stats.nHits + stats.nMisses;
+
+    Object result;
+    result.push_back(Pair("hits", int64_t(stats.nHits)));
+    result.push_back(Pair("misses", int64_t(stats.nMisses)));
+    result.push_back(Pair("hitrate", nLookups ? double(stats.nHits) / double(nLookups) : 0.));
+    result.push_back(Pair("inserts", int64_t(stats.nInserts)));
+    result.push_back(Pair("evictions", int64_t(stats.nEvictions)));
+    result.push_back(Pair("entries", int64_t(stats.nEntries)));
+    result.push_back(Pair("slots", int64_t(stats.nSlots)));
+    result.push_back(Pair("maxslots", int64_t(stats.nMaxSlots)));
+    result.push_back(Pair("maxbytes", int64_t(stats.nMaxBytes)));
+    return result;
+}
+
+static Object WriteBufferStats(const CDBWriteBuffer::Stats& stats)
+{
+    Object result;
+    result.push_back(Pair("enabled", stats.fEnabled));
+    result.push_back(Pair("keys", int64_t(stats.nKeys)));
+    result.push_back(Pair("bytes", int64_t(stats.nBytes)));
+    result.push_back(Pair("commits", int64_t(stats.nCommits)));
+    result.push_back(Pair("flushes", int64_t(stats.nFlushes)));
+    result.push_back(Pair("flushedkeys", int64_t(stats.nFlushedKeys)));
+    result.push_back(Pair("flushedbytes", int64_t(stats.nFlushedBytes)));
+    result.push_back(Pair("flushms", stats.nFlushMicros / 1000.));
+    result.push_back(Pair("lastflushms", stats.nLastFlushMicros / 1000.));
+    return result;
+}
+
+Value getdbbatchstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbbatchstats\n"
+            "Returns an object containing statistics of the block writes kept in memory during the initial sync.");
+
+    Object result;
+    result.push_back(Pair("maxbytes", GetArg("-dbbatchsize", DEFAULT_DB_BATCH_SIZE) * 1048576));
+    result.push_back(Pair("maxseconds", GetArg("-dbbatchtime", DEFAULT_DB_BATCH_TIME)));
+    result.push_back(Pair("txdb", WriteBufferStats(CTxDB::WriteBuffer().GetStats())));
+    result.push_back(Pair("pegdb", WriteBufferStats(CPegDB::WriteBuffer().GetStats())));
+    return result;
+}
+
+static Object LevelDBStats(const CDBStats& stats)
+{
+    Object options;
+    options.push_back(Pair("cache", int64_t(stats.options.nCacheBytes)));
+    options.push_back(Pair("writebuffer", int64_t(stats.options.nWriteBufferBytes)));
+    options.push_back(Pair("filesize", int64_t(stats.options.nMaxFileBytes)));
+    options.push_back(Pair("blocksize", int64_t(stats.options.nBlockBytes)));
+    options.push_back(Pair("compression", stats.options.fCompression));
+    options.push_back(Pair("bloombits", stats.options.nBloomBits));
+
+    Object prefixes;
+    for (const std::pair<std::string, uint64_t>& item : stats.vPrefixBytes)
+        prefixes.push_back(Pair(item.first, int64_t(item.second)));
+
+    Array files;
+    for (int nFiles : stats.vFilesAtLevel)
+        files.push_back(nFiles);
+
+    std::vector<std::string> vLines;
+    boost::split(vLines, stats.strStats, boost::is_any_of("\n"));
+    Array lines;
+    for (const std::string& strLine : vLines) {
+        if (!strLine.empty())
+            lines.push_back(strLine);
+    }
+
+    Object result;
+    result.push_back(Pair("options", options));
+    result.push_back(Pair("approxbytes", int64_t(stats.nApproxBytes)));
+    result.push_back(Pair("prefixbytes", prefixes));
+    result.push_back(Pair("filesatlevel", files));
+    result.push_back(Pair("stats", lines));
+    return result;
+}
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns an object containing the options and the LevelDB statistics of txleveldb and pegleveldb:\n"
+            "approximate size on disk of all the keys and of the keys of each prefix, files at each level\n"
+            "and the leveldb.stats compaction table.");
+
+    Object result;
+    result.push_back(Pair("dbcache", GetArg("-dbcache", DEFAULT_DB_CACHE)));
+    result.push_back(Pair("dbcachepeg", GetArg("-dbcachepeg", DEFAULT_DB_CACHE_PEG)));
+    CDBStats txstats;
+    if (CTxDB::GetDBStats(txstats)) {
+        Object txdb = LevelDBStats(txstats);
+        txdb.push_back(Pair("writebuffer", WriteBufferStats(CTxDB::WriteBuffer().GetStats())));
+        result.push_back(Pair("txdb", txdb));
+    }
+    CDBStats pegstats;
+    if (CPegDB::GetDBStats(pegstats)) {
+        Object pegdb = LevelDBStats(pegstats);
+        pegdb.push_back(Pair("writebuffer", WriteBufferStats(CPegDB::WriteBuffer().GetStats())));
+        result.push_back(Pair("pegdb", pegdb));
+    }
+    return result;
+}
+
+Value benchpegdb(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "benchpegdb [maxrecords=10000] [migrate=false]\n"
+            "Measures fractions codecs on records of pegdb: bytes per record,\n"
+            "encode and decode ns per record. With migrate=true the measured\n"
+            "records stored by older codecs are rewritten with vdelta codec.\n"
+            "maxrecords -1 processes all records.");
+
+    int64_t nMaxRecords = 10000;
+    if (params.size() > 0)
+        nMaxRecords = params[0].get_int64();
+    bool fMigrate = false;
+    if (params.size() > 1)
+        fMigrate = params[1].get_bool();
+
+    CPegDBCodecStats stats;
+    if (fMigrate) {
+        LOCK(cs_main);
+        CPegDB pegdb("r+");
+        if (!pegdb.BenchFractions(nMaxRecords, true, stats))
+            throw runtime_error("benchpegdb: failed to migrate records");
+    } else {
+        CPegDB pegdb("r");
+        pegdb.BenchFractions(nMaxRecords, false, stats);
+    }
+
+    auto per = [](int64_t v, int64_t n) { return n ? double(v)/double(n) : 0.; };
+
+    Object result;
+    result.push_back(Pair("records", stats.nRecords));
+
+    Object stored;
+    stored.push_back(Pair("value", stats.nValueRecords));
+    stored.push_back(Pair("zdelta", stats.nZDeltaRecords));
+    stored.push_back(Pair("vdelta", stats.nVDeltaRecords));
+    stored.push_back(Pair("raw", stats.nRawRecords));
+    stored.push_back(Pair("bytesperrecord", per(stats.nStoredBytes, stats.nRecords)));
+    result.push_back(Pair("stored", stored));
+
+    Object zdelta;
+    zdelta.push_back(Pair("bytesperrecord", per(stats.nZDeltaBytes, stats.nCodecRecords)));
+    zdelta.push_back(Pair("encodens", per(stats.nZDeltaEncodeNs, stats.nCodecRecords)));
+    zdelta.push_back(Pair("decodens", per(stats.nZDeltaDecodeNs, stats.nCodecRecords)));
+    result.push_back(Pair("zdelta", zdelta));
+
+    Object vdelta;
+    vdelta.push_back(Pair("bytesperrecord", per(stats.nVDeltaBytes, stats.nCodecRecords)));
+    vdelta.push_back(Pair("encodens", per(stats.nVDeltaEncodeNs, stats.nCodecRecords)));
+    vdelta.push_back(Pair("decodens", per(stats.nVDeltaDecodeNs, stats.nCodecRecords)));
+    result.push_back(Pair("vdelta", vdelta));
+
+    result.push_back(Pair("migrated", stats.nMigrated));
+    return result;
+}
+
 Value getfractions(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -168,17 +381,19 @@ Value getfractions(const Array& params, bool fHelp)
             return obj;
         }
     }
-    fractions = fractions.Std();
+    // fractions of pegdb and of the mempool are compact, they are read
+    // via const access only
+    const CFractions fractionsStd = fractions.Std();
     
     Array f;
     int64_t total = 0;
     int64_t reserve = 0;
     int64_t liquidity = 0;
     for(int i=0; i<PEG_SIZE; i++) {
-        total += fractions.f[i];
-        if (i<supply) reserve += fractions.f[i];
-        if (i>=supply) liquidity += fractions.f[i];
-        f.push_back(fractions.f[i]);
+        total += fractionsStd.f[i];
+        if (i<supply) reserve += fractionsStd.f[i];
+        if (i>=supply) liquidity += fractionsStd.f[i];
+        f.push_back(fractionsStd.f[i]);
     }
     
     int lock = 0;
@@ -239,7 +454,7 @@ Value getfractionsbase64(const Array& params, bool fHelp)
         if (txdb.ReadTxIndex(txhash, txindex)) {
             CBlock block;
             if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false)) {
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
                 if (mi != mapBlockIndex.end()) {
                     CBlockIndex* pindex = (*mi).second;
                     int nPegInterval = Params().PegInterval(pindex->nHeight);
@@ -291,13 +506,14 @@ Value getliquidityrate(const Array& params, bool fHelp)
             return obj;
         }
     }
-    fractions = fractions.Std();
+    // compact as in getfractions, read via const access
+    const CFractions fractionsStd = fractions.Std();
     
     int64_t total = 0;
     int highkey = 0;
     for(int i=supply; i<PEG_SIZE; i++) {
-        total += fractions.f[i];
-        if (fractions.f[i] >0)
+        total += fractionsStd.f[i];
+        if (fractionsStd.f[i] >0)
             highkey = i;
     }
     
@@ -309,7 +525,7 @@ Value getliquidityrate(const Array& params, bool fHelp)
     int multiplier = 1;
     vector<double> periods;
     for(int i=supply; i<=highkey; i++) {
-        double e = double(fractions.f[i])/double(total);
+        double e = double(fractionsStd.f[i])/double(total);
         average += e;
         while (true) {
             if (multiplier >20) break;
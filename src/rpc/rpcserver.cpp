@@ -230,6 +230,7 @@ static const CRPCCommand vRPCCommands[] =
     { "getdifficulty",          &getdifficulty,          true,      false,     false },
     { "getinfo",                &getinfo,                true,      false,     false },
     { "getrawmempool",          &getrawmempool,          true,      false,     false },
+    { "getmempoolinfo",         &getmempoolinfo,         true,      true,      false },
     { "getblock",               &getblock,               false,     false,     false },
     { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
     { "getblockhash",           &getblockhash,           false,     false,     false },
@@ -240,12 +241,18 @@ static const CRPCCommand vRPCCommands[] =
     { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
     { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
     { "getcheckpoint",          &getcheckpoint,          true,      false,     false },
+    { "getblockfilestats",      &getblockfilestats,      true,      true,      false },
     { "sendalert",              &sendalert,              false,     false,     false },
     { "validateaddress",        &validateaddress,        true,      false,     false },
     { "validatepubkey",         &validatepubkey,         true,      false,     false },
     { "verifymessage",          &verifymessage,          false,     false,     false },
     { "gettxout",               &gettxout,               false,     false,     false },
     { "getpeginfo",             &getpeginfo,             true,      false,     false },
+    { "getpegstats",            &getpegstats,            true,      false,     false },
+    { "getsigcachestats",       &getsigcachestats,       true,      true,      false },
+    { "getdbbatchstats",        &getdbbatchstats,        true,      true,      false },
+    { "getdbstats",             &getdbstats,             true,      true,      false },
+    { "benchpegdb",             &benchpegdb,             false,     false,     false },
     { "getfractions",           &getfractions,           true,      false,     false },
     { "getfractionsbase64",     &getfractionsbase64,     true,      false,     false },
     { "getliquidityrate",       &getliquidityrate,       true,      false,     false },
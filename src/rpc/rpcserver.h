@@ -180,12 +180,19 @@ extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool f
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getblockfilestats(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getpeginfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getpegstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcachestats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbbatchstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getdbstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value benchpegdb(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getfractions(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getfractionsbase64(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getliquidityrate(const json_spirit::Array& params, bool fHelp);
@@ -22,6 +22,7 @@ typedef std::vector<unsigned char> valtype;
 
 class CKeyStore;
 class CTransaction;
+class CTxOut;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
 static const unsigned int MAX_OP_RETURN_RELAY = 250;      // bytes
@@ -722,7 +723,32 @@ public:
 
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
 bool IsCompressedOrUncompressedPubKey(const valtype &vchPubKey);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Signature hashes of the inputs of one transaction. The serialization
+ *  of blanked inputs and of the outputs is made once and the hash state
+ *  before every input is kept, so the SIGHASH_ALL hash of an input does not
+ *  copy and reserialize the transaction. Other hash types are streamed.
+ *  Hashes are the same as of SignatureHash. Scripts of the inputs are not
+ *  part of the hashes, they can change while the context is used.
+ */
+class CSignatureHashContext
+{
+public:
+    explicit CSignatureHashContext(const CTransaction& txToIn);
+
+    const CTransaction& GetTx() const { return txTo; }
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+
+private:
+    const CTransaction& txTo;
+    std::vector<unsigned char> vchBlankInputs;  // inputs without scripts
+    size_t nBlankInputSize;
+    std::vector<unsigned char> vchOutputs;      // outputs and nLockTime
+    std::vector<CHashWriter> vPrefixes;         // states before every input
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                const CSignatureHashContext* psighash = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -731,11 +757,15 @@ isminetype IsMine(const CKeyStore& keystore, const CTxDestination &dest);
 void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey, std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   const CSignatureHashContext* psighash = NULL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+                   const CSignatureHashContext* psighash = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                   unsigned int flags, int nHashType);
+                   unsigned int flags, int nHashType, const CSignatureHashContext* psighash = NULL);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifySignature(const CTxOut& txoutFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                     const CSignatureHashContext* psighash = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -0,0 +1,188 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+#include "key.h"
+#include "util.h"
+
+#include <string.h>
+
+using namespace std;
+
+CSignatureCache::CSignatureCache(size_t nMaxBytesIn)
+    :nMaxBytes(nMaxBytesIn)
+    ,nHits(0)
+    ,nMisses(0)
+    ,nInserts(0)
+    ,nEvictions(0)
+{
+    uint256 salt = GetRandHash();
+    SHA256_Init(&ctxSalted);
+    SHA256_Update(&ctxSalted, salt.begin(), salt.size());
+
+    // slots are allocated as the shards fill
+    nMaxBuckets = nMaxBytes / (sizeof(uint256) * nWays * nShards);
+}
+
+uint256 CSignatureCache::Key(const uint256 & hash, const vector<unsigned char> & vchSig, const CPubKey & pubKey) const
+{
+    // the salted state is copied, sizes are fixed by the
+    // signature encoding and the pubkey prefix byte
+    SHA256_CTX ctx = ctxSalted;
+    SHA256_Update(&ctx, &hash, sizeof(hash));
+    SHA256_Update(&ctx, pubKey.begin(), pubKey.size());
+    SHA256_Update(&ctx, vchSig.data(), vchSig.size());
+    uint256 key;
+    SHA256_Final(key.begin(), &ctx);
+    return key;
+}
+
+// key bits are uniform: low word picks the bucket, next the shard
+static inline size_t BucketOf(const uint256 & key, size_t nBuckets)
+{
+    uint64_t nWord;
+    memcpy(&nWord, &key, sizeof(nWord));
+    return nWord % nBuckets;
+}
+
+CSignatureCache::Shard& CSignatureCache::ShardOf(const uint256 & key)
+{
+    uint64_t nWord;
+    memcpy(&nWord, (const unsigned char*)&key + 8, sizeof(nWord));
+    return shards[nWord % nShards];
+}
+
+void CSignatureCache::Grow(Shard & shard)
+{
+    size_t nBuckets = min(max(nMinBuckets, shard.nBuckets * 2), nMaxBuckets);
+    vector<uint256> vSlots(nBuckets * nWays);
+    size_t nEntries = 0;
+    for (const uint256 & key : shard.vSlots) {
+        if (key.IsNull())
+            continue;
+        uint256* pslots = &vSlots[BucketOf(key, nBuckets) * nWays];
+        for (int i=0; i<nWays; i++) {
+            if (pslots[i].IsNull()) {
+                pslots[i] = key;
+                nEntries++;
+                break;
+            }
+        }
+    }
+    // keys of a bucket which is full in the new layout are dropped
+    nEvictions += shard.nEntries - nEntries;
+    shard.vSlots.swap(vSlots);
+    shard.nBuckets = nBuckets;
+    shard.nEntries = nEntries;
+}
+
+bool CSignatureCache::Get(const uint256 & hash, const vector<unsigned char> & vchSig, const CPubKey & pubKey)
+{
+    if (nMaxBuckets == 0)
+        return false;
+
+    uint256 key = Key(hash, vchSig, pubKey);
+    Shard & shard = ShardOf(key);
+    {
+        boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+        if (shard.nBuckets == 0) {
+            nMisses++;
+            return false;
+        }
+        const uint256* pslots = &shard.vSlots[BucketOf(key, shard.nBuckets) * nWays];
+        for (int i=0; i<nWays; i++) {
+            if (pslots[i] == key) {
+                nHits++;
+                return true;
+            }
+        }
+    }
+    nMisses++;
+    return false;
+}
+
+void CSignatureCache::Set(const uint256 & hash, const vector<unsigned char> & vchSig, const CPubKey & pubKey)
+{
+    if (nMaxBuckets == 0)
+        return;
+
+    uint256 key = Key(hash, vchSig, pubKey);
+    Shard & shard = ShardOf(key);
+    boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+    if (shard.nBuckets != 0) {
+        const uint256* pslots = &shard.vSlots[BucketOf(key, shard.nBuckets) * nWays];
+        for (int i=0; i<nWays; i++) {
+            if (pslots[i] == key)
+                return;
+        }
+    }
+    nInserts++;
+    if (shard.nBuckets == 0)
+        Grow(shard);
+    uint256* pslots;
+    while (true) {
+        pslots = &shard.vSlots[BucketOf(key, shard.nBuckets) * nWays];
+        for (int i=0; i<nWays; i++) {
+            if (pslots[i].IsNull()) {
+                pslots[i] = key;
+                shard.nEntries++;
+                return;
+            }
+        }
+        // below half load a full bucket is a random collision
+        if (shard.nBuckets == nMaxBuckets || shard.nEntries < shard.nBuckets * nWays / 2)
+            break;
+        Grow(shard);
+    }
+    // Evict by the salted key bits, random for peers trying to
+    // pre-generate and re-use a set of valid signatures
+    uint64_t nWord;
+    memcpy(&nWord, (const unsigned char*)&key + 16, sizeof(nWord));
+    pslots[nWord % nWays] = key;
+    nEvictions++;
+}
+
+void CSignatureCache::Clear()
+{
+    for (Shard & shard : shards) {
+        boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+        vector<uint256>().swap(shard.vSlots);
+        shard.nBuckets = 0;
+        shard.nEntries = 0;
+    }
+}
+
+CSignatureCache::Stats CSignatureCache::GetStats() const
+{
+    Stats stats;
+    stats.nHits         = nHits;
+    stats.nMisses       = nMisses;
+    stats.nInserts      = nInserts;
+    stats.nEvictions    = nEvictions;
+    stats.nMaxSlots     = nMaxBuckets * nWays * nShards;
+    stats.nMaxBytes     = nMaxBytes;
+    for (const Shard & shard : shards) {
+        boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+        stats.nEntries += shard.nEntries;
+        stats.nSlots += shard.vSlots.size();
+    }
+    return stats;
+}
+
+static size_t SignatureCacheBytes()
+{
+    // -maxsigcachesize was the number of cached signatures, it is
+    // kept as the number of 32 byte entries
+    if (!mapArgs.count("-sigcachemb") && mapArgs.count("-maxsigcachesize")) {
+        const int64_t nMaxEntries = (MAX_SIG_CACHE_MB << 20) / sizeof(uint256);
+        return max(min(GetArg("-maxsigcachesize", 0), nMaxEntries), int64_t(0)) * sizeof(uint256);
+    }
+    return max(min(GetArg("-sigcachemb", DEFAULT_SIG_CACHE_MB), MAX_SIG_CACHE_MB), int64_t(0)) << 20;
+}
+
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache(SignatureCacheBytes());
+    return signatureCache;
+}
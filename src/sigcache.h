@@ -0,0 +1,84 @@
+// Copyright (c) 2020 yshurik
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITBAY_SIGCACHE_H
+#define BITBAY_SIGCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <boost/thread/shared_mutex.hpp>
+#include <openssl/sha.h>
+
+#include "uint256.h"
+
+class CPubKey;
+
+/** Default and maximum of -sigcachemb, in megabytes */
+static const int64_t DEFAULT_SIG_CACHE_MB = 32;
+static const int64_t MAX_SIG_CACHE_MB = 4096;
+
+/** Cache of valid signatures, keyed by SHA256 of a random salt and of
+ *  (signature hash, signature, public key), so entries are 32 bytes and
+ *  can not be chosen to collide by peers. The table is split into shards
+ *  with own lock, each shard is a set associative table: a key has a
+ *  bucket of nWays slots and a full bucket evicts one of them chosen by
+ *  the key bits. A shard starts empty and doubles its buckets instead of
+ *  evicting once it is half full, up to its part of the configured memory.
+ *  Lookups take the shard lock shared, so script check threads do not
+ *  serialize on the cache.
+ */
+class CSignatureCache {
+public:
+    struct Stats {
+        uint64_t nHits          = 0;
+        uint64_t nMisses        = 0;
+        uint64_t nInserts       = 0;
+        uint64_t nEvictions     = 0;
+        uint64_t nEntries       = 0;
+        uint64_t nSlots         = 0;    // allocated
+        uint64_t nMaxSlots      = 0;
+        uint64_t nMaxBytes      = 0;
+    };
+
+    explicit CSignatureCache(size_t nMaxBytes);
+
+    bool    Get(const uint256 & hash, const std::vector<unsigned char> & vchSig, const CPubKey & pubKey);
+    void    Set(const uint256 & hash, const std::vector<unsigned char> & vchSig, const CPubKey & pubKey);
+    void    Clear();
+
+    Stats   GetStats() const;
+
+    static const int nShards = 16;
+    static const int nWays = 4;
+    static const size_t nMinBuckets = 256; // per shard, first allocation
+
+private:
+    struct Shard {
+        mutable boost::shared_mutex mutex;
+        std::vector<uint256>        vSlots; // null for free slots
+        size_t                      nBuckets = 0;
+        size_t                      nEntries = 0;
+    };
+
+    uint256     Key(const uint256 & hash, const std::vector<unsigned char> & vchSig, const CPubKey & pubKey) const;
+    Shard&      ShardOf(const uint256 & key);
+    void        Grow(Shard & shard);
+
+    SHA256_CTX              ctxSalted;      // state after the salt
+    size_t                  nMaxBuckets;    // per shard
+    size_t                  nMaxBytes;
+    Shard                   shards[nShards];
+    std::atomic<uint64_t>   nHits;
+    std::atomic<uint64_t>   nMisses;
+    std::atomic<uint64_t>   nInserts;
+    std::atomic<uint64_t>   nEvictions;
+};
+
+/** The cache of CheckSig, sized by -sigcachemb on first use, or by the
+ *  deprecated -maxsigcachesize which counts entries */
+CSignatureCache& GetSignatureCache();
+
+#endif
@@ -0,0 +1,272 @@
+#include <boost/test/unit_test.hpp>
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "blockdownload.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// header chain of n blocks on top of a block at nRootHeight, each block
+// adds nTrust to the chain trust which is the height with the default one
+static vector<uint256> AddChain(CBlockDownload& download, const uint256& hashRoot, int nRootHeight, int n,
+                                NodeId node = 1, int nTrust = 1)
+{
+    vector<uint256> vHashes;
+    uint256 hashPrev = hashRoot;
+    uint256 nChainTrust = download.HeaderHeight(hashRoot) >= 0 ? download.HeaderTrust(hashRoot) : uint256(nRootHeight);
+    for (int i=0; i<n; i++) {
+        uint256 hash = GetRandHash();
+        nChainTrust += nTrust;
+        BOOST_CHECK(download.AddHeader(hash, hashPrev, nRootHeight + 1 + i, nChainTrust, node));
+        vHashes.push_back(hash);
+        hashPrev = hash;
+    }
+    return vHashes;
+}
+
+BOOST_AUTO_TEST_SUITE(blockdownload_tests)
+
+BOOST_AUTO_TEST_CASE(blockdownload_window)
+{
+    CBlockDownload download(64, 16, 60, 1000);
+    BOOST_CHECK(!download.IsActive());
+    BOOST_CHECK(download.StartHeaders(1, 500, 100, 0));
+    BOOST_CHECK(!download.StartHeaders(2, 500, 100, 1)); // one headers request at a time
+    BOOST_CHECK(download.IsHeadersPeer(1));
+    BOOST_CHECK(!download.IsHeadersPeer(2));
+
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 200);
+    download.HeadersReceived(1, false, 2);
+    BOOST_CHECK(!download.IsHeadersPeer(1));
+    BOOST_CHECK(download.IsActive());
+    BOOST_CHECK(download.BestHeaderHeight() == 300);
+    BOOST_CHECK(download.HeaderHeight(vChain[9]) == 110);
+    BOOST_CHECK(!download.StartHeaders(1, 500, 100, 3)); // at the end of its chain
+    BOOST_CHECK(download.StartHeaders(2, 500, 100, 3));
+
+    // locator starts at the tip and ends at the connected parent
+    vector<uint256> vHave = download.GetLocatorHashes();
+    BOOST_CHECK(vHave.front() == vChain.back());
+    BOOST_CHECK(vHave.back() == hashRoot);
+
+    // peers get distinct blocks up to their limit, within the window
+    set<uint256> setRequested;
+    for (NodeId node = 1; node <= 5; node++) {
+        vector<uint256> vHashes;
+        download.RequestBlocks(node, 1000, 10, vHashes);
+        BOOST_CHECK(vHashes.size() == (node <= 4 ? 16u : 0u));
+        setRequested.insert(vHashes.begin(), vHashes.end());
+    }
+    BOOST_CHECK(setRequested.size() == 64);
+    for (int i=0; i<64; i++)
+        BOOST_CHECK(setRequested.count(vChain[i]));
+
+    // peer below the height of the blocks is not asked
+    download.NodeFinalized(1);
+    vector<uint256> vLow;
+    download.RequestBlocks(6, 100, 10, vLow);
+    BOOST_CHECK(vLow.empty());
+    download.RequestBlocks(6, 1000, 10, vLow);
+    BOOST_CHECK(vLow.size() == 16);
+    BOOST_CHECK(download.GetStats().nInFlight == 64);
+
+    // timeouts free the requests
+    download.ExpireRequests(69);
+    BOOST_CHECK(download.GetStats().nInFlight == 64);
+    download.ExpireRequests(70);
+    BOOST_CHECK(download.GetStats().nInFlight == 0);
+    BOOST_CHECK(download.GetStats().nTimeouts == 64);
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_order)
+{
+    CBlockDownload download(64, 16, 60, 1000);
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 10);
+
+    vector<uint256> vHashes;
+    download.RequestBlocks(1, 1000, 0, vHashes);
+    BOOST_CHECK(vHashes.size() == 10);
+
+    // blocks received out of order are taken in the chain order
+    NodeId node = -1;
+    for (int i=9; i>=1; i--) {
+        BOOST_CHECK(download.IsWanted(vChain[i]));
+        BOOST_CHECK(download.BlockReceived(vChain[i], 1));
+        download.BufferBlock(vChain[i], std::make_shared<CBlock>(), 1);
+        BOOST_CHECK(!download.TakeNext(node));
+    }
+    BOOST_CHECK(download.GetStats().nBuffered == 9);
+    BOOST_CHECK(download.GetStats().nInFlight == 1);
+
+    // first block connected directly, the rest follow with their sender
+    BOOST_CHECK(download.BlockReceived(vChain[0], 1));
+    download.BlockAccepted(vChain[0]);
+    BOOST_CHECK(!download.IsWanted(vChain[0]));
+    int nTaken = 0;
+    while (download.TakeNext(node)) {
+        BOOST_CHECK(node == 1);
+        download.BlockAccepted(vChain[1 + nTaken]);
+        nTaken++;
+    }
+    BOOST_CHECK(nTaken == 9);
+    BOOST_CHECK(!download.IsActive());
+    BOOST_CHECK(download.GetStats().nHeaders == 0);
+    BOOST_CHECK(download.GetStats().nReceived == 10);
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_unsolicited)
+{
+    CBlockDownload download(64, 16, 60, 1000);
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 10);
+
+    vector<uint256> vHashes;
+    download.RequestBlocks(1, 1000, 0, vHashes);
+    BOOST_CHECK(vHashes.size() == 10);
+
+    // a copy from another peer does not end the request
+    BOOST_CHECK(!download.BlockReceived(vChain[0], 2));
+    BOOST_CHECK(download.GetStats().nInFlight == 10);
+    BOOST_CHECK(download.GetStats().nReceived == 0);
+    BOOST_CHECK(download.BlockReceived(vChain[0], 1));
+    BOOST_CHECK(!download.BlockReceived(vChain[0], 1)); // once
+    BOOST_CHECK(download.GetStats().nInFlight == 9);
+
+    // a block not taken (bad copy) is requested again
+    vHashes.clear();
+    download.RequestBlocks(2, 1000, 1, vHashes);
+    BOOST_CHECK(vHashes.size() == 1 && vHashes[0] == vChain[0]);
+    BOOST_CHECK(!download.IsInvalid(vChain[0]));
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_fork_invalid)
+{
+    CBlockDownload download(64, 16, 60, 1000);
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 20);
+
+    vector<uint256> vHashes;
+    download.RequestBlocks(1, 1000, 0, vHashes);
+    BOOST_CHECK(vHashes.size() == 16);
+
+    // longer fork from block 110 replaces the chain, requests above the fork are dropped
+    vector<uint256> vFork = AddChain(download, vChain[9], 110, 15);
+    BOOST_CHECK(download.BestHeaderHeight() == 125);
+    BOOST_CHECK(download.IsWanted(vChain[9]));
+    BOOST_CHECK(!download.IsWanted(vChain[10]));
+    BOOST_CHECK(download.IsWanted(vFork[0]));
+    BOOST_CHECK(download.GetStats().nInFlight == 10);
+
+    // shorter one does not
+    AddChain(download, vChain[19], 120, 2);
+    BOOST_CHECK(download.BestHeaderHeight() == 125);
+
+    // invalid block drops the header chain and refuses its descendants
+    download.BlockInvalid(vFork[3]);
+    BOOST_CHECK(!download.IsActive());
+    BOOST_CHECK(download.GetStats().nInFlight == 0);
+    BOOST_CHECK(download.IsInvalid(vFork[3]));
+    BOOST_CHECK(!download.AddHeader(vFork[4], vFork[3], 115, 115, 1));
+    BOOST_CHECK(download.IsInvalid(vFork[4]));
+    BOOST_CHECK(download.AddHeader(vFork[0], vChain[9], 111, 111, 1));
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_trust)
+{
+    CBlockDownload download(64, 16, 60, 1000);
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 20);
+    BOOST_CHECK(download.BestHeaderTrust() == 120);
+
+    // a taller chain of easier targets does not replace it
+    AddChain(download, hashRoot, 100, 30, 2, 0);
+    BOOST_CHECK(download.BestHeaderHeight() == 120);
+    BOOST_CHECK(download.IsWanted(vChain[0]));
+
+    // a shorter one with more trust does
+    vector<uint256> vFork = AddChain(download, hashRoot, 100, 10, 3, 3);
+    BOOST_CHECK(download.BestHeaderHeight() == 110);
+    BOOST_CHECK(download.BestHeaderTrust() == 130);
+    BOOST_CHECK(download.IsWanted(vFork[0]));
+    BOOST_CHECK(!download.IsWanted(vChain[0]));
+
+    // the header keeps what the target of the next one is computed from
+    CBlockDownload::CHeader header;
+    header.hashPrev = vFork[9];
+    header.nHeight = 111;
+    header.nChainTrust = 133;
+    header.node = 3;
+    header.nTime = 1500000000;
+    header.nBits = 0x1c03ffff;
+    header.fProofOfStake = true;
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(download.AddHeader(hash, header));
+    BOOST_CHECK(download.BestHeaderHeight() == 111);
+    const CBlockDownload::CHeader* pheader = download.GetHeader(hash);
+    BOOST_REQUIRE(pheader);
+    BOOST_CHECK(pheader->nTime == 1500000000 && pheader->nBits == 0x1c03ffff && pheader->fProofOfStake);
+    BOOST_CHECK(!download.GetHeader(GetRandHash()));
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_stall)
+{
+    CBlockDownload download(64, 16, 60, 1000, 300);
+    BOOST_CHECK(download.ExpireStalledChain(0) == -1);
+    BOOST_CHECK(!download.IsStalled(0));
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 10, 7);
+    AddChain(download, vChain[9], 110, 10, 8);
+
+    // connected blocks are progress
+    for (int64_t nNow = 10; nNow < 490; nNow += 10) {
+        BOOST_CHECK(download.ExpireStalledChain(nNow) == -1);
+        if (nNow == 200)
+            download.BlockAccepted(vChain[0]);
+    }
+    BOOST_CHECK(download.IsActive());
+
+    // a pause of the checks starts the wait again
+    for (int64_t nNow = 1000; nNow < 1300; nNow += 10)
+        BOOST_CHECK(download.ExpireStalledChain(nNow) == -1);
+
+    // the chain is dropped, the sender of the missing block is blamed
+    BOOST_CHECK(download.ExpireStalledChain(1300) == 7);
+    BOOST_CHECK(!download.IsActive());
+    BOOST_CHECK(download.GetStats().nStalls == 1);
+    BOOST_CHECK(!download.IsInvalid(vChain[1]));
+    BOOST_CHECK(download.ExpireStalledChain(1310) == -1);
+
+    // the getblocks sync is taken for the stall timeout
+    BOOST_CHECK(download.IsStalled(1300));
+    BOOST_CHECK(download.IsStalled(1599));
+    BOOST_CHECK(!download.IsStalled(1600));
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_headers_limit)
+{
+    CBlockDownload download(64, 16, 60, 100);
+    uint256 hashRoot = GetRandHash();
+    vector<uint256> vChain = AddChain(download, hashRoot, 100, 100);
+
+    // header sync pauses until blocks are connected
+    BOOST_CHECK(!download.StartHeaders(1, 1000, 100, 0));
+    download.BlockAccepted(vChain[9]);
+    BOOST_CHECK(download.BestHeaderHeight() == 200);
+    BOOST_CHECK(download.StartHeaders(1, 1000, 110, 0));
+
+    // unanswered request goes to another peer after the timeout
+    BOOST_CHECK(!download.StartHeaders(2, 1000, 110, 59));
+    BOOST_CHECK(download.StartHeaders(2, 1000, 110, 60));
+    BOOST_CHECK(!download.StartHeaders(3, 1000, 110, 100));
+    download.NodeFinalized(2);
+    BOOST_CHECK(!download.StartHeaders(1, 1000, 110, 100)); // idle after its timeout
+    BOOST_CHECK(download.StartHeaders(3, 1000, 110, 100));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+#include <boost/test/unit_test.hpp>
+
+#include <set>
+#include <vector>
+
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+static vector<uint256> RandomHashes(size_t n)
+{
+    vector<uint256> vHashes(n);
+    for (size_t i=0; i<n; i++)
+        vHashes[i] = GetRandHash();
+    return vHashes;
+}
+
+BOOST_AUTO_TEST_SUITE(blockindexmap_tests)
+
+BOOST_AUTO_TEST_CASE(blockindexmap_basic)
+{
+    CBlockIndexMap map;
+    vector<uint256> vHashes = RandomHashes(5000);
+    vector<const uint256*> vKeys;
+    for (const uint256& hash : vHashes) {
+        CBlockIndex* pindex = map.NewIndex();
+        auto mi = map.insert(hash, pindex).first;
+        pindex->phashBlock = &((*mi).first);
+        vKeys.push_back(pindex->phashBlock);
+    }
+    BOOST_CHECK(map.size() == vHashes.size());
+    BOOST_CHECK(!map.insert(vHashes[0], NULL).second);
+
+    // keys do not move when the table grows
+    for (size_t i=0; i<vHashes.size(); i++) {
+        BOOST_CHECK(*vKeys[i] == vHashes[i]);
+        auto mi = map.find(vHashes[i]);
+        BOOST_CHECK(mi != map.end());
+        BOOST_CHECK(mi->second->phashBlock == vKeys[i]);
+        BOOST_CHECK(map.count(vHashes[i]) == 1);
+    }
+    BOOST_CHECK(map.find(GetRandHash()) == map.end());
+
+    set<uint256> setSeen;
+    for (const CBlockIndexMap::value_type& item : map)
+        setSeen.insert(item.first);
+    BOOST_CHECK(setSeen == set<uint256>(vHashes.begin(), vHashes.end()));
+
+    // ref adds entry as std::map operator[]
+    uint256 hashUnknown = GetRandHash();
+    BOOST_CHECK(map.ref(hashUnknown) == NULL);
+    BOOST_CHECK(map.count(hashUnknown) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockindexmap_reserve)
+{
+    CBlockIndexMap map;
+    vector<uint256> vHashes = RandomHashes(3000);
+    map.insert(vHashes[0], map.NewIndex());
+    map.reserve(vHashes.size());
+    size_t nUsage = map.MemoryUsage();
+    for (const uint256& hash : vHashes)
+        map.insert(hash, map.NewIndex());
+    BOOST_CHECK(map.size() == vHashes.size());
+    for (const uint256& hash : vHashes)
+        BOOST_CHECK(map.count(hash) == 1);
+    // table is not regrown, only entries and indexes chunks are added
+    BOOST_CHECK(map.MemoryUsage() - nUsage < 2 * 4096 * (sizeof(CBlockIndexMap::value_type) + sizeof(CBlockIndex)));
+}
+
+BOOST_AUTO_TEST_CASE(blockindexmap_clear)
+{
+    CBlockIndexMap map;
+    size_t nEmptyUsage = map.MemoryUsage();
+    vector<uint256> vHashes = RandomHashes(10000);
+    for (const uint256& hash : vHashes) {
+        CBlockIndex* pindex = map.NewIndex();
+        pindex->nHeight = map.size();
+        pindex->phashBlock = &map.insert(hash, pindex).first->first;
+    }
+    BOOST_CHECK(map.MemoryUsage() > nEmptyUsage);
+
+    // block indexes are released with the chunks
+    map.Clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map.find(vHashes[0]) == map.end());
+    BOOST_CHECK(map.MemoryUsage() == nEmptyUsage);
+
+    // and the map is usable again
+    CBlockIndex* pindex = map.NewIndex();
+    map.insert(vHashes[0], pindex);
+    BOOST_CHECK(map.size() == 1);
+    BOOST_CHECK(map.find(vHashes[0])->second == pindex);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
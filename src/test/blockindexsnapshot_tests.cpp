@@ -0,0 +1,182 @@
+#include <boost/test/unit_test.hpp>
+
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "blockindexsnapshot.h"
+#include "hash.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// chain of n blocks with a fork of two blocks at the middle
+static vector<CBlockIndex*> BuildChain(CBlockIndexMap& mapIndex, int n)
+{
+    vector<CBlockIndex*> vChain;
+    CBlockIndex* pindexPrev = NULL;
+    for (int i=0; i<n + 2; i++) {
+        CBlockIndex* pindex = mapIndex.NewIndex();
+        pindex->phashBlock = &mapIndex.insert(GetRandHash(), pindex).first->first;
+        if (i == n)
+            pindexPrev = vChain[n / 2];
+        pindex->pprev = pindexPrev;
+        if (pindexPrev && i < n)
+            pindexPrev->pnext = pindex;
+        pindex->nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+        pindex->nFile = 1;
+        pindex->nBlockPos = i * 1000;
+        pindex->nMint = i * COIN;
+        pindex->nMoneySupply = i * 2 * COIN;
+        pindex->nPegSupplyIndex = i % 1200;
+        pindex->nPegVotesInflate = i % 3;
+        pindex->nPegVotesDeflate = i % 5;
+        pindex->nPegVotesNochange = i % 7;
+        pindex->nStakeModifier = i * 12345;
+        pindex->bnStakeModifierV2 = GetRandHash();
+        if (i % 2) {
+            pindex->SetProofOfStake();
+            pindex->prevoutStake = COutPoint(GetRandHash(), i);
+            pindex->nStakeTime = 1500000000 + i;
+        }
+        pindex->hashProof = GetRandHash();
+        pindex->nVersion = 7;
+        pindex->hashMerkleRoot = GetRandHash();
+        pindex->nTime = 1500000000 + i * 64;
+        pindex->nBits = 0x1d00ffff;
+        pindex->nNonce = i;
+        pindex->nChainTrust = (pindexPrev ? pindexPrev->nChainTrust : 0) + pindex->GetBlockTrust();
+        vChain.push_back(pindex);
+        pindexPrev = pindex;
+    }
+    return vChain;
+}
+
+BOOST_AUTO_TEST_SUITE(blockindexsnapshot_tests)
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_roundtrip)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("blkindex-%%%%%%.snapshot");
+
+    CBlockIndexMap mapIndex;
+    vector<CBlockIndex*> vChain = BuildChain(mapIndex, 1000);
+    mapIndex.ref(GetRandHash()); // referenced only, not written
+    uint256 hashBest = vChain[999]->GetBlockHash();
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, mapIndex, hashBest));
+
+    // stale snapshot is not loaded and is removed
+    CBlockIndexMap mapStale;
+    set<pair<COutPoint, unsigned int> > setStale;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(path, mapStale, vChain[998]->GetBlockHash(), setStale));
+    BOOST_CHECK(mapStale.empty());
+    BOOST_CHECK(!boost::filesystem::exists(path));
+
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, mapIndex, hashBest));
+    CBlockIndexMap mapLoaded;
+    set<pair<COutPoint, unsigned int> > setStakeSeen;
+    BOOST_CHECK(ReadBlockIndexSnapshot(path, mapLoaded, hashBest, setStakeSeen));
+    BOOST_CHECK(!boost::filesystem::exists(path));
+    BOOST_CHECK(mapLoaded.size() == vChain.size());
+    BOOST_CHECK(setStakeSeen.size() == vChain.size() / 2);
+
+    for (const CBlockIndex* pindex : vChain) {
+        CBlockIndexMap::iterator mi = mapLoaded.find(pindex->GetBlockHash());
+        BOOST_REQUIRE(mi != mapLoaded.end());
+        const CBlockIndex* pindexLoaded = mi->second;
+        BOOST_CHECK(pindexLoaded->phashBlock == &mi->first);
+        BOOST_CHECK(pindexLoaded->GetBlockHash() == pindex->GetBlockHash());
+        BOOST_CHECK((pindexLoaded->pprev ? pindexLoaded->pprev->GetBlockHash() : 0) ==
+                    (pindex->pprev ? pindex->pprev->GetBlockHash() : 0));
+        BOOST_CHECK((pindexLoaded->pnext ? pindexLoaded->pnext->GetBlockHash() : 0) ==
+                    (pindex->pnext ? pindex->pnext->GetBlockHash() : 0));
+        BOOST_CHECK(pindexLoaded->nHeight == pindex->nHeight);
+        BOOST_CHECK(pindexLoaded->nFile == pindex->nFile);
+        BOOST_CHECK(pindexLoaded->nBlockPos == pindex->nBlockPos);
+        BOOST_CHECK(pindexLoaded->nFlags == pindex->nFlags);
+        BOOST_CHECK(pindexLoaded->nChainTrust == pindex->nChainTrust);
+        BOOST_CHECK(pindexLoaded->nMint == pindex->nMint);
+        BOOST_CHECK(pindexLoaded->nMoneySupply == pindex->nMoneySupply);
+        BOOST_CHECK(pindexLoaded->nPegSupplyIndex == pindex->nPegSupplyIndex);
+        BOOST_CHECK(pindexLoaded->nPegVotesInflate == pindex->nPegVotesInflate);
+        BOOST_CHECK(pindexLoaded->nPegVotesDeflate == pindex->nPegVotesDeflate);
+        BOOST_CHECK(pindexLoaded->nPegVotesNochange == pindex->nPegVotesNochange);
+        BOOST_CHECK(pindexLoaded->nStakeModifier == pindex->nStakeModifier);
+        BOOST_CHECK(pindexLoaded->bnStakeModifierV2 == pindex->bnStakeModifierV2);
+        BOOST_CHECK(pindexLoaded->prevoutStake == pindex->prevoutStake);
+        BOOST_CHECK(pindexLoaded->nStakeTime == pindex->nStakeTime);
+        BOOST_CHECK(pindexLoaded->hashProof == pindex->hashProof);
+        BOOST_CHECK(pindexLoaded->GetBlockHeader().GetHash() == pindex->GetBlockHeader().GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_corrupted)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("blkindex-%%%%%%.snapshot");
+
+    CBlockIndexMap mapIndex;
+    vector<CBlockIndex*> vChain = BuildChain(mapIndex, 100);
+    uint256 hashBest = vChain[99]->GetBlockHash();
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, mapIndex, hashBest));
+
+    // flip a byte of a record
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, 1000, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, 1000, SEEK_SET);
+    fputc(ch ^ 0x01, file);
+    fclose(file);
+
+    CBlockIndexMap mapLoaded;
+    set<pair<COutPoint, unsigned int> > setStakeSeen;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(path, mapLoaded, hashBest, setStakeSeen));
+    BOOST_CHECK(mapLoaded.empty());
+    BOOST_CHECK(setStakeSeen.empty());
+    BOOST_CHECK(!boost::filesystem::exists(path));
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_duplicate)
+{
+    boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("blkindex-%%%%%%.snapshot");
+
+    CBlockIndexMap mapIndex;
+    vector<CBlockIndex*> vChain = BuildChain(mapIndex, 100);
+    uint256 hashBest = vChain[99]->GetBlockHash();
+    BOOST_CHECK(WriteBlockIndexSnapshot(path, mapIndex, hashBest));
+
+    // the hash of the first record is repeated in the 50th one, the checksum
+    // matches so the read fails after the records before it were inserted
+    const size_t nHeaderSize = 88;
+    const size_t nRecordSize = 280;
+    const size_t nHashRecordsOffset = 56;
+    vector<char> vData(boost::filesystem::file_size(path));
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fread(vData.data(), 1, vData.size(), file) == vData.size());
+    memcpy(&vData[nHeaderSize + 50 * nRecordSize], &vData[nHeaderSize], 32);
+    uint256 hashRecords = Hash(vData.begin() + nHeaderSize, vData.end());
+    memcpy(&vData[nHashRecordsOffset], hashRecords.begin(), 32);
+    fseek(file, 0, SEEK_SET);
+    fwrite(vData.data(), 1, vData.size(), file);
+    fclose(file);
+
+    CBlockIndexMap mapLoaded;
+    set<pair<COutPoint, unsigned int> > setStakeSeen;
+    BOOST_CHECK(!ReadBlockIndexSnapshot(path, mapLoaded, hashBest, setStakeSeen));
+    BOOST_CHECK(mapLoaded.empty());
+    BOOST_CHECK(setStakeSeen.empty());
+    BOOST_CHECK(mapLoaded.find(vChain[0]->GetBlockHash()) == mapLoaded.end());
+    BOOST_CHECK(!boost::filesystem::exists(path));
+
+    // the map is ready for the scan
+    CBlockIndex* pindex = mapLoaded.NewIndex();
+    BOOST_CHECK(mapLoaded.insert(vChain[0]->GetBlockHash(), pindex).second);
+    BOOST_CHECK(mapLoaded.size() == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
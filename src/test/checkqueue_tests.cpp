@@ -0,0 +1,216 @@
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include "blockfile.h"
+#include "checkpoints.h"
+#include "checkqueue.h"
+#include "key.h"
+#include "main.h"
+#include "pegdb-leveldb.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+// check numbered in the order of adding, fails if its number is listed
+struct CTestCheck
+{
+    int n;
+    const vector<int>* pvFail;
+    atomic<int>* pnRun;
+
+    CTestCheck() : n(-1), pvFail(NULL), pnRun(NULL) {}
+    CTestCheck(int nIn, const vector<int>* pvFailIn, atomic<int>* pnRunIn)
+        : n(nIn), pvFail(pvFailIn), pnRun(pnRunIn) {}
+
+    bool operator()()
+    {
+        (*pnRun)++;
+        for (int nFail : *pvFail) {
+            if (n == nFail)
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CTestCheck& check)
+    {
+        std::swap(n, check.n);
+        std::swap(pvFail, check.pvFail);
+        std::swap(pnRun, check.pnRun);
+    }
+};
+
+// adds nChecks in batches of 10 and waits, returns number of first failed
+static int RunChecks(CCheckQueue<CTestCheck>& queue, int nChecks, const vector<int>& vFail, atomic<int>& nRun)
+{
+    CCheckQueueControl<CTestCheck> control(&queue);
+    for (int i=0; i<nChecks; i+=10) {
+        vector<CTestCheck> vChecks;
+        for (int j=i; j<i+10 && j<nChecks; j++)
+            vChecks.push_back(CTestCheck(j, &vFail, &nRun));
+        control.Add(vChecks);
+    }
+    CTestCheck failed;
+    if (control.Wait(&failed))
+        return -1;
+    return failed.n;
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_first_failed)
+{
+    CCheckQueue<CTestCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i=0; i<3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CTestCheck>::Thread, &queue));
+
+    atomic<int> nRun(0);
+    BOOST_CHECK(RunChecks(queue, 1000, vector<int>(), nRun) == -1);
+    BOOST_CHECK(nRun == 1000);
+    BOOST_CHECK(queue.IsIdle());
+
+    // the first added of failed checks is reported whatever the order of execution
+    for (int i=0; i<50; i++) {
+        vector<int> vFail;
+        vFail.push_back(990 - i * 7);
+        vFail.push_back(500 + i);
+        vFail.push_back(20 + i * 3);
+        BOOST_CHECK(RunChecks(queue, 1000, vFail, nRun) == 20 + i * 3);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // the queue is reusable after a failure
+    nRun = 0;
+    BOOST_CHECK(RunChecks(queue, 100, vector<int>(), nRun) == -1);
+    BOOST_CHECK(nRun == 100);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_control_no_queue)
+{
+    CCheckQueueControl<CTestCheck> control(NULL);
+    vector<CTestCheck> vChecks;
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+}
+
+// the failing tx of the block connected with the script checks inline or
+// queued, returns its DoS score
+static int ConnectFailing(const CBlock& blockIn, CBlockIndex* pindex, int nThreads)
+{
+    int nThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    CBlock block = blockIn;
+    CTxDB txdb("r");
+    CPegDB pegdb("r");
+    BOOST_CHECK(!block.ConnectBlock(txdb, pegdb, pindex, true));
+    nScriptCheckThreads = nThreadsPrev;
+    return block.vtx[1].nDoS;
+}
+
+// A tx with a bad signature on its first input and a spent second input:
+// the serial verification fails on the signature first, with -par>1 the
+// queued check of the signature is run before the double spend is reported
+BOOST_AUTO_TEST_CASE(checkqueue_connectblock_mixed_failure)
+{
+    boost::filesystem::path pathData = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("checkqueue-%%%%%%");
+    boost::filesystem::create_directories(pathData);
+    mapArgs["-datadir"] = pathData.string();
+    ClearDatadirCache();
+
+    CKey key;
+    key.MakeNewKey(true);
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptPubKey = CScript() << key.GetPubKey() << OP_CHECKSIG;
+    unsigned int nTime = GetAdjustedTime() - 600;
+
+    // the tx of the inputs on disk and in the tx index, its second output
+    // is spent
+    CBlock blockPrev;
+    blockPrev.nTime = nTime - 600;
+    blockPrev.vtx.resize(2);
+    blockPrev.vtx[0].nTime = blockPrev.nTime;
+    blockPrev.vtx[0].vin.resize(1);
+    blockPrev.vtx[0].vin[0].prevout.SetNull();
+    blockPrev.vtx[0].vin[0].scriptSig = CScript() << 99999;
+    blockPrev.vtx[0].vout.resize(1);
+    blockPrev.vtx[0].vout[0].SetEmpty();
+    CTransaction& txPrev = blockPrev.vtx[1];
+    txPrev.nTime = blockPrev.nTime;
+    txPrev.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txPrev.vout.push_back(CTxOut(1000 * COIN, scriptPubKey));
+    txPrev.vout.push_back(CTxOut(1000 * COIN, scriptPubKey));
+    blockPrev.hashMerkleRoot = blockPrev.BuildMerkleTree();
+    unsigned int nFile, nBlockPos;
+    BOOST_REQUIRE(blockPrev.WriteToDisk(nFile, nBlockPos));
+    {
+        CTxDB txdb("cr+");
+        CPegDB pegdb("cr+");
+        unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) -
+                (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(blockPrev.vtx.size());
+        for (unsigned int n=0; n<blockPrev.vtx.size(); n++) {
+            BOOST_REQUIRE(txdb.AddTxIndex(blockPrev.vtx[n], CDiskTxPos(nFile, nBlockPos, nTxPos), 99999, n));
+            nTxPos += ::GetSerializeSize(blockPrev.vtx[n], SER_DISK, CLIENT_VERSION);
+        }
+        CTxIndex txindex;
+        BOOST_REQUIRE(txdb.ReadTxIndex(txPrev.GetHash(), txindex));
+        txindex.vSpent[1] = CDiskTxPos(nFile, nBlockPos, nTxPos);
+        BOOST_REQUIRE(txdb.UpdateTxIndex(txPrev.GetHash(), txindex));
+    }
+
+    CBlock block;
+    block.nTime = nTime;
+    block.vtx.resize(2);
+    block.vtx[0].nTime = nTime;
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vin[0].scriptSig = CScript() << 100000;
+    block.vtx[0].vout.resize(1);
+    block.vtx[0].vout[0].SetEmpty();
+    CTransaction& tx = block.vtx[1];
+    tx.nTime = nTime;
+    tx.vin.push_back(CTxIn(COutPoint(txPrev.GetHash(), 0)));
+    tx.vin.push_back(CTxIn(COutPoint(txPrev.GetHash(), 1)));
+    tx.vout.push_back(CTxOut(1500 * COIN, scriptPubKey));
+    // signed by another key
+    vector<unsigned char> vchSig;
+    BOOST_REQUIRE(keyOther.Sign(SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig = CScript() << vchSig;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    CBlockIndex index;
+    index.nHeight = 100000;
+    index.nTime = nTime;
+
+    // signatures are checked above the checkpoints only
+    int nBestHeightPrev = nBestHeight;
+    nBestHeight = Checkpoints::GetTotalBlocksEstimate();
+    BOOST_CHECK(ConnectFailing(block, &index, 0) == 100);
+    boost::thread_group threadGroup;
+    for (int i=0; i<2; i++)
+        threadGroup.create_thread(&ThreadScriptCheck);
+    BOOST_CHECK(ConnectFailing(block, &index, 3) == 100);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nBestHeight = nBestHeightPrev;
+
+    CTxDB().Close();
+    CPegDB().Close();
+    CloseBlockFiles();
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathData);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
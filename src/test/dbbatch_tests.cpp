@@ -0,0 +1,262 @@
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "dbbatch.h"
+#include "main.h"
+#include "pegdata.h"
+#include "pegdb-leveldb.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <leveldb/env.h>
+#include <memenv/memenv.h>
+
+using namespace std;
+
+// reference lookup of the previous implementation: scan of the whole batch
+class CBatchScanner : public leveldb::WriteBatch::Handler {
+public:
+    std::string needle;
+    std::string value;
+    bool deleted = false;
+    bool foundEntry = false;
+
+    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& v) {
+        if (key.ToString() == needle) {
+            foundEntry = true;
+            deleted = false;
+            value = v.ToString();
+        }
+    }
+    virtual void Delete(const leveldb::Slice& key) {
+        if (key.ToString() == needle) {
+            foundEntry = true;
+            deleted = true;
+        }
+    }
+};
+
+static string Key(int n)
+{
+    return strprintf("tx%08d", n);
+}
+
+BOOST_AUTO_TEST_SUITE(dbbatch_tests)
+
+BOOST_AUTO_TEST_CASE(dbbatch_lookup)
+{
+    CDBBatch batch;
+    batch.Put(Key(1), "a");
+    batch.Put(Key(2), "b");
+    batch.Put(Key(3), "c");
+    batch.Delete(Key(2));
+    batch.Put(Key(1), "aa");
+    batch.Delete(Key(4));
+
+    string value;
+    bool deleted;
+    BOOST_CHECK(batch.Get(Key(1), &value, &deleted) && !deleted && value == "aa");
+    BOOST_CHECK(batch.Get(Key(2), &value, &deleted) && deleted);
+    BOOST_CHECK(batch.Get(Key(4), &value, &deleted) && deleted);
+    BOOST_CHECK(!batch.Get(Key(5), &value, &deleted) && !deleted);
+    BOOST_CHECK(batch.IsDeleted(Key(2)));
+    BOOST_CHECK(!batch.IsDeleted(Key(3)));
+
+    // deleted keys are skipped by seeks
+    string key;
+    BOOST_CHECK(batch.Seek(Key(2), &key, &value) && key == Key(3) && value == "c");
+    BOOST_CHECK(!batch.Seek(Key(4), &key, &value));
+
+    CDBBatch::Puts seekmap;
+    BOOST_CHECK(batch.Range(Key(0), Key(2), &seekmap));
+    BOOST_CHECK(seekmap.size() == 1 && seekmap.begin()->first == Key(1));
+    seekmap.clear();
+    BOOST_CHECK(batch.Range(Key(1), Key(9), &seekmap));
+    BOOST_CHECK(seekmap.size() == 2);
+    BOOST_CHECK(batch.Size() == 4);
+
+    // re-written key is no more deleted
+    batch.Put(Key(2), "bb");
+    BOOST_CHECK(batch.Get(Key(2), &value, &deleted) && !deleted && value == "bb");
+    BOOST_CHECK(!batch.IsDeleted(Key(2)));
+}
+
+BOOST_AUTO_TEST_CASE(dbbatch_layered)
+{
+    CDBWriteBuffer buffer;
+    CDBBatch committed;
+    committed.Put(Key(1), "a");
+    committed.Put(Key(2), "b");
+    committed.Put(Key(3), "c");
+    committed.Delete(Key(5));
+    BOOST_CHECK(!buffer.Commit(committed)); // disabled
+    buffer.Enable();
+    BOOST_CHECK(buffer.Commit(committed));
+
+    // transaction on the buffer: its own changes first
+    CDBBatch batch(&buffer);
+    batch.Delete(Key(2));
+    batch.Put(Key(3), "cc");
+    batch.Put(Key(4), "d");
+
+    string value;
+    bool deleted;
+    BOOST_CHECK(batch.Get(Key(1), &value, &deleted) && !deleted && value == "a");
+    BOOST_CHECK(batch.Get(Key(2), &value, &deleted) && deleted);
+    BOOST_CHECK(batch.Get(Key(3), &value, &deleted) && !deleted && value == "cc");
+    BOOST_CHECK(batch.Get(Key(5), &value, &deleted) && deleted);
+    BOOST_CHECK(!batch.Get(Key(6), &value, &deleted) && !deleted);
+    BOOST_CHECK(batch.IsDeleted(Key(2)));
+    BOOST_CHECK(batch.IsDeleted(Key(5)));
+    BOOST_CHECK(!batch.IsDeleted(Key(1)));
+    batch.Put(Key(5), "e");
+    BOOST_CHECK(!batch.IsDeleted(Key(5)));
+
+    string key;
+    BOOST_CHECK(batch.Seek(Key(0), &key, &value) && key == Key(1) && value == "a");
+    BOOST_CHECK(batch.Seek(Key(2), &key, &value) && key == Key(3) && value == "cc");
+    CDBBatch::Puts seekmap;
+    BOOST_CHECK(batch.Range(Key(1), Key(5), &seekmap));
+    BOOST_CHECK(seekmap.size() == 4);
+    BOOST_CHECK(!seekmap.count(Key(2)));
+    BOOST_CHECK(seekmap[Key(3)] == "cc");
+
+    // commit applies the transaction on the buffer
+    BOOST_CHECK(buffer.Commit(batch));
+    CDBBatch view(&buffer);
+    BOOST_CHECK(view.Get(Key(2), &value, &deleted) && deleted);
+    BOOST_CHECK(view.Get(Key(4), &value, &deleted) && !deleted && value == "d");
+    BOOST_CHECK(buffer.GetStats().nCommits == 2);
+    BOOST_CHECK(buffer.GetStats().nKeys == 5);
+}
+
+BOOST_AUTO_TEST_CASE(dbbatch_write_buffer)
+{
+    leveldb::Env* penv = leveldb::NewMemEnv(leveldb::Env::Default());
+    leveldb::Options options;
+    options.env = penv;
+    options.create_if_missing = true;
+    leveldb::DB* pdb = NULL;
+    BOOST_REQUIRE(leveldb::DB::Open(options, "dbbatch", &pdb).ok());
+    BOOST_REQUIRE(pdb->Put(leveldb::WriteOptions(), Key(9), "old").ok());
+
+    CDBWriteBuffer buffer;
+    BOOST_CHECK(!buffer.Put(Key(1), "a"));
+    buffer.Enable();
+    for (int i=0; i<100; i++) {
+        CDBBatch batch(&buffer);
+        batch.Put(Key(i), string(10, 'x'));
+        BOOST_CHECK(buffer.Commit(batch));
+    }
+    BOOST_CHECK(buffer.Delete(Key(9)));
+    BOOST_CHECK(buffer.Put(Key(0), "y"));
+    // 98 puts of 10+10 bytes, one of 10+1, one delete of 10
+    BOOST_CHECK_EQUAL(buffer.Bytes(), 98u*20 + 11 + 10);
+
+    // nothing written before the flush
+    string value;
+    BOOST_CHECK(pdb->Get(leveldb::ReadOptions(), Key(0), &value).IsNotFound());
+    BOOST_CHECK(buffer.Flush(pdb, false).ok());
+    BOOST_CHECK(buffer.IsEnabled());
+    BOOST_CHECK(pdb->Get(leveldb::ReadOptions(), Key(0), &value).ok() && value == "y");
+    BOOST_CHECK(pdb->Get(leveldb::ReadOptions(), Key(50), &value).ok() && value == string(10, 'x'));
+    BOOST_CHECK(pdb->Get(leveldb::ReadOptions(), Key(9), &value).IsNotFound());
+
+    CDBWriteBuffer::Stats stats = buffer.GetStats();
+    BOOST_CHECK(stats.nFlushes == 1);
+    BOOST_CHECK(stats.nFlushedKeys == 100);
+    BOOST_CHECK(stats.nKeys == 0 && stats.nBytes == 0);
+    BOOST_CHECK(stats.nCommits == 100);
+
+    // disabled after the last flush, commits go to disk again
+    BOOST_CHECK(buffer.Put(Key(200), "z"));
+    BOOST_CHECK(buffer.Flush(pdb, true).ok());
+    BOOST_CHECK(!buffer.IsEnabled());
+    BOOST_CHECK(pdb->Get(leveldb::ReadOptions(), Key(200), &value).ok() && value == "z");
+    CDBBatch batch(&buffer);
+    batch.Put(Key(201), "w");
+    BOOST_CHECK(!buffer.Commit(batch));
+
+    delete pdb;
+    delete penv;
+}
+
+// A reorganization during the initial sync, with the changes of the blocks
+// connected before kept in the write buffers. A crash between the flushes of
+// the pegdb and of the txdb right after it leaves the fractions of the
+// stored best chain: the shared tx connected again and the new one are
+// there, the one of the disconnected block only is erased.
+BOOST_AUTO_TEST_CASE(dbbatch_reorganize_crash)
+{
+    boost::filesystem::path pathData = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("reorg-%%%%%%");
+    boost::filesystem::create_directories(pathData);
+    mapArgs["-datadir"] = pathData.string();
+    ClearDatadirCache();
+
+    uint256 hashOld = GetRandHash();
+    uint256 hashNew = GetRandHash();
+    uint320 fkeyOld(GetRandHash(), 0);
+    uint320 fkeyShared(GetRandHash(), 0);
+    uint320 fkeyNew(GetRandHash(), 0);
+    CFractions fractions(1000, CFractions::VALUE);
+    {
+        CTxDB txdb("cr+");
+        CPegDB pegdb("cr+");
+        CTxDB::WriteBuffer().Enable();
+        CPegDB::WriteBuffer().Enable();
+
+        // the old branch is connected and kept
+        BOOST_REQUIRE(txdb.TxnBegin() && pegdb.TxnBegin());
+        BOOST_CHECK(pegdb.WriteFractions(fkeyOld, fractions));
+        BOOST_CHECK(pegdb.WriteFractions(fkeyShared, fractions));
+        BOOST_CHECK(txdb.WriteHashBestChain(hashOld));
+        BOOST_REQUIRE(pegdb.TxnCommit() && txdb.TxnCommit());
+        BOOST_CHECK(CPegDB::WriteBuffer().Bytes() > 0 && CTxDB::WriteBuffer().Bytes() > 0);
+
+        // the reorganization as Reorganize() writes it, the shared tx is
+        // connected again
+        BOOST_REQUIRE(txdb.TxnBegin() && pegdb.TxnBegin());
+        BOOST_CHECK(pegdb.WriteFractions(fkeyShared, fractions));
+        BOOST_CHECK(pegdb.WriteFractions(fkeyNew, fractions));
+        BOOST_CHECK(WriteReorganize(txdb, pegdb, hashNew, std::vector<uint320>(1, fkeyOld)));
+
+        // crash between the flushes: the pegdb is written, the changes of
+        // the txdb are lost, written to a scratch database
+        BOOST_CHECK(CPegDB::FlushWriteBuffer(true));
+        leveldb::Env* penv = leveldb::NewMemEnv(leveldb::Env::Default());
+        leveldb::Options options;
+        options.env = penv;
+        options.create_if_missing = true;
+        leveldb::DB* pdbLost = NULL;
+        BOOST_REQUIRE(leveldb::DB::Open(options, "lost", &pdbLost).ok());
+        BOOST_CHECK(CTxDB::WriteBuffer().Flush(pdbLost, true).ok());
+        delete pdbLost;
+        delete penv;
+    }
+    CTxDB().Close();
+    CPegDB().Close();
+
+    {
+        CTxDB txdb("r");
+        CPegDB pegdb("r");
+        uint256 hashBest;
+        BOOST_CHECK(txdb.ReadHashBestChain(hashBest) && hashBest == hashNew);
+        CFractions fractionsRead(0, CFractions::VALUE);
+        BOOST_CHECK(pegdb.ReadFractions(fkeyShared, fractionsRead, true));
+        BOOST_CHECK(pegdb.ReadFractions(fkeyNew, fractionsRead, true));
+        BOOST_CHECK(!pegdb.ReadFractions(fkeyOld, fractionsRead, true));
+    }
+    CTxDB().Close();
+    CPegDB().Close();
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathData);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
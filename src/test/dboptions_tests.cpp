@@ -0,0 +1,113 @@
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include "dboptions.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "util.h"
+#include "version.h"
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <memenv/memenv.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(dboptions_tests)
+
+BOOST_AUTO_TEST_CASE(dboptions_args)
+{
+    map<string, string> mapArgsSaved = mapArgs;
+
+    mapArgs.clear();
+    CDBOptions txopts = GetDBOptions("txdb");
+    CDBOptions pegopts = GetDBOptions("pegdb");
+    BOOST_CHECK(txopts.nCacheBytes == size_t(DEFAULT_DB_CACHE / 2) << 20);
+    BOOST_CHECK(pegopts.nCacheBytes == size_t(DEFAULT_DB_CACHE / 2) << 20);
+    BOOST_CHECK(txopts.nWriteBufferBytes == 4 << 20);
+    BOOST_CHECK(txopts.nMaxFileBytes == 2 << 20);
+    BOOST_CHECK(txopts.nBlockBytes == 4 << 10);
+    BOOST_CHECK(txopts.fCompression);
+    BOOST_CHECK(txopts.nBloomBits == 10);
+
+    // cache split and per database options
+    mapArgs["-dbcache"] = "400";
+    mapArgs["-dbcachepeg"] = "75";
+    mapArgs["-pegdbwritebuffer"] = "32";
+    mapArgs["-pegdbblocksize"] = "16";
+    mapArgs["-pegdbcompression"] = "0";
+    mapArgs["-txdbfilesize"] = "8";
+    mapArgs["-txdbbloombits"] = "0";
+    txopts = GetDBOptions("txdb");
+    pegopts = GetDBOptions("pegdb");
+    BOOST_CHECK(txopts.nCacheBytes == 100 << 20);
+    BOOST_CHECK(pegopts.nCacheBytes == 300 << 20);
+    BOOST_CHECK(pegopts.nWriteBufferBytes == 32 << 20);
+    BOOST_CHECK(txopts.nWriteBufferBytes == 4 << 20);
+    BOOST_CHECK(pegopts.nBlockBytes == 16 << 10);
+    BOOST_CHECK(!pegopts.fCompression);
+    BOOST_CHECK(txopts.fCompression);
+    BOOST_CHECK(txopts.nMaxFileBytes == 8 << 20);
+    BOOST_CHECK(txopts.nBloomBits == 0);
+    BOOST_CHECK(pegopts.nBloomBits == 10);
+
+    leveldb::Options options = MakeLevelDBOptions(txopts);
+    BOOST_CHECK(options.filter_policy == NULL);
+    BOOST_CHECK(options.max_file_size == 8 << 20);
+    delete options.block_cache;
+
+    // out of range values are clamped
+    mapArgs["-dbcachepeg"] = "150";
+    mapArgs["-txdbwritebuffer"] = "0";
+    txopts = GetDBOptions("txdb");
+    BOOST_CHECK(txopts.nCacheBytes == 1 << 20);
+    BOOST_CHECK(txopts.nWriteBufferBytes == 1 << 20);
+
+    mapArgs = mapArgsSaved;
+}
+
+BOOST_AUTO_TEST_CASE(dboptions_stats)
+{
+    leveldb::Env* penv = leveldb::NewMemEnv(leveldb::Env::Default());
+    leveldb::Options options;
+    options.env = penv;
+    options.create_if_missing = true;
+    options.compression = leveldb::kNoCompression;
+    leveldb::DB* pdb = NULL;
+    BOOST_REQUIRE(leveldb::DB::Open(options, "dboptions", &pdb).ok());
+
+    // keys serialized as the txdb does
+    string strValue(1000, 'x');
+    for (int i=0; i<2000; i++) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("tx"), uint256(i));
+        pdb->Put(leveldb::WriteOptions(), ssKey.str(), strValue);
+        CDataStream ssUtxo(SER_DISK, CLIENT_VERSION);
+        ssUtxo << strprintf("utxo%s%d", i % 2 ? "Baddress" : "Bother", i);
+        pdb->Put(leveldb::WriteOptions(), ssUtxo.str(), strValue.substr(0, 500));
+    }
+    pdb->CompactRange(NULL, NULL);
+
+    CDBStats stats;
+    vector<string> vPrefixes = {"tx", "utxo", "addr"};
+    GetLevelDBStats(pdb, vPrefixes, stats);
+    BOOST_CHECK(!stats.strStats.empty());
+    BOOST_CHECK(!stats.vFilesAtLevel.empty());
+    BOOST_REQUIRE(stats.vPrefixBytes.size() == 3);
+    BOOST_CHECK(stats.vPrefixBytes[0].first == "tx");
+    uint64_t nTx = stats.vPrefixBytes[0].second;
+    uint64_t nUtxo = stats.vPrefixBytes[1].second;
+    BOOST_CHECK(nTx > 1500000 && nTx < 2500000);
+    BOOST_CHECK(nUtxo > 700000 && nUtxo < 1300000);
+    BOOST_CHECK(stats.vPrefixBytes[2].second == 0);
+    BOOST_CHECK(stats.nApproxBytes >= nTx + nUtxo);
+    BOOST_TEST_MESSAGE(strprintf("tx %d utxo %d all %d", nTx, nUtxo, stats.nApproxBytes));
+
+    delete pdb;
+    delete penv;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,434 @@
+#include <boost/test/unit_test.hpp>
+
+#include <stdexcept>
+#include <string>
+
+#include "main.h"
+#include "pegdata.h"
+#include "serialize.h"
+#include "version.h"
+
+using namespace std;
+
+static string Packed(const CFractions& f)
+{
+    CDataStream fout(SER_DISK, CLIENT_VERSION);
+    f.Pack(fout, nullptr, CFractions::SER_VDELTA);
+    return fout.str();
+}
+
+// tx spending the given outputs of value nValueIn each, paying nFee
+static CTransaction SpendTx(const vector<COutPoint>& vPrevOuts, int64_t nValueIn, int64_t nFee,
+                            MapPrevOut& mapInputs)
+{
+    CTransaction tx;
+    mapInputs.clear();
+    for (const COutPoint& prevout : vPrevOuts) {
+        tx.vin.push_back(CTxIn(prevout));
+        tx.vin.back().scriptSig = CScript() << vector<unsigned char>(72, 1) << vector<unsigned char>(33, 2);
+        mapInputs[uint320(prevout.hash, prevout.n)] = CTxOut(nValueIn, CScript());
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValueIn * vPrevOuts.size() - nFee;
+    return tx;
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(mempoolfractions_decoded)
+{
+    CTxMemPoolFractions store(1 << 20);
+    CFractions f = CFractions(1000000000, CFractions::VALUE).Std();
+    f.nLockTime = 12345;
+    f.nFlags |= CFractions::NOTARY_F;
+    store.Set(uint320(1), f);
+    store.Set(uint320(2), CFractions(500, CFractions::VALUE));
+    BOOST_CHECK(store.Has(uint320(1)));
+    BOOST_CHECK(!store.Has(uint320(3)));
+
+    CFractions g;
+    BOOST_CHECK(store.Get(uint320(1), 1000000000, g));
+    BOOST_CHECK(Packed(g) == Packed(f));
+    BOOST_CHECK(g.nLockTime == 12345);
+    BOOST_CHECK(store.Get(uint320(2), 500, g));
+    BOOST_CHECK(g.Total() == 500);
+    BOOST_CHECK(!store.Get(uint320(3), 1, g));
+
+    CTxMemPoolFractions::Stats stats = store.GetStats();
+    BOOST_CHECK(stats.nEntries == 2);
+    BOOST_CHECK(stats.nDecoded == 2);
+    BOOST_CHECK(stats.nHits == 2);
+    BOOST_CHECK(stats.nUnpacks == 0);
+    BOOST_CHECK(stats.nDecodedBytes > 0);
+
+    store.Erase(uint320(1));
+    store.Erase(uint320(2));
+    stats = store.GetStats();
+    BOOST_CHECK(stats.nEntries == 0);
+    BOOST_CHECK(stats.nDecodedBytes == 0);
+}
+
+BOOST_AUTO_TEST_CASE(mempoolfractions_spill)
+{
+    // the cap holds about one decoded std fractions
+    CTxMemPoolFractions store(0);
+    CFractions f = CFractions(1000000000, CFractions::VALUE).Std();
+    store.Set(uint320(1), f);
+    CTxMemPoolFractions::Stats stats = store.GetStats();
+    BOOST_CHECK(stats.nDecoded == 0);
+    BOOST_CHECK(stats.nSpills == 1);
+    size_t nOne = 0;
+    {
+        CTxMemPoolFractions probe(1 << 20);
+        probe.Set(uint320(1), f);
+        nOne = probe.GetStats().nDecodedBytes;
+    }
+    store.SetMaxBytes(nOne + nOne / 2);
+
+    // packed entry is decoded by the lookup
+    CFractions g;
+    BOOST_CHECK(store.Get(uint320(1), 1000000000, g));
+    BOOST_CHECK(Packed(g) == Packed(f));
+    stats = store.GetStats();
+    BOOST_CHECK(stats.nUnpacks == 1);
+    BOOST_CHECK(stats.nDecoded == 1);
+
+    // the least recently used one is spilled
+    CFractions f2 = CFractions(2000000000, CFractions::VALUE).Std();
+    store.Set(uint320(2), f2);
+    stats = store.GetStats();
+    BOOST_CHECK(stats.nEntries == 2);
+    BOOST_CHECK(stats.nDecoded == 1);
+    BOOST_CHECK(stats.nSpills == 2);
+    BOOST_CHECK(stats.nPackedBytes > 0);
+    BOOST_CHECK(stats.nDecodedBytes <= stats.nMaxBytes);
+    BOOST_CHECK(store.Get(uint320(2), 2000000000, g));
+    BOOST_CHECK(store.GetStats().nHits == 1);
+    BOOST_CHECK(store.Get(uint320(1), 1000000000, g));
+    BOOST_CHECK(Packed(g) == Packed(f));
+    BOOST_CHECK(store.GetStats().nUnpacks == 2);
+
+    store.Clear();
+    stats = store.GetStats();
+    BOOST_CHECK(stats.nEntries == 0);
+    BOOST_CHECK(stats.nDecodedBytes == 0 && stats.nPackedBytes == 0);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_links)
+{
+    CTxMemPool pool;
+    MapPrevOut mapInputs;
+    MapFractions mapFractions;
+
+    // parent with two outputs, a child spending both and a grandchild
+    CTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txParent.vout.resize(2);
+    txParent.vout[0].nValue = 1000;
+    txParent.vout[1].nValue = 2000;
+    uint256 hashParent = txParent.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashParent, txParent, mapInputs, mapFractions));
+
+    CTransaction txChild;
+    txChild.vin.resize(2);
+    txChild.vin[0].prevout = COutPoint(hashParent, 0);
+    txChild.vin[1].prevout = COutPoint(hashParent, 1);
+    txChild.vout.resize(1);
+    txChild.vout[0].nValue = 2900;
+    uint256 hashChild = txChild.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashChild, txChild, mapInputs, mapFractions));
+
+    CTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].prevout = COutPoint(hashChild, 0);
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].nValue = 2800;
+    uint256 hashGrandChild = txGrandChild.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashGrandChild, txGrandChild, mapInputs, mapFractions));
+
+    BOOST_CHECK(pool.mapLinks.size() == 3);
+    BOOST_CHECK(pool.mapLinks[hashParent].setParents.empty());
+    BOOST_CHECK(pool.mapLinks[hashParent].setChildren.size() == 1);
+    BOOST_CHECK(pool.mapLinks[hashChild].setParents.count(hashParent));
+    BOOST_CHECK(pool.mapLinks[hashChild].setChildren.count(hashGrandChild));
+    BOOST_CHECK(pool.mapLinks[hashGrandChild].setParents.count(hashChild));
+
+    // removal unlinks, the recursive one drops the descendants
+    pool.remove(txGrandChild);
+    BOOST_CHECK(pool.mapLinks.size() == 2);
+    BOOST_CHECK(pool.mapLinks[hashChild].setChildren.empty());
+    BOOST_CHECK(pool.addUnchecked(hashGrandChild, txGrandChild, mapInputs, mapFractions));
+    pool.remove(txParent, true);
+    BOOST_CHECK(pool.mapLinks.empty());
+    BOOST_CHECK(pool.size() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_ranks)
+{
+    CTxMemPool pool;
+    MapPrevOut mapInputs;
+    MapFractions mapFractions;
+
+    // low fee parent, its child paying for both, independent tx between
+    MapPrevOut mapParentInputs;
+    CTransaction txParent = SpendTx({COutPoint(GetRandHash(), 0)}, 100000, 10, mapParentInputs);
+    uint256 hashParent = txParent.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashParent, txParent, mapParentInputs, mapFractions, 5.0));
+    CTransaction txChild = SpendTx({COutPoint(hashParent, 0)}, 99990, 10000, mapInputs);
+    uint256 hashChild = txChild.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashChild, txChild, mapInputs, mapFractions));
+    CTransaction txOther = SpendTx({COutPoint(GetRandHash(), 0)}, 100000, 1000, mapInputs);
+    uint256 hashOther = txOther.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashOther, txOther, mapInputs, mapFractions));
+
+    const CTxMemPoolRank& rankParent = pool.mapRanks[hashParent];
+    const CTxMemPoolRank& rankChild = pool.mapRanks[hashChild];
+    BOOST_CHECK(rankParent.nFee == 10);
+    BOOST_CHECK(rankParent.nInChainValue == 100000);
+    BOOST_CHECK(rankChild.nFee == 10000);
+    BOOST_CHECK(rankChild.nInChainValue == 0);
+    BOOST_CHECK(rankChild.nAncestors == 2);
+    BOOST_CHECK(rankChild.nAncestorsSize == rankParent.nTxSize + rankChild.nTxSize);
+    BOOST_CHECK(rankChild.nAncestorsFee == 10010);
+    BOOST_CHECK(pool.setByPriority.rbegin()->second == hashParent);
+
+    // best package first, parents before children
+    BOOST_CHECK(pool.setByFeeRate.size() == 3);
+    CTxMemPoolIndex::reverse_iterator it = pool.setByFeeRate.rbegin();
+    BOOST_CHECK((it++)->second == hashChild);
+    BOOST_CHECK((it++)->second == hashOther);
+    BOOST_CHECK((it++)->second == hashParent);
+    vector<uint256> vPackage;
+    pool.queryPackage(hashChild, set<uint256>(), vPackage);
+    BOOST_CHECK(vPackage.size() == 2 && vPackage[0] == hashParent && vPackage[1] == hashChild);
+    pool.queryPackage(hashChild, {hashParent}, vPackage);
+    BOOST_CHECK(vPackage.size() == 1 && vPackage[0] == hashChild);
+
+    // confirmed parent leaves the package, its output ages the child
+    pool.remove(txParent);
+    BOOST_CHECK(rankChild.nAncestors == 1);
+    BOOST_CHECK(rankChild.nAncestorsFee == 10000);
+    BOOST_CHECK(rankChild.nInChainValue == 99990);
+    BOOST_CHECK(pool.setByFeeRate.size() == 2);
+    BOOST_CHECK(pool.setByPriority.size() == 2);
+
+    // back from a disconnected block, it is linked to the child again
+    BOOST_CHECK(pool.addUnchecked(hashParent, txParent, mapParentInputs, mapFractions));
+    BOOST_CHECK(pool.mapLinks[hashChild].setParents.count(hashParent));
+    BOOST_CHECK(pool.mapRanks[hashChild].nAncestors == 2);
+    BOOST_CHECK(pool.mapRanks[hashChild].nInChainValue == 0);
+
+    pool.clear();
+    BOOST_CHECK(pool.mapRanks.empty());
+    BOOST_CHECK(pool.setByFeeRate.empty() && pool.setByPriority.empty());
+}
+
+BOOST_AUTO_TEST_CASE(mempool_pegreview_needs)
+{
+    const int64_t nValue = 1000000000;
+    int64_t nTotal = 0;
+    CFractions crossing = CFractions(nValue, CFractions::VALUE).Std();
+    CFractions above = crossing.HighPart(200, &nTotal);
+    MapFractions mapChain;
+    COutPoint prevoutCrossing(GetRandHash(), 0);
+    COutPoint prevoutAbove(GetRandHash(), 0);
+    mapChain[uint320(prevoutCrossing.hash, prevoutCrossing.n)] = crossing;
+    mapChain[uint320(prevoutAbove.hash, prevoutAbove.n)] = above;
+    PegReadFractions readFractions = [&](const uint320& fkey, CFractions& fractions) {
+        MapFractions::const_iterator it = mapChain.find(fkey);
+        if (it == mapChain.end())
+            return false;
+        fractions = it->second;
+        return true;
+    };
+
+    MapPrevOut mapInputs;
+    MapFractions mapGroupFractions;
+    CTransaction txCrossing = SpendTx({prevoutCrossing}, nValue, 10000, mapInputs);
+    CTransaction txAbove = SpendTx({prevoutAbove}, nTotal, 10000, mapInputs);
+    CTransaction txUnknown = SpendTx({COutPoint(GetRandHash(), 0)}, nValue, 10000, mapInputs);
+    BOOST_CHECK(NeedsPegReview(txCrossing, mapGroupFractions, readFractions, 100, 200));
+    BOOST_CHECK(NeedsPegReview(txCrossing, mapGroupFractions, readFractions, 200, 100));
+    BOOST_CHECK(!NeedsPegReview(txAbove, mapGroupFractions, readFractions, 100, 200));
+    BOOST_CHECK(NeedsPegReview(txAbove, mapGroupFractions, readFractions, 100, 300));
+    BOOST_CHECK(NeedsPegReview(txUnknown, mapGroupFractions, readFractions, 100, 200));
+
+    // inputs of the group are taken before the chain ones
+    mapGroupFractions[uint320(prevoutCrossing.hash, prevoutCrossing.n)] = above;
+    BOOST_CHECK(!NeedsPegReview(txCrossing, mapGroupFractions, readFractions, 100, 200));
+
+    // notary marks on the outputs or the inputs
+    CFractions marked = above;
+    marked.nFlags |= CFractions::NOTARY_F;
+    mapGroupFractions[uint320(txAbove.GetHash(), 0)] = marked;
+    BOOST_CHECK(NeedsPegReview(txAbove, mapGroupFractions, readFractions, 100, 200));
+    mapGroupFractions.clear();
+    mapGroupFractions[uint320(prevoutAbove.hash, prevoutAbove.n)] = marked;
+    BOOST_CHECK(NeedsPegReview(txAbove, mapGroupFractions, readFractions, 100, 200));
+}
+
+BOOST_AUTO_TEST_CASE(mempool_pegreview_group)
+{
+    const int64_t nValue = 1000000000;
+    int64_t nTotal = 0;
+    CFractions crossing = CFractions(nValue, CFractions::VALUE).Std();
+    CFractions above = crossing.HighPart(200, &nTotal);
+    MapFractions mapChain;
+    PegReadFractions readFractions = [&](const uint320& fkey, CFractions& fractions) {
+        MapFractions::const_iterator it = mapChain.find(fkey);
+        if (it == mapChain.end())
+            return false;
+        fractions = it->second;
+        return true;
+    };
+    auto chainOutput = [&](const CFractions& fractions) {
+        COutPoint prevout(GetRandHash(), 0);
+        mapChain[uint320(prevout.hash, prevout.n)] = fractions;
+        return prevout;
+    };
+
+    // parents crossing the supply change or not, the recheck of one fails
+    // the tx, of another misses inputs; each has a child in the group
+    MapPrevOut mapInputs;
+    CTransaction txCrossing = SpendTx({chainOutput(crossing)}, nValue, 10000, mapInputs);
+    CTransaction txAbove = SpendTx({chainOutput(above)}, nTotal, 10000, mapInputs);
+    CTransaction txInvalid = SpendTx({chainOutput(crossing)}, nValue, 20000, mapInputs);
+    CTransaction txMissing = SpendTx({chainOutput(crossing)}, nValue, 30000, mapInputs);
+    vector<CTransaction> vParents = {txCrossing, txAbove, txInvalid, txMissing};
+    CPegReviewGroup group;
+    for (const CTransaction& tx : vParents) {
+        group.vTxs.push_back(tx);
+        group.mapGroupFractions[uint320(tx.GetHash(), 0)] = CFractions(tx.vout[0].nValue, CFractions::VALUE).Std().HighPart(200, &nTotal);
+    }
+    for (const CTransaction& tx : vParents)
+        group.vTxs.push_back(SpendTx({COutPoint(tx.GetHash(), 0)}, tx.vout[0].nValue, 10000, mapInputs));
+    group.vPegSupplyIndex.assign(group.vTxs.size(), 100);
+
+    vector<uint256> vRechecks;
+    PegRecheck recheck = [&](CTransaction& tx, const CPegReviewGroup&,
+                             MapFractions& mapOutputsFractions, bool& fInvalid) {
+        uint256 hash = tx.GetHash();
+        vRechecks.push_back(hash);
+        fInvalid = hash == txInvalid.GetHash();
+        if (fInvalid || hash == txMissing.GetHash())
+            return false;
+        mapOutputsFractions[uint320(hash, 0)] = CFractions(tx.vout[0].nValue, CFractions::VALUE).Std();
+        return true;
+    };
+    ReviewPegGroup(group, 200, readFractions, recheck);
+
+    // the crossing parents and the child of the rechecked one
+    BOOST_CHECK(group.fReviewed);
+    BOOST_CHECK(vRechecks.size() == 4);
+    BOOST_CHECK(vRechecks[0] == txCrossing.GetHash());
+    BOOST_CHECK(vRechecks[1] == txInvalid.GetHash());
+    BOOST_CHECK(vRechecks[2] == txMissing.GetHash());
+    BOOST_CHECK(vRechecks[3] == group.vTxs[4].GetHash());
+    BOOST_CHECK(group.mapRechecked.size() == 2);
+    BOOST_CHECK(group.mapRechecked.count(txCrossing.GetHash()));
+    BOOST_CHECK(group.mapRechecked.count(group.vTxs[4].GetHash()));
+    BOOST_CHECK(group.mapGroupFractions[uint320(txCrossing.GetHash(), 0)].Low(100) > 0);
+    BOOST_CHECK(group.vRemove.size() == 1 && group.vRemove[0] == txInvalid.GetHash());
+    BOOST_CHECK(group.setUnreviewed.size() == 2);
+    BOOST_CHECK(group.setUnreviewed.count(txMissing.GetHash()));
+    BOOST_CHECK(group.setUnreviewed.count(group.vTxs[7].GetHash()));
+
+    // a review which throws is not finished
+    CPegReviewGroup groupThrown;
+    groupThrown.vTxs = {txCrossing};
+    groupThrown.vPegSupplyIndex = {100};
+    PegRecheck thrower = [&](CTransaction&, const CPegReviewGroup&, MapFractions&, bool&) -> bool {
+        throw std::runtime_error("recheck");
+    };
+    BOOST_CHECK_THROW(ReviewPegGroup(groupThrown, 200, readFractions, thrower), std::runtime_error);
+    BOOST_CHECK(!groupThrown.fReviewed);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_package_totals)
+{
+    CTxMemPool pool;
+    MapPrevOut mapInputs;
+    MapFractions mapFractions;
+
+    // a diamond: two children of the top tx, one tx spending both
+    MapPrevOut mapTopInputs;
+    CTransaction txTop;
+    txTop.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txTop.vout.resize(2);
+    txTop.vout[0].nValue = 100000;
+    txTop.vout[1].nValue = 100000;
+    mapTopInputs[uint320(txTop.vin[0].prevout.hash, 0)] = CTxOut(210000, CScript());
+    uint256 hashTop = txTop.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashTop, txTop, mapTopInputs, mapFractions));
+    CTransaction txLeft = SpendTx({COutPoint(hashTop, 0)}, 100000, 1000, mapInputs);
+    BOOST_CHECK(pool.addUnchecked(txLeft.GetHash(), txLeft, mapInputs, mapFractions));
+    CTransaction txRight = SpendTx({COutPoint(hashTop, 1)}, 100000, 2000, mapInputs);
+    BOOST_CHECK(pool.addUnchecked(txRight.GetHash(), txRight, mapInputs, mapFractions));
+    MapPrevOut mapBottomInputs;
+    CTransaction txBottom = SpendTx({COutPoint(txLeft.GetHash(), 0), COutPoint(txRight.GetHash(), 0)}, 0, 0, mapBottomInputs);
+    txBottom.vout[0].nValue = 194000;
+    mapBottomInputs[uint320(txLeft.GetHash(), 0)] = txLeft.vout[0];
+    mapBottomInputs[uint320(txRight.GetHash(), 0)] = txRight.vout[0];
+    uint256 hashBottom = txBottom.GetHash();
+    BOOST_CHECK(pool.addUnchecked(hashBottom, txBottom, mapBottomInputs, mapFractions));
+
+    uint64_t nAllSize = 0;
+    for (const uint256& hash : {hashTop, txLeft.GetHash(), txRight.GetHash(), hashBottom})
+        nAllSize += pool.mapRanks[hash].nTxSize;
+    const CTxMemPoolRank& rankBottom = pool.mapRanks[hashBottom];
+    BOOST_CHECK(rankBottom.nAncestors == 4);
+    BOOST_CHECK(rankBottom.nAncestorsSize == nAllSize);
+    BOOST_CHECK(rankBottom.nAncestorsFee == 10000 + 1000 + 2000 + 3000);
+
+    // the confirmed top leaves the package once, it comes back once
+    uint64_t nTopSize = pool.mapRanks[hashTop].nTxSize;
+    pool.remove(txTop);
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestors == 3);
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestorsSize == nAllSize - nTopSize);
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestorsFee == 6000);
+    BOOST_CHECK(pool.mapRanks[txLeft.GetHash()].nAncestors == 1);
+    BOOST_CHECK(pool.addUnchecked(hashTop, txTop, mapTopInputs, mapFractions));
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestors == 4);
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestorsSize == nAllSize);
+    BOOST_CHECK(pool.mapRanks[hashBottom].nAncestorsFee == 16000);
+
+    // the index follows the totals
+    for (const CTxMemPoolIndex::value_type& item : pool.setByFeeRate)
+        BOOST_CHECK(item.first == pool.mapRanks[item.second].GetAncestorsFeePerKb());
+}
+
+BOOST_AUTO_TEST_CASE(mempool_chain_limits)
+{
+    CTxMemPool pool;
+    MapPrevOut mapInputs;
+    MapFractions mapFractions;
+    string reason;
+
+    // chain of five, a sixth tx is over an ancestor limit of five
+    uint256 hashRoot;
+    uint256 hashPrev;
+    for (int i=0; i<5; i++) {
+        CTransaction tx = SpendTx({COutPoint(i ? hashPrev : GetRandHash(), 0)}, 1000000, 10000, mapInputs);
+        BOOST_CHECK(pool.CheckChainLimits(tx, 5, 5, reason));
+        hashPrev = tx.GetHash();
+        if (i == 0)
+            hashRoot = hashPrev;
+        BOOST_CHECK(pool.addUnchecked(hashPrev, tx, mapInputs, mapFractions));
+    }
+    CTransaction txLong = SpendTx({COutPoint(hashPrev, 0)}, 1000000, 10000, mapInputs);
+    BOOST_CHECK(!pool.CheckChainLimits(txLong, 5, 10, reason));
+    BOOST_CHECK(pool.CheckChainLimits(txLong, 6, 10, reason));
+
+    // the root would get a sixth descendant
+    BOOST_CHECK(!pool.CheckChainLimits(txLong, 10, 5, reason));
+    CTransaction txWide = SpendTx({COutPoint(hashRoot, 1)}, 1000000, 10000, mapInputs);
+    BOOST_CHECK(!pool.CheckChainLimits(txWide, 10, 5, reason));
+    BOOST_CHECK(pool.CheckChainLimits(txWide, 10, 6, reason));
+
+    // txs spending the chain only are not limited
+    CTransaction txFree = SpendTx({COutPoint(GetRandHash(), 0)}, 1000000, 10000, mapInputs);
+    BOOST_CHECK(pool.CheckChainLimits(txFree, 1, 1, reason));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,247 @@
+#include <boost/test/unit_test.hpp>
+
+#include <set>
+#include <vector>
+
+#include "init.h"
+#include "main.h"
+#include "miner.h"
+#include "util.h"
+
+using namespace std;
+
+// Tip of a chain for the templates, the mempool is cleared with it
+struct MinerTestTip {
+    CBlockIndex index;
+    uint256 hash;
+    CBlockIndex* pindexBestSaved;
+    uint256 hashBestChainSaved;
+
+    explicit MinerTestTip(int nHeight) {
+        hash = GetRandHash();
+        index.phashBlock = &hash;
+        index.nHeight = nHeight;
+        index.nTime = GetAdjustedTime() - 600;
+        pindexBestSaved = pindexBest;
+        hashBestChainSaved = hashBestChain;
+        pindexBest = &index;
+        hashBestChain = hash;
+        mempool.clear();
+    }
+    ~MinerTestTip() {
+        mempool.clear();
+        pindexBest = pindexBestSaved;
+        hashBestChain = hashBestChainSaved;
+        mapArgs.erase("-blockprioritysize");
+        mapArgs.erase("-blockmaxsize");
+    }
+    // a new block on the tip, the mempool is kept
+    void Next() {
+        hash = GetRandHash();
+        index.nHeight++;
+        hashBestChain = hash;
+    }
+};
+
+// tx spending the given output of value nValueIn, paying nFee, added to the mempool
+static CTransaction AddTx(const COutPoint& prevout, int64_t nValueIn, int64_t nFee,
+                          double dPriority = 0, unsigned int nTime = 0)
+{
+    CTransaction tx;
+    if (nTime)
+        tx.nTime = nTime;
+    tx.vin.push_back(CTxIn(prevout));
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(72, 1) << vector<unsigned char>(33, 2);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValueIn - nFee;
+    MapPrevOut mapInputs;
+    mapInputs[uint320(prevout.hash, prevout.n)] = CTxOut(nValueIn, CScript());
+    MapFractions mapFractions;
+    BOOST_CHECK(mempool.addUnchecked(tx.GetHash(), tx, mapInputs, mapFractions, dPriority));
+    return tx;
+}
+
+// Connects with the fees of the mempool, the txs of setBad do not connect
+static BlockTemplateConnect TestConnect(const set<uint256>& setBad, vector<uint256>* pvConnected = NULL)
+{
+    return [&setBad, pvConnected](CBlockTemplate&, CTransaction& tx, int64_t,
+                                  int64_t& nTxFees, unsigned int&) {
+        uint256 hash = tx.GetHash();
+        if (pvConnected)
+            pvConnected->push_back(hash);
+        if (setBad.count(hash))
+            return false;
+        nTxFees = mempool.mapRanks[hash].nFee;
+        return true;
+    };
+}
+
+BOOST_AUTO_TEST_SUITE(miner_tests)
+
+BOOST_AUTO_TEST_CASE(miner_priority_aging)
+{
+    MinerTestTip tip(100);
+    CReserveKey reservekey(pwalletMain);
+    set<uint256> setBad;
+
+    // the higher priority at entry, and the one aging faster by its input
+    CTransaction txEntry = AddTx(COutPoint(GetRandHash(), 0), 1000000, 100000, 1e9);
+    CTransaction txAging = AddTx(COutPoint(GetRandHash(), 0), 100000 * COIN, 100000, 1e8);
+    BOOST_CHECK(mempool.setByPriority.rbegin()->second == txEntry.GetHash());
+
+    // room for one of them in the priority part, the other is taken by fee
+    unsigned int nTxSize = mempool.mapRanks[txAging.GetHash()].nTxSize;
+    mapArgs["-blockprioritysize"] = strprintf("%u", 1000 + nTxSize + 1);
+    tip.index.nHeight = 200;
+
+    CBlockTemplate templ;
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, TestConnect(setBad)));
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 3);
+    BOOST_CHECK(templ.pblock->vtx[1].GetHash() == txAging.GetHash());
+    BOOST_CHECK(templ.pblock->vtx[2].GetHash() == txEntry.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(miner_package_whole)
+{
+    MinerTestTip tip(100);
+    CReserveKey reservekey(pwalletMain);
+    mapArgs["-blockprioritysize"] = "0";
+
+    // the package of the parent with its child pays the most, other tx
+    // pays less, the parent alone the least; the child does not connect
+    CTransaction txParent = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 20000);
+    CTransaction txChild = AddTx(COutPoint(txParent.GetHash(), 0), txParent.vout[0].nValue, 1000000);
+    CTransaction txOther = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 100000);
+    BOOST_CHECK(mempool.setByFeeRate.rbegin()->second == txChild.GetHash());
+    set<uint256> setBad = {txChild.GetHash()};
+    vector<uint256> vConnected;
+
+    // the parent is rolled back with the child and is taken by its own fee
+    CBlockTemplate templ;
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, TestConnect(setBad, &vConnected)));
+    BOOST_REQUIRE(vConnected.size() == 4);
+    BOOST_CHECK(vConnected[0] == txParent.GetHash());
+    BOOST_CHECK(vConnected[1] == txChild.GetHash());
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 3);
+    BOOST_CHECK(templ.pblock->vtx[1].GetHash() == txOther.GetHash());
+    BOOST_CHECK(templ.pblock->vtx[2].GetHash() == txParent.GetHash());
+    BOOST_CHECK(templ.nBlockTx == 2);
+    BOOST_CHECK(templ.nFees == 120000);
+    BOOST_CHECK(templ.setIncluded.size() == 2);
+    BOOST_CHECK(templ.setFailed.count(txChild.GetHash()));
+    BOOST_CHECK(!templ.setFailed.count(txParent.GetHash()));
+    BOOST_CHECK(templ.nBlockSize == 1000 + mempool.mapRanks[txParent.GetHash()].nTxSize +
+                                           mempool.mapRanks[txOther.GetHash()].nTxSize);
+}
+
+BOOST_AUTO_TEST_CASE(miner_template_update)
+{
+    MinerTestTip tip(100);
+    CReserveKey reservekey(pwalletMain);
+    mapArgs["-blockprioritysize"] = "0";
+    set<uint256> setBad;
+    vector<uint256> vConnected;
+    BlockTemplateConnect connect = TestConnect(setBad, &vConnected);
+
+    CTransaction txFirst = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 100000);
+    CBlockTemplate templ;
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, connect));
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 2);
+
+    // same tip and mempool: reused as is
+    uint64_t nReuses = nBlockTemplateReuses;
+    vConnected.clear();
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    BOOST_CHECK(nBlockTemplateReuses == nReuses + 1);
+    BOOST_CHECK(vConnected.empty());
+    BOOST_CHECK(templ.pblock->vtx.size() == 2);
+
+    // a new tx: extended, only the new one is connected
+    uint64_t nExtends = nBlockTemplateExtends;
+    CTransaction txSecond = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 50000);
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    BOOST_CHECK(nBlockTemplateExtends == nExtends + 1);
+    BOOST_REQUIRE(vConnected.size() == 1);
+    BOOST_CHECK(vConnected[0] == txSecond.GetHash());
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 3);
+    BOOST_CHECK(templ.pblock->vtx[1].GetHash() == txFirst.GetHash());
+    BOOST_CHECK(templ.pblock->vtx[2].GetHash() == txSecond.GetHash());
+    BOOST_CHECK(templ.nFees == 150000);
+
+    // an included tx left the mempool: rebuilt
+    mempool.remove(txFirst);
+    BOOST_CHECK(!UpdateBlockTemplate(templ, connect));
+
+    // a new tip: rebuilt
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, connect));
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    tip.Next();
+    BOOST_CHECK(!UpdateBlockTemplate(templ, connect));
+}
+
+BOOST_AUTO_TEST_CASE(miner_template_deferred)
+{
+    MinerTestTip tip(100);
+    CReserveKey reservekey(pwalletMain);
+    mapArgs["-blockprioritysize"] = "0";
+    set<uint256> setBad;
+    vector<uint256> vConnected;
+    BlockTemplateConnect connect = TestConnect(setBad, &vConnected);
+
+    // timestamped an hour ahead, not taken until then
+    int64_t nNow = GetTime();
+    CTransaction txLater = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 100000, 0, GetAdjustedTime() + 3600);
+    CBlockTemplate templ;
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, connect));
+    BOOST_CHECK(templ.pblock->vtx.size() == 1);
+    BOOST_CHECK(templ.fDeferred);
+    BOOST_CHECK(vConnected.empty());
+
+    // still early: the mempool is the same but the deferred one is retried
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    BOOST_CHECK(templ.pblock->vtx.size() == 1);
+    BOOST_CHECK(templ.fDeferred);
+
+    SetMockTime(nNow + 7200);
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    SetMockTime(0);
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 2);
+    BOOST_CHECK(templ.pblock->vtx[1].GetHash() == txLater.GetHash());
+    BOOST_CHECK(!templ.fDeferred);
+    BOOST_CHECK(vConnected.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(miner_template_better_fee)
+{
+    MinerTestTip tip(100);
+    CReserveKey reservekey(pwalletMain);
+    mapArgs["-blockprioritysize"] = "0";
+    set<uint256> setBad;
+    BlockTemplateConnect connect = TestConnect(setBad);
+
+    // room for two txs, both taken
+    CTransaction txLow = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 100000);
+    CTransaction txMid = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 200000);
+    unsigned int nTxSize = mempool.mapRanks[txLow.GetHash()].nTxSize;
+    mapArgs["-blockmaxsize"] = strprintf("%u", 1000 + 2 * nTxSize + 1);
+    CBlockTemplate templ;
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, connect));
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 3);
+
+    // a worse paying one does not fit, the template is kept
+    CTransaction txWorse = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 50000);
+    BOOST_CHECK(UpdateBlockTemplate(templ, connect));
+    BOOST_CHECK(templ.pblock->vtx.size() == 3);
+    BOOST_CHECK(templ.setSkipped.count(txWorse.GetHash()));
+
+    // a better paying one does not fit either: rebuilt, it replaces the lowest
+    CTransaction txBetter = AddTx(COutPoint(GetRandHash(), 0), 1000000000, 1000000);
+    BOOST_CHECK(!UpdateBlockTemplate(templ, connect));
+    BOOST_REQUIRE(CreateBlockTemplate(templ, reservekey, true, connect));
+    BOOST_REQUIRE(templ.pblock->vtx.size() == 3);
+    BOOST_CHECK(templ.pblock->vtx[1].GetHash() == txBetter.GetHash());
+    BOOST_CHECK(templ.pblock->vtx[2].GetHash() == txMid.GetHash());
+    BOOST_CHECK(templ.nFees == 1200000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
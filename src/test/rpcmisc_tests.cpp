@@ -0,0 +1,69 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "json/json_spirit_utils.h"
+#include "main.h"
+#include "pegdata.h"
+#include "pegdb-leveldb.h"
+#include "rpcserver.h"
+#include "util.h"
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(rpcmisc_tests)
+
+// The fractions read back from pegdb are compact, the peg RPCs only read them
+BOOST_AUTO_TEST_CASE(rpcmisc_fractions_compact)
+{
+    boost::filesystem::path pathData = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("pegdb-%%%%%%");
+    boost::filesystem::create_directories(pathData);
+    mapArgs["-datadir"] = pathData.string();
+    ClearDatadirCache();
+
+    // 100 at the slots [100,200)
+    CFractions fractions(0, CFractions::STD);
+    for (int i=100; i<200; i++)
+        fractions.f[i] = 100;
+    uint256 txhash = GetRandHash();
+    {
+        CPegDB pegdb("cr+");
+        BOOST_REQUIRE(pegdb.WriteFractions(uint320(txhash, 1), fractions));
+        CFractions fractionsRead(0, CFractions::VALUE);
+        BOOST_REQUIRE(pegdb.ReadFractions(uint320(txhash, 1), fractionsRead, true));
+        BOOST_CHECK(fractionsRead.IsCompact());
+    }
+
+    string txhashnout = txhash.GetHex() + ":1";
+    Array params;
+    params.push_back(txhashnout);
+    params.push_back(150);
+    Object obj = getfractions(params, false).get_obj();
+    BOOST_CHECK(find_value(obj, "total").get_int64() == 10000);
+    BOOST_CHECK(find_value(obj, "reserve").get_int64() == 5000);
+    BOOST_CHECK(find_value(obj, "liquidity").get_int64() == 5000);
+    const Array& values = find_value(obj, "values").get_array();
+    BOOST_REQUIRE(values.size() == PEG_SIZE);
+    BOOST_CHECK(values[99].get_int64() == 0);
+    BOOST_CHECK(values[100].get_int64() == 100);
+
+    // even liquidity over 50 slots: a tenth of it every 5 slots, the
+    // periods of the rate are 9 tenths at least
+    params.clear();
+    params.push_back(txhashnout);
+    params.push_back("150");
+    obj = getliquidityrate(params, false).get_obj();
+    BOOST_CHECK(find_value(obj, "rate").get_int() > 0);
+    const Object& periods = find_value(obj, "periods").get_obj();
+    BOOST_REQUIRE(periods.size() >= 9);
+    BOOST_CHECK(periods[0].name_ == "5");
+
+    CPegDB().Close();
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathData);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,126 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "key.h"
+#include "sigcache.h"
+#include "util.h"
+
+using namespace std;
+
+static CPubKey RandomPubKey()
+{
+    vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    uint256 x = GetRandHash();
+    memcpy(&vch[1], &x, 32);
+    return CPubKey(vch);
+}
+
+static vector<unsigned char> RandomSig()
+{
+    uint256 r = GetRandHash();
+    uint256 s = GetRandHash();
+    vector<unsigned char> vch((unsigned char*)&r, (unsigned char*)&r + 32);
+    vch.insert(vch.end(), (unsigned char*)&s, (unsigned char*)&s + 32);
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CSignatureCache cache(1 << 20);
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubKey = RandomPubKey();
+
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubKey));
+    cache.Set(hash, vchSig, pubKey);
+    BOOST_CHECK(cache.Get(hash, vchSig, pubKey));
+    cache.Set(hash, vchSig, pubKey); // already cached
+
+    // any part of the key differs
+    BOOST_CHECK(!cache.Get(GetRandHash(), vchSig, pubKey));
+    BOOST_CHECK(!cache.Get(hash, RandomSig(), pubKey));
+    BOOST_CHECK(!cache.Get(hash, vchSig, RandomPubKey()));
+    vector<unsigned char> vchSigShort(vchSig.begin(), vchSig.end() - 1);
+    BOOST_CHECK(!cache.Get(hash, vchSigShort, pubKey));
+
+    CSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK(stats.nHits == 1);
+    BOOST_CHECK(stats.nMisses == 5);
+    BOOST_CHECK(stats.nInserts == 1);
+    BOOST_CHECK(stats.nEntries == 1);
+    BOOST_CHECK(stats.nEvictions == 0);
+    BOOST_CHECK(stats.nMaxSlots * 32 == (1 << 20));
+
+    cache.Clear();
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubKey));
+    BOOST_CHECK(cache.GetStats().nEntries == 0);
+    BOOST_CHECK(cache.GetStats().nSlots == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_lazy)
+{
+    // 4MB is 131072 slots, none allocated before use
+    CSignatureCache cache(4 << 20);
+    BOOST_CHECK(cache.GetStats().nSlots == 0);
+    BOOST_CHECK(cache.GetStats().nMaxSlots == 131072);
+
+    // one shard allocates its first buckets
+    vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubKey = RandomPubKey();
+    cache.Set(GetRandHash(), vchSig, pubKey);
+    BOOST_CHECK(cache.GetStats().nSlots == CSignatureCache::nMinBuckets * CSignatureCache::nWays);
+
+    // shards grow with the entries, keeping the ones added before
+    vector<uint256> vHashes;
+    for (int i=0; i<20000; i++) {
+        vHashes.push_back(GetRandHash());
+        cache.Set(vHashes.back(), vchSig, pubKey);
+    }
+    CSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK(stats.nSlots > stats.nEntries);
+    BOOST_CHECK(stats.nSlots < stats.nMaxSlots);
+    BOOST_CHECK(stats.nEvictions == stats.nInserts - stats.nEntries);
+    BOOST_CHECK(stats.nEntries > 20000 * 9 / 10);
+    int nFound = 0;
+    for (const uint256& hash : vHashes)
+        nFound += cache.Get(hash, vchSig, pubKey);
+    BOOST_CHECK(nFound == (int)stats.nEntries - 1);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_bounded)
+{
+    // 64KB is 2048 slots
+    CSignatureCache cache(64 << 10);
+    vector<uint256> vHashes;
+    vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubKey = RandomPubKey();
+    for (int i=0; i<10000; i++) {
+        vHashes.push_back(GetRandHash());
+        cache.Set(vHashes.back(), vchSig, pubKey);
+    }
+
+    CSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK(stats.nSlots == 2048);
+    BOOST_CHECK(stats.nEntries <= stats.nSlots);
+    BOOST_CHECK(stats.nEntries > stats.nSlots * 9 / 10);
+    BOOST_CHECK(stats.nInserts == 10000);
+    BOOST_CHECK(stats.nEvictions == stats.nInserts - stats.nEntries);
+
+    // the last added ones are mostly kept
+    int nFound = 0;
+    for (int i=10000-100; i<10000; i++)
+        nFound += cache.Get(vHashes[i], vchSig, pubKey);
+    BOOST_CHECK(nFound > 70);
+
+    // zero size disables the cache
+    CSignatureCache disabled(0);
+    disabled.Set(vHashes[0], vchSig, pubKey);
+    BOOST_CHECK(!disabled.Get(vHashes[0], vchSig, pubKey));
+    BOOST_CHECK(disabled.GetStats().nEntries == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+#include <boost/test/unit_test.hpp>
+
+#include <limits>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "blockfile.h"
+#include "kernel.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+// protocol v3 starts after this time
+static const int64_t nTimeV3 = 1484956800;
+
+// Chain of 200 blocks in memory ending before protocol v3, the blocks
+// with staking outputs are written to the block files and the tx index
+// of a temporary data directory
+struct StakeTestChain {
+    boost::filesystem::path pathData;
+    vector<uint256> vHashes;
+    vector<CBlockIndex*> vChain;
+
+    StakeTestChain() {
+        pathData = boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("stake-%%%%%%");
+        boost::filesystem::create_directories(pathData);
+        mapArgs["-datadir"] = pathData.string();
+        ClearDatadirCache();
+
+        const int nBlocks = 200;
+        vHashes.resize(nBlocks);
+        for (int i=0; i<nBlocks; i++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            vHashes[i] = GetRandHash();
+            pindex->phashBlock = &vHashes[i];
+            pindex->pprev = i ? vChain[i - 1] : NULL;
+            pindex->nHeight = 30000 + i;
+            pindex->nTime = nTimeV3 - 600 - (nBlocks - 1 - i) * 64;
+            pindex->nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+            pindex->bnStakeModifierV2 = GetRandHash();
+            vChain.push_back(pindex);
+        }
+    }
+    ~StakeTestChain() {
+        CTxDB().Close();
+        CloseBlockFiles();
+        for (CBlockIndex* pindex : vChain)
+            delete pindex;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathData);
+    }
+
+    CBlockIndex* Tip() { return vChain.back(); }
+
+    // block i with a tx of nOutputs staking outputs of nValue, indexed as
+    // ConnectBlock() does; the first output is returned
+    COutPoint AddStake(int i, int nOutputs, int64_t nValue, unsigned int nTimeTx) {
+        CBlockIndex* pindex = vChain[i];
+        CBlock block;
+        block.nTime = pindex->nTime;
+        CTransaction txCoinBase;
+        txCoinBase.nTime = pindex->nTime;
+        txCoinBase.vin.resize(1);
+        txCoinBase.vin[0].prevout.SetNull();
+        txCoinBase.vin[0].scriptSig = CScript() << pindex->nHeight;
+        txCoinBase.vout.resize(1);
+        block.vtx.push_back(txCoinBase);
+        CTransaction tx;
+        tx.nTime = nTimeTx;
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        for (int n=0; n<nOutputs; n++)
+            tx.vout.push_back(CTxOut(nValue, CScript() << OP_TRUE));
+        block.vtx.push_back(tx);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        unsigned int nFile, nBlockPos;
+        BOOST_REQUIRE(block.WriteToDisk(nFile, nBlockPos));
+        pindex->nFile = nFile;
+        pindex->nBlockPos = nBlockPos;
+
+        CTxDB txdb("cr+");
+        unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) -
+                (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(block.vtx.size());
+        for (unsigned int n=0; n<block.vtx.size(); n++) {
+            BOOST_REQUIRE(txdb.AddTxIndex(block.vtx[n], CDiskTxPos(nFile, nBlockPos, nTxPos), pindex->nHeight, n));
+            nTxPos += ::GetSerializeSize(block.vtx[n], SER_DISK, CLIENT_VERSION);
+        }
+        return COutPoint(tx.GetHash(), 0);
+    }
+};
+
+// The table agrees with CheckKernel() for the prevout at 64 timestamps
+// nStep apart, returns the number of timestamps passing
+static int CheckKernelAgrees(CStakeCandidateTable& table, CBlockIndex* pindexPrev, unsigned int nBits,
+                             const COutPoint& prevout, int64_t nTimeFrom, int nStep)
+{
+    int nPassed = 0;
+    for (int n=0; n<64; n++) {
+        int64_t nTime = nTimeFrom + n * nStep;
+        const CStakeCandidate* pcandidate = table.Get(pindexPrev, nBits, prevout);
+        bool fKernel = ::CheckKernel(pindexPrev, nBits, nTime, prevout);
+        BOOST_CHECK_MESSAGE(table.CheckKernel(*pcandidate, pindexPrev, nBits, nTime) == fKernel,
+                            strprintf("%s at %d", prevout.ToString(), nTime));
+        nPassed += fKernel;
+    }
+    return nPassed;
+}
+
+BOOST_AUTO_TEST_SUITE(stakecandidate_tests)
+
+BOOST_AUTO_TEST_CASE(stakecandidate_checkkernel)
+{
+    StakeTestChain chain;
+    // about a third of the kernels of 1000 coins meet the target
+    const unsigned int nBits = 0x1c03ffff;
+    COutPoint prevoutOld = chain.AddStake(10, 3, 1000 * COIN, chain.vChain[10]->nTime);
+    COutPoint prevoutRecent = chain.AddStake(190, 1, 1000 * COIN, chain.vChain[190]->nTime);
+    // the tx is timestamped in the middle of the search window
+    COutPoint prevoutLate = chain.AddStake(20, 1, 1000 * COIN, nTimeV3 + 512);
+    COutPoint prevoutMissing(GetRandHash(), 0);
+
+    CStakeCandidateTable table;
+    CBlockIndex* pindexTip = chain.Tip();
+    const CStakeCandidate* pcandidate = table.Get(pindexTip, nBits, prevoutOld);
+    BOOST_CHECK(pcandidate->fFound && !pcandidate->fRecent);
+    BOOST_CHECK(pcandidate->nValue == 1000 * COIN);
+    BOOST_CHECK(pcandidate->nTimeBlockFrom == chain.vChain[10]->nTime);
+
+    // protocol v3 kernels of the table
+    int nPassed = 0;
+    for (unsigned int n=0; n<3; n++)
+        nPassed += CheckKernelAgrees(table, pindexTip, nBits, COutPoint(prevoutOld.hash, n), nTimeV3 + 1, 16);
+    BOOST_CHECK(nPassed > 0 && nPassed < 3 * 64);
+
+    // within nStakeMinConfirmations of the tip
+    pcandidate = table.Get(pindexTip, nBits, prevoutRecent);
+    BOOST_CHECK(pcandidate->fFound && pcandidate->fRecent);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexTip, nBits, prevoutRecent, nTimeV3 + 1, 16) == 0);
+
+    // timestamps before the tx fail with nTime violation
+    pcandidate = table.Get(pindexTip, nBits, prevoutLate);
+    BOOST_CHECK(pcandidate->nTimeTxPrev == nTimeV3 + 512);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexTip, nBits, prevoutLate, nTimeV3 + 1, 1) == 0);
+    CheckKernelAgrees(table, pindexTip, nBits, prevoutLate, nTimeV3 + 1, 16);
+
+    // not in the chain
+    BOOST_CHECK(!table.Get(pindexTip, nBits, prevoutMissing)->fFound);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexTip, nBits, prevoutMissing, nTimeV3 + 1, 16) == 0);
+    BOOST_CHECK(table.size() == 6);
+
+    // before protocol v3 the generic path is taken: the modifier of v2 and
+    // the min age instead of the confirmations, the recent output is younger
+    nPassed = CheckKernelAgrees(table, pindexTip, nBits, prevoutOld, nTimeV3 - 64 * 16, 16);
+    BOOST_CHECK(nPassed > 0 && nPassed < 64);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexTip, nBits, prevoutRecent, nTimeV3 - 64 * 16, 16) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(stakecandidate_clear)
+{
+    StakeTestChain chain;
+    const unsigned int nBits = 0x1c03ffff;
+    // any kernel of 1000 coins meets the target
+    const unsigned int nBitsEasy = 0x21010000;
+    COutPoint prevoutOld = chain.AddStake(10, 2, 1000 * COIN, chain.vChain[10]->nTime);
+    COutPoint prevoutRecent = chain.AddStake(190, 1, 1000 * COIN, chain.vChain[190]->nTime);
+
+    CStakeCandidateTable table;
+    CBlockIndex* pindexTip = chain.Tip();
+    table.Get(pindexTip, nBits, prevoutOld);
+    table.Get(pindexTip, nBits, COutPoint(prevoutOld.hash, 1));
+    BOOST_CHECK(table.size() == 2);
+
+    // a candidate checked at another tip than the one of the table takes
+    // the generic path
+    const CStakeCandidate candidateStale = *table.Get(pindexTip, nBits, prevoutOld);
+    CBlockIndex* pindexPrev = chain.vChain[198];
+    for (int n=0; n<64; n++) {
+        int64_t nTime = nTimeV3 + 1 + n * 16;
+        BOOST_CHECK(table.CheckKernel(candidateStale, pindexPrev, nBits, nTime) ==
+                    ::CheckKernel(pindexPrev, nBits, nTime, prevoutOld));
+    }
+
+    // another tip clears the table, its modifier is taken
+    BOOST_CHECK(table.Get(pindexPrev, nBits, prevoutOld)->fFound);
+    BOOST_CHECK(table.size() == 1);
+    CheckKernelAgrees(table, pindexPrev, nBits, prevoutOld, nTimeV3 + 1, 16);
+
+    // another target clears it too: the old output passes everywhere, the
+    // recent one still does not
+    BOOST_CHECK(table.Get(pindexPrev, nBitsEasy, prevoutOld)->fTargetOverflow);
+    BOOST_CHECK(table.size() == 1);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexPrev, nBitsEasy, prevoutOld, nTimeV3 + 1, 16) == 64);
+    BOOST_CHECK(CheckKernelAgrees(table, pindexPrev, nBitsEasy, prevoutRecent, nTimeV3 + 1, 16) == 0);
+    BOOST_CHECK(table.size() == 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -22,23 +22,29 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "base58.h"
+#include "blockindexsnapshot.h"
 #include "peg.h"
 #include "script.h"
 
+#include <atomic>
+#include <deque>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 using namespace std;
 using namespace boost;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
 
+static CDBOptions& DBOptions() {
+    static CDBOptions dbopts;
+    return dbopts;
+}
+
 static leveldb::Options GetOptions() {
-    leveldb::Options options;
-    int nCacheSizeMB = GetArg("-dbcache", 50);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    return options;
+    DBOptions() = GetDBOptions("txdb");
+    return MakeLevelDBOptions(DBOptions());
 }
 
 static void init_blockindex(leveldb::Options& options, bool fRemoveOld = false, bool fCreateBootstrap = false) {
@@ -79,6 +85,7 @@ static void init_blockindex(leveldb::Options& options, bool fRemoveOld = false,
 // CDB subclasses are created and destroyed VERY OFTEN. That's why
 // we shouldn't treat this as a free operations.
 CTxDB::CTxDB(const char* pszMode)
+    :bufferView(&WriteBuffer())
 {
     assert(pszMode);
     activeBatch = NULL;
@@ -93,7 +100,6 @@ CTxDB::CTxDB(const char* pszMode)
 
     options = GetOptions();
     options.create_if_missing = fCreate;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
     init_blockindex(options); // Init directory
     pdb = txdb;
@@ -135,6 +141,7 @@ CTxDB::CTxDB(const char* pszMode)
 
 void CTxDB::Close()
 {
+    FlushWriteBuffer(true);
     delete txdb;
     txdb = pdb = NULL;
     delete options.filter_policy;
@@ -148,14 +155,16 @@ void CTxDB::Close()
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CDBBatch(&WriteBuffer());
     return true;
 }
 
 bool CTxDB::TxnCommit()
 {
     assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
+    leveldb::Status status;
+    if (!WriteBuffer().Commit(*activeBatch))
+        status = activeBatch->Write(pdb);
     delete activeBatch;
     activeBatch = NULL;
     if (!status.ok()) {
@@ -165,121 +174,57 @@ bool CTxDB::TxnCommit()
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
-
-    CBatchScanner() : foundEntry(false) {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        }
-    }
-
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
-        }
-    }
-};
+CDBWriteBuffer& CTxDB::WriteBuffer()
+{
+    static CDBWriteBuffer buffer;
+    return buffer;
+}
 
-class CBatchSeeker : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    std::string stople;
-    std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap;
-    std::set<std::string> *erased;
-
-    CBatchSeeker() {}
-
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        leveldb::Slice sneedle(needle);
-        leveldb::Slice sstople(stople);
-        if (key.compare(sneedle) >= 0) {
-            if (stople.empty() || key.compare(sstople) <= 0) {
-                (*seekmap)[key.ToString()] = value.ToString();
-            }
-        }
-        erased->erase(key.ToString());
-    }
+bool CTxDB::GetDBStats(CDBStats& stats)
+{
+    if (!txdb)
+        return false;
+    static const vector<string> vPrefixes = {
+        "tx", "blockindex", "utxo", "ftxo", "addr", "fqueue", "pegbalance"
+    };
+    stats.options = DBOptions();
+    GetLevelDBStats(txdb, vPrefixes, stats);
+    return true;
+}
 
-    virtual void Delete(const leveldb::Slice& key) {
-        seekmap->erase(key.ToString());
-        erased->insert(key.ToString());
-    }
-};
+bool CTxDB::FlushWriteBuffer(bool fDisable)
+{
+    if (!txdb)
+        return true;
+    leveldb::Status status = WriteBuffer().Flush(txdb, fDisable);
+    if (!status.ok())
+        return error("CTxDB::FlushWriteBuffer() : LevelDB write failure: %s", status.ToString());
+    return true;
+}
 
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. The batch keeps
+// its changes indexed, so the lookup does not depend on the batch size.
+// Commits kept by the write buffer are looked up the same way.
 bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
-    assert(activeBatch);
-    *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
-    }
-    return scanner.foundEntry;
+    return ReadBatch()->Get(key.str(), value, deleted);
 }
 
 // When performing a seek, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// a database transaction begins reads are consistent with it. Deleted keys
+// are to be checked by the caller with CDBBatch::IsDeleted.
 bool CTxDB::SeekBatch(const CDataStream &fromkey, 
-                      string *key, string *value, 
-                      std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap,
-                      std::set<std::string> *erased) const {
-    assert(activeBatch);
-    CBatchSeeker scanner;
-    scanner.needle = fromkey.str();
-    scanner.erased = erased;
-    scanner.seekmap = seekmap;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
-    }
-    if (scanner.seekmap->empty())
-        return false;
-    *key = scanner.seekmap->begin()->first;
-    *value = scanner.seekmap->begin()->second;
-    return true;
+                      string *key, string *value) const {
+    return ReadBatch()->Seek(fromkey.str(), key, value);
 }
 
-// When performing a seek, if we have an active batch we need to check it first
-// before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+// Same as above, collects all keys of the batch in [fromkey, tokey].
 bool CTxDB::SeekBatch(const CDataStream &fromkey, 
                       const CDataStream &tokey, 
-                      std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap,
-                      std::set<std::string> *erased) const {
-    assert(activeBatch);
-    CBatchSeeker scanner;
-    scanner.needle = fromkey.str();
-    scanner.stople = tokey.str();
-    scanner.erased = erased;
-    scanner.seekmap = seekmap;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
-    }
-    return !scanner.seekmap->empty();
+                      std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap) const {
+    return ReadBatch()->Range(fromkey.str(), tokey.str(), seekmap);
 }
 
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
@@ -308,78 +253,120 @@ bool CTxDB::EraseTxIndex(const CTransaction& tx)
     return Erase(make_pair(string("tx"), hash));
 }
 
-//bool SetTxIndexesV1(CTxDB & ctxdb,
-//                    LoadMsg load_msg);
+// Threads of the startup passes over the block index and the chain
+static int LoadThreads()
+{
+    int nThreads = std::max(1, std::min(8, int(boost::thread::hardware_concurrency())));
+    return std::max(1, std::min(16, int(GetArg("-loadthreads", nThreads))));
+}
 
-static bool SetTxIndexesV1(CTxDB & ctxdb, LoadMsg load_msg) {
-    if (!ctxdb.TxnBegin())
+// Tx indexes of the main chain blocks in [nFrom, nTo) are set to v1:
+// the height comes from the block index and the position of the tx from
+// one read of the block for all its txs. Only the indexes pointing to the
+// block are updated, the ones already done are skipped. Txs without an
+// index or with the index of another block are counted in nSkipped.
+static bool SetTxIndexesV1Range(const vector<CBlockIndex*>& vChain, int nFrom, int nTo,
+                                std::atomic<int>& nUpdated, std::atomic<int>& nSkipped)
+{
+    CTxDB txdb;
+    if (!txdb.TxnBegin())
         return error("SetTxIndexesV1() : TxnBegin failed");
-
-    leveldb::Iterator *iterator = txdb->NewIterator(leveldb::ReadOptions());
-    // Seek to start key.
-    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
-    ssStartKey << make_pair(string("tx"), uint256(0));
-    iterator->Seek(ssStartKey.str());
-    // Now read each entry.
-    int indexCount = 0;
-    while (iterator->Valid())
-    {
-        boost::this_thread::interruption_point();
-        // Unpack keys and values.
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.write(iterator->key().data(), iterator->key().size());
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.write(iterator->value().data(), iterator->value().size());
-        string strType;
-        ssKey >> strType;
-        // Did we reach the end of the data to read?
-        if (strType != "tx")
-            break;
-        
-        uint256 txhash;
-        auto keypair = make_pair(string("tx"), txhash);
-        CDataStream ssKeyRead(SER_DISK, CLIENT_VERSION);
-        ssKeyRead.write(iterator->key().data(), iterator->key().size());
-        ssKeyRead >> keypair;
-        
-        CTxIndex txindex;
-        if (!ctxdb.ReadTxIndex(keypair.second, txindex)) {
-            return error("SetTxIndexesV1() : ReadTxIndex failed, txhash %s", keypair.second.GetHex());
-        }
-        
-        uint256 blockhash;
-        unsigned int nTxIndex = 0;
-        txindex.nHeight = txindex.GetHeightInMainChain(&nTxIndex, keypair.second, &blockhash);
-        if (txindex.nHeight == 0) {
-            return error("SetTxIndexesV1() : GetHeightInMainChain failed, txhash %s", keypair.second.GetHex());
-        }
-        txindex.nIndex = uint16_t(nTxIndex);
-        txindex.nVersion = 1;
-        
-        if (!ctxdb.UpdateTxIndex(keypair.second, txindex)) {
-            return error("SetTxIndexesV1() : UpdateTxIndex failed");
+    for (int nHeight = nFrom; nHeight < nTo; nHeight++) {
+        const CBlockIndex* pindex = vChain[nHeight];
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("SetTxIndexesV1() : ReadFromDisk failed, height %d", nHeight);
+        for (unsigned int i=0; i<block.vtx.size(); i++) {
+            uint256 txhash = block.vtx[i].GetHash();
+            CTxIndex txindex;
+            if (!txdb.ReadTxIndex(txhash, txindex)) {
+                LogPrintf("SetTxIndexesV1() : tx %s at height %d has no index\n", txhash.ToString(), nHeight);
+                nSkipped++;
+                continue;
+            }
+            if (txindex.pos.nFile != pindex->nFile || txindex.pos.nBlockPos != pindex->nBlockPos) {
+                LogPrintf("SetTxIndexesV1() : tx %s at height %d is indexed in another block\n", txhash.ToString(), nHeight);
+                nSkipped++;
+                continue;
+            }
+            if (txindex.nVersion == 1 && txindex.nHeight == nHeight && txindex.nIndex == i)
+                continue;
+            txindex.nHeight = nHeight;
+            txindex.nIndex = uint16_t(i);
+            txindex.nVersion = 1;
+            if (!txdb.UpdateTxIndex(txhash, txindex))
+                return error("SetTxIndexesV1() : UpdateTxIndex failed");
+            nUpdated++;
         }
+    }
+    if (!txdb.TxnCommit())
+        return error("SetTxIndexesV1() : TxnCommit failed");
+    return true;
+}
 
-        iterator->Next();
+// The main chain is walked in chunks of TXINDEX_V1_CHUNK blocks, a round
+// of chunks is given to the threads and the height reached is written as
+// a checkpoint after each round, so an interrupted upgrade resumes there.
+static const int TXINDEX_V1_CHUNK = 1000;
 
-        indexCount++;
-        if (indexCount % 10000 == 0) {
-            load_msg(std::string(" update tx indexes: ")+std::to_string(indexCount));
-            // commit on every 10k
-            if (!ctxdb.TxnCommit())
-                return error("SetTxIndexesV1() : TxnCommit failed");
-            if (!ctxdb.TxnBegin())
-                return error("SetTxIndexesV1() : TxnBegin failed");
-        }
+static bool SetTxIndexesV1(CTxDB & ctxdb, LoadMsg load_msg) {
+    int64_t nStart = GetTimeMicros();
+    vector<CBlockIndex*> vChain(nBestHeight+1, nullptr);
+    for (CBlockIndex* pindex = pindexBest; pindex; pindex = pindex->pprev)
+        vChain[pindex->nHeight] = pindex;
+
+    int nHeight = 0;
+    if (!ctxdb.ReadTxIndexV1Height(nHeight))
+        nHeight = 0;
+    nHeight = std::max(0, std::min(nHeight, nBestHeight+1));
+    if (nHeight > 0)
+        LogPrintf("SetTxIndexesV1() : resuming at height %d\n", nHeight);
+
+    int nThreads = LoadThreads();
+    std::atomic<int> nUpdated(0);
+    std::atomic<int> nSkipped(0);
+    while (nHeight <= nBestHeight) {
+        boost::this_thread::interruption_point();
+        int nRoundEnd = std::min(nBestHeight+1, nHeight + nThreads * TXINDEX_V1_CHUNK);
+        std::atomic<bool> fFailed(false);
+        auto update = [&](int nFrom) {
+            int nTo = std::min(nRoundEnd, nFrom + TXINDEX_V1_CHUNK);
+            try {
+                if (!SetTxIndexesV1Range(vChain, nFrom, nTo, nUpdated, nSkipped))
+                    fFailed = true;
+            }
+            catch (std::exception& e) {
+                LogPrintf("SetTxIndexesV1() : %s\n", e.what());
+                fFailed = true;
+            }
+        };
+        boost::thread_group threadGroup;
+        for (int nFrom = nHeight + TXINDEX_V1_CHUNK; nFrom < nRoundEnd; nFrom += TXINDEX_V1_CHUNK)
+            threadGroup.create_thread([&update, nFrom] { update(nFrom); });
+        update(nHeight);
+        threadGroup.join_all();
+        if (fFailed)
+            return error("SetTxIndexesV1() : update failed in heights %d-%d", nHeight, nRoundEnd-1);
+
+        nHeight = nRoundEnd;
+        if (!ctxdb.WriteTxIndexV1Height(nHeight))
+            return error("SetTxIndexesV1() : progress write failed");
+        load_msg(std::string(" update tx indexes: ")+std::to_string(nHeight)+"/"+std::to_string(nBestHeight));
     }
-    delete iterator;
 
+    if (!ctxdb.TxnBegin())
+        return error("SetTxIndexesV1() : TxnBegin failed");
     if (!ctxdb.WriteTxIndexIsV1Ready(true))
         return error("SetTxIndexesV1() : flag write failed");
-
+    if (!ctxdb.EraseTxIndexV1Height())
+        return error("SetTxIndexesV1() : progress erase failed");
     if (!ctxdb.TxnCommit())
         return error("SetTxIndexesV1() : TxnCommit failed");
 
+    LogPrintf("SetTxIndexesV1() : %d tx indexes updated\n", int(nUpdated));
+    if (nSkipped > 0)
+        LogPrintf("SetTxIndexesV1() : WARNING %d txs of the main chain are not upgraded, -reindex rebuilds the indexes\n", int(nSkipped));
+    AddStartupTime("tx indexes v1", GetTimeMicros() - nStart);
     return true;
 }
 
@@ -448,6 +435,21 @@ bool CTxDB::WriteTxIndexIsV1Ready(bool bReady)
     return Write(string("txIndexIsV1Ready"), bReady);
 }
 
+bool CTxDB::ReadTxIndexV1Height(int& nHeight)
+{
+    return Read(string("txIndexV1Height"), nHeight);
+}
+
+bool CTxDB::WriteTxIndexV1Height(int nHeight)
+{
+    return Write(string("txIndexV1Height"), nHeight);
+}
+
+bool CTxDB::EraseTxIndexV1Height()
+{
+    return Erase(string("txIndexV1Height"));
+}
+
 bool CTxDB::ReadBlockIndexIsPegReady(bool& bReady)
 {
     return Read(string("blockIndexIsPegReady"), bReady);
@@ -502,12 +504,12 @@ CBlockIndex *CTxDB::InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = mapBlockIndex.NewIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
     mi = mapBlockIndex.insert(hash, pindexNew).first;
@@ -516,103 +518,240 @@ CBlockIndex *CTxDB::InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool CTxDB::LoadBlockIndex(LoadMsg load_msg)
+bool CTxDB::ScanBlockIndex(LoadMsg load_msg)
 {
-    if (mapBlockIndex.size() > 0) {
-        // Already loaded once in this session. It can happen during migration
-        // from BDB.
-        return true;
-    }
     // The block index is an in-memory structure that maps hashes to on-disk
     // locations where the contents of the block can be found. Here, we scan it
     // out of the DB and into mapBlockIndex.
-    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
-    // Seek to start key.
-    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
-    ssStartKey << make_pair(string("blockindex"), uint256(0));
-    iterator->Seek(ssStartKey.str());
-    // Now read each entry.
-    int indexCount = 0;
-    while (iterator->Valid())
-    {
-        boost::this_thread::interruption_point();
-        // Unpack keys and values.
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.write(iterator->key().data(), iterator->key().size());
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.write(iterator->value().data(), iterator->value().size());
-        string strType;
-        ssKey >> strType;
-        // Did we reach the end of the data to read?
-        if (strType != "blockindex")
-            break;
-        CDiskBlockIndex diskindex;
-        ssValue >> diskindex;
-
-        uint256 blockHash = diskindex.GetBlockHash();
-        // Construct block index object
-        CBlockIndex* pindexNew    = InsertBlockIndex(blockHash);
-        pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-        pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
-        pindexNew->nFile          = diskindex.nFile;
-        pindexNew->nBlockPos      = diskindex.nBlockPos;
-        pindexNew->nHeight        = diskindex.nHeight;
-        pindexNew->nMint          = diskindex.nMint;
-        pindexNew->nMoneySupply   = diskindex.nMoneySupply;
-        pindexNew->nPegSupplyIndex  = diskindex.nPegSupplyIndex;
-        pindexNew->nPegVotesInflate = diskindex.nPegVotesInflate;
-        pindexNew->nPegVotesDeflate = diskindex.nPegVotesDeflate;
-        pindexNew->nPegVotesNochange= diskindex.nPegVotesNochange;
-        pindexNew->nFlags         = diskindex.nFlags;
-        pindexNew->nStakeModifier = diskindex.nStakeModifier;
-        pindexNew->bnStakeModifierV2 = diskindex.bnStakeModifierV2;
-        pindexNew->prevoutStake   = diskindex.prevoutStake;
-        pindexNew->nStakeTime     = diskindex.nStakeTime;
-        pindexNew->hashProof      = diskindex.hashProof;
-        pindexNew->nVersion       = diskindex.nVersion;
-        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-        pindexNew->nTime          = diskindex.nTime;
-        pindexNew->nBits          = diskindex.nBits;
-        pindexNew->nNonce         = diskindex.nNonce;
-
-        // Watch for genesis block
-        if (pindexGenesisBlock == NULL && blockHash == Params().HashGenesisBlock())
-            pindexGenesisBlock = pindexNew;
-
-        if (!pindexNew->CheckIndex()) {
-            delete iterator;
-            return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
+    // The keyspace is split by first byte of block hash between threads which
+    // decode, hash and check the entries. Decoded entries are handed over in
+    // batches to this thread which inserts them into the map while the rest
+    // is still decoded, the queue of batches is bounded so at most a few
+    // batches per thread are held decoded.
+    int64_t nStart = GetTimeMicros();
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << string("blockindex");
+    const string strPrefix = ssPrefix.str();
+
+    struct CDecodedBatch {
+        vector<CDiskBlockIndex> vIndexes;
+        vector<uint256> vHashes;
+    };
+    const size_t nBatchSize = 1024;
+    int nThreads = LoadThreads();
+    const size_t nMaxQueued = 4 * nThreads;
+    boost::mutex csQueue;
+    boost::condition_variable condQueue;
+    std::deque<CDecodedBatch> queueDecoded;
+    int nFinished = 0;
+    std::atomic<bool> fFailed(false);
+    std::atomic<bool> fInterrupted(false);
+
+    auto push = [&](CDecodedBatch& batch) {
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        while (queueDecoded.size() >= nMaxQueued && !fFailed)
+            condQueue.wait(lock);
+        queueDecoded.push_back(std::move(batch));
+        condQueue.notify_all();
+        batch = CDecodedBatch();
+    };
+    auto decode = [&](int nPart) {
+        int nFrom = nPart * 256 / nThreads;
+        int nTo = (nPart + 1) * 256 / nThreads;
+        CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+        ssStartKey << make_pair(string("blockindex"), uint256(nFrom));
+        leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+        try {
+            CDecodedBatch batch;
+            for (iterator->Seek(ssStartKey.str()); iterator->Valid() && !fFailed; iterator->Next())
+            {
+                boost::this_thread::interruption_point();
+                leveldb::Slice key = iterator->key();
+                // Did we reach the end of the data to read?
+                if (key.size() <= strPrefix.size() || !key.starts_with(strPrefix))
+                    break;
+                if ((unsigned char)key[strPrefix.size()] >= nTo)
+                    break;
+                CDataStream ssValue(iterator->value().data(),
+                                    iterator->value().data() + iterator->value().size(),
+                                    SER_DISK, CLIENT_VERSION);
+                batch.vIndexes.emplace_back();
+                CDiskBlockIndex& diskindex = batch.vIndexes.back();
+                ssValue >> diskindex;
+                batch.vHashes.push_back(diskindex.GetBlockHash());
+                if (!diskindex.CheckIndex()) {
+                    LogPrintf("LoadBlockIndex() : CheckIndex failed at %d\n", diskindex.nHeight);
+                    fFailed = true;
+                    break;
+                }
+                if (batch.vIndexes.size() == nBatchSize)
+                    push(batch);
+            }
+            if (!batch.vIndexes.empty() && !fFailed)
+                push(batch);
         }
-
-        // NovaCoin: build setStakeSeen
-        if (pindexNew->IsProofOfStake())
-            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
-        iterator->Next();
-        indexCount++;
-        if (indexCount % 10000 == 0) {
-            load_msg(std::to_string(indexCount));
+        catch (boost::thread_interrupted&) {
+            fInterrupted = true;
+        }
+        catch (std::exception& e) {
+            LogPrintf("LoadBlockIndex() : %s\n", e.what());
+            fFailed = true;
+        }
+        delete iterator;
+        boost::unique_lock<boost::mutex> lock(csQueue);
+        nFinished++;
+        condQueue.notify_all();
+    };
+
+    boost::thread_group threadGroup;
+    for (int i=0; i<nThreads; i++)
+        threadGroup.create_thread([&decode, i] { decode(i); });
+
+    // Construct block index objects
+    int nInserted = 0;
+    int nMaxHeight = 0;
+    try {
+        while (true) {
+            CDecodedBatch batch;
+            {
+                boost::unique_lock<boost::mutex> lock(csQueue);
+                while (queueDecoded.empty() && nFinished < nThreads && !fFailed)
+                    condQueue.wait(lock);
+                if (queueDecoded.empty() || fFailed)
+                    break;
+                batch = std::move(queueDecoded.front());
+                queueDecoded.pop_front();
+                condQueue.notify_all();
+            }
+            for (size_t i=0; i<batch.vIndexes.size(); i++)
+            {
+                const CDiskBlockIndex& diskindex = batch.vIndexes[i];
+                const uint256& blockHash = batch.vHashes[i];
+                CBlockIndex* pindexNew    = InsertBlockIndex(blockHash);
+                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+                pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+                pindexNew->nFile          = diskindex.nFile;
+                pindexNew->nBlockPos      = diskindex.nBlockPos;
+                pindexNew->nHeight        = diskindex.nHeight;
+                pindexNew->nMint          = diskindex.nMint;
+                pindexNew->nMoneySupply   = diskindex.nMoneySupply;
+                pindexNew->nPegSupplyIndex  = diskindex.nPegSupplyIndex;
+                pindexNew->nPegVotesInflate = diskindex.nPegVotesInflate;
+                pindexNew->nPegVotesDeflate = diskindex.nPegVotesDeflate;
+                pindexNew->nPegVotesNochange= diskindex.nPegVotesNochange;
+                pindexNew->nFlags         = diskindex.nFlags;
+                pindexNew->nStakeModifier = diskindex.nStakeModifier;
+                pindexNew->bnStakeModifierV2 = diskindex.bnStakeModifierV2;
+                pindexNew->prevoutStake   = diskindex.prevoutStake;
+                pindexNew->nStakeTime     = diskindex.nStakeTime;
+                pindexNew->hashProof      = diskindex.hashProof;
+                pindexNew->nVersion       = diskindex.nVersion;
+                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+                pindexNew->nTime          = diskindex.nTime;
+                pindexNew->nBits          = diskindex.nBits;
+                pindexNew->nNonce         = diskindex.nNonce;
+
+                // Watch for genesis block
+                if (pindexGenesisBlock == NULL && blockHash == Params().HashGenesisBlock())
+                    pindexGenesisBlock = pindexNew;
+
+                // NovaCoin: build setStakeSeen
+                if (pindexNew->IsProofOfStake())
+                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+                nMaxHeight = std::max(nMaxHeight, pindexNew->nHeight);
+            }
+            int nPrevInserted = nInserted;
+            nInserted += batch.vIndexes.size();
+            if (nInserted / 10000 != nPrevInserted / 10000)
+                load_msg(std::to_string(nInserted));
         }
     }
-    delete iterator;
+    catch (...) {
+        // the decoders use the locals of this function, they are stopped
+        // before any exception (interruption, bad_alloc) leaves it
+        fFailed = true;
+        {
+            boost::unique_lock<boost::mutex> lock(csQueue);
+            condQueue.notify_all();
+        }
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        throw;
+    }
+    if (fFailed) {
+        // decoders waiting for the queue are woken by the failure
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        return error("LoadBlockIndex() : decoding of block index failed");
+    }
+    threadGroup.join_all();
+    if (fInterrupted)
+        throw boost::thread_interrupted();
+    AddStartupTime("block index: decode and insert", GetTimeMicros() - nStart);
 
     boost::this_thread::interruption_point();
-    
-    // Calculate nChainTrust
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for(const std::pair<uint256, CBlockIndex*> & item : mapBlockIndex)
+
+    // Calculate nChainTrust, blocks are bucketed by height so every
+    // block is visited after its parent
+    nStart = GetTimeMicros();
+    vector<int> vHeightStart(nMaxHeight + 2, 0);
+    for(const CBlockIndexMap::value_type & item : mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        if (item.second)
+            vHeightStart[item.second->nHeight + 1]++;
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for(const std::pair<int, CBlockIndex*> & item : vSortedByHeight)
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+    vector<CBlockIndex*> vSortedByHeight(vHeightStart.back());
+    for(const CBlockIndexMap::value_type & item : mapBlockIndex)
+    {
+        if (item.second)
+            vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+    }
+    for(CBlockIndex* pindex : vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
         pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
     }
-    
+    AddStartupTime("block index: chain trust", GetTimeMicros() - nStart);
+
+    return true;
+}
+
+bool CTxDB::LoadBlockIndex(LoadMsg load_msg)
+{
+    if (mapBlockIndex.size() > 0) {
+        // Already loaded once in this session. It can happen during migration
+        // from BDB.
+        return true;
+    }
+    // The index of a clean shutdown is taken from the snapshot if it was
+    // written for the best chain of the db, otherwise it is scanned
+    int64_t nStart = GetTimeMicros();
+    uint256 hashBestChainDisk;
+    if (GetBoolArg("-blockindexsnapshot", true) &&
+        ReadHashBestChain(hashBestChainDisk) &&
+        ReadBlockIndexSnapshot(BlockIndexSnapshotPath(), mapBlockIndex, hashBestChainDisk, setStakeSeen))
+    {
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(Params().HashGenesisBlock());
+        if (mi != mapBlockIndex.end())
+            pindexGenesisBlock = mi->second;
+        LogPrintf("LoadBlockIndex() : %u blocks from snapshot\n", mapBlockIndex.size());
+        AddStartupTime("block index: snapshot", GetTimeMicros() - nStart);
+    }
+    else {
+        boost::filesystem::remove(BlockIndexSnapshotPath());
+        // nothing of a failed snapshot read may leak into the scan
+        mapBlockIndex.Clear();
+        setStakeSeen.clear();
+        pindexGenesisBlock = NULL;
+        if (!ScanBlockIndex(load_msg))
+            return false;
+    }
+
+    boost::this_thread::interruption_point();
+    nStart = GetTimeMicros();
+
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
     {
@@ -799,7 +938,8 @@ bool CTxDB::LoadBlockIndex(LoadMsg load_msg)
         CPegDB pegdb;
         block.SetBestChain(txdb, pegdb, pindexFork);
     }
-    
+    AddStartupTime("block index: verify", GetTimeMicros() - nStart);
+
     return true;
 }
 
@@ -828,6 +968,26 @@ bool CTxDB::WriteUtxoDbIsReady(bool bReady)
     return Write(string("utxoDbIsReady"), bReady);
 }
 
+bool CTxDB::ReadUtxoDbProgress(int& nHeight, uint256& hashBlock)
+{
+    pair<int, uint256> progress;
+    if (!Read(string("utxoDbProgress"), progress))
+        return false;
+    nHeight = progress.first;
+    hashBlock = progress.second;
+    return true;
+}
+
+bool CTxDB::WriteUtxoDbProgress(int nHeight, uint256 hashBlock)
+{
+    return Write(string("utxoDbProgress"), make_pair(nHeight, hashBlock));
+}
+
+bool CTxDB::EraseUtxoDbProgress()
+{
+    return Erase(string("utxoDbProgress"));
+}
+
 bool CTxDB::ReadAddressLastBalance(string sAddress, CAddressBalance & balance, int64_t & nIdx)
 {
     nIdx = -1;
@@ -1152,6 +1312,108 @@ bool CTxDB::CleanupPegBalances(LoadMsg load_msg)
     return true;
 }
 
+// Block of the utxo index rebuild with the inputs of its txs and the
+// fractions of their inputs and outputs, read ahead of ConnectUtxo
+struct CUtxoLoadBlock {
+    CBlockIndex* pindex = nullptr;
+    CBlock block;
+    vector<MapPrevTx> vInputs;
+    vector<MapFractions> vInputsFractions;
+    vector<MapFractions> vOutputsFractions;
+};
+
+// Blocks taken by a round of the rebuild: read by the threads while the
+// blocks of the previous round are connected, committed in one batch
+static const size_t UTXO_LOAD_ROUND = 500;
+
+static bool ReadUtxoLoadBlock(CTxDB& txdb, CPegDB& pegdb, CUtxoLoadBlock& item)
+{
+    if (!item.block.ReadFromDisk(item.pindex, true))
+        return error("LoadUtxoData() : block ReadFromDisk failed");
+    size_t nTxs = item.block.vtx.size();
+    item.vInputs.resize(nTxs);
+    item.vInputsFractions.resize(nTxs);
+    item.vOutputsFractions.resize(nTxs);
+    for(size_t i=0; i < nTxs; i++)
+    {
+        const CTransaction& tx = item.block.vtx[i];
+        MapPrevTx& mapInputs = item.vInputs[i];
+        MapFractions& mapInputsFractions = item.vInputsFractions[i];
+        for(size_t j =0; j < tx.vin.size(); j++) {
+            if (tx.IsCoinBase()) continue;
+            const COutPoint & prevout = tx.vin[j].prevout;
+            if (prevout.hash == uint256(0)) continue;
+            if (!mapInputs.count(prevout.hash)) {
+                CTxIndex& prevtxindex = mapInputs[prevout.hash].first;
+                if (!txdb.ReadTxIndex(prevout.hash, prevtxindex))
+                    return error("LoadUtxoData() : ReadTxIndex failed");
+                CTransaction& prev = mapInputs[prevout.hash].second;
+                if (!prev.ReadFromDisk(prevtxindex.pos))
+                    return error("LoadUtxoData() : ReadDiskTx failed");
+            }
+            // Read input fractions
+            auto txoutid = uint320(prevout.hash, prevout.n);
+            CFractions& fractions = mapInputsFractions[txoutid];
+            fractions = CFractions(0, CFractions::VALUE);
+            if (!pegdb.ReadFractions(txoutid, fractions, true)) { // must_have
+                mapInputsFractions.erase(txoutid);
+            }
+        }
+        MapFractions& mapOutputsFractions = item.vOutputsFractions[i];
+        uint256 txhash = tx.GetHash();
+        for(size_t j =0; j < tx.vout.size(); j++) {
+            // Read output fractions
+            auto txoutid = uint320(txhash, j);
+            CFractions& fractions = mapOutputsFractions[txoutid];
+            fractions = CFractions(0, CFractions::VALUE);
+            if (!pegdb.ReadFractions(txoutid, fractions, true)) { // must_have
+                mapOutputsFractions.erase(txoutid);
+            }
+        }
+    }
+    return true;
+}
+
+static void TakeUtxoLoadRound(CBlockIndex*& pindex, vector<CUtxoLoadBlock>& vItems)
+{
+    vItems.clear();
+    vItems.reserve(UTXO_LOAD_ROUND);
+    for (; pindex && vItems.size() < UTXO_LOAD_ROUND; pindex = pindex->pnext) {
+        vItems.emplace_back();
+        vItems.back().pindex = pindex;
+    }
+}
+
+// The threads take the blocks of the round in turn
+static void ReadUtxoLoadRound(vector<CUtxoLoadBlock>& vItems, int nThreads,
+                              boost::thread_group& threadGroup, std::atomic<bool>& fFailed)
+{
+    if (vItems.empty())
+        return;
+    auto pnNext = std::make_shared<std::atomic<size_t> >(0);
+    for (int i=0; i<nThreads; i++) {
+        threadGroup.create_thread([&vItems, &fFailed, pnNext] {
+            CTxDB txdb("r");
+            CPegDB pegdb("r");
+            try {
+                size_t n;
+                while (!fFailed && (n = (*pnNext)++) < vItems.size()) {
+                    boost::this_thread::interruption_point();
+                    if (!ReadUtxoLoadBlock(txdb, pegdb, vItems[n]))
+                        fFailed = true;
+                }
+            }
+            catch (boost::thread_interrupted&) {
+                fFailed = true;
+            }
+            catch (std::exception& e) {
+                LogPrintf("LoadUtxoData() : %s\n", e.what());
+                fFailed = true;
+            }
+        });
+    }
+}
+
 bool CTxDB::LoadUtxoData(LoadMsg load_msg)
 {
     bool fIsReady = false;
@@ -1168,65 +1430,89 @@ bool CTxDB::LoadUtxoData(LoadMsg load_msg)
     setSkipAddresses.insert(Params().PegDeflateAddr());
     setSkipAddresses.insert(Params().PegNochangeAddr());
     
+    int nProgressHeight = -1;
+    uint256 hashProgress;
+    bool fProgress = ReadUtxoDbProgress(nProgressHeight, hashProgress);
+
     if (!fIsReady && fEnabled) {
-        // remove all first
-        CleanupUtxoData(load_msg);
+        // The index is built block by block in rounds: the blocks, the
+        // inputs and the fractions of a round are read by the threads
+        // while the previous round is connected in chain order. Each
+        // round is committed with the block reached, the rebuild resumes
+        // after it if the block is still in the main chain.
+        CBlockIndex* pindexRead = pindexGenesisBlock;
+        if (fProgress && mapBlockIndex.count(hashProgress) &&
+            mapBlockIndex.ref(hashProgress)->IsInMainChain()) {
+            pindexRead = mapBlockIndex.ref(hashProgress)->pnext;
+            LogPrintf("LoadUtxoData() : resuming at height %d\n", nProgressHeight+1);
+        }
+        else {
+            // remove all first
+            CleanupUtxoData(load_msg);
+        }
         // pegdb is ready
         CPegDB pegdb("r");
         // over all blocks
         
-        CBlockIndex* pindex = pindexGenesisBlock;
-        while (pindex)
-        {
-            if (pindex->nHeight % 1000 == 0) {
-                load_msg(std::string(" balances changes: ")+std::to_string(pindex->nHeight));
-            }
-            CBlock block;
-            if (!block.ReadFromDisk(pindex, true)) 
-                return error("LoadUtxoData() : block ReadFromDisk failed");
-            
-            // fill address map
-            for(size_t i=0; i < block.vtx.size(); i++)
-            {
-                const CTransaction& tx = block.vtx[i];
-                MapPrevTx mapInputs;
-                MapFractions mapInputsFractions;
-                for(size_t j =0; j < tx.vin.size(); j++) {
-                    if (tx.IsCoinBase()) continue;
-                    const COutPoint & prevout = tx.vin[j].prevout;
-                    if (prevout.hash == uint256(0)) continue;
-                    CTxIndex& prevtxindex = mapInputs[prevout.hash].first;
-                    if (!ReadTxIndex(prevout.hash, prevtxindex))
-                        return error("LoadUtxoData() : ReadTxIndex failed");
-                    CTransaction& prev = mapInputs[prevout.hash].second;
-                    if(!ReadDiskTx(prevout.hash, prev))
-                        return error("LoadUtxoData() : ReadDiskTx failed");
-                    // Read input fractions
-                    auto txoutid = uint320(prevout.hash, prevout.n);
-                    CFractions& fractions = mapInputsFractions[txoutid];
-                    fractions = CFractions(0, CFractions::VALUE);
-                    if (!pegdb.ReadFractions(txoutid, fractions, true)) { // must_have
-                        mapInputsFractions.erase(txoutid);
-                    }
+        int nThreads = LoadThreads();
+        std::atomic<bool> fFailed(false);
+        vector<CUtxoLoadBlock> vCurrent, vNext;
+        std::unique_ptr<boost::thread_group> pReaders(new boost::thread_group);
+        TakeUtxoLoadRound(pindexRead, vNext);
+        ReadUtxoLoadRound(vNext, nThreads, *pReaders, fFailed);
+
+        auto connect = [&](vector<CUtxoLoadBlock>& vItems) {
+            if (!TxnBegin())
+                return error("LoadUtxoData() : TxnBegin failed");
+            for (CUtxoLoadBlock& item : vItems) {
+                boost::this_thread::interruption_point();
+                CBlockIndex* pindex = item.pindex;
+                if (pindex->nHeight % 1000 == 0) {
+                    load_msg(std::string(" balances changes: ")+std::to_string(pindex->nHeight));
                 }
-                MapFractions mapOutputsFractions;
-                for(size_t j =0; j < tx.vout.size(); j++) {
-                    // Read output fractions
-                    auto txoutid = uint320(tx.GetHash(), j);
-                    CFractions& fractions = mapOutputsFractions[txoutid];
-                    fractions = CFractions(0, CFractions::VALUE);
-                    if (!pegdb.ReadFractions(txoutid, fractions, true)) { // must_have
-                        mapOutputsFractions.erase(txoutid);
-                    }
+                // fill address map
+                for(size_t i=0; i < item.block.vtx.size(); i++)
+                {
+                    if (!item.block.vtx[i].ConnectUtxo(*this, pindex, i, item.vInputs[i],
+                                                       item.vInputsFractions[i],
+                                                       item.vOutputsFractions[i]))
+                        return error("LoadUtxoData() : tx.ConnectUtxo failed");
+                }
+                MapFractions mapFractionsEmpty; // empty as all is in pegdb already
+                if (!item.block.ProcessFrozenQueue(*this, pegdb, mapFractionsEmpty, pindex, true /*fLoading*/))
+                    return error("LoadUtxoData() : ConnectFrozenQueue failed");
+            }
+            const CBlockIndex* pindexLast = vItems.back().pindex;
+            if (!WriteUtxoDbProgress(pindexLast->nHeight, pindexLast->GetBlockHash()))
+                return error("LoadUtxoData() : progress write failed");
+            if (!TxnCommit())
+                return error("LoadUtxoData() : TxnCommit failed");
+            return true;
+        };
+
+        try {
+            while (!vNext.empty()) {
+                pReaders->join_all();
+                if (fFailed)
+                    return error("LoadUtxoData() : reading of blocks failed");
+                vCurrent.swap(vNext);
+                TakeUtxoLoadRound(pindexRead, vNext);
+                pReaders.reset(new boost::thread_group);
+                ReadUtxoLoadRound(vNext, nThreads, *pReaders, fFailed);
+                if (!connect(vCurrent)) {
+                    TxnAbort();
+                    fFailed = true;
+                    pReaders->join_all();
+                    return false;
                 }
-                if (!tx.ConnectUtxo(*this, pindex, i, mapInputs, mapInputsFractions, mapOutputsFractions))
-                    return error("LoadUtxoData() : tx.ConnectUtxo failed");
             }
-            MapFractions mapFractionsEmpty; // empty as all is in pegdb already
-            if (!block.ProcessFrozenQueue(*this, pegdb, mapFractionsEmpty, pindex, true /*fLoading*/))
-                return error("LoadUtxoData() : ConnectFrozenQueue failed");
-            
-            pindex = pindex->pnext;
+        }
+        catch (...) {
+            TxnAbort();
+            fFailed = true;
+            pReaders->interrupt_all();
+            pReaders->join_all();
+            throw;
         }
         
         // when it is ready we recalc pegbalances as if prune enabled
@@ -1333,6 +1619,7 @@ bool CTxDB::LoadUtxoData(LoadMsg load_msg)
         
         // utxo db is ready for use
         WriteUtxoDbIsReady(true);
+        EraseUtxoDbProgress();
     }
     
     if (fIsReady && !fEnabled) {
@@ -1340,6 +1627,12 @@ bool CTxDB::LoadUtxoData(LoadMsg load_msg)
         // turn off as ready, new blocks are not processed
         WriteUtxoDbIsReady(false);
     }
+
+    if (!fIsReady && !fEnabled && fProgress) {
+        // rebuild was interrupted and is not wanted anymore
+        CleanupUtxoData(load_msg);
+        EraseUtxoDbProgress();
+    }
     
     return true;
 }
@@ -1359,7 +1652,7 @@ bool CTxDB::DeductSpent(std::string sAddress, const CFractions & fractions, bool
         base -= fractions;
     }
     CDataStream fout(SER_DISK, CLIENT_VERSION);
-    base.Pack(fout, nullptr, false /*compress*/);
+    base.Pack(fout, nullptr, CFractions::SER_RAW);
     return Write("pegbalance"+sAddress, fout);
 }
 
@@ -1378,7 +1671,7 @@ bool CTxDB::AppendUnspent(std::string sAddress, const CFractions & fractions, bo
         base += fractions;
     }
     CDataStream fout(SER_DISK, CLIENT_VERSION);
-    base.Pack(fout, nullptr, false /*compress*/);
+    base.Pack(fout, nullptr, CFractions::SER_RAW);
     return Write("pegbalance"+sAddress, fout);
 }
 
@@ -8,6 +8,8 @@
 #define BITCOIN_LEVELDB_H
 
 #include "main.h"
+#include "dbbatch.h"
+#include "dboptions.h"
 
 #include <map>
 #include <string>
@@ -41,39 +43,37 @@ public:
     // Destroys the underlying shared global state accessed by this TxDB.
     void Close();
 
-    struct cmpBySlice {
-        bool operator()(const std::string& a, const std::string& b) const {
-            leveldb::Slice sa(a);
-            leveldb::Slice sb(b);
-            int cmp = sa.compare(sb);
-            return cmp < 0;
-        }
-    };
+    typedef CDBBatch::cmpBySlice cmpBySlice;
     
 private:
     leveldb::DB *pdb;  // Points to the global instance.
 
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    CDBBatch *activeBatch;
+    // Empty batch on the write buffer, for the reads made outside of
+    // a transaction while the write buffer is enabled
+    CDBBatch bufferView;
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
 
 protected:
-    
+
+    // Pending changes to look at before disk: an open transaction, or
+    // commits kept by the write buffer
+    bool HasBatch() const { return activeBatch || WriteBuffer().IsEnabled(); }
+    const CDBBatch* ReadBatch() const { return activeBatch ? activeBatch : &bufferView; }
+
     // Returns true and sets (value,false) if activeBatch contains the given key
     // or leaves value alone and sets deleted = true if activeBatch contains a
     // delete for it.
     bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
     bool SeekBatch(const CDataStream &fromkey, 
-                   std::string *key, std::string *value, 
-                   std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap,
-                   std::set<std::string> *erased) const;
+                   std::string *key, std::string *value) const;
     bool SeekBatch(const CDataStream &fromkey, 
                    const CDataStream &tokey, 
-                   std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap,
-                   std::set<std::string> *erased) const;
+                   std::map<std::string,std::string, CTxDB::cmpBySlice> *seekmap) const;
 
     template<typename K>
     bool Seek(const K& fromkey, std::string & rawkey, std::string & rawvalue)
@@ -85,12 +85,10 @@ protected:
         std::string strBKey;
         std::string strBValue;
         bool foundInBatch = false;
-        std::set<std::string> erasedKeys;
-        std::map<std::string,std::string, CTxDB::cmpBySlice> seekmap;
         // First we must search for it in the currently pending set of
         // changes to the db. Then go on to read disk and compare which is to use.
-        if (activeBatch) {
-            foundInBatch = SeekBatch(ssFromKey, &strBKey, &strBValue, &seekmap, &erasedKeys);
+        if (HasBatch()) {
+            foundInBatch = SeekBatch(ssFromKey, &strBKey, &strBValue);
         }
 
         std::string strDKey;
@@ -107,7 +105,7 @@ protected:
         while(iterator->Valid()) {
             strDKey = iterator->key().ToString();
             strDValue = iterator->value().ToString();
-            if (!erasedKeys.count(strDKey)) {
+            if (!HasBatch() || !ReadBatch()->IsDeleted(strDKey)) {
                 foundOnDisk = true;
                 break;
             }
@@ -161,12 +159,11 @@ protected:
         };
         
         bool foundInBatch = false;
-        std::set<std::string> erasedKeys;
         std::map<std::string,std::string, CTxDB::cmpBySlice> seekmap;
         // First we must search for it in the currently pending set of
         // changes to the db. Then go on to read disk and compare which is to use.
-        if (activeBatch) {
-            foundInBatch = SeekBatch(ssFromKey, ssToKey, &seekmap, &erasedKeys);
+        if (HasBatch()) {
+            foundInBatch = SeekBatch(ssFromKey, ssToKey, &seekmap);
         }
         
         leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
@@ -180,7 +177,7 @@ protected:
         // to merge with batch
         while(iterator->Valid()) {
             string strDKey = iterator->key().ToString();
-            if (erasedKeys.count(strDKey)) {
+            if (HasBatch() && ReadBatch()->IsDeleted(strDKey)) {
                 iterator->Next();
                 continue;
             }
@@ -231,7 +228,7 @@ protected:
         std::string strValue;
 
         bool readFromDb = true;
-        if (activeBatch) {
+        if (HasBatch()) {
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
@@ -270,7 +267,7 @@ protected:
         ssKey << key;
 
         bool readFromDb = true;
-        if (activeBatch) {
+        if (HasBatch()) {
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
@@ -310,6 +307,8 @@ protected:
             activeBatch->Put(ssKey.str(), ssValue.str());
             return true;
         }
+        if (WriteBuffer().Put(ssKey.str(), ssValue.str()))
+            return true;
         leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
         if (!status.ok()) {
             LogPrintf("LevelDB write failure: %s\n", status.ToString());
@@ -333,6 +332,8 @@ protected:
             activeBatch->Delete(ssKey.str());
             return true;
         }
+        if (WriteBuffer().Delete(ssKey.str()))
+            return true;
         leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
         return (status.ok() || status.IsNotFound());
     }
@@ -345,11 +346,10 @@ protected:
         ssKey << key;
         std::string unused;
 
-        if (activeBatch) {
+        if (HasBatch()) {
             bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
-            }
+            if (ScanBatch(ssKey, &unused, &deleted))
+                return !deleted;
         }
 
 
@@ -368,6 +368,14 @@ public:
         return true;
     }
 
+    // Commits kept in memory while the write buffer is enabled, written
+    // in one leveldb write by FlushWriteBuffer, see CDBWriteBuffer
+    static CDBWriteBuffer& WriteBuffer();
+    static bool FlushWriteBuffer(bool fDisable);
+
+    // LevelDB statistics and options of the database, false if not open
+    static bool GetDBStats(CDBStats& stats);
+
     bool ReadVersion(int& nVersion)
     {
         nVersion = 0;
@@ -396,6 +404,7 @@ public:
     bool ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust);
     bool WriteBestInvalidTrust(CBigNum bnBestInvalidTrust);
     bool LoadBlockIndex(LoadMsg load_msg);
+    bool ScanBlockIndex(LoadMsg load_msg);
     bool LoadUtxoData(LoadMsg load_msg);
     bool CleanupUtxoData(LoadMsg load_msg);
     bool CleanupPegBalances(LoadMsg load_msg);
@@ -406,6 +415,9 @@ public:
 
     bool ReadTxIndexIsV1Ready(bool& bReady);
     bool WriteTxIndexIsV1Ready(bool bReady);
+    bool ReadTxIndexV1Height(int& nHeight);     // progress of the upgrade
+    bool WriteTxIndexV1Height(int nHeight);
+    bool EraseTxIndexV1Height();
     
     bool ReadBlockIndexIsPegReady(bool& bReady);
     bool WriteBlockIndexIsPegReady(bool bReady);
@@ -418,6 +430,10 @@ public:
 
     bool ReadUtxoDbIsReady(bool& bReady);
     bool WriteUtxoDbIsReady(bool bReady);
+    // last block of an unfinished rebuild of the utxo index
+    bool ReadUtxoDbProgress(int& nHeight, uint256& hashBlock);
+    bool WriteUtxoDbProgress(int nHeight, uint256 hashBlock);
+    bool EraseUtxoDbProgress();
 
     bool ReadUtxoDbEnabled(bool& fEnabled);
     bool WriteUtxoDbEnabled(bool fEnabled);
@@ -472,11 +488,11 @@ public:
     bool AppendUnspent(std::string sAddress, const CFractions & fractions, bool peg_on);
     bool ReadPegBalance(std::string sAddress, CFractions & fractions);
     
-    // warning: this method use disk Seek and ignores current batch
+    // warning: this method use disk Seek and ignores current batch and write buffer
     bool ReadAddressBalanceRecords(string addr, vector<CAddressBalance> & records);
-    // warning: this method use disk Seek and ignores current batch
+    // warning: this method use disk Seek and ignores current batch and write buffer
     bool ReadAddressUnspent(string addr, vector<CAddressUnspent> & records);
-    // warning: this method use disk Seek and ignores current batch
+    // warning: this method use disk Seek and ignores current batch and write buffer
     bool ReadAddressFrozen(string addr, vector<CAddressUnspent> & records);
     
 };
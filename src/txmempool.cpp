@@ -7,10 +7,146 @@
 #include "txmempool.h"
 #include "txdb.h"
 #include "main.h" // for CTransaction
+#include "pegalloc.h"
+
+#include <atomic>
+
+#include <boost/thread.hpp>
 
 using namespace std;
 
+// approximate bookkeeping per entry: map node, list node, key copies
+static const size_t nEntryOverhead = sizeof(CFractions) + sizeof(string) + 3*sizeof(uint320) + 96;
+
+CTxMemPoolFractions::CTxMemPoolFractions(size_t nMaxBytesIn)
+    :nMaxBytes(nMaxBytesIn)
+{
+}
+
+void CTxMemPoolFractions::Release(Entry& entry)
+{
+    if (entry.fDecoded) {
+        lru.erase(entry.lru);
+        nDecodedBytes -= std::min(entry.nBytes, nDecodedBytes);
+    }
+    else {
+        nPackedBytes -= std::min(entry.nBytes, nPackedBytes);
+    }
+    entry.fractions = CFractions();
+    entry.strPacked.clear();
+    entry.fDecoded = false;
+    entry.nBytes = 0;
+}
+
+void CTxMemPoolFractions::Decoded(Entries::iterator it, const CFractions& f)
+{
+    Entry& entry = it->second;
+    Release(entry);
+    // the kept copy must not share an arena buffer
+    CFractionsArena::Pause pause;
+    entry.fractions = f;
+    entry.fractions.nVersion = f.nVersion;
+    entry.fractions.Compact();
+    entry.fDecoded = true;
+    entry.nBytes = entry.fractions.MemoryUsage() + nEntryOverhead;
+    lru.push_front(it->first);
+    entry.lru = lru.begin();
+    nDecodedBytes += entry.nBytes;
+}
+
+void CTxMemPoolFractions::Packed(Entries::iterator it, const CFractions& f)
+{
+    Entry& entry = it->second;
+    Release(entry);
+    CDataStream fout(SER_DISK, CLIENT_VERSION);
+    f.Pack(fout, nullptr, CFractions::SER_VDELTA);
+    entry.strPacked = fout.str();
+    entry.nBytes = entry.strPacked.capacity() + nEntryOverhead;
+    nPackedBytes += entry.nBytes;
+}
+
+void CTxMemPoolFractions::Spill()
+{
+    while (nDecodedBytes > nMaxBytes && !lru.empty()) {
+        Entries::iterator it = mapEntries.find(lru.back());
+        CFractions f = it->second.fractions;
+        f.nVersion = it->second.fractions.nVersion;
+        Packed(it, f);
+        nSpills++;
+    }
+}
+
+void CTxMemPoolFractions::Set(const uint320& key, const CFractions& f)
+{
+    Entries::iterator it = mapEntries.insert(make_pair(key, Entry())).first;
+    Decoded(it, f);
+    Spill();
+}
+
+bool CTxMemPoolFractions::Get(const uint320& key, int64_t nValue, CFractions& f)
+{
+    Entries::iterator it = mapEntries.find(key);
+    if (it == mapEntries.end())
+        return false;
+    Entry& entry = it->second;
+    if (entry.fDecoded) {
+        lru.splice(lru.begin(), lru, entry.lru);
+        f = entry.fractions;
+        f.nVersion = entry.fractions.nVersion;
+        nHits++;
+        return true;
+    }
+    f = CFractions(nValue, CFractions::STD);
+    CDataStream finp(entry.strPacked.data(), entry.strPacked.data() + entry.strPacked.size(),
+                     SER_DISK, CLIENT_VERSION);
+    f.Unpack(finp);
+    nUnpacks++;
+    if (nMaxBytes > 0) {
+        Decoded(it, f);
+        Spill();
+    }
+    return true;
+}
+
+void CTxMemPoolFractions::Erase(const uint320& key)
+{
+    Entries::iterator it = mapEntries.find(key);
+    if (it == mapEntries.end())
+        return;
+    Release(it->second);
+    mapEntries.erase(it);
+}
+
+void CTxMemPoolFractions::Clear()
+{
+    mapEntries.clear();
+    lru.clear();
+    nDecodedBytes = 0;
+    nPackedBytes = 0;
+}
+
+void CTxMemPoolFractions::SetMaxBytes(size_t nMaxBytesIn)
+{
+    nMaxBytes = nMaxBytesIn;
+    Spill();
+}
+
+CTxMemPoolFractions::Stats CTxMemPoolFractions::GetStats() const
+{
+    Stats stats;
+    stats.nEntries      = mapEntries.size();
+    stats.nDecoded      = lru.size();
+    stats.nDecodedBytes = nDecodedBytes;
+    stats.nPackedBytes  = nPackedBytes;
+    stats.nMaxBytes     = nMaxBytes;
+    stats.nHits         = nHits;
+    stats.nUnpacks      = nUnpacks;
+    stats.nSpills       = nSpills;
+    return stats;
+}
+
 CTxMemPool::CTxMemPool()
+    :mapFractions(size_t(DEFAULT_MEMPOOL_FRACTIONS) << 20)
 {
 }
 
@@ -26,27 +162,203 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+void CTxMemPool::SetFractionsMaxBytes(size_t nMaxBytes)
+{
+    LOCK(cs);
+    mapFractions.SetMaxBytes(nMaxBytes);
+}
+
+CTxMemPoolFractions::Stats CTxMemPool::GetFractionsStats() const
+{
+    LOCK(cs);
+    return mapFractions.GetStats();
+}
+
+CTxMemPoolReviewStats CTxMemPool::GetReviewStats() const
+{
+    LOCK(cs);
+    return reviewStats;
+}
+
+void CTxMemPool::Index(const uint256& hash)
+{
+    const CTxMemPoolRank& rank = mapRanks[hash];
+    setByPriority.insert(make_pair(rank.dPriority, hash));
+    setByFeeRate.insert(make_pair(rank.GetAncestorsFeePerKb(), hash));
+}
+
+void CTxMemPool::Unindex(const uint256& hash)
+{
+    std::map<uint256, CTxMemPoolRank>::const_iterator it = mapRanks.find(hash);
+    if (it == mapRanks.end())
+        return;
+    setByPriority.erase(make_pair(it->second.dPriority, hash));
+    setByFeeRate.erase(make_pair(it->second.GetAncestorsFeePerKb(), hash));
+}
+
+void CTxMemPool::CalculateAncestors(const uint256& hash, set<uint256>& setAncestors) const
+{
+    vector<uint256> vWalk(1, hash);
+    while (!vWalk.empty()) {
+        uint256 hashWalk = vWalk.back();
+        vWalk.pop_back();
+        std::map<uint256, CTxMemPoolLinks>::const_iterator it = mapLinks.find(hashWalk);
+        if (it == mapLinks.end())
+            continue;
+        for (const uint256& hashParent : it->second.setParents) {
+            if (setAncestors.insert(hashParent).second)
+                vWalk.push_back(hashParent);
+        }
+    }
+}
+
+// Package totals are summed over the mempool ancestors of the tx. A tx is
+// an ancestor once even if it is reached by several paths.
+void CTxMemPool::UpdateAncestors(const uint256& hash)
+{
+    set<uint256> setAncestors;
+    CalculateAncestors(hash, setAncestors);
+    Unindex(hash);
+    CTxMemPoolRank& rank = mapRanks[hash];
+    rank.nAncestors = 1;
+    rank.nAncestorsSize = rank.nTxSize;
+    rank.nAncestorsFee = rank.nFee;
+    for (const uint256& hashAncestor : setAncestors) {
+        const CTxMemPoolRank& rankAncestor = mapRanks[hashAncestor];
+        rank.nAncestors++;
+        rank.nAncestorsSize += rankAncestor.nTxSize;
+        rank.nAncestorsFee += rankAncestor.nFee;
+    }
+    Index(hash);
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, set<uint256>& setDescendants) const
+{
+    vector<uint256> vWalk(1, hash);
+    while (!vWalk.empty()) {
+        uint256 hashWalk = vWalk.back();
+        vWalk.pop_back();
+        std::map<uint256, CTxMemPoolLinks>::const_iterator it = mapLinks.find(hashWalk);
+        if (it == mapLinks.end())
+            continue;
+        for (const uint256& hashChild : it->second.setChildren) {
+            if (setDescendants.insert(hashChild).second)
+                vWalk.push_back(hashChild);
+        }
+    }
+}
+
+// The tx with its mempool ancestors, and each ancestor with its descendants
+// and the tx, are within the limits. The txs of the mempool are added under
+// the limits, so the walks are bounded by them.
+bool CTxMemPool::CheckChainLimits(const CTransaction& tx,
+                                  uint64_t nAncestorLimit,
+                                  uint64_t nDescendantLimit,
+                                  string& reason) const
+{
+    LOCK(cs);
+    set<uint256> setAncestors;
+    for (const CTxIn& txin : tx.vin) {
+        if (!mapLinks.count(txin.prevout.hash))
+            continue;
+        if (setAncestors.insert(txin.prevout.hash).second)
+            CalculateAncestors(txin.prevout.hash, setAncestors);
+    }
+    if (setAncestors.size() + 1 > nAncestorLimit) {
+        reason = strprintf("too many unconfirmed ancestors [limit: %u]", nAncestorLimit);
+        return false;
+    }
+    for (const uint256& hashAncestor : setAncestors) {
+        set<uint256> setDescendants;
+        CalculateDescendants(hashAncestor, setDescendants);
+        if (setDescendants.size() + 2 > nDescendantLimit) {
+            reason = strprintf("too many descendants for tx %s [limit: %u]", hashAncestor.ToString(), nDescendantLimit);
+            return false;
+        }
+    }
+    return true;
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, 
                               CTransaction &tx, 
                               const MapPrevOut& mapInputs,
-                              MapFractions& mapFractions)
+                              MapFractions& mapOutputsFractions,
+                              double dPriority)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
     {
+        Unindex(hash);
         mapTx[hash] = tx;
         mapPrevOuts[hash] = mapInputs;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+        // link to the mempool txs it spends
+        CTxMemPoolLinks& links = mapLinks[hash];
+        links.nPegSupplyIndex = pindexBest ? pindexBest->nPegSupplyIndex : 0;
+        for (const CTxIn& txin : tx.vin) {
+            std::map<uint256, CTxMemPoolLinks>::iterator it = mapLinks.find(txin.prevout.hash);
+            if (it == mapLinks.end() || txin.prevout.hash == hash)
+                continue;
+            links.setParents.insert(txin.prevout.hash);
+            it->second.setChildren.insert(hash);
+        }
+        // and to the ones spending it, when it is back from a disconnected block
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+            if (it == mapNextTx.end())
+                continue;
+            uint256 hashChild = it->second.ptx->GetHash();
+            links.setChildren.insert(hashChild);
+            mapLinks[hashChild].setParents.insert(hash);
+            CTxMemPoolRank& rankChild = mapRanks[hashChild];
+            Unindex(hashChild);
+            rankChild.nInChainValue = std::max(int64_t(0), rankChild.nInChainValue - tx.vout[i].nValue);
+            Index(hashChild);
+        }
+        // fee and priority for the block assembly
+        CTxMemPoolRank& rank = mapRanks[hash];
+        rank = CTxMemPoolRank();
+        rank.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        rank.dPriority = dPriority;
+        rank.nHeight = pindexBest ? pindexBest->nHeight : 0;
+        int64_t nValueIn = 0;
+        for (const CTxIn& txin : tx.vin) {
+            MapPrevOut::const_iterator it = mapInputs.find(uint320(txin.prevout.hash, txin.prevout.n));
+            if (it == mapInputs.end())
+                continue;
+            nValueIn += it->second.nValue;
+            if (!links.setParents.count(txin.prevout.hash))
+                rank.nInChainValue += it->second.nValue;
+        }
+        rank.nFee = nValueIn - tx.GetValueOut();
+        UpdateAncestors(hash);
+        // the descendants of a tx back from a disconnected block get it in
+        // their packages; with mempool parents too they are summed again as
+        // they may have some of its ancestors by other paths
+        if (!links.setChildren.empty()) {
+            set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            for (const uint256& hashDescendant : setDescendants) {
+                if (!links.setParents.empty()) {
+                    UpdateAncestors(hashDescendant);
+                    continue;
+                }
+                Unindex(hashDescendant);
+                CTxMemPoolRank& rankDescendant = mapRanks[hashDescendant];
+                rankDescendant.nAncestors++;
+                rankDescendant.nAncestorsSize += rank.nTxSize;
+                rankDescendant.nAncestorsFee += rank.nFee;
+                Index(hashDescendant);
+            }
+        }
         nTransactionsUpdated++;
         // store fractions
-        for (MapFractions::iterator mi = mapFractions.begin(); mi != mapFractions.end(); ++mi)
+        for (MapFractions::iterator mi = mapOutputsFractions.begin(); mi != mapOutputsFractions.end(); ++mi)
         {
-            CDataStream fout(SER_DISK, CLIENT_VERSION);
-            (*mi).second.Pack(fout);
-            mapPackedFractions[(*mi).first] = fout.str();
+            mapFractions.Set((*mi).first, (*mi).second);
         }
         mapPrevOuts[hash] = mapInputs;
     }
@@ -73,7 +385,50 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
             }
             for(size_t i=0; i<tx.vout.size(); i++) {
                 auto fkey = uint320(hash, i);
-                mapPackedFractions.erase(fkey);
+                mapFractions.Erase(fkey);
+            }
+            // the tx leaves the packages of its descendants, it is counted
+            // once in each of them
+            set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            std::map<uint256, CTxMemPoolRank>::const_iterator itRank = mapRanks.find(hash);
+            if (itRank != mapRanks.end()) {
+                const CTxMemPoolRank& rank = itRank->second;
+                for (const uint256& hashDescendant : setDescendants) {
+                    Unindex(hashDescendant);
+                    CTxMemPoolRank& rankDescendant = mapRanks[hashDescendant];
+                    rankDescendant.nAncestors--;
+                    rankDescendant.nAncestorsSize -= rank.nTxSize;
+                    rankDescendant.nAncestorsFee -= rank.nFee;
+                    Index(hashDescendant);
+                }
+            }
+            set<uint256> setChildren;
+            std::map<uint256, CTxMemPoolLinks>::iterator it = mapLinks.find(hash);
+            if (it != mapLinks.end()) {
+                for (const uint256& hashParent : it->second.setParents)
+                    mapLinks[hashParent].setChildren.erase(hash);
+                for (const uint256& hashChild : it->second.setChildren)
+                    mapLinks[hashChild].setParents.erase(hash);
+                setChildren.swap(it->second.setChildren);
+                mapLinks.erase(it);
+            }
+            Unindex(hash);
+            mapRanks.erase(hash);
+            // the outputs spent by the remaining children are confirmed
+            // with the tx, they age the priority from the next block
+            int nConfirmHeight = pindexBest ? pindexBest->nHeight + 1 : 0;
+            for (const uint256& hashChild : setChildren) {
+                CTxMemPoolRank& rankChild = mapRanks[hashChild];
+                Unindex(hashChild);
+                for (const CTxIn& txin : mapTx[hashChild].vin) {
+                    if (txin.prevout.hash != hash || txin.prevout.n >= tx.vout.size())
+                        continue;
+                    int64_t nValue = tx.vout[txin.prevout.n].nValue;
+                    rankChild.nInChainValue += nValue;
+                    rankChild.dPriority += double(nValue) * (1 + rankChild.nHeight - nConfirmHeight) / rankChild.nTxSize;
+                }
+                Index(hashChild);
             }
             mapTx.erase(hash);
             mapPrevOuts.erase(hash);
@@ -98,106 +453,281 @@ bool CTxMemPool::removeConflicts(const CTransaction &tx)
     return true;
 }
 
-void CTxMemPool::reviewOnPegChange()
+// The fractions of the outputs of tx may differ for the new supply index
+// if the fractions of its inputs have a part between the supply indexes,
+// or carry notary marks which are set with the time of the block
+bool NeedsPegReview(const CTransaction& tx,
+                    const MapFractions& mapGroupFractions,
+                    const PegReadFractions& readFractions,
+                    int nSupplyFrom,
+                    int nSupplyTo)
 {
-    LOCK(cs);
-    vector<uint256> vRemove;
-    
-    // build reverse map in->out to find roots
-    map<CInPoint, COutPoint> mapPrevTx;
-    for (map<uint256, CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi) {
-        CTransaction& tx = (*mi).second;
+    const uint32_t nNotary = CFractions::NOTARY_F | CFractions::NOTARY_V |
+                             CFractions::NOTARY_L | CFractions::NOTARY_C;
+    int nLow = std::min(nSupplyFrom, nSupplyTo);
+    int nHigh = std::max(nSupplyFrom, nSupplyTo);
+    uint256 hash = tx.GetHash();
+    for (size_t i=0; i<tx.vout.size(); i++) {
+        MapFractions::const_iterator it = mapGroupFractions.find(uint320(hash, i));
+        if (it != mapGroupFractions.end() && (it->second.nFlags & nNotary))
+            return true;
+    }
+    for (const CTxIn& txin : tx.vin) {
+        auto fkey = uint320(txin.prevout.hash, txin.prevout.n);
+        CFractions fractions(0, CFractions::VALUE);
+        MapFractions::const_iterator it = mapGroupFractions.find(fkey);
+        if (it != mapGroupFractions.end())
+            fractions = it->second;
+        else if (!readFractions(fkey, fractions))
+            return true;
+        if (fractions.nFlags & nNotary)
+            return true;
+        if (fractions.Low(nHigh) != fractions.Low(nLow))
+            return true;
+    }
+    return false;
+}
+
+void ReviewPegGroup(CPegReviewGroup& group,
+                    int nSupply,
+                    const PegReadFractions& readFractions,
+                    const PegRecheck& recheck)
+{
+    set<uint256> setRechecked;
+    set<uint256> setRemoved;
+    for (size_t n=0; n<group.vTxs.size(); n++) {
+        CTransaction& tx = group.vTxs[n];
         uint256 hash = tx.GetHash();
-        for (unsigned int i = 0; i < tx.vout.size(); i++) {
-            std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-            if (it != mapNextTx.end()) {
-                mapPrevTx[it->second] = COutPoint(hash, i);
-            }
+        group.mapTxs[hash] = &tx;
+
+        bool fParentRechecked = false;
+        bool fParentRemoved = false;
+        bool fParentUnreviewed = false;
+        for (const CTxIn& txin : tx.vin) {
+            fParentRechecked |= setRechecked.count(txin.prevout.hash) > 0;
+            fParentRemoved |= setRemoved.count(txin.prevout.hash) > 0;
+            fParentUnreviewed |= group.setUnreviewed.count(txin.prevout.hash) > 0;
         }
-    }
-    
-    // start peg checks from tx non-dependent on other tx
-    for (map<uint256, CTransaction>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi) {
-        CTransaction& tx = (*mi).second;
-        bool fDependent = false;
-        for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            std::map<CInPoint, COutPoint>::iterator it = mapPrevTx.find(CInPoint(&tx, i));
-            if (it != mapPrevTx.end()) {
-                fDependent = true;
-            }
+        if (fParentRemoved) {
+            // removed with the parent
+            setRemoved.insert(hash);
+            continue;
         }
-        if (!fDependent) {
-            reviewOnPegChange(tx, vRemove);
+        if (fParentUnreviewed) {
+            // the fractions of the parent are of the old supply index
+            group.setUnreviewed.insert(hash);
+            continue;
         }
+        if (!fParentRechecked &&
+            !NeedsPegReview(tx, group.mapGroupFractions, readFractions, group.vPegSupplyIndex[n], nSupply))
+            continue;
+
+        MapFractions mapOutputsFractions;
+        bool fInvalid = false;
+        if (!recheck(tx, group, mapOutputsFractions, fInvalid)) {
+            if (fInvalid) {
+                group.vRemove.push_back(hash);
+                setRemoved.insert(hash);
+            }
+            else group.setUnreviewed.insert(hash);
+            continue;
+        }
+        // overwrite fractions (changed due to new peg supply index)
+        for (MapFractions::iterator mi = mapOutputsFractions.begin(); mi != mapOutputsFractions.end(); ++mi)
+            group.mapGroupFractions[(*mi).first] = (*mi).second;
+        group.mapRechecked[hash] = std::move(mapOutputsFractions);
+        setRechecked.insert(hash);
     }
-    
-    // remove collected and all dependent
-    for(uint256 hash : vRemove) {
-        std::map<uint256, CTransaction>::const_iterator it = mapTx.find(hash);
-        if (it == mapTx.end()) continue;
-        const CTransaction& tx = (*it).second;
-        remove(tx, true /*recursive*/);
-    }
+    group.fReviewed = true;
 }
 
-void CTxMemPool::reviewOnPegChange(CTransaction& tx, 
-                                   vector<uint256>& vRemove)
+// Inputs from the txs of the group are given, others are fetched
+static bool RecheckPegTx(CTxDB& txdb,
+                         CPegDB& pegdb,
+                         int nSupply,
+                         unsigned int nTime,
+                         CTransaction& tx,
+                         const CPegReviewGroup& group,
+                         MapFractions& mapOutputsFractions,
+                         bool& fInvalid)
 {
-    uint256 hash = tx.GetHash();
-    
     MapPrevTx mapInputs;
     MapFractions mapInputsFractions;
+    for (const CTxIn& txin : tx.vin) {
+        map<uint256, const CTransaction*>::const_iterator it = group.mapTxs.find(txin.prevout.hash);
+        if (it == group.mapTxs.end() || mapInputs.count(txin.prevout.hash))
+            continue;
+        const CTransaction& txPrev = *it->second;
+        mapInputs[txin.prevout.hash].second = txPrev;
+        mapInputs[txin.prevout.hash].first.vSpent.resize(txPrev.vout.size());
+        for (size_t i=0; i<txPrev.vout.size(); i++) {
+            auto fkey = uint320(txin.prevout.hash, i);
+            MapFractions::const_iterator fi = group.mapGroupFractions.find(fkey);
+            if (fi != group.mapGroupFractions.end())
+                mapInputsFractions[fkey] = fi->second;
+        }
+    }
     map<uint256, CTxIndex> mapUnused;
-    MapFractions mapOutputsFractions;
+    fInvalid = false;
+    if (!tx.FetchInputs(txdb, pegdb,
+                        mapUnused, mapOutputsFractions,
+                        false /*block*/, false /*miner*/,
+                        mapInputs, mapInputsFractions,
+                        fInvalid))
+        return false;
+
     CFractions feesFractions;
-    
-    {
-        CTxDB txdb("r");
-        CPegDB pegdb("r");
+    string sPegFailCause;
+    bool peg_ok = CalculateStandardFractions(tx,
+                                             nSupply,
+                                             nTime,
+                                             mapInputs, mapInputsFractions,
+                                             mapOutputsFractions,
+                                             feesFractions,
+                                             sPegFailCause);
+    if (!peg_ok) {
+        fInvalid = true;
+        return false;
+    }
+    return true;
+}
 
-        bool fInvalid = false;
-        if (!tx.FetchInputs(txdb, pegdb, 
-                            mapUnused, mapOutputsFractions, 
-                            false /*block*/, false /*miner*/, 
-                            mapInputs, mapInputsFractions, 
-                            fInvalid))
-        {
-            if (fInvalid) {
-                vRemove.push_back(hash);
-                return;
+// Only the txs which inputs have fractions crossing the change of the peg
+// supply index are rechecked, with their descendants. The connected groups
+// of txs are independent and are given to threads. The groups are copied
+// from the mempool and checked without its lock: the inputs from the
+// mempool are passed with the group, and the results are applied to the
+// txs still in the mempool.
+void CTxMemPool::reviewOnPegChange()
+{
+    int64_t nStart = GetTimeMicros();
+    int nSupply = pindexBest->nPegSupplyIndex;
+    unsigned int nTime = pindexBest->nTime;
+
+    // connected groups, each in the order of spending: parents first
+    vector<CPegReviewGroup> vGroups;
+    uint64_t nTxs = 0;
+    {
+        LOCK(cs);
+        nTxs = mapTx.size();
+        map<uint256, int> mapGroupOf;
+        map<uint256, size_t> mapParentsLeft;
+        for (map<uint256, CTxMemPoolLinks>::iterator mi = mapLinks.begin(); mi != mapLinks.end(); ++mi) {
+            if (mapGroupOf.count((*mi).first))
+                continue;
+            int nGroup = vGroups.size();
+            vGroups.emplace_back();
+            vector<uint256> vConnected(1, (*mi).first);
+            mapGroupOf[(*mi).first] = nGroup;
+            for (size_t i=0; i<vConnected.size(); i++) {
+                const CTxMemPoolLinks& links = mapLinks[vConnected[i]];
+                for (const set<uint256>* pset : {&links.setParents, &links.setChildren}) {
+                    for (const uint256& hashLinked : *pset) {
+                        if (mapGroupOf.insert(make_pair(hashLinked, nGroup)).second)
+                            vConnected.push_back(hashLinked);
+                    }
+                }
             }
-        }
-    
-        string sPegFailCause;
-        bool peg_ok = CalculateStandardFractions(tx, 
-                                                 pindexBest->nPegSupplyIndex,
-                                                 pindexBest->nTime,
-                                                 mapInputs, mapInputsFractions,
-                                                 mapOutputsFractions,
-                                                 feesFractions,
-                                                 sPegFailCause);
-        if (!peg_ok) {
-            vRemove.push_back(hash);
-            return;
-        }
-        
-        if (peg_ok) {
-            // overwrite fractions (changed due to new peg supply index)
-            for (MapFractions::iterator mi = mapOutputsFractions.begin(); mi != mapOutputsFractions.end(); ++mi)
-            {
-                CDataStream fout(SER_DISK, CLIENT_VERSION);
-                (*mi).second.Pack(fout);
-                mapPackedFractions[(*mi).first] = fout.str();
+            CPegReviewGroup& group = vGroups.back();
+            vector<uint256> vReady;
+            for (const uint256& hash : vConnected) {
+                mapParentsLeft[hash] = mapLinks[hash].setParents.size();
+                if (mapParentsLeft[hash] == 0)
+                    vReady.push_back(hash);
             }
-            // check dependent transactions
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                if (it != mapNextTx.end()) {
-                    reviewOnPegChange(*it->second.ptx, vRemove);
+            for (size_t i=0; i<vReady.size(); i++) {
+                const uint256& hash = vReady[i];
+                const CTransaction& tx = mapTx[hash];
+                group.vTxs.push_back(tx);
+                group.vPegSupplyIndex.push_back(mapLinks[hash].nPegSupplyIndex);
+                for (size_t n=0; n<tx.vout.size(); n++) {
+                    CFractions& fractions = group.mapGroupFractions[uint320(hash, n)];
+                    if (!mapFractions.Get(uint320(hash, n), tx.vout[n].nValue, fractions))
+                        group.mapGroupFractions.erase(uint320(hash, n));
+                }
+                for (const uint256& hashChild : mapLinks[hash].setChildren) {
+                    if (--mapParentsLeft[hashChild] == 0)
+                        vReady.push_back(hashChild);
                 }
             }
         }
     }
+
+    int nThreads = std::max(1, std::min(int(vGroups.size()),
+                                        int(boost::thread::hardware_concurrency())));
+    std::atomic<size_t> nNext(0);
+    auto review = [&]() {
+        size_t n;
+        while ((n = nNext++) < vGroups.size()) {
+            try {
+                CTxDB txdb("r");
+                CPegDB pegdb("r");
+                PegReadFractions readFractions = [&](const uint320& fkey, CFractions& fractions) {
+                    return pegdb.ReadFractions(fkey, fractions, true /*must_have*/);
+                };
+                PegRecheck recheck = [&](CTransaction& tx, const CPegReviewGroup& group,
+                                         MapFractions& mapOutputsFractions, bool& fInvalid) {
+                    return RecheckPegTx(txdb, pegdb, nSupply, nTime, tx, group, mapOutputsFractions, fInvalid);
+                };
+                ReviewPegGroup(vGroups[n], nSupply, readFractions, recheck);
+            }
+            catch (std::exception& e) {
+                LogPrintf("reviewOnPegChange() : %s, %d txs of the group are removed\n",
+                          e.what(), vGroups[n].vTxs.size());
+            }
+        }
+    };
+    boost::thread_group threadGroup;
+    for (int i=1; i<nThreads; i++)
+        threadGroup.create_thread(review);
+    review();
+    threadGroup.join_all();
+
+    // store the new fractions, remove the failed txs and all dependent,
+    // the txs of a group which review did not finish are removed
+    LOCK(cs);
+    CTxMemPoolReviewStats stats;
+    stats.nHeight = pindexBest->nHeight;
+    stats.nPegSupplyIndex = nSupply;
+    stats.nTxs = nTxs;
+    stats.nGroups = vGroups.size();
+    vector<uint256> vRemove;
+    for (CPegReviewGroup& group : vGroups) {
+        if (!group.fReviewed) {
+            for (const CTransaction& tx : group.vTxs)
+                vRemove.push_back(tx.GetHash());
+            continue;
+        }
+        for (map<uint256, MapFractions>::iterator mi = group.mapRechecked.begin(); mi != group.mapRechecked.end(); ++mi) {
+            if (!mapTx.count((*mi).first))
+                continue;
+            for (MapFractions::iterator fi = (*mi).second.begin(); fi != (*mi).second.end(); ++fi)
+                mapFractions.Set((*fi).first, (*fi).second);
+            stats.nRechecked++;
+        }
+        vRemove.insert(vRemove.end(), group.vRemove.begin(), group.vRemove.end());
+        for (const CTransaction& tx : group.vTxs) {
+            uint256 hash = tx.GetHash();
+            if (group.setUnreviewed.count(hash))
+                continue;
+            map<uint256, CTxMemPoolLinks>::iterator mi = mapLinks.find(hash);
+            if (mi != mapLinks.end())
+                (*mi).second.nPegSupplyIndex = nSupply;
+        }
+    }
+    for(uint256 hash : vRemove) {
+        std::map<uint256, CTransaction>::const_iterator it = mapTx.find(hash);
+        if (it == mapTx.end()) continue;
+        const CTransaction& tx = (*it).second;
+        size_t nBefore = mapTx.size();
+        remove(tx, true /*recursive*/);
+        stats.nRemoved += nBefore - mapTx.size();
+    }
+    stats.nMicros = GetTimeMicros() - nStart;
+    reviewStats = stats;
+    LogPrintf("reviewOnPegChange() : peg %d at height %d, %d txs in %d groups, %d rechecked, %d removed, %.2fms\n",
+              nSupply, stats.nHeight, stats.nTxs, stats.nGroups,
+              stats.nRechecked, stats.nRemoved, stats.nMicros * 0.001);
 }
 
 void CTxMemPool::clear()
@@ -206,6 +736,11 @@ void CTxMemPool::clear()
     mapTx.clear();
     mapPrevOuts.clear();
     mapNextTx.clear();
+    mapFractions.Clear();
+    mapLinks.clear();
+    mapRanks.clear();
+    setByPriority.clear();
+    setByFeeRate.clear();
     ++nTransactionsUpdated;
 }
 
@@ -219,7 +754,44 @@ void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
         vtxid.push_back((*mi).first);
 }
 
-bool CTxMemPool::lookup(uint256 hash, CTransaction& result, MapFractions& mapFractions) const
+// The tx with its mempool ancestors which are not in setIncluded, parents
+// first: an ancestor always has less ancestors than its descendants
+void CTxMemPool::queryPackage(const uint256& hash,
+                              const set<uint256>& setIncluded,
+                              vector<uint256>& vPackage) const
+{
+    vPackage.clear();
+
+    LOCK(cs);
+    if (!mapTx.count(hash))
+        return;
+    set<uint256> setPackage;
+    vector<uint256> vWalk(1, hash);
+    setPackage.insert(hash);
+    while (!vWalk.empty()) {
+        uint256 hashWalk = vWalk.back();
+        vWalk.pop_back();
+        std::map<uint256, CTxMemPoolLinks>::const_iterator it = mapLinks.find(hashWalk);
+        if (it == mapLinks.end())
+            continue;
+        for (const uint256& hashParent : it->second.setParents) {
+            if (setIncluded.count(hashParent))
+                continue;
+            if (setPackage.insert(hashParent).second)
+                vWalk.push_back(hashParent);
+        }
+    }
+    vector<pair<uint64_t, uint256> > vOrdered;
+    vOrdered.reserve(setPackage.size());
+    for (const uint256& hashPackage : setPackage)
+        vOrdered.push_back(make_pair(mapRanks.find(hashPackage)->second.nAncestors, hashPackage));
+    sort(vOrdered.begin(), vOrdered.end());
+    vPackage.reserve(vOrdered.size());
+    for (const pair<uint64_t, uint256>& item : vOrdered)
+        vPackage.push_back(item.second);
+}
+
+bool CTxMemPool::lookup(uint256 hash, CTransaction& result, MapFractions& mapResultFractions) const
 {
     LOCK(cs);
     std::map<uint256, CTransaction>::const_iterator it = mapTx.find(hash);
@@ -227,30 +799,21 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result, MapFractions& mapFra
     result = it->second;
     for(size_t i=0; i<result.vout.size(); i++) {
         auto fkey = uint320(hash, i);
-        if (!mapPackedFractions.count(fkey)) 
+        CFractions f;
+        if (!mapFractions.Get(fkey, result.vout[i].nValue, f))
             return false;
-        string strValue = mapPackedFractions.at(fkey);
-        CFractions f(result.vout[i].nValue, CFractions::STD);
-        CDataStream finp(strValue.data(), strValue.data() + strValue.size(),
-                         SER_DISK, CLIENT_VERSION);
-        f.Unpack(finp);
-        mapFractions[fkey] = f;
+        mapResultFractions[fkey] = f;
     }
     return true;
 }
 
 bool CTxMemPool::lookup(uint256 hash, size_t n, CFractions& f) const
 {
+    LOCK(cs);
     std::map<uint256, CTransaction>::const_iterator it = mapTx.find(hash);
     if (it == mapTx.end()) return false;
-    CTransaction result = it->second;
-    auto fkey = uint320(hash, n);
-    if (!mapPackedFractions.count(fkey)) 
+    if (n >= it->second.vout.size())
         return false;
-    string strValue = mapPackedFractions.at(fkey);
-    f = CFractions(result.vout[n].nValue, CFractions::STD);
-    CDataStream finp(strValue.data(), strValue.data() + strValue.size(),
-                     SER_DISK, CLIENT_VERSION);
-    f.Unpack(finp);
-    return true;
+    auto fkey = uint320(hash, n);
+    return mapFractions.Get(fkey, it->second.vout[n].nValue, f);
 }
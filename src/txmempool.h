@@ -9,6 +9,150 @@
 #include "sync.h"
 #include "peg.h"
 
+#include <functional>
+#include <list>
+#include <set>
+
+/** Default for -mempoolfractions, megabytes of decoded fractions of the mempool outputs */
+static const int DEFAULT_MEMPOOL_FRACTIONS = 32;
+/** Default for -limitancestorcount, max number of mempool ancestors of a tx, with itself */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitdescendantcount, max number of mempool descendants of a tx, with itself */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+
+/** Fractions of the mempool outputs. They are kept decoded and compacted
+ *  up to nMaxBytes, the least recently used ones over it are spilled to
+ *  the packed form and decoded again by the next lookup. Not locked, it
+ *  is used under CTxMemPool::cs.
+ */
+class CTxMemPoolFractions
+{
+public:
+    struct Stats {
+        uint64_t nEntries       = 0;
+        uint64_t nDecoded       = 0;
+        uint64_t nDecodedBytes  = 0;
+        uint64_t nPackedBytes   = 0;
+        uint64_t nMaxBytes      = 0;
+        uint64_t nHits          = 0;    // lookups of decoded fractions
+        uint64_t nUnpacks       = 0;    // lookups of packed fractions
+        uint64_t nSpills        = 0;
+    };
+
+    explicit CTxMemPoolFractions(size_t nMaxBytes);
+
+    void    Set(const uint320& key, const CFractions& f);
+    bool    Get(const uint320& key, int64_t nValue, CFractions& f);
+    bool    Has(const uint320& key) const { return mapEntries.count(key) != 0; }
+    void    Erase(const uint320& key);
+    void    Clear();
+
+    void    SetMaxBytes(size_t nMaxBytes);
+    Stats   GetStats() const;
+
+private:
+    struct Entry {
+        CFractions  fractions;      // if decoded
+        std::string strPacked;      // otherwise
+        bool        fDecoded = false;
+        size_t      nBytes = 0;
+        std::list<uint320>::iterator lru;
+    };
+    typedef std::map<uint320, Entry> Entries;
+
+    void    Decoded(Entries::iterator it, const CFractions& f);
+    void    Packed(Entries::iterator it, const CFractions& f);
+    void    Release(Entry& entry);
+    void    Spill();
+
+    Entries             mapEntries;
+    std::list<uint320>  lru;        // decoded entries, most recently used first
+    size_t              nMaxBytes;
+    size_t              nDecodedBytes = 0;
+    size_t              nPackedBytes = 0;
+    uint64_t            nHits = 0;
+    uint64_t            nUnpacks = 0;
+    uint64_t            nSpills = 0;
+};
+
+/** Mempool txs spent by a mempool tx and spending its outputs, with the
+ *  peg supply index its output fractions were calculated for */
+struct CTxMemPoolLinks {
+    std::set<uint256> setParents;
+    std::set<uint256> setChildren;
+    int nPegSupplyIndex = 0;
+};
+
+/** Fee, size and priority of a mempool tx, with the totals of the package
+ *  of the tx and its mempool ancestors which is mined with it */
+struct CTxMemPoolRank {
+    unsigned int nTxSize        = 0;
+    int64_t      nFee           = 0;
+    double       dPriority      = 0;    // sum(valuein * age) / txsize at nHeight
+    int64_t      nInChainValue  = 0;    // inputs in the chain, aging the priority
+    int          nHeight        = 0;
+    uint64_t     nAncestors     = 1;    // with the tx itself
+    uint64_t     nAncestorsSize = 0;
+    int64_t      nAncestorsFee  = 0;
+
+    double GetPriority(int nCurrentHeight) const {
+        return dPriority + double(nCurrentHeight - nHeight) * nInChainValue / nTxSize;
+    }
+    double GetFeePerKb() const {
+        return double(nFee) / (double(nTxSize) / 1000.0);
+    }
+    double GetAncestorsFeePerKb() const {
+        return double(nAncestorsFee) / (double(nAncestorsSize) / 1000.0);
+    }
+};
+
+/** Mempool txs ordered by a score, the best last */
+typedef std::set<std::pair<double, uint256> > CTxMemPoolIndex;
+
+/** Counts and time of the last review of the mempool on peg change */
+struct CTxMemPoolReviewStats {
+    int      nHeight            = 0;
+    int      nPegSupplyIndex    = 0;
+    uint64_t nTxs               = 0;
+    uint64_t nGroups            = 0;    // independent groups of txs, checked in parallel
+    uint64_t nRechecked         = 0;
+    uint64_t nRemoved           = 0;
+    int64_t  nMicros            = 0;
+};
+
+/** Connected txs of the mempool in the order of spending, with the output
+ *  fractions of all of them, reviewed by one thread on peg change. The
+ *  fractions of the rechecked txs replace the ones of the group for their
+ *  children. Txs which could not be rechecked keep their supply index.
+ */
+struct CPegReviewGroup {
+    std::vector<CTransaction> vTxs;
+    std::vector<int> vPegSupplyIndex;
+    MapFractions mapGroupFractions;
+    std::map<uint256, const CTransaction*> mapTxs;  // reviewed so far
+    std::vector<uint256> vRemove;
+    std::map<uint256, MapFractions> mapRechecked;
+    std::set<uint256> setUnreviewed;
+    bool fReviewed = false;
+};
+
+/** Fractions of an output of the chain, false if not found */
+typedef std::function<bool(const uint320&, CFractions&)> PegReadFractions;
+/** Recheck of a tx of the group for the new supply index: fractions of its
+ *  outputs, or false with fInvalid set if the tx is to be removed */
+typedef std::function<bool(CTransaction&, const CPegReviewGroup&,
+                           MapFractions&, bool&)> PegRecheck;
+
+bool NeedsPegReview(const CTransaction& tx,
+                    const MapFractions& mapGroupFractions,
+                    const PegReadFractions& readFractions,
+                    int nSupplyFrom,
+                    int nSupplyTo);
+void ReviewPegGroup(CPegReviewGroup& group,
+                    int nSupply,
+                    const PegReadFractions& readFractions,
+                    const PegRecheck& recheck);
+
 /*
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -24,28 +168,48 @@ class CTxMemPool
 private:
     unsigned int nTransactionsUpdated;
 
+    void Index(const uint256& hash);
+    void Unindex(const uint256& hash);
+    void CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const;
+    void UpdateAncestors(const uint256& hash);
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx;
     std::map<uint256, MapPrevOut> mapPrevOuts;
     std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint320, std::string> mapPackedFractions; // #NOTE3
+    mutable CTxMemPoolFractions mapFractions; // #NOTE3
+    std::map<uint256, CTxMemPoolLinks> mapLinks;
+    std::map<uint256, CTxMemPoolRank> mapRanks;
+    CTxMemPoolIndex setByPriority;  // by the priority at the height of entry
+    CTxMemPoolIndex setByFeeRate;   // by the fee rate of the ancestors package
+    CTxMemPoolReviewStats reviewStats;
 
     CTxMemPool();
 
     bool addUnchecked(const uint256& hash, 
                       CTransaction& tx, 
                       const MapPrevOut & mapPrevOuts,
-                      MapFractions& mapOutputsFractions);
+                      MapFractions& mapOutputsFractions,
+                      double dPriority = 0);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
+    bool CheckChainLimits(const CTransaction& tx,
+                          uint64_t nAncestorLimit,
+                          uint64_t nDescendantLimit,
+                          std::string& reason) const;
     void reviewOnPegChange();
-    void reviewOnPegChange(CTransaction&, 
-                           std::vector<uint256>& vRemove);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    void queryPackage(const uint256& hash,
+                      const std::set<uint256>& setIncluded,
+                      std::vector<uint256>& vPackage) const;
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+    void SetFractionsMaxBytes(size_t nMaxBytes);
+    CTxMemPoolFractions::Stats GetFractionsStats() const;
+    CTxMemPoolReviewStats GetReviewStats() const;
 
     unsigned long size() const
     {
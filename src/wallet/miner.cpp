@@ -53,91 +53,78 @@ void SHA256Transform(void* pstate, void* pinput, const void* pinit)
         ((uint32_t*)pstate)[i] = ctx.h[i];
 }
 
-// Some explaining would be appreciated
-class COrphan
-{
-public:
-    CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
-    double dFeePerKb;
-
-    COrphan(CTransaction* ptxIn)
-    {
-        ptx = ptxIn;
-        dPriority = dFeePerKb = 0;
-    }
-};
-
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
+uint64_t nBlockTemplateBuilds = 0;
+uint64_t nBlockTemplateExtends = 0;
+uint64_t nBlockTemplateReuses = 0;
  
-// We want to sort transactions by priority and fee, so:
-typedef boost::tuple<double, double, CTransaction*> TxPriority;
-class TxPriorityCompare
+// Stop trying packages once the block is nearly full and this many in a row did not fit
+static const int MAX_CONSECUTIVE_FAILURES = 1000;
+
+// Largest block you're willing to create
+static unsigned int GetBlockMaxSize()
 {
-    bool byFee;
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
-    }
-};
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", MAX_BLOCK_SIZE_GEN/2);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    return std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+}
 
-// CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
-unique_ptr<CBlock> CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees)
+// Fetches the inputs of tx from the chain and the template, and connects
+// them with the block rules
+static bool ConnectToBlockTemplate(CTxDB& txdb,
+                                   CPegDB& pegdb,
+                                   CBlockTemplate& templ,
+                                   CTransaction& tx,
+                                   int64_t nMinFee,
+                                   int64_t& nTxFees,
+                                   unsigned int& nTxSigOps)
 {
-    // Create new block
-    unique_ptr<CBlock> pblock(new CBlock());
-    if (!pblock.get())
-        return nullptr;
+    map<uint256, CTxIndex>& mapTestPool = templ.mapTestPool;
+
+    // Connecting shouldn't fail due to dependency on other memory pool transactions
+    // because we're already processing them in order of dependency
+    map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
+    MapFractions mapTestFractionsPoolTmp(templ.mapTestFractionsPool);
+    MapPrevTx mapInputs;
+    MapFractions mapInputsFractions;
+    bool fInvalid;
+    if (!tx.FetchInputs(txdb, pegdb, mapTestPoolTmp, mapTestFractionsPoolTmp, false, true, mapInputs, mapInputsFractions, fInvalid))
+        return false;
+
+    nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
+    if (nTxFees < nMinFee)
+        return false;
+
+    nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
+    if (templ.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    if (!tx.ConnectInputs(mapInputs, mapInputsFractions,
+                          mapTestPoolTmp, mapTestFractionsPoolTmp,
+                          templ.feesFractions,
+                          CDiskTxPos(1,1,1), pindexBest, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
+        return false;
+    mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size(),
+                                            0/*nHeight*/, templ.nBlockTx +2 /*coinbase+coinstake*/);
+    swap(mapTestPool, mapTestPoolTmp);
+    return true;
+}
 
+// Collect memory pool transactions into the template: the high-priority
+// part only when it is built, transactions arriving later are added by fee
+static void AddToBlockTemplate(CBlockTemplate& templ, bool fPriority, const BlockTemplateConnect& connectIn)
+{
+    CBlock* pblock = templ.pblock.get();
+    bool fProofOfStake = templ.fProofOfStake;
     CBlockIndex* pindexPrev = pindexBest;
     int nHeight = pindexPrev->nHeight + 1;
 
-    // Create coinbase tx
-    CTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-
-    if (!fProofOfStake)
-    {
-        CPubKey pubkey;
-        if (!reservekey.GetReservedKey(pubkey))
-            return nullptr;
-        txNew.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
-    }
-    else
-    {
-        // Height first in coinbase required for block.version=2
-        txNew.vin[0].scriptSig = (CScript() << nHeight) + COINBASE_FLAGS;
-        assert(txNew.vin[0].scriptSig.size() <= 100);
-
-        txNew.vout[0].SetEmpty();
-    }
-
-    // Add our coinbase tx as first transaction
-    pblock->vtx.push_back(txNew);
-
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", MAX_BLOCK_SIZE_GEN/2);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
@@ -158,226 +145,339 @@ unique_ptr<CBlock> CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, i
     if (mapArgs.count("-mintxfee"))
         ParseMoney(mapArgs["-mintxfee"], nMinTxFee);
 
-    pblock->nBits = GetNextTargetRequired(pindexPrev, fProofOfStake);
+    LOCK2(cs_main, mempool.cs);
+    unique_ptr<CTxDB> ptxdb;
+    unique_ptr<CPegDB> ppegdb;
+    BlockTemplateConnect connect = connectIn;
+    if (!connect)
+    {
+        ptxdb.reset(new CTxDB("r"));
+        ppegdb.reset(new CPegDB("r"));
+        connect = [&](CBlockTemplate& templIn, CTransaction& tx, int64_t nMinFee,
+                      int64_t& nTxFees, unsigned int& nTxSigOps) {
+            return ConnectToBlockTemplate(*ptxdb, *ppegdb, templIn, tx, nMinFee, nTxFees, nTxSigOps);
+        };
+    }
+
+    templ.hashPrevBlock = pindexPrev->GetBlockHash();
+    templ.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    templ.fDeferred = false;
+
+    map<uint256, CTxIndex>& mapTestPool = templ.mapTestPool;
+    CFractions& feesFractions = templ.feesFractions;
+    uint64_t& nBlockSize = templ.nBlockSize;
+    uint64_t& nBlockTx = templ.nBlockTx;
+    int& nBlockSigOps = templ.nBlockSigOps;
+    int64_t& nFees = templ.nFees;
+    set<uint256>& setIncluded = templ.setIncluded;
+    set<uint256>& setFailed = templ.setFailed;
+    set<uint256>& setSkipped = templ.setSkipped;
+
+    // Timestamp limit, the transaction can be taken later
+    auto isTimely = [&](const uint256& hash) -> bool
+    {
+        const CTransaction& tx = mempool.mapTx[hash];
+        if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
+        {
+            templ.fDeferred = true;
+            return false;
+        }
+        return true;
+    };
+
+    auto addTx = [&](const uint256& hash) -> bool
+    {
+        CTransaction& tx = mempool.mapTx[hash];
+        const CTxMemPoolRank& rank = mempool.mapRanks[hash];
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            return false;
+
+        // Size limits
+        unsigned int nTxSize = rank.nTxSize;
+        if (nBlockSize + nTxSize >= nBlockMaxSize)
+            return false;
+
+        // Legacy limits on sigOps:
+        unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        // Transaction fee
+        int64_t nMinFee = GetMinFee(tx, nHeight, nBlockSize, GMF_BLOCK);
+        int64_t nTxFees = 0;
+        if (!connect(templ, tx, nMinFee, nTxFees, nTxSigOps))
+            return false;
+
+        // Added
+        pblock->vtx.push_back(tx);
+        setIncluded.insert(hash);
+        nBlockSize += nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
 
-    // Collect memory pool transactions into the block
-    int64_t nFees = 0;
+        if (fDebug && GetBoolArg("-printpriority", false))
+        {
+            LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
+                   rank.GetPriority(pindexPrev->nHeight), rank.GetFeePerKb(), hash.ToString());
+        }
+        return true;
+    };
+
+    // First the high-priority transactions whose mempool inputs are already
+    // in the block. The index is by the priority at the height of entry, the
+    // inputs age it at different rates, so the candidates are ordered by
+    // the priority at the next height.
+    if (fPriority && nBlockPrioritySize > 0)
     {
-        LOCK2(cs_main, mempool.cs);
-        CTxDB txdb("r");
-        CPegDB pegdb("r");
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size()+1);
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        vector<pair<double, uint256> > vPriority;
+        for (const CTxMemPoolIndex::value_type& item : mempool.setByPriority)
+        {
+            double dPriority = mempool.mapRanks[item.second].GetPriority(pindexPrev->nHeight);
+            if (dPriority >= COIN * 144 / 250)
+                vPriority.push_back(make_pair(dPriority, item.second));
+        }
+        sort(vPriority.rbegin(), vPriority.rend());
+        for (const pair<double, uint256>& item : vPriority)
         {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            const uint256& hash = item.second;
+            const CTxMemPoolRank& rank = mempool.mapRanks[hash];
+            if (nBlockSize + rank.nTxSize >= nBlockPrioritySize)
+                break;
+            bool fReady = true;
+            for (const uint256& hashParent : mempool.mapLinks[hash].setParents)
+                fReady &= setIncluded.count(hashParent) > 0;
+            if (!fReady || setIncluded.count(hash) || setFailed.count(hash) || !isTimely(hash))
                 continue;
+            if (!addTx(hash))
+                setFailed.insert(hash);
+        }
+    }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            for(const CTxIn& txin : tx.vin)
-            {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+    // Then by fee, each transaction with its mempool ancestors. How far the
+    // index is walked depends on the block size, not on the mempool size.
+    int nFailures = 0;
+    for (CTxMemPoolIndex::reverse_iterator mi = mempool.setByFeeRate.rbegin();
+         mi != mempool.setByFeeRate.rend(); ++mi)
+    {
+        const uint256& hash = (*mi).second;
+        if (setIncluded.count(hash) || setFailed.count(hash))
+            continue;
 
-                int nConf = txindex.GetDepthInMainChain();
-                dPriority += (double)nValueIn * nConf;
+        // Skip free transactions if we're past the minimum block size:
+        const CTxMemPoolRank& rank = mempool.mapRanks[hash];
+        if (rank.GetAncestorsFeePerKb() < nMinTxFee)
+        {
+            if (nBlockSize >= nBlockMinSize)
+                break;
+            if (nBlockSize + rank.nAncestorsSize >= nBlockMinSize)
+            {
+                setSkipped.insert(hash);
+                continue;
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority /= nTxSize;
+        }
 
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut()) / (double(nTxSize)/1000.0);
+        vector<uint256> vPackage;
+        mempool.queryPackage(hash, setIncluded, vPackage);
+        bool fTimely = true;
+        for (const uint256& hashPackage : vPackage)
+            fTimely &= isTimely(hashPackage);
+        if (!fTimely)
+        {
+            setSkipped.insert(hash);
+            continue;
+        }
 
-            if (porphan)
+        // The package is added whole or not at all: its size, sigops and
+        // fees are checked first, a transaction failing to connect rolls
+        // back the ones of the package added before it
+        uint64_t nPackageSize = 0;
+        unsigned int nPackageSigOps = 0;
+        int64_t nPackageFees = 0;
+        int64_t nPackageMinFee = 0;
+        bool fFits = true;
+        for (const uint256& hashPackage : vPackage)
+        {
+            const CTransaction& txPackage = mempool.mapTx[hashPackage];
+            const CTxMemPoolRank& rankPackage = mempool.mapRanks[hashPackage];
+            if (setFailed.count(hashPackage))
             {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
+                setFailed.insert(hash);
+                fFits = false;
+                break;
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
+            nPackageSize += rankPackage.nTxSize;
+            nPackageSigOps += GetLegacySigOpCount(txPackage);
+            nPackageFees += rankPackage.nFee;
+            nPackageMinFee += GetMinFee(txPackage, nHeight, nBlockSize, GMF_BLOCK);
         }
-        
-        // Collect transactions into block
-        map<uint256, CTxIndex> mapTestPool;
-        MapFractions mapTestFractionsPool;
-        CFractions feesFractions;
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
+        fFits = fFits &&
+                nBlockSize + nPackageSize < nBlockMaxSize &&
+                nBlockSigOps + nPackageSigOps < MAX_BLOCK_SIGOPS &&
+                nPackageFees >= nPackageMinFee;
+        if (!fFits)
+            setSkipped.insert(hash);
+
+        bool fAdded = fFits;
+        if (fFits)
         {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            size_t nVtxBefore = pblock->vtx.size();
+            uint64_t nBlockSizeBefore = nBlockSize;
+            uint64_t nBlockTxBefore = nBlockTx;
+            int nBlockSigOpsBefore = nBlockSigOps;
+            int64_t nFeesBefore = nFees;
+            map<uint256, CTxIndex> mapTestPoolBefore;
+            CFractions feesFractionsBefore;
+            if (vPackage.size() > 1)
+            {
+                mapTestPoolBefore = mapTestPool;
+                feesFractionsBefore = feesFractions;
+            }
+            for (const uint256& hashPackage : vPackage)
+            {
+                if (!addTx(hashPackage))
+                {
+                    setFailed.insert(hashPackage);
+                    fAdded = false;
+                    break;
+                }
+            }
+            if (!fAdded && pblock->vtx.size() > nVtxBefore)
+            {
+                for (size_t i = nVtxBefore; i < pblock->vtx.size(); i++)
+                    setIncluded.erase(pblock->vtx[i].GetHash());
+                pblock->vtx.resize(nVtxBefore);
+                nBlockSize = nBlockSizeBefore;
+                nBlockTx = nBlockTxBefore;
+                nBlockSigOps = nBlockSigOpsBefore;
+                nFees = nFeesBefore;
+                swap(mapTestPool, mapTestPoolBefore);
+                feesFractions = feesFractionsBefore;
+            }
+        }
+        if (fAdded)
+        {
+            // free ones filling the minimum size are not taken by fee
+            if (rank.GetAncestorsFeePerKb() >= nMinTxFee)
+                templ.dMinFeeRate = std::min(templ.dMinFeeRate, rank.GetAncestorsFeePerKb());
+            nFailures = 0;
+        }
+        else if (++nFailures > MAX_CONSECUTIVE_FAILURES && nBlockSize + 4000 > nBlockMaxSize)
+            break;
+    }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    if (fDebug && GetBoolArg("-printpriority", false))
+        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
-            // Timestamp limit
-            if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
-                continue;
+    if (!fProofOfStake)
+        pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(nFees);
 
-            // Transaction fee
-            int64_t nMinFee = GetMinFee(tx, nHeight, nBlockSize, GMF_BLOCK);
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    pblock->nTime          = max(pindexPrev->GetPastTimeLimit()+1, pblock->GetMaxTransactionTime());
+    if (!fProofOfStake)
+        pblock->UpdateTime(pindexPrev);
+    pblock->nNonce         = 0;
+}
 
-            // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+bool CreateBlockTemplate(CBlockTemplate& templ, CReserveKey& reservekey, bool fProofOfStake,
+                         const BlockTemplateConnect& connect)
+{
+    templ = CBlockTemplate();
+    templ.fProofOfStake = fProofOfStake;
 
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 144 / 250)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+    // Create new block
+    templ.pblock.reset(new CBlock());
+    CBlock* pblock = templ.pblock.get();
 
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            MapFractions mapTestFractionsPoolTmp(mapTestFractionsPool);
-            MapPrevTx mapInputs;
-            MapFractions mapInputsFractions;
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, pegdb, mapTestPoolTmp, mapTestFractionsPoolTmp, false, true, mapInputs, mapInputsFractions, fInvalid))
-                continue;
+    CBlockIndex* pindexPrev = pindexBest;
+    int nHeight = pindexPrev->nHeight + 1;
 
-            int64_t nTxFees = tx.GetValueIn(mapInputs)-tx.GetValueOut();
-            if (nTxFees < nMinFee)
-                continue;
+    // Create coinbase tx
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
 
-            nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    if (!fProofOfStake)
+    {
+        CPubKey pubkey;
+        if (!reservekey.GetReservedKey(pubkey))
+            return false;
+        txNew.vout[0].scriptPubKey.SetDestination(pubkey.GetID());
+    }
+    else
+    {
+        // Height first in coinbase required for block.version=2
+        txNew.vin[0].scriptSig = (CScript() << nHeight) + COINBASE_FLAGS;
+        assert(txNew.vin[0].scriptSig.size() <= 100);
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            if (!tx.ConnectInputs(mapInputs, mapInputsFractions,
-                                  mapTestPoolTmp, mapTestFractionsPoolTmp,
-                                  feesFractions,
-                                  CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
-                continue;
-            mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size(), 
-                                                    0/*nHeight*/, nBlockTx +2 /*coinbase+coinstake*/);
-            swap(mapTestPool, mapTestPoolTmp);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fDebug && GetBoolArg("-printpriority", false))
-            {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
-            }
+        txNew.vout[0].SetEmpty();
+    }
 
-            // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
-            {
-                for(COrphan* porphan : mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+    // Add our coinbase tx as first transaction
+    pblock->vtx.push_back(txNew);
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
+    pblock->nBits = GetNextTargetRequired(pindexPrev, fProofOfStake);
 
-        if (fDebug && GetBoolArg("-printpriority", false))
-            LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+    AddToBlockTemplate(templ, true /*priority*/, connect);
+    nBlockTemplateBuilds++;
+    return true;
+}
 
-        if (!fProofOfStake)
-            pblock->vtx[0].vout[0].nValue = GetProofOfWorkReward(nFees);
+// The template is kept while the tip is the same and all of its
+// transactions are still in the mempool, the new ones are appended.
+// It is rebuilt when a new package pays a better fee rate than the worst
+// one taken by fee and does not fit, unless it was already passed over.
+// Failed and passed over transactions are not retried by the extends: the
+// block only grows, a rebuild retries them.
+bool UpdateBlockTemplate(CBlockTemplate& templ, const BlockTemplateConnect& connect)
+{
+    LOCK2(cs_main, mempool.cs);
+    if (!templ.pblock || templ.hashPrevBlock != hashBestChain)
+        return false;
+    if (templ.nTransactionsUpdated == mempool.GetTransactionsUpdated() && !templ.fDeferred)
+    {
+        nBlockTemplateReuses++;
+        return true;
+    }
+    for (const uint256& hash : templ.setIncluded)
+    {
+        if (!mempool.mapTx.count(hash))
+            return false;
+    }
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
+    for (CTxMemPoolIndex::reverse_iterator mi = mempool.setByFeeRate.rbegin();
+         mi != mempool.setByFeeRate.rend() && (*mi).first > templ.dMinFeeRate; ++mi)
+    {
+        const uint256& hash = (*mi).second;
+        if (templ.setIncluded.count(hash) || templ.setFailed.count(hash) || templ.setSkipped.count(hash))
+            continue;
+        if (templ.nBlockSize + mempool.mapRanks[hash].nAncestorsSize >= nBlockMaxSize)
+            return false;
+    }
+    // the transactions arriving since are later than the coinbase
+    if (templ.fProofOfStake)
+        templ.pblock->vtx[0].nTime = GetAdjustedTime();
+    AddToBlockTemplate(templ, false /*priority*/, connect);
+    nBlockTemplateExtends++;
+    return true;
+}
 
-        if (pFees)
-            *pFees = nFees;
+// CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
+unique_ptr<CBlock> CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees)
+{
+    CBlockTemplate templ;
+    if (!CreateBlockTemplate(templ, reservekey, fProofOfStake))
+        return nullptr;
 
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-        pblock->nTime          = max(pindexPrev->GetPastTimeLimit()+1, pblock->GetMaxTransactionTime());
-        if (!fProofOfStake)
-            pblock->UpdateTime(pindexPrev);
-        pblock->nNonce         = 0;
-    }
+    if (pFees)
+        *pFees = templ.nFees;
 
-    return pblock;
+    return std::move(templ.pblock);
 }
 
 
@@ -531,6 +631,7 @@ void ThreadStakeMiner(CWallet *pwallet)
     RenameThread("bitbay-miner");
 
     CReserveKey reservekey(pwallet);
+    CBlockTemplate templ;
 
     bool fTryToSync = true;
 
@@ -566,12 +667,12 @@ void ThreadStakeMiner(CWallet *pwallet)
         }
 
         //
-        // Create new block
+        // Create new block, or take the template of the same tip
         //
-        int64_t nFees;
-        unique_ptr<CBlock> pblock(CreateNewBlock(reservekey, true, &nFees));
-        if (!pblock.get())
+        if (!UpdateBlockTemplate(templ) && !CreateBlockTemplate(templ, reservekey, true))
             return;
+        int64_t nFees = templ.nFees;
+        unique_ptr<CBlock> pblock(new CBlock(*templ.pblock));
 
         // Trying to sign a block
         if (pblock->SignBlock(*pwallet, nFees))
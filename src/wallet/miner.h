@@ -9,6 +9,45 @@
 #include "main.h"
 #include "wallet.h"
 
+#include <limits>
+
+/** Block assembled from the mempool, with the state to extend it by the
+ *  transactions arriving while the tip stays the same */
+struct CBlockTemplate
+{
+    std::unique_ptr<CBlock> pblock;
+    int64_t nFees = 0;
+    bool fProofOfStake = false;
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated = 0;
+    bool fDeferred = false;     // some transactions were not timely yet
+
+    std::map<uint256, CTxIndex> mapTestPool;
+    MapFractions mapTestFractionsPool;
+    CFractions feesFractions;
+    uint64_t nBlockSize = 1000;
+    uint64_t nBlockTx = 0;
+    int nBlockSigOps = 100;
+    std::set<uint256> setIncluded;
+    std::set<uint256> setFailed;
+    std::set<uint256> setSkipped;   // passed over by fee, no reason to rebuild
+    double dMinFeeRate = std::numeric_limits<double>::max(); // of the packages taken by fee
+};
+
+/** Connects a mempool transaction to the template: its fees and sigops
+ *  with the P2SH ones, false if it can not be in the block. By default
+ *  the inputs are fetched from the chain and the template. */
+typedef std::function<bool(CBlockTemplate& templ, CTransaction& tx, int64_t nMinFee,
+                           int64_t& nTxFees, unsigned int& nTxSigOps)> BlockTemplateConnect;
+
+/** Build a block template on the current tip */
+bool CreateBlockTemplate(CBlockTemplate& templ, CReserveKey& reservekey, bool fProofOfStake=false,
+                         const BlockTemplateConnect& connect=BlockTemplateConnect());
+
+/** Bring the template up to date with the mempool, false if it has to be rebuilt */
+bool UpdateBlockTemplate(CBlockTemplate& templ,
+                         const BlockTemplateConnect& connect=BlockTemplateConnect());
+
 /* Generate a new block, without valid proof-of-work */
 std::unique_ptr<CBlock> CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake=false, int64_t* pFees = 0);
 
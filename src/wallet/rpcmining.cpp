@@ -133,7 +133,8 @@ Value getstakinginfo(const Array& params, bool fHelp)
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getstakinginfo\n"
-            "Returns an object containing staking-related information.");
+            "Returns an object containing staking-related information,\n"
+            "with the counts of block templates built, extended and reused by the stake miner.");
 
     uint64_t nWeight = 0;
     if (pwalletMain)
@@ -166,6 +167,12 @@ Value getstakinginfo(const Array& params, bool fHelp)
 
     obj.push_back(Pair("expectedtime", nExpectedTime));
 
+    Object templates;
+    templates.push_back(Pair("builds", (uint64_t)nBlockTemplateBuilds));
+    templates.push_back(Pair("extends", (uint64_t)nBlockTemplateExtends));
+    templates.push_back(Pair("reuses", (uint64_t)nBlockTemplateReuses));
+    obj.push_back(Pair("templates", templates));
+
     return obj;
 }
 
@@ -614,6 +614,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx,
                 if (mapOutputFractions.find(fkey) != mapOutputFractions.end()) {
                     CFractions& fractions = wtx.vOutFractions[i].Ref();
                     fractions = mapOutputFractions.at(fkey);
+                    fractions.Compact();
                 }
             }
             // Get merkle branch if transaction was found in a block
@@ -633,7 +634,7 @@ void CWallet::CleanFractionsOfSpentTxouts(const CBlock* pBlockRef)
         return;
     uint256 hashBlock = pBlockRef->GetHash();
     LOCK(cs_main);
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return;
     CBlockIndex* pblockindex = (*mi).second;
@@ -864,9 +865,7 @@ int64_t CWallet::GetReserve(uint256 txhash, long n, const CTxOut& txout) const
                 if (fF || fV)
                     return 0;
                 
-                int64_t nReserve = 0;
-                wtx.vOutFractions[n].Ref().LowPart(nLastPegSupplyIndex, &nReserve);
-                return nReserve;
+                return wtx.vOutFractions[n].Low(nLastPegSupplyIndex);
             }
         }
     }
@@ -902,9 +901,7 @@ int64_t CWallet::GetLiquidity(uint256 txhash, long n, const CTxOut& txout) const
                 if (fF || fV)
                     return 0;
                 
-                int64_t nLiquidity = 0;
-                wtx.vOutFractions[n].Ref().HighPart(nLastPegSupplyIndex, &nLiquidity);
-                return nLiquidity;
+                return wtx.vOutFractions[n].High(nLastPegSupplyIndex);
             }
         }
     }
@@ -1759,10 +1756,10 @@ bool CWallet::SelectCoinsMinConf(PegTxType txType,
         int64_t nValue = 0;
         if (txType == PEG_MAKETX_SEND_RESERVE ||
             txType == PEG_MAKETX_FREEZE_RESERVE) {
-            nValue = pcoin->vOutFractions[i].Ref().Low(GetPegSupplyIndex());
+            nValue = pcoin->vOutFractions[i].Low(GetPegSupplyIndex());
         } else if (txType == PEG_MAKETX_SEND_LIQUIDITY ||
                    txType == PEG_MAKETX_FREEZE_LIQUIDITY) {
-            nValue = pcoin->vOutFractions[i].Ref().High(GetPegSupplyIndex());
+            nValue = pcoin->vOutFractions[i].High(GetPegSupplyIndex());
         }
         if (nValue == 0) continue;
         
@@ -1899,10 +1896,10 @@ bool CWallet::SelectCoins(PegTxType txType,
             int64_t nValue = 0;
             if (txType == PEG_MAKETX_SEND_RESERVE ||
                 txType == PEG_MAKETX_FREEZE_RESERVE) {
-                nValue = out.tx->vOutFractions[out.i].Ref().Low(GetPegSupplyIndex());
+                nValue = out.tx->vOutFractions[out.i].Low(GetPegSupplyIndex());
             } else if (txType == PEG_MAKETX_SEND_LIQUIDITY ||
                        txType == PEG_MAKETX_FREEZE_LIQUIDITY) {
-                nValue = out.tx->vOutFractions[out.i].Ref().High(GetPegSupplyIndex());
+                nValue = out.tx->vOutFractions[out.i].High(GetPegSupplyIndex());
             }
             nValueRet += nValue;
             
@@ -2374,9 +2371,10 @@ bool CWallet::CreateTransaction(PegTxType txType,
 
                 // Sign
                 if (!fTest) {
+                    CSignatureHashContext sighash(wtxNew);
                     int nIn = 0;
                     for(const CSelectedCoin& coin : vCoins) {
-                        if (!SignSignature(*this, *coin.tx, wtxNew, nIn++)) {
+                        if (!SignSignature(*this, *coin.tx, wtxNew, nIn++, SIGHASH_ALL, &sighash)) {
                             sFailCause = "CT-6, failed to sign";
                             return false;
                         }
@@ -2452,6 +2450,7 @@ bool CWallet::CreateTransaction(PegTxType txType,
                 } 
                 CFractions& fractions = wtxNew.vOutFractions[i].Ref();
                 fractions = mapOutputFractions.at(fkey);
+                fractions.Compact();
             }
         }
     }
@@ -2564,13 +2563,14 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore,
         
         bool fKernelFoundForCoin = false;
         if (!fKernelFound) {
+            // read once per tip, the time slots only hash
+            const CStakeCandidate* pcandidate = stakeCandidates.Get(pindexPrev, nBits, prevoutStake);
             for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound && pindexPrev == pindexBest; n++)
             {
                 boost::this_thread::interruption_point();
                 // Search backward in time from the given txNew timestamp
                 // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-                int64_t nBlockTime;
-                if (CheckKernel(pindexPrev, nBits, txCoinStake.nTime - n, prevoutStake, &nBlockTime))
+                if (stakeCandidates.CheckKernel(*pcandidate, pindexPrev, nBits, txCoinStake.nTime - n))
                 {
                     // Found a kernel
                     LogPrint("coinstake", "CreateCoinStake : kernel found\n");
@@ -2701,10 +2701,11 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore,
                 CScript scriptPubKey;
                 scriptPubKey.SetDestination(CBitcoinAddress(sAddress).Get());
                 txConsolidate.vout.push_back(CTxOut(nValue, scriptPubKey));
+                CSignatureHashContext sighash(txConsolidate);
                 int nIn = 0;
                 for(const CTransaction* pcoin : vConsolidatePrev)
                 {
-                    if (!SignSignature(*this, *pcoin, txConsolidate, nIn++)) {
+                    if (!SignSignature(*this, *pcoin, txConsolidate, nIn++, SIGHASH_ALL, &sighash)) {
                         error("CreateCoinStake : failed to sign consolidate");
                         txConsolidate.vin.clear();
                         break;
@@ -3456,7 +3457,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        CBlockIndexMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && blit->second->IsInMainChain()) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
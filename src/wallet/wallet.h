@@ -14,6 +14,7 @@
 
 #include "crypter.h"
 #include "main.h"
+#include "kernel.h"
 #include "key.h"
 #include "keystore.h"
 #include "script.h"
@@ -133,6 +134,9 @@ private:
     int nConsolidateMin = 20;
     int nConsolidateMax = 50;
     int64_t nConsolidateMaxAmount = 10000000000000;
+
+    // what the kernel search needs of the staking coins, per tip
+    CStakeCandidateTable stakeCandidates;
     
 public:
     /// Main wallet lock.
@@ -502,9 +506,10 @@ public:
     CFractionsRef() {}
     CFractionsRef(const CFractionsRef & cp) {
         if (cp.ptr) {
-            ptr = std::unique_ptr<CFractions>(new CFractions(*cp.ptr));
+            ptr = std::unique_ptr<CFractions>(new CFractions(*cp.ptr)); // shares buffer
         }
     }
+    CFractionsRef(CFractionsRef &&) = default;
     void Init(int64_t value) {
          nValue = value;
          ptr.reset();
@@ -527,6 +532,15 @@ public:
         if (!ptr) return 0;
         return ptr->nLockTime;
     }
+    // reserve and liquidity without making the fractions
+    int64_t Low(int supply) const {
+        if (!ptr) return CFractions::StdLow(nValue, supply);
+        return ptr->Low(supply);
+    }
+    int64_t High(int supply) const {
+        if (!ptr) return CFractions::StdHigh(nValue, supply);
+        return ptr->High(supply);
+    }
     
     int64_t nValue = 0;
     mutable std::unique_ptr<CFractions> ptr;